@@ -0,0 +1,177 @@
+#ifndef BLOCKCG_H
+#define BLOCKCG_H
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "CGMatrix.h"
+
+// Preconditioned conjugate gradients for k right-hand sides of one operator,
+// iterated in lockstep. The k vectors of B, X and of every work block are
+// stored interleaved, entry j of vector c at [j*k + c], so that the one
+// A.applyBlock() (SpMM) of an iteration reads every matrix entry once for all
+// k products, where k separate solves would stream the matrix k times. On
+// bandwidth-bound operators an iteration thus costs little more than one of
+// single-vector CG, and the k inner products of each kind are one reduction.
+// Every column keeps its own step lengths, so the iterates are those of k
+// independent conjugateGradient() calls: unlike the block CG of O'Leary
+// there is no k x k coupling of the search directions, which would cut the
+// iterations further but breaks down when the residuals become linearly
+// dependent. A column stops when it meets the tolerances (or A or M turn out
+// not to be SPD for it); its steps are zero from then on and the others go
+// on, so an iteration costs the same until the last column has converged.
+// B and X hold rows()*k values; the options apply to each column and the
+// statistics are per column.
+template< class Op, class Prec >
+std::vector<CGStats> blockConjugateGradient(const LinearOperator<Op>& op, const LinearOperator<Prec>& prec,
+                                            std::size_t k, const std::vector<double>& B,
+                                            std::vector<double>& X, const CGOptions& opt) {
+    static_assert(is_linear_operator_v<Op>, "blockConjugateGradient: Op must provide rows(), cols() and apply()");
+    static_assert(is_linear_operator_v<Prec>, "blockConjugateGradient: Prec must provide rows(), cols() and apply()");
+    constexpr bool plain = std::is_same_v<Prec, IdentityPreconditioner>;
+    const Op& A = op.derived();
+    const Prec& M = prec.derived();
+    const std::size_t N = A.rows();
+    const auto n = static_cast<std::ptrdiff_t>(N);
+    const int maxit = opt.maxit < 0 ? static_cast<int>(N) : opt.maxit;
+    if (B.size() != N * k)
+        throw std::invalid_argument("blockConjugateGradient: B must hold k vectors of rows() entries");
+    if (opt.warm_start) X.resize(N * k, 0.0); else X.assign(N * k, 0.0);
+
+    std::vector<CGStats> stats(k);
+    std::vector<double> bnorm(k, 0.0), stop(k), rr(k, 0.0), rz(k), alpha(k, 0.0), beta(k, 0.0);
+    std::vector<char> active(k, 1);
+    // dot[c] = U.V of column c
+    auto dots = [&](const std::vector<double>& U, const std::vector<double>& V, std::vector<double>& dot) {
+        dot.assign(k, 0.0);
+        double* d = dot.data();
+#ifdef _OPENMP
+        #pragma omp parallel for reduction(+:d[:k]) if(n > 16384)
+#endif
+        for (std::ptrdiff_t i = 0; i < n; i++)
+            for (std::size_t c = 0; c < k; c++) d[c] += U[i*k + c] * V[i*k + c];
+    };
+
+    dots(B, B, rr);
+    for (std::size_t c = 0; c < k; c++) {
+        bnorm[c] = std::sqrt(rr[c]);
+        stop[c] = std::max(opt.rtol * bnorm[c], opt.atol);
+    }
+    auto record = [&](std::size_t c, double rs) {
+        stats[c].residual = std::sqrt(rs);
+        stats[c].relative_residual = bnorm[c] > 0.0 ? stats[c].residual / bnorm[c] : stats[c].residual;
+        if (opt.history) stats[c].history.push_back(stats[c].residual);
+    };
+
+    std::vector<double> R(N * k), AP(N * k), Z;
+    A.applyBlock(k, X, R);
+    for (std::size_t j = 0; j < N * k; j++) R[j] = B[j] - R[j];
+    dots(R, R, rr);
+    std::size_t nactive = 0;
+    for (std::size_t c = 0; c < k; c++) {
+        stats[c].initial_residual = stats[c].residual = std::sqrt(rr[c]);
+        stats[c].relative_residual = bnorm[c] > 0.0 ? stats[c].residual / bnorm[c] : stats[c].residual;
+        if (stats[c].residual <= stop[c]) { stats[c].converged = true; active[c] = 0; }
+        else ++nactive;
+    }
+    if (nactive == 0) return stats;
+
+    if constexpr (!plain) M.applyBlock(k, R, Z);
+    const std::vector<double>& ZR = plain ? R : Z;     // M^-1 R
+    std::vector<double> P = ZR;
+    if constexpr (plain) rz = rr; else dots(R, Z, rz);
+
+    std::vector<double> pAp(k), rznew(k);
+    for (int it = 0; it < maxit && nactive > 0; it++) {
+        A.applyBlock(k, P, AP);
+        dots(P, AP, pAp);
+        for (std::size_t c = 0; c < k; c++) {
+            alpha[c] = 0.0;
+            if (!active[c]) continue;
+            ++stats[c].iterations;
+            if (pAp[c] > 0.0) alpha[c] = rz[c] / pAp[c];
+            else { active[c] = 0; --nactive; }     // A is not SPD for this column
+        }
+
+        const double* a = alpha.data();
+        double* s = rr.data();
+        for (std::size_t c = 0; c < k; c++) s[c] = 0.0;
+#ifdef _OPENMP
+        #pragma omp parallel for reduction(+:s[:k]) if(n > 16384)
+#endif
+        for (std::ptrdiff_t i = 0; i < n; i++)
+            for (std::size_t c = 0; c < k; c++) {
+                X[i*k + c] += a[c] * P[i*k + c];
+                R[i*k + c] -= a[c] * AP[i*k + c];
+                s[c] += R[i*k + c] * R[i*k + c];
+            }
+        for (std::size_t c = 0; c < k; c++) {
+            if (!active[c]) continue;
+            record(c, rr[c]);
+            if (stats[c].residual <= stop[c]) { stats[c].converged = true; active[c] = 0; --nactive; }
+        }
+        if (nactive == 0) break;
+
+        if constexpr (plain) rznew = rr;
+        else { M.applyBlock(k, R, Z); dots(R, Z, rznew); }
+        for (std::size_t c = 0; c < k; c++) {
+            beta[c] = 0.0;
+            if (!active[c]) continue;
+            if (!(rznew[c] > 0.0)) { active[c] = 0; --nactive; continue; }    // M is not SPD
+            beta[c] = rznew[c] / rz[c];
+            rz[c] = rznew[c];
+        }
+        const double* bt = beta.data();
+#ifdef _OPENMP
+        #pragma omp parallel for if(n > 16384)
+#endif
+        for (std::ptrdiff_t i = 0; i < n; i++)
+            for (std::size_t c = 0; c < k; c++)
+                P[i*k + c] = ZR[i*k + c] + bt[c] * P[i*k + c];
+    }
+    return stats;
+}
+
+// Block conjugate gradients without preconditioning, see above
+template< class Op >
+std::vector<CGStats> blockConjugateGradient(const LinearOperator<Op>& op, std::size_t k,
+                                            const std::vector<double>& B, std::vector<double>& X,
+                                            const CGOptions& opt) {
+    return blockConjugateGradient(op, IdentityPreconditioner(op.derived().rows()), k, B, X, opt);
+}
+
+// Solve A x[c] = b[c] for all right-hand sides b with one block CG. The
+// vectors are interleaved into blocks and the solutions copied back; x is
+// resized to b.size() vectors, each used as initial guess if warm_start.
+template< class Op, class Prec >
+std::vector<CGStats> conjugateGradient(const LinearOperator<Op>& op, const LinearOperator<Prec>& prec,
+                                       const std::vector<std::vector<double>>& b,
+                                       std::vector<std::vector<double>>& x, const CGOptions& opt) {
+    const std::size_t N = op.derived().rows(), k = b.size();
+    x.resize(k);
+    std::vector<double> B(N * k), X(N * k, 0.0);
+    for (std::size_t c = 0; c < k; c++) {
+        if (b[c].size() != N)
+            throw std::invalid_argument("conjugateGradient: every right-hand side must have rows() entries");
+        for (std::size_t i = 0; i < N; i++) B[i*k + c] = b[c][i];
+        if (opt.warm_start)
+            for (std::size_t i = 0; i < N && i < x[c].size(); i++) X[i*k + c] = x[c][i];
+    }
+    auto stats = blockConjugateGradient(op, prec, k, B, X, opt);
+    for (std::size_t c = 0; c < k; c++) {
+        x[c].resize(N);
+        for (std::size_t i = 0; i < N; i++) x[c][i] = X[i*k + c];
+    }
+    return stats;
+}
+
+// Multiple right-hand sides without preconditioning, see above
+template< class Op >
+std::vector<CGStats> conjugateGradient(const LinearOperator<Op>& op, const std::vector<std::vector<double>>& b,
+                                       std::vector<std::vector<double>>& x, const CGOptions& opt) {
+    return conjugateGradient(op, IdentityPreconditioner(op.derived().rows()), b, x, opt);
+}
+
+#endif
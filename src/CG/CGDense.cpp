@@ -34,29 +34,26 @@ void vectorSub(vector<double>& v1, const vector<double>& v2, double alpha) {
     }
 }
 
-void conjugateGradient(const vector<vector<double>>& A, const vector<double>& b, vector<double>& x) {
-    int N = A.size();
-    vector<double> r = b;
-    vector<double> p = r;
-    vector<double> Ap(N);
-    double alpha, beta, rsold, rsnew;
-
-    rsold = dotProduct(r, r);
-    for (int j = 0; j < N; j++) {
-        Ap = matVecMult(A, p);
-        alpha = rsold / dotProduct(p, Ap);
-
-        vectorAdd(x, p, alpha);
-        vectorSub(r, Ap, alpha);
-
-        rsnew = dotProduct(r, r);
-        if (sqrt(rsnew) < 1e-6)
-            break;
-
-        beta = rsnew / rsold;
-        for (int i = 0; i < N; i++) {
-            p[i] = r[i] + beta * p[i];
-        }
-        rsold = rsnew;
+namespace {
+
+// Nested-vector dense matrix as a linear operator
+class NestedDense : public LinearOperator<NestedDense> {
+public:
+    explicit NestedDense(const vector<vector<double>>& A) : A(A) {}
+    size_t rows() const { return A.size(); }
+    size_t cols() const { return A.empty() ? 0 : A[0].size(); }
+    void apply(const vector<double>& x, vector<double>& y) const {
+        y.assign(A.size(), 0.0);
+        for (size_t i = 0; i < A.size(); i++)
+            for (size_t j = 0; j < x.size(); j++)
+                y[i] += A[i][j] * x[j];
     }
+private:
+    const vector<vector<double>>& A;
+};
+
+}
+
+void conjugateGradient(const vector<vector<double>>& A, const vector<double>& b, vector<double>& x) {
+    conjugateGradient(NestedDense(A), b, x);
 }
@@ -1,7 +1,12 @@
 #ifndef CGMATRIX_H
 #define CGMATRIX_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
 #include <vector>
+#include "../matrix/LinearOperator.h"
 
 std::vector<double> matVecMult(const std::vector<std::vector<double>>& A, const std::vector<double>& v);
 double dotProduct(const std::vector<double>& v1, const std::vector<double>& v2);
@@ -9,4 +14,138 @@ void vectorAdd(std::vector<double>& v1, const std::vector<double>& v2, double al
 void vectorSub(std::vector<double>& v1, const std::vector<double>& v2, double alpha);
 void conjugateGradient(const std::vector<std::vector<double>>& A, const std::vector<double>& b, std::vector<double>& x);
 
+// Stopping criteria and start of the conjugate gradient iteration
+struct CGOptions {
+    double rtol = 1e-6;         // stop when ||b - A*x|| <= rtol*||b|| ...
+    double atol = 0.0;          // ... or when ||b - A*x|| <= atol
+    int maxit = -1;             // maximum number of iterations, -1: number of rows
+    bool warm_start = true;     // start from x as given, false: start from x = 0
+    bool history = false;       // record the residual norm of every iteration
+};
+
+// What the conjugate gradient iteration did
+struct CGStats {
+    int iterations = 0;
+    double initial_residual = 0.0;      // ||b - A*x0||
+    double residual = 0.0;              // ||r|| at exit, from the CG recurrence
+    double relative_residual = 0.0;     // residual / ||b||, residual if b = 0
+    bool converged = false;             // false: maxit reached or A not SPD
+    std::vector<double> history;        // ||r|| after each iteration, if requested
+};
+
+// No preconditioning, M = I. conjugateGradient recognizes it at compile time
+// and uses r in place of z = M^-1 r, without copying.
+class IdentityPreconditioner : public LinearOperator<IdentityPreconditioner> {
+public:
+    explicit IdentityPreconditioner(std::size_t n) : n(n) {}
+    std::size_t rows() const { return n; }
+    std::size_t cols() const { return n; }
+    void apply(const std::vector<double>& r, std::vector<double>& z) const { z = r; }
+private:
+    std::size_t n;
+};
+
+// Preconditioned conjugate gradients for any linear operator (Dense,
+// SparseCSR, CSR, ...) and any SPD preconditioner M, a linear operator whose
+// apply(r, z) computes z = M^-1 r (see Preconditioner.h). The types are known
+// at compile time, so A.apply() and M.apply() are called directly and the
+// work vectors are allocated once, outside of the iteration. The vector
+// updates are fused, x and r in one loop with the new r.r, so every
+// iteration reads each work vector about once besides the two applies.
+// The residual checked against the tolerances is ||b - A*x||, not the
+// preconditioned residual. If warm_start, an x of the wrong size is resized,
+// padded with zeros.
+template< class Op, class Prec >
+CGStats conjugateGradient(const LinearOperator<Op>& op, const LinearOperator<Prec>& prec,
+                          const std::vector<double>& b, std::vector<double>& x,
+                          const CGOptions& opt) {
+    static_assert(is_linear_operator_v<Op>, "conjugateGradient: Op must provide rows(), cols() and apply()");
+    static_assert(is_linear_operator_v<Prec>, "conjugateGradient: Prec must provide rows(), cols() and apply()");
+    constexpr bool plain = std::is_same_v<Prec, IdentityPreconditioner>;
+    const Op& A = op.derived();
+    const Prec& M = prec.derived();
+    const std::size_t N = A.rows();
+    const auto n = static_cast<std::ptrdiff_t>(N);
+    const int maxit = opt.maxit < 0 ? static_cast<int>(N) : opt.maxit;
+    if (opt.warm_start) x.resize(N, 0.0); else x.assign(N, 0.0);
+
+    CGStats stats;
+    const double bnorm = std::sqrt(dotProduct(b, b));
+    const double stop = std::max(opt.rtol * bnorm, opt.atol);
+    auto record = [&](double rs) {
+        stats.residual = std::sqrt(rs);
+        stats.relative_residual = bnorm > 0.0 ? stats.residual / bnorm : stats.residual;
+        if (opt.history) stats.history.push_back(stats.residual);
+    };
+
+    std::vector<double> r(N), Ap(N), z;
+    A.residual(b, x, r);
+    double rr = dotProduct(r, r);
+    stats.initial_residual = std::sqrt(rr);
+    stats.residual = stats.initial_residual;
+    stats.relative_residual = bnorm > 0.0 ? stats.residual / bnorm : stats.residual;
+    if (stats.residual <= stop) { stats.converged = true; return stats; }
+
+    if constexpr (!plain) M.apply(r, z);
+    const std::vector<double>& zr = plain ? r : z;     // M^-1 r
+    std::vector<double> p = zr;
+    double rzold = plain ? rr : dotProduct(r, z);
+
+    while (stats.iterations < maxit) {
+        ++stats.iterations;
+        A.apply(p, Ap);
+        const double pAp = dotProduct(p, Ap);
+        if (!(pAp > 0.0)) break;        // A is not SPD (or p = 0): no progress possible
+        const double alpha = rzold / pAp;
+
+        rr = 0.0;
+#ifdef _OPENMP
+        #pragma omp parallel for reduction(+:rr) if(n > 16384)
+#endif
+        for (std::ptrdiff_t i = 0; i < n; i++) {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * Ap[i];
+            rr += r[i] * r[i];
+        }
+        record(rr);
+        if (stats.residual <= stop) { stats.converged = true; break; }
+
+        double rznew = rr;
+        if constexpr (!plain) {
+            M.apply(r, z);
+            rznew = dotProduct(r, z);
+            if (!(rznew > 0.0)) break;  // M is not SPD
+        }
+        const double beta = rznew / rzold;
+#ifdef _OPENMP
+        #pragma omp parallel for if(n > 16384)
+#endif
+        for (std::ptrdiff_t i = 0; i < n; i++) {
+            p[i] = zr[i] + beta * p[i];
+        }
+        rzold = rznew;
+    }
+    return stats;
+}
+
+// Conjugate gradients without preconditioning, see above
+template< class Op >
+CGStats conjugateGradient(const LinearOperator<Op>& op, const std::vector<double>& b,
+                          std::vector<double>& x, const CGOptions& opt) {
+    return conjugateGradient(op, IdentityPreconditioner(op.derived().rows()), b, x, opt);
+}
+
+// Conjugate gradients to an absolute residual norm tol, at most maxit
+// iterations (default: the number of rows), warm started from x.
+// Returns the number of iterations.
+template< class Op >
+int conjugateGradient(const LinearOperator<Op>& op, const std::vector<double>& b,
+                      std::vector<double>& x, double tol = 1e-6, int maxit = -1) {
+    CGOptions opt;
+    opt.rtol = 0.0;
+    opt.atol = tol;
+    opt.maxit = maxit;
+    return conjugateGradient(op, b, x, opt).iterations;
+}
+
 #endif
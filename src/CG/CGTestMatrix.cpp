@@ -1,6 +1,19 @@
 #include "CGMatrix.h"
+#include "Preconditioner.h"
+#include "PipelinedCG.h"
+#include "BlockCG.h"
 #include <cassert>
+#include <cmath>
 #include <iostream>
+#include "../matrix/Dense.h"
+#include "../matrix/SparseCSR.h"
+#include "../matrix/SellCSigma.h"
+#include "../matrix/BlockCSR.h"
+
+static_assert(is_linear_operator_v<Dense>, "Dense is not a linear operator");
+static_assert(is_linear_operator_v<SparseCSR<>>, "SparseCSR is not a linear operator");
+static_assert(is_linear_operator_v<SellCSigma>, "SellCSigma is not a linear operator");
+static_assert(is_linear_operator_v<BlockCSR<3>>, "BlockCSR is not a linear operator");
 
 void testConjugateGradient() {
     std::vector<std::vector<double>> A = {{4, 1}, {1, 3}};
@@ -15,7 +28,270 @@ void testConjugateGradient() {
     std::cout << "Conjugate Gradient test passed" << std::endl;
 }
 
+void testConjugateGradientOperators() {
+    // 1D Laplacian with a shifted diagonal, as sparse and dense matrices
+    const int n = 50;
+    std::vector<std::size_t> connectivity;
+    for (int i = 0; i + 1 < n; i++) { connectivity.push_back(i); connectivity.push_back(i+1); }
+    SparseCSR<> S(connectivity, 2);
+    Dense D(n, n);
+    for (int i = 0; i < n; i++) {
+        S.at(i,i) = D.at(i,i) = 2.5;
+        if (i > 0) S.at(i,i-1) = D.at(i,i-1) = -1.0;
+        if (i + 1 < n) S.at(i,i+1) = D.at(i,i+1) = -1.0;
+    }
+    std::vector<double> b(n), xs, xd;
+    for (int i = 0; i < n; i++) b[i] = 1.0 + 0.1*i;
+
+    int its = conjugateGradient(S, b, xs, 1e-10);
+    int itd = conjugateGradient(D, b, xd, 1e-10);
+    std::vector<double> r;
+    S.residual(b, xs, r);
+    assert(its > 0 && std::abs(its - itd) <= 1 && "CG iteration counts differ");
+    assert(std::sqrt(dotProduct(r, r)) < 1e-9 && "CG with SparseCSR did not converge");
+    for (int i = 0; i < n; i++)
+        assert(std::abs(xs[i] - xd[i]) < 1e-8 && "CG solutions differ");
+    std::cout << "Conjugate Gradient with SparseCSR and Dense operators passed" << std::endl;
+}
+
+void testConjugateGradientOptions() {
+    // 1D Laplacian with a shifted diagonal
+    const int n = 200;
+    std::vector<std::size_t> connectivity;
+    for (int i = 0; i + 1 < n; i++) { connectivity.push_back(i); connectivity.push_back(i+1); }
+    SparseCSR<> S(connectivity, 2);
+    for (int i = 0; i < n; i++) {
+        S.at(i,i) = 2.1;
+        if (i > 0) S.at(i,i-1) = -1.0;
+        if (i + 1 < n) S.at(i,i+1) = -1.0;
+    }
+    std::vector<double> b(n, 1.0), x, r;
+    const double bnorm = std::sqrt(dotProduct(b, b));
+
+    // relative tolerance, with the residual history
+    CGOptions opt;
+    opt.rtol = 1e-8;
+    opt.history = true;
+    CGStats st = conjugateGradient(S, b, x, opt);
+    S.residual(b, x, r);
+    assert(st.converged && st.iterations > 0 && "CG did not converge");
+    assert(st.relative_residual <= 1e-8 && std::abs(st.residual - st.relative_residual*bnorm) < 1e-12);
+    assert(std::sqrt(dotProduct(r, r)) < 1e-6 * bnorm && "CG recurrence drifted from the true residual");
+    assert(static_cast<int>(st.history.size()) == st.iterations && st.history.back() == st.residual);
+    assert(std::abs(st.initial_residual - bnorm) < 1e-12 && "CG did not start from zero");
+
+    // warm start from the solution: no iterations
+    CGStats warm = conjugateGradient(S, b, x, opt);
+    assert(warm.converged && warm.iterations == 0 && "CG warm start ignored x");
+
+    // cold start ignores x, absolute tolerance
+    opt.warm_start = false;
+    opt.rtol = 0.0;
+    opt.atol = 1e-6 * bnorm;
+    CGStats cold = conjugateGradient(S, b, x, opt);
+    assert(cold.converged && cold.iterations > 0 && cold.iterations <= st.iterations);
+    assert(cold.residual <= opt.atol);
+
+    // iteration cap
+    opt.maxit = 3;
+    CGStats capped = conjugateGradient(S, b, x, opt);
+    assert(!capped.converged && capped.iterations == 3 && "CG ignored maxit");
+    std::cout << "Conjugate Gradient options and statistics passed" << std::endl;
+}
+
+// 2D 5-point Laplacian on an m x m grid with a coefficient varying over
+// three orders of magnitude, plus a small shift
+SparseCSR<> variableLaplacian(int m) {
+    std::vector<std::size_t> connectivity;
+    auto id = [m](int i, int j) { return static_cast<std::size_t>(i + m*j); };
+    for (int j = 0; j < m; j++)
+        for (int i = 0; i < m; i++) {
+            if (i + 1 < m) { connectivity.push_back(id(i,j)); connectivity.push_back(id(i+1,j)); }
+            if (j + 1 < m) { connectivity.push_back(id(i,j)); connectivity.push_back(id(i,j+1)); }
+        }
+    SparseCSR<> A(connectivity, 2);
+    auto k = [m](int i, int j) { return std::pow(10.0, 3.0 * (i + j) / (2.0 * m)); };
+    for (int j = 0; j < m; j++)
+        for (int i = 0; i < m; i++) {
+            double d = 1e-3;
+            auto couple = [&](int i2, int j2) {
+                double c = 0.5 * (k(i,j) + k(i2,j2));
+                A.at(id(i,j), id(i2,j2)) = -c;
+                d += c;
+            };
+            if (i > 0) couple(i-1, j);
+            if (i + 1 < m) couple(i+1, j);
+            if (j > 0) couple(i, j-1);
+            if (j + 1 < m) couple(i, j+1);
+            A.at(id(i,j), id(i,j)) = d;
+        }
+    return A;
+}
+
+void testPreconditioners() {
+    SparseCSR<> A = variableLaplacian(24);
+    const std::size_t n = A.rows();
+    std::vector<double> b(n), x, r;
+    for (std::size_t i = 0; i < n; i++) b[i] = std::sin(0.1 * i);
+    CGOptions opt;
+    opt.rtol = 1e-10;
+    opt.maxit = 10000;
+    opt.warm_start = false;
+
+    CGStats plain = conjugateGradient(A, b, x, opt);
+    assert(plain.converged && "CG did not converge");
+
+    auto check = [&](const CGStats& st, const char* name) {
+        A.residual(b, x, r);
+        assert(st.converged && st.iterations < plain.iterations);
+        assert(std::sqrt(dotProduct(r, r)) < 1e-9 * std::sqrt(dotProduct(b, b)));
+        std::cout << "  " << name << ": " << st.iterations << " iterations (CG: "
+                  << plain.iterations << ")" << std::endl;
+    };
+    JacobiPreconditioner<> jacobi(A);
+    check(conjugateGradient(A, jacobi, b, x, opt), "Jacobi");
+    SSORPreconditioner<> ssor(A, 1.2);
+    assert(ssor.colors() == 2 && "a 5-point stencil is two-colorable");
+    check(conjugateGradient(A, ssor, b, x, opt), "SSOR");
+    IC0Preconditioner<> ic(A);
+    check(conjugateGradient(A, ic, b, x, opt), "IC(0)");
+
+    // setup from symmetric storage gives the same preconditioners
+    SparseCSR<> S(A);
+    S.toSymmetric();
+    std::vector<double> z1, z2;
+    for (int k = 0; k < 3; k++) {
+        if (k == 0) { jacobi.apply(b, z1); JacobiPreconditioner<>(S).apply(b, z2); }
+        if (k == 1) { ssor.apply(b, z1); SSORPreconditioner<>(S, 1.2).apply(b, z2); }
+        if (k == 2) { ic.apply(b, z1); IC0Preconditioner<>(S).apply(b, z2); }
+        for (std::size_t i = 0; i < n; i++)
+            assert(std::abs(z1[i] - z2[i]) < 1e-12 * (1.0 + std::abs(z1[i])));
+    }
+
+    // IC(0) of a tridiagonal matrix is its exact Cholesky factor: one iteration
+    std::vector<std::size_t> connectivity;
+    for (int i = 0; i + 1 < 40; i++) { connectivity.push_back(i); connectivity.push_back(i+1); }
+    SparseCSR<> T(connectivity, 2);
+    for (int i = 0; i < 40; i++) {
+        T.at(i,i) = 2.0 + 0.01*i;
+        if (i > 0) T.at(i,i-1) = -1.0;
+        if (i + 1 < 40) T.at(i,i+1) = -1.0;
+    }
+    std::vector<double> bt(40, 1.0), xt;
+    IC0Preconditioner<> exact(T);
+    assert(exact.levels() == 40 && "tridiagonal forward solve is sequential");
+    CGStats st = conjugateGradient(T, exact, bt, xt, opt);
+    assert(st.converged && st.iterations == 1 && "IC(0) of a tridiagonal matrix is not exact");
+    std::cout << "Preconditioned Conjugate Gradient passed" << std::endl;
+}
+
+void testPipelinedConjugateGradient() {
+    SparseCSR<> A = variableLaplacian(24);
+    const std::size_t n = A.rows();
+    std::vector<double> b(n), x, y, r;
+    for (std::size_t i = 0; i < n; i++) b[i] = std::sin(0.1 * i);
+    const double bnorm = std::sqrt(dotProduct(b, b));
+    CGOptions opt;
+    opt.rtol = 1e-8;
+    opt.maxit = 10000;
+    opt.warm_start = false;
+    opt.history = true;
+
+    auto compare = [&](const CGStats& cg, const CGStats& pipe) {
+        A.residual(b, y, r);
+        assert(cg.converged && pipe.converged && "pipelined CG did not converge");
+        assert(std::sqrt(dotProduct(r, r)) <= opt.rtol * bnorm && "pipelined CG residual too large");
+        assert(pipe.iterations <= cg.iterations + cg.iterations / 4 + 2 && "pipelined CG too slow");
+        assert(std::abs(pipe.initial_residual - bnorm) < 1e-12);
+        for (std::size_t i = 0; i < n; i++)
+            assert(std::abs(x[i] - y[i]) < 1e-6 * (1.0 + std::abs(x[i])) && "CG solutions differ");
+    };
+
+    // unpreconditioned, the condition number limits the attainable accuracy
+    // of the pipelined recurrences to about 1e-9 here
+    CGStats cg = conjugateGradient(A, b, x, opt);
+    compare(cg, pipelinedConjugateGradient(A, b, y, opt));
+    opt.rtol = 1e-10;
+    JacobiPreconditioner<> jacobi(A);
+    cg = conjugateGradient(A, jacobi, b, x, opt);
+    compare(cg, pipelinedConjugateGradient(A, jacobi, b, y, opt));
+    IC0Preconditioner<> ic(A);
+    cg = conjugateGradient(A, ic, b, x, opt);
+    CGStats pipe = pipelinedConjugateGradient(A, ic, b, y, opt);
+    compare(cg, pipe);
+
+    // warm start from the solution, and the iteration cap
+    opt.warm_start = true;
+    CGStats warm = pipelinedConjugateGradient(A, ic, b, y, opt);
+    assert(warm.converged && warm.iterations == 0 && "pipelined CG warm start ignored x");
+    opt.warm_start = false;
+    opt.maxit = 3;
+    CGStats capped = pipelinedConjugateGradient(A, ic, b, y, opt);
+    assert(!capped.converged && capped.iterations == 3 && capped.history.size() == 3);
+    std::cout << "Pipelined Conjugate Gradient passed (IC(0): " << pipe.iterations
+              << " iterations, CG: " << cg.iterations << ")" << std::endl;
+}
+
+void testBlockConjugateGradient() {
+    SparseCSR<> A = variableLaplacian(16);
+    const std::size_t n = A.rows(), k = 5;
+    std::vector<std::vector<double>> b(k, std::vector<double>(n)), x, y(k);
+    for (std::size_t c = 0; c < k; c++)
+        for (std::size_t i = 0; i < n; i++) b[c][i] = std::sin(0.1 * (c + 1) * i) + c;
+    b[3].assign(n, 0.0);                // converged from the start
+    CGOptions opt;
+    opt.rtol = 1e-10;
+    opt.maxit = 10000;
+    opt.warm_start = false;
+
+    // every column takes the steps of a single-vector CG
+    auto compare = [&](const std::vector<CGStats>& block, auto solve) {
+        assert(block.size() == k && x.size() == k);
+        for (std::size_t c = 0; c < k; c++) {
+            CGStats single = solve(b[c], y[c]);
+            assert(block[c].converged && "block CG did not converge");
+            assert(std::abs(block[c].iterations - single.iterations) <= 1 && "block CG iterations differ");
+            for (std::size_t i = 0; i < n; i++)
+                assert(std::abs(x[c][i] - y[c][i]) < 1e-8 * (1.0 + std::abs(y[c][i])) && "block CG solutions differ");
+        }
+        assert(block[3].iterations == 0 && x[3] == std::vector<double>(n, 0.0));
+    };
+
+    auto plain = conjugateGradient(A, b, x, opt);
+    compare(plain, [&](const std::vector<double>& bc, std::vector<double>& yc) {
+        return conjugateGradient(A, bc, yc, opt); });
+    JacobiPreconditioner<> jacobi(A);
+    compare(conjugateGradient(A, jacobi, b, x, opt), [&](const std::vector<double>& bc, std::vector<double>& yc) {
+        return conjugateGradient(A, jacobi, bc, yc, opt); });
+    IC0Preconditioner<> ic(A);      // through the default applyBlock
+    auto icb = conjugateGradient(A, ic, b, x, opt);
+    compare(icb, [&](const std::vector<double>& bc, std::vector<double>& yc) {
+        return conjugateGradient(A, ic, bc, yc, opt); });
+
+    // symmetric storage, interleaved blocks, warm start from the solution
+    SparseCSR<> S = A;
+    S.toSymmetric();
+    std::vector<double> B(n * k), X;
+    for (std::size_t c = 0; c < k; c++)
+        for (std::size_t i = 0; i < n; i++) B[i*k + c] = b[c][i];
+    auto sym = blockConjugateGradient(S, k, B, X, opt);
+    for (std::size_t c = 0; c < k; c++)
+        assert(sym[c].converged && std::abs(sym[c].iterations - plain[c].iterations) <= plain[c].iterations / 50 + 1
+               && "symmetric storage changed block CG");     // up to rounding, summed in another order
+    opt.warm_start = true;
+    opt.rtol = 1e-8;                // the true residual lags the recurrence a little
+    for (const auto& st : blockConjugateGradient(S, k, B, X, opt))
+        assert(st.converged && st.iterations == 0 && "block CG warm start ignored X");
+    std::cout << "Block Conjugate Gradient passed (" << k << " right-hand sides, IC(0): "
+              << icb[0].iterations << " iterations)" << std::endl;
+}
+
 int main() {
     testConjugateGradient();
+    testConjugateGradientOperators();
+    testConjugateGradientOptions();
+    testPreconditioners();
+    testPipelinedConjugateGradient();
+    testBlockConjugateGradient();
     return 0;
 }
@@ -0,0 +1,148 @@
+#ifndef PIPELINEDCG_H
+#define PIPELINEDCG_H
+
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+#include "CGMatrix.h"
+
+// Pipelined preconditioned conjugate gradients (Ghysels and Vanroose, Parallel
+// Computing 40, 2014). Classical CG needs the result of p.Ap before it can
+// update x and r, and the result of r.z before it can update p: two global
+// reductions, each a synchronization point, per iteration. The pipelined
+// recurrences carry w = A u, s = A p, q = M^-1 s and z = A q along with the
+// usual vectors, so that the three inner products of an iteration,
+// gamma = r.u, delta = w.u and r.r, are computed together in the loop that
+// updates all vectors. That loop is the only reduction of an iteration, and
+// the products m = M^-1 w and n = A m that follow do not depend on its result:
+// with threads the reduction completes at the barrier the products need
+// anyway, across processes it can be started before and completed after them.
+// The price is four more vectors, one more AXPY each, and a recurrence for r
+// that drifts further from b - A*x than in CG. When the recurrence residual
+// meets the tolerance, the true residual is therefore computed; if it does not
+// meet the tolerance too, the recurrences are restarted from it, as they are
+// when rounding makes the step length nonpositive near convergence.
+// Same operator, preconditioner, options and statistics as conjugateGradient.
+template< class Op, class Prec >
+CGStats pipelinedConjugateGradient(const LinearOperator<Op>& op, const LinearOperator<Prec>& prec,
+                                   const std::vector<double>& b, std::vector<double>& x,
+                                   const CGOptions& opt) {
+    static_assert(is_linear_operator_v<Op>, "pipelinedConjugateGradient: Op must provide rows(), cols() and apply()");
+    static_assert(is_linear_operator_v<Prec>, "pipelinedConjugateGradient: Prec must provide rows(), cols() and apply()");
+    constexpr bool plain = std::is_same_v<Prec, IdentityPreconditioner>;
+    const Op& A = op.derived();
+    const Prec& M = prec.derived();
+    const std::size_t N = A.rows();
+    const auto n = static_cast<std::ptrdiff_t>(N);
+    const int maxit = opt.maxit < 0 ? static_cast<int>(N) : opt.maxit;
+    if (opt.warm_start) x.resize(N, 0.0); else x.assign(N, 0.0);
+
+    CGStats stats;
+    const double bnorm = std::sqrt(dotProduct(b, b));
+    const double stop = std::max(opt.rtol * bnorm, opt.atol);
+    auto record = [&](double rs) {
+        stats.residual = std::sqrt(rs);
+        stats.relative_residual = bnorm > 0.0 ? stats.residual / bnorm : stats.residual;
+    };
+
+    // with M = I: u = r, m = w and q = s, these are not stored
+    std::vector<double> r(N), w(N), nv(N), z(N, 0.0), s(N, 0.0), p(N, 0.0);
+    std::vector<double> u, m, q;
+    if constexpr (!plain) { u.resize(N); m.resize(N); q.assign(N, 0.0); }
+    const std::vector<double>& ur = plain ? r : u;      // M^-1 r
+    const std::vector<double>& mw = plain ? w : m;      // M^-1 w
+    const std::vector<double>& qs = plain ? s : q;      // M^-1 s
+
+    double gamma = 0.0, delta = 0.0, rr = 0.0;
+    // r = b - A*x, u = M^-1 r, w = A*u and their inner products; the
+    // recurrences start over (beta = 0) after every call
+    auto restart = [&]() {
+        A.residual(b, x, r);
+        if constexpr (!plain) M.apply(r, u);
+        A.apply(ur, w);
+        gamma = delta = rr = 0.0;
+#ifdef _OPENMP
+        #pragma omp parallel for reduction(+:gamma,delta,rr) if(n > 16384)
+#endif
+        for (std::ptrdiff_t i = 0; i < n; i++) {
+            gamma += r[i] * ur[i];
+            delta += w[i] * ur[i];
+            rr += r[i] * r[i];
+        }
+    };
+
+    restart();
+    stats.initial_residual = std::sqrt(rr);
+    record(rr);
+    if (stats.residual <= stop) { stats.converged = true; return stats; }
+
+    bool first = true;
+    double gamma_old = 0.0, alpha_old = 0.0;
+    while (stats.iterations < maxit) {
+        ++stats.iterations;
+        if constexpr (!plain) M.apply(w, m);
+        A.apply(mw, nv);
+
+        double beta = 0.0, alpha;
+        if (first) {
+            alpha = delta > 0.0 ? gamma / delta : 0.0;
+        } else {
+            beta = gamma / gamma_old;
+            const double den = delta - beta * gamma / alpha_old;
+            alpha = den > 0.0 ? gamma / den : 0.0;
+        }
+        if (!(alpha > 0.0)) {
+            if (first) break;           // A or M is not SPD: no progress possible
+            // rounding errors broke the recurrences: start over from b - A*x
+            restart();
+            record(rr);
+            if (opt.history) stats.history.push_back(stats.residual);
+            if (stats.residual <= stop) { stats.converged = true; break; }
+            first = true;
+            continue;
+        }
+        first = false;
+        gamma_old = gamma;
+        alpha_old = alpha;
+
+        // all vector updates and the only reduction of the iteration
+        gamma = delta = rr = 0.0;
+#ifdef _OPENMP
+        #pragma omp parallel for reduction(+:gamma,delta,rr) if(n > 16384)
+#endif
+        for (std::ptrdiff_t i = 0; i < n; i++) {
+            z[i] = nv[i] + beta * z[i];
+            s[i] = w[i] + beta * s[i];
+            p[i] = ur[i] + beta * p[i];
+            if constexpr (!plain) q[i] = m[i] + beta * q[i];
+            x[i] += alpha * p[i];
+            r[i] -= alpha * s[i];
+            if constexpr (!plain) u[i] -= alpha * qs[i];
+            w[i] -= alpha * z[i];
+            gamma += r[i] * ur[i];
+            delta += w[i] * ur[i];
+            rr += r[i] * r[i];
+        }
+        record(rr);
+        if (opt.history) stats.history.push_back(stats.residual);
+
+        if (stats.residual <= stop) {
+            // confirm with the true residual, restart from it if it is off
+            restart();
+            record(rr);
+            if (stats.residual <= stop) { stats.converged = true; break; }
+            first = true;
+        }
+    }
+    return stats;
+}
+
+// Pipelined conjugate gradients without preconditioning, see above
+template< class Op >
+CGStats pipelinedConjugateGradient(const LinearOperator<Op>& op, const std::vector<double>& b,
+                                   std::vector<double>& x, const CGOptions& opt) {
+    return pipelinedConjugateGradient(op, IdentityPreconditioner(op.derived().rows()), b, x, opt);
+}
+
+#endif
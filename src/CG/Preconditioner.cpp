@@ -0,0 +1,362 @@
+/*
+    Preconditioners for the native conjugate gradients:
+
+    Jacobi:
+    z_i = r_i / a_ii. One aligned array of inverse diagonal entries and one
+    vectorizable loop, so it costs less than a tenth of a SpMV; it helps when
+    the diagonal varies a lot, e.g., on meshes with very different element sizes.
+
+    Multicolor SSOR:
+    M = omega/(2-omega) (D/omega + L) D^-1 (D/omega + U), applied as a forward
+    sweep, a diagonal scaling and a backward sweep. A plain Gauss-Seidel sweep is
+    sequential, row i needs the new values of all rows before it. The rows are
+    therefore colored greedily so that no two rows of one color are coupled, and
+    L and U are taken in the color order: L holds the couplings to rows of
+    earlier colors, U to rows of later colors. All rows of one color can then be
+    updated at the same time. Tetrahedron meshes need some 10-30 colors; the
+    convergence is that of SSOR in the multicolor ordering, a little worse than
+    in the natural ordering.
+
+    IC(0):
+    L L^T ~ A with L restricted to the pattern of the lower triangle of A. The
+    factorization is row by row (up-looking): the entries of row i follow from
+    the sparse dot products of row i with the rows k < i it couples to. The two
+    triangular solves are level scheduled: level(i) = 1 + max level(j) over the
+    rows j that row i depends on, and the rows of one level are solved in
+    parallel. The number of levels depends on the numbering; a bandwidth
+    reducing numbering (RCM) gives about as many levels as the bandwidth,
+    space-filling curve orderings give fewer.
+
+    All three read the matrix once at setup, in full or symmetric storage, and
+    keep their own arrays, so the SparseCSR can be refilled afterwards.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include "Preconditioner.h"
+
+namespace {
+
+template< typename Index, typename Value, class F >
+void
+withFull( const SparseCSR<Index,Value> &A, F f )
+// *****************************************************************************
+//  Call f with A in full storage, expanding a symmetric A into a temporary
+// *****************************************************************************
+{
+   if (!A.isSymmetric()) { f(A); return; }
+   SparseCSR<Index,Value> full(A);
+   full.toFull();
+   f(full);
+}
+
+template< typename Index, typename Value >
+std::vector<double>
+diagonal( const SparseCSR<Index,Value> &A, const char* who )
+// *****************************************************************************
+//  Diagonal of a matrix, which must be nonzero for all three preconditioners
+// *****************************************************************************
+{
+   const auto& rp = A.getRPtr();
+   const auto& ci = A.getCols();
+   const auto& va = A.getVals();
+   const Index n = static_cast<Index>(A.rows());
+   std::vector<double> d(static_cast<std::size_t>(n), 0.0);
+   for (Index i = 0; i < n; ++i)
+      for (Index k = rp[i]; k < rp[i+1]; ++k)
+         if (ci[k] == i) d[i] = va[k];
+   for (Index i = 0; i < n; ++i)
+      if (d[i] == 0.0)
+         throw std::invalid_argument(std::string(who) + ": zero diagonal entry in row "
+                                     + std::to_string(i));
+   return d;
+}
+
+template< typename Index >
+void
+bucket( const std::vector<Index> &key, std::vector<Index> &order, std::vector<Index> &offset )
+// *****************************************************************************
+//  Group 0..n-1 by key (color or level) with a counting sort
+//! \param[in] key Key of each row, 0 <= key < number of groups
+//! \param[out] order Rows in increasing key, ascending within a key
+//! \param[out] offset Start of each group in order, number of groups + 1 entries
+// *****************************************************************************
+{
+   Index ngroups = 0;
+   for (auto k : key) ngroups = std::max(ngroups, static_cast<Index>(k + 1));
+   offset.assign(static_cast<std::size_t>(ngroups) + 1, 0);
+   for (auto k : key) ++offset[k+1];
+   for (Index g = 0; g < ngroups; ++g) offset[g+1] += offset[g];
+   std::vector<Index> pos(offset.begin(), offset.end() - 1);
+   order.resize(key.size());
+   for (std::size_t i = 0; i < key.size(); ++i) order[pos[key[i]]++] = static_cast<Index>(i);
+}
+
+} // namespace
+
+template< typename Index, typename Value >
+JacobiPreconditioner<Index,Value>::JacobiPreconditioner(const SparseCSR<Index,Value> &A)
+{
+   auto d = diagonal(A, "JacobiPreconditioner");
+   invdiag.resize(d.size());
+   for (std::size_t i = 0; i < d.size(); ++i) invdiag[i] = 1.0 / d[i];
+}
+
+template< typename Index, typename Value >
+void JacobiPreconditioner<Index,Value>::apply( const std::vector<double> &r,
+                                               std::vector<double> &z ) const
+{
+   const auto n = static_cast<std::ptrdiff_t>(invdiag.size());
+   z.resize(invdiag.size());
+   const double* __restrict d = invdiag.data();
+   const double* __restrict rp = r.data();
+   double* __restrict zp = z.data();
+#ifdef _OPENMP
+   #pragma omp parallel for simd schedule(static) if(n > 16384)
+#endif
+   for (std::ptrdiff_t i = 0; i < n; ++i) zp[i] = d[i] * rp[i];
+}
+
+template< typename Index, typename Value >
+void JacobiPreconditioner<Index,Value>::applyBlock( std::size_t k, const std::vector<double> &R,
+                                                    std::vector<double> &Z ) const
+{
+   const auto n = static_cast<std::ptrdiff_t>(invdiag.size());
+   Z.resize(R.size());
+#ifdef _OPENMP
+   #pragma omp parallel for schedule(static) if(n > 16384)
+#endif
+   for (std::ptrdiff_t i = 0; i < n; ++i)
+      for (std::size_t c = 0; c < k; ++c) Z[i*k + c] = invdiag[i] * R[i*k + c];
+}
+
+template< typename Index, typename Value >
+SSORPreconditioner<Index,Value>::SSORPreconditioner(const SparseCSR<Index,Value> &A, double omega)
+   : omega(omega)
+{
+// *****************************************************************************
+//  Set up multicolor SSOR
+//! \param[in] A Symmetric positive definite matrix
+//! \param[in] omega Relaxation parameter, 0 < omega < 2, 1: symmetric Gauss-Seidel
+// *****************************************************************************
+   if (!(omega > 0.0 && omega < 2.0))
+      throw std::invalid_argument("SSORPreconditioner: omega must be in (0,2)");
+
+   diag = diagonal(A, "SSORPreconditioner");
+
+   withFull(A, [&]( const SparseCSR<Index,Value> &F ) {
+      const auto& rp = F.getRPtr();
+      const auto& ci = F.getCols();
+      const auto& va = F.getVals();
+      const Index n = static_cast<Index>(F.rows());
+
+      //! greedy coloring: the smallest color not used by an already colored neighbour
+      std::vector<Index> c(static_cast<std::size_t>(n), -1);
+      std::vector<Index> used;          // used[k] == i: color k taken by a neighbour of i
+      for (Index i = 0; i < n; ++i) {
+         for (Index k = rp[i]; k < rp[i+1]; ++k) {
+            Index j = ci[k];
+            if (j == i || c[j] < 0) continue;
+            if (static_cast<std::size_t>(c[j]) >= used.size()) used.resize(c[j] + 1, -1);
+            used[c[j]] = i;
+         }
+         Index k = 0;
+         while (static_cast<std::size_t>(k) < used.size() && used[k] == i) ++k;
+         c[i] = k;
+      }
+      bucket(c, order, color);
+
+      //! split the off-diagonal couplings by the color of the column
+      lptr.assign(static_cast<std::size_t>(n) + 1, 0);
+      uptr.assign(static_cast<std::size_t>(n) + 1, 0);
+      for (Index q = 0; q < n; ++q) {
+         Index i = order[q];
+         for (Index k = rp[i]; k < rp[i+1]; ++k) {
+            Index j = ci[k];
+            if (j == i) continue;
+            if (c[j] < c[i]) { lcol.push_back(j); lval.push_back(va[k]); }
+            else { ucol.push_back(j); uval.push_back(va[k]); }
+         }
+         lptr[q+1] = static_cast<Index>(lcol.size());
+         uptr[q+1] = static_cast<Index>(ucol.size());
+      }
+   });
+}
+
+template< typename Index, typename Value >
+void SSORPreconditioner<Index,Value>::apply( const std::vector<double> &r,
+                                             std::vector<double> &z ) const
+{
+// *****************************************************************************
+//  z = M^-1 r, one forward and one backward multicolor sweep from z = 0
+//! \details One parallel region; the colors are processed one after the
+//!   other, the rows of a color in parallel.
+// *****************************************************************************
+   z.resize(diag.size());
+   const Index ncolors = static_cast<Index>(color.size()) - 1;
+   const double scale = (2.0 - omega) / omega;
+
+#ifdef _OPENMP
+   #pragma omp parallel if(diag.size() > 16384)
+#endif
+   {
+      //! forward: (D/omega + L) y = r
+      for (Index c = 0; c < ncolors; ++c) {
+#ifdef _OPENMP
+         #pragma omp for schedule(static)
+#endif
+         for (Index q = color[c]; q < color[c+1]; ++q) {
+            const Index i = order[q];
+            double s = r[i];
+            for (Index k = lptr[q]; k < lptr[q+1]; ++k) s -= lval[k] * z[lcol[k]];
+            z[i] = omega * s / diag[i];
+         }
+      }
+
+      //! backward: (D/omega + U) z = (2-omega)/omega D y
+      for (Index c = ncolors - 1; c >= 0; --c) {
+#ifdef _OPENMP
+         #pragma omp for schedule(static)
+#endif
+         for (Index q = color[c]; q < color[c+1]; ++q) {
+            const Index i = order[q];
+            double s = scale * diag[i] * z[i];
+            for (Index k = uptr[q]; k < uptr[q+1]; ++k) s -= uval[k] * z[ucol[k]];
+            z[i] = omega * s / diag[i];
+         }
+      }
+   }
+}
+
+template< typename Index, typename Value >
+IC0Preconditioner<Index,Value>::IC0Preconditioner(const SparseCSR<Index,Value> &A)
+{
+// *****************************************************************************
+//  Incomplete Cholesky factorization and level schedules of the solves
+//! \param[in] A Symmetric positive definite matrix
+// *****************************************************************************
+   const Index n = static_cast<Index>(A.rows());
+   std::vector<double> adiag = diagonal(A, "IC0Preconditioner");
+
+   //! strictly lower triangle of A, columns sorted in each row
+   withFull(A, [&]( const SparseCSR<Index,Value> &F ) {
+      const auto& rp = F.getRPtr();
+      const auto& ci = F.getCols();
+      const auto& va = F.getVals();
+      lptr.assign(static_cast<std::size_t>(n) + 1, 0);
+      std::vector<std::pair<Index,double>> row;
+      for (Index i = 0; i < n; ++i) {
+         row.clear();
+         for (Index k = rp[i]; k < rp[i+1]; ++k)
+            if (ci[k] < i) row.emplace_back(ci[k], va[k]);
+         std::sort(row.begin(), row.end());
+         for (const auto& e : row) { lcol.push_back(e.first); lval.push_back(e.second); }
+         lptr[i+1] = static_cast<Index>(lcol.size());
+      }
+   });
+
+   //! up-looking factorization: l_ik = (a_ik - sum_j<k l_ij l_kj) / l_kk
+   ldiag.resize(static_cast<std::size_t>(n));
+   for (Index i = 0; i < n; ++i) {
+      double d = adiag[i];
+      for (Index p = lptr[i]; p < lptr[i+1]; ++p) {
+         const Index k = lcol[p];
+         double s = lval[p];
+         Index a = lptr[i], b = lptr[k];          // merge rows i and k below column k
+         while (a < p && b < lptr[k+1]) {
+            if (lcol[a] < lcol[b]) ++a;
+            else if (lcol[b] < lcol[a]) ++b;
+            else s -= lval[a++] * lval[b++];
+         }
+         lval[p] = s / ldiag[k];
+         d -= lval[p] * lval[p];
+      }
+      if (!(d > 0.0))
+         throw std::runtime_error("IC0Preconditioner: nonpositive pivot in row "
+                                  + std::to_string(i) + ", matrix not SPD enough for IC(0)");
+      ldiag[i] = std::sqrt(d);
+   }
+
+   //! L^T row-wise: strictly upper part
+   uptr.assign(static_cast<std::size_t>(n) + 1, 0);
+   for (auto j : lcol) ++uptr[j+1];
+   for (Index i = 0; i < n; ++i) uptr[i+1] += uptr[i];
+   ucol.resize(lcol.size());
+   uval.resize(lval.size());
+   std::vector<Index> pos(uptr.begin(), uptr.end() - 1);
+   for (Index i = 0; i < n; ++i)
+      for (Index p = lptr[i]; p < lptr[i+1]; ++p) {
+         Index m = pos[lcol[p]]++;
+         ucol[m] = i;
+         uval[m] = lval[p];
+      }
+
+   //! level schedules: a row depends on the rows of its off-diagonal entries
+   std::vector<Index> level(static_cast<std::size_t>(n), 0);
+   for (Index i = 0; i < n; ++i)
+      for (Index p = lptr[i]; p < lptr[i+1]; ++p)
+         level[i] = std::max(level[i], static_cast<Index>(level[lcol[p]] + 1));
+   bucket(level, forder, flevel);
+   std::fill(level.begin(), level.end(), 0);
+   for (Index i = n - 1; i >= 0; --i)
+      for (Index p = uptr[i]; p < uptr[i+1]; ++p)
+         level[i] = std::max(level[i], static_cast<Index>(level[ucol[p]] + 1));
+   bucket(level, border, blevel);
+}
+
+template< typename Index, typename Value >
+void IC0Preconditioner<Index,Value>::apply( const std::vector<double> &r,
+                                            std::vector<double> &z ) const
+{
+// *****************************************************************************
+//  z = (L L^T)^-1 r by level-scheduled forward and backward substitution
+// *****************************************************************************
+   z.resize(ldiag.size());
+   const Index nf = static_cast<Index>(flevel.size()) - 1;
+   const Index nb = static_cast<Index>(blevel.size()) - 1;
+
+#ifdef _OPENMP
+   #pragma omp parallel if(ldiag.size() > 16384)
+#endif
+   {
+      //! forward: L y = r
+      for (Index l = 0; l < nf; ++l) {
+#ifdef _OPENMP
+         #pragma omp for schedule(static)
+#endif
+         for (Index q = flevel[l]; q < flevel[l+1]; ++q) {
+            const Index i = forder[q];
+            double s = r[i];
+            for (Index p = lptr[i]; p < lptr[i+1]; ++p) s -= lval[p] * z[lcol[p]];
+            z[i] = s / ldiag[i];
+         }
+      }
+
+      //! backward: L^T z = y
+      for (Index l = 0; l < nb; ++l) {
+#ifdef _OPENMP
+         #pragma omp for schedule(static)
+#endif
+         for (Index q = blevel[l]; q < blevel[l+1]; ++q) {
+            const Index i = border[q];
+            double s = z[i];
+            for (Index p = uptr[i]; p < uptr[i+1]; ++p) s -= uval[p] * z[ucol[p]];
+            z[i] = s / ldiag[i];
+         }
+      }
+   }
+}
+
+#define FIREFLY_PRECONDITIONERS(Index, Value)                                              \
+   template class JacobiPreconditioner< Index, Value >;                                    \
+   template class SSORPreconditioner< Index, Value >;                                      \
+   template class IC0Preconditioner< Index, Value >;
+
+FIREFLY_PRECONDITIONERS( std::int32_t, double )
+FIREFLY_PRECONDITIONERS( std::int64_t, double )
+FIREFLY_PRECONDITIONERS( std::int32_t, float )
+FIREFLY_PRECONDITIONERS( std::int64_t, float )
+
+#undef FIREFLY_PRECONDITIONERS
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "../matrix/LinearOperator.h"
+#include "../matrix/Dense.h"
+#include "../matrix/SparseCSR.h"
+
+// Preconditioners for conjugateGradient(A, M, b, x, opt), see CGMatrix.h and
+// Preconditioner.cpp. Each one is a LinearOperator whose apply(r, z) computes
+// z = M^-1 r for a symmetric positive definite M approximating A. They are
+// set up from a SparseCSR in full or symmetric (upper triangle) storage.
+
+//! \brief Jacobi (diagonal) preconditioner, z = D^-1 r
+template< typename Index = std::int32_t, typename Value = double >
+class JacobiPreconditioner : public LinearOperator< JacobiPreconditioner<Index,Value> >
+{
+public:
+    explicit JacobiPreconditioner(const SparseCSR<Index,Value> &A);
+    std::size_t rows() const { return invdiag.size(); }
+    std::size_t cols() const { return invdiag.size(); }
+    void apply( const std::vector<double> &r, std::vector<double> &z ) const;
+    void applyBlock( std::size_t k, const std::vector<double> &R,
+                     std::vector<double> &Z ) const;     // k interleaved vectors
+
+private:
+    std::vector<double, AlignedAllocator<double,64> > invdiag;   // 1 / a_ii
+};
+
+//! \brief Symmetric successive over-relaxation in multicolor order
+//! \details The rows are colored so that no two rows of a color are coupled;
+//!   the sweeps go over the colors in order, the rows of one color in parallel.
+template< typename Index = std::int32_t, typename Value = double >
+class SSORPreconditioner : public LinearOperator< SSORPreconditioner<Index,Value> >
+{
+public:
+    explicit SSORPreconditioner(const SparseCSR<Index,Value> &A, double omega = 1.0);
+    std::size_t rows() const { return diag.size(); }
+    std::size_t cols() const { return diag.size(); }
+    std::size_t colors() const { return color.size() - 1; }
+    void apply( const std::vector<double> &r, std::vector<double> &z ) const;
+
+private:
+    double omega;
+    std::vector<Index> order;       // rows grouped by color
+    std::vector<Index> color;       // offsets of the colors in order
+    std::vector<Index> lptr, lcol;  // couplings to earlier colors, per row of order
+    std::vector<Value> lval;
+    std::vector<Index> uptr, ucol;  // couplings to later colors, per row of order
+    std::vector<Value> uval;
+    std::vector<double> diag;       // a_ii, in the original numbering
+};
+
+//! \brief Incomplete Cholesky factorization without fill, A ~ L L^T
+//! \details L has the pattern of the lower triangle of A. Both triangular
+//!   solves are level scheduled: the rows of a level only depend on rows of
+//!   earlier levels and are solved in parallel. Throws std::runtime_error if
+//!   a pivot is not positive, i.e., the factorization breaks down.
+template< typename Index = std::int32_t, typename Value = double >
+class IC0Preconditioner : public LinearOperator< IC0Preconditioner<Index,Value> >
+{
+public:
+    explicit IC0Preconditioner(const SparseCSR<Index,Value> &A);
+    std::size_t rows() const { return ldiag.size(); }
+    std::size_t cols() const { return ldiag.size(); }
+    std::size_t levels() const { return flevel.size() - 1; }   // of the forward solve
+    void apply( const std::vector<double> &r, std::vector<double> &z ) const;
+
+private:
+    std::vector<Index> lptr, lcol;  // strictly lower part of L, row-wise
+    std::vector<double> lval;
+    std::vector<Index> uptr, ucol;  // strictly upper part of L^T, row-wise
+    std::vector<double> uval;
+    std::vector<double> ldiag;      // diagonal of L
+    std::vector<Index> forder, flevel;  // rows by level of the forward solve
+    std::vector<Index> border, blevel;  // rows by level of the backward solve
+};
+
+extern template class JacobiPreconditioner< std::int32_t, double >;
+extern template class JacobiPreconditioner< std::int64_t, double >;
+extern template class JacobiPreconditioner< std::int32_t, float >;
+extern template class JacobiPreconditioner< std::int64_t, float >;
+extern template class SSORPreconditioner< std::int32_t, double >;
+extern template class SSORPreconditioner< std::int64_t, double >;
+extern template class SSORPreconditioner< std::int32_t, float >;
+extern template class SSORPreconditioner< std::int64_t, float >;
+extern template class IC0Preconditioner< std::int32_t, double >;
+extern template class IC0Preconditioner< std::int64_t, double >;
+extern template class IC0Preconditioner< std::int32_t, float >;
+extern template class IC0Preconditioner< std::int64_t, float >;
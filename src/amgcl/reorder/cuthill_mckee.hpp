@@ -140,7 +140,7 @@ struct cuthill_mckee {
             for(ptrdiff_t soughtDegree = firstVal; soughtDegree != finalVal; soughtDegree += increment)
             {
                 ptrdiff_t node = firstWithDegree[soughtDegree];
-                while (node > 0) {
+                while (node >= 0) {
                     // Visit neighbors
                     for(auto a = backend::row_begin(A, node); a; ++a) {
                         ptrdiff_t c = a.col();
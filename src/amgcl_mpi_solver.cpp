@@ -0,0 +1,170 @@
+// The AMGCL types are defined as in amgcl_solver.cpp, with or without Boost
+#ifndef FIREFLY_AMGCL_RUNTIME
+#define AMGCL_NO_BOOST
+#endif
+
+#include <algorithm>
+#include <vector>
+#include <amgcl/backend/builtin.hpp>
+#include <amgcl/adapter/crs_tuple.hpp>
+#include <amgcl/mpi/distributed_matrix.hpp>
+#include <amgcl/mpi/make_solver.hpp>
+#include <amgcl/mpi/amg.hpp>
+#include <amgcl/mpi/coarsening/smoothed_aggregation.hpp>
+#include <amgcl/mpi/relaxation/gauss_seidel.hpp>
+#include <amgcl/mpi/relaxation/ilu0.hpp>
+#include <amgcl/mpi/relaxation/spai0.hpp>
+#include <amgcl/mpi/direct_solver/skyline_lu.hpp>
+#include <amgcl/mpi/partition/merge.hpp>
+#include <amgcl/mpi/solver/bicgstab.hpp>
+
+#include <amgcl_mpi_solver.hpp>
+
+typedef amgcl::backend::builtin<double> Backend;
+
+// Distributed AMG with smoothed aggregation and BiCGStab iterations; coarse
+// levels are merged onto fewer ranks, the coarsest is solved with skyline LU
+template <template <class> class Relaxation>
+using MPISolver = amgcl::mpi::make_solver<
+    amgcl::mpi::amg<
+        Backend,
+        amgcl::mpi::coarsening::smoothed_aggregation<Backend>,
+        Relaxation<Backend>,
+        amgcl::mpi::direct::skyline_lu<double>,
+        amgcl::mpi::partition::merge<Backend>>,
+    amgcl::mpi::solver::bicgstab<Backend>>;
+
+/*
+Solve with AMGCL over MPI from the local rows of a matrix in any CRS adapter
+format of AMGCL with global column indices.
+Returns: tuple of number of iterations used and the error.
+*/
+template <class Matrix>
+static SolverResult mpiSolve(
+    MPI_Comm comm,
+    const AmgclPrecondType &preconditioner,
+    const Matrix &A,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+)
+{
+    amgcl::mpi::communicator world(comm);
+    if (x.size() != amgcl::backend::rows(A))
+        x.assign(amgcl::backend::rows(A), 0);
+
+    if (preconditioner == AmgclPrecond_GaussSeidel)
+    {
+        MPISolver<amgcl::mpi::relaxation::gauss_seidel> solve(world, A);
+        return solve(rhs, x);
+    }
+    else if (preconditioner == AmgclPrecond_ILU0)
+    {
+        MPISolver<amgcl::mpi::relaxation::ilu0> solve(world, A);
+        return solve(rhs, x);
+    }
+    else if (preconditioner == AmgclPrecond_SPAI0)
+    {
+        MPISolver<amgcl::mpi::relaxation::spai0> solve(world, A);
+        return solve(rhs, x);
+    }
+    else
+    {
+        throw -1;
+    }
+}
+
+// Rows [first, last) of part r of nrows rows split into p balanced blocks
+static std::pair<std::size_t, std::size_t> rowBlock(std::size_t nrows, std::size_t p, std::size_t r)
+{
+    std::size_t chunk = nrows / p, extra = nrows % p;
+    std::size_t first = r * chunk + std::min(r, extra);
+    return { first, first + chunk + (r < extra ? 1 : 0) };
+}
+
+std::pair<std::size_t, std::size_t> amgclRowBlock(MPI_Comm comm, std::size_t nrows)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    return rowBlock(nrows, size, rank);
+}
+
+SolverResult solveAMGCL(
+    MPI_Comm comm,
+    const AmgclPrecondType &preconditioner,
+    const std::vector<int> &row_endpoints,
+    const std::vector<int> &col_indices,
+    const std::vector<double> &values,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+)
+{
+    int n = row_endpoints.size() - 1;
+    return mpiSolve(comm, preconditioner, std::tie(n, row_endpoints, col_indices, values), rhs, x);
+}
+
+SolverResult solveAMGCL(
+    MPI_Comm comm,
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<> &A,
+    const std::vector<double> &b,
+    std::vector<double> &x
+)
+{
+    // AMGCL needs all nonzeros
+    if (A.isSymmetric()) {
+        SparseCSR<> full(A);
+        full.toFull();
+        return solveAMGCL(comm, preconditioner, full, b, x);
+    }
+
+    const std::size_t nrows = A.rows();
+    auto [first, last] = amgclRowBlock(comm, nrows);
+    if (x.size() != nrows)
+        x.assign(nrows, 0);
+
+    // the local rows: the columns and values are used in place, only the row
+    // pointer is shifted to start at zero
+    const auto &rptr = A.getRPtr();
+    int n = static_cast<int>(last - first);
+    std::vector<int> ptr(rptr.begin() + first, rptr.begin() + last + 1);
+    for (auto &p : ptr) p -= rptr[first];
+    auto cols = amgcl::make_iterator_range(A.getCols().data() + rptr[first], A.getCols().data() + rptr[last]);
+    auto vals = amgcl::make_iterator_range(A.getVals().data() + rptr[first], A.getVals().data() + rptr[last]);
+    std::vector<double> rhs(b.begin() + first, b.begin() + last);
+    std::vector<double> xloc(x.begin() + first, x.begin() + last);
+
+    SolverResult result = mpiSolve(comm, preconditioner, std::tie(n, ptr, cols, vals), rhs, xloc);
+
+    // gather the solution on every rank
+    int size;
+    MPI_Comm_size(comm, &size);
+    std::vector<int> counts(size), displs(size);
+    for (int r = 0; r < size; ++r) {
+        auto [f, l] = rowBlock(nrows, size, r);
+        displs[r] = static_cast<int>(f);
+        counts[r] = static_cast<int>(l - f);
+    }
+    MPI_Allgatherv(xloc.data(), n, MPI_DOUBLE, x.data(), counts.data(), displs.data(),
+                   MPI_DOUBLE, comm);
+    return result;
+}
+
+SolverResult solveAMGCLLocal(
+    MPI_Comm comm,
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<> &A,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+)
+{
+    // AMGCL needs all nonzeros, only a square block can be stored symmetric
+    if (A.isSymmetric()) {
+        SparseCSR<> full(A);
+        full.toFull();
+        return solveAMGCLLocal(comm, preconditioner, full, rhs, x);
+    }
+
+    int n = static_cast<int>(A.rows());
+    return mpiSolve(comm, preconditioner, std::tie(n, A.getRPtr(), A.getCols(), A.getVals()), rhs, x);
+}
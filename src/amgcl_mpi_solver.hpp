@@ -0,0 +1,91 @@
+#ifndef AMGCL_MPI_FIREFLY
+#define AMGCL_MPI_FIREFLY
+
+#include <mpi.h>
+#include <utility>
+#include <amgcl_solver.hpp>
+
+/*
+Distributed-memory AMGCL solves over MPI: smoothed aggregation AMG with the
+relaxation of AmgclPrecondType and BiCGStab, as the serial solveAMGCL. Every
+rank of the communicator owns a block of consecutive rows of the global matrix,
+the blocks in rank order. Coarse levels that become too small per rank are
+merged onto fewer ranks (merge partitioner) and the coarsest one is solved
+directly. Consecutive rows are as good a partition as the node numbering: use
+renumberRCM or renumberSFC of Reorder.hpp first on unstructured meshes.
+All functions are collective, the results are the same on all ranks.
+*/
+
+/*
+Input:
+- comm: MPI communicator
+- nrows: number of global rows
+Returns: first and one past the last row of this rank in the balanced block
+partition, nrows/size rows per rank, the first nrows%size ranks one more.
+*/
+std::pair<std::size_t, std::size_t> amgclRowBlock(MPI_Comm comm, std::size_t nrows);
+
+/*
+Input:
+- comm: MPI communicator
+- preconditioner: AmgclPrecondType enum value specifying preconditioner
+- row_endpoints: zero-based row pointer of the local rows in CRS format
+- col_indices: global column indices of the local rows in CRS format
+- values: values of the local rows in CRS format
+- rhs: local part of the right-hand-side
+- x: local part of the initial guess on input, of the solution on output
+  (resized to zero if its size is wrong)
+Returns: tuple of number of iterations used and the error.
+*/
+SolverResult solveAMGCL(
+    MPI_Comm comm,
+    const AmgclPrecondType &preconditioner,
+    const std::vector<int> &row_endpoints,
+    const std::vector<int> &col_indices,
+    const std::vector<double> &values,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+);
+
+/*
+Input:
+- comm: MPI communicator
+- preconditioner: AmgclPrecondType enum value specifying preconditioner
+- A: the global matrix, the same on every rank (e.g., assembled redundantly);
+  each rank passes its amgclRowBlock rows to the solver. Every rank thus holds
+  all nonzeros, which limits the problem size to the memory of one rank: use
+  solveAMGCLLocal with the rows of each rank for larger problems.
+- b: global right-hand-side
+- x: global initial guess on input, global solution on output, gathered on every
+  rank (resized to zero if its size is wrong)
+Returns: tuple of number of iterations used and the error.
+*/
+SolverResult solveAMGCL(
+    MPI_Comm comm,
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<> &A,
+    const std::vector<double> &b,
+    std::vector<double> &x
+);
+
+/*
+Input:
+- comm: MPI communicator
+- preconditioner: AmgclPrecondType enum value specifying preconditioner
+- A: the local rows of the global matrix, all nonzeros stored, with global
+  column indices (cols() is the number of global rows), e.g. the amgclRowBlock
+  rows assembled on this rank only
+- rhs: local part of the right-hand-side
+- x: local part of the initial guess on input, of the solution on output
+  (resized to zero if its size is wrong)
+Returns: tuple of number of iterations used and the error.
+*/
+SolverResult solveAMGCLLocal(
+    MPI_Comm comm,
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<> &A,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+);
+
+#endif
@@ -1,5 +1,15 @@
+// The runtime interface of AMGCL reads its parameters from a Boost property
+// tree; without Boost only the compile-time solvers are built
+#ifndef FIREFLY_AMGCL_RUNTIME
 #define AMGCL_NO_BOOST
+#endif
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 #include <amgcl/amg.hpp>
 #include <amgcl/backend/builtin.hpp>
@@ -7,38 +17,393 @@
 #include <amgcl/solver/cg.hpp>
 #include <amgcl/solver/bicgstab.hpp>
 #include <amgcl/adapter/crs_tuple.hpp>
+#include <amgcl/adapter/zero_copy.hpp>
 #include <amgcl/coarsening/smoothed_aggregation.hpp>
 #include <amgcl/relaxation/gauss_seidel.hpp>
 #include <amgcl/relaxation/ilu0.hpp>
 #include <amgcl/relaxation/spai0.hpp>
+#ifdef FIREFLY_AMGCL_RUNTIME
+#include <boost/property_tree/json_parser.hpp>
+#include <amgcl/preconditioner/runtime.hpp>
+#include <amgcl/solver/runtime.hpp>
+#endif
 
 #include <amgcl_solver.hpp>
 
+namespace amgcl {
+namespace backend {
+
+// Let the Krylov solvers of the builtin backend use SellCSigma for their SpMVs
+template <class Alpha, class Vector1, class Beta, class Vector2>
+struct spmv_impl<Alpha, SellCSigma, Vector1, Beta, Vector2>
+{
+    static void apply(Alpha alpha, const SellCSigma &A, const Vector1 &x, Beta beta, Vector2 &y)
+    {
+        A.multAdd(alpha, &x[0], beta, &y[0], &y[0]);
+    }
+};
+
+template <class Vector1, class Vector2, class Vector3>
+struct residual_impl<SellCSigma, Vector1, Vector2, Vector3>
+{
+    static void apply(const Vector1 &rhs, const SellCSigma &A, const Vector2 &x, Vector3 &r)
+    {
+        A.multAdd(-1.0, &x[0], 1.0, &rhs[0], &r[0]);
+    }
+};
+
+} // namespace backend
+} // namespace amgcl
+
 typedef amgcl::backend::builtin<double> Backend;
 
-typedef amgcl::make_solver<
+// AMG preconditioner with values of type Real, BiCGStab iterations in double.
+// With Real = float the hierarchy (including the system matrix used by the
+// Krylov products) is stored in single precision: mixed precision.
+template <typename Real, template <class> class Relaxation>
+using Solver = amgcl::make_solver<
     amgcl::amg<
-        Backend,
+        amgcl::backend::builtin<Real>,
         amgcl::coarsening::smoothed_aggregation,
-        amgcl::relaxation::gauss_seidel>,
-    amgcl::solver::bicgstab<Backend>>
-    Solver_G_S;
+        Relaxation>,
+    amgcl::solver::bicgstab<Backend>>;
 
-typedef amgcl::make_solver<
-    amgcl::amg<
-        Backend,
-        amgcl::coarsening::smoothed_aggregation,
-        amgcl::relaxation::ilu0>,
-    amgcl::solver::bicgstab<Backend>>
-    Solver_ILU0;
+// Precision of the matrix values of solves from double matrices, set by the
+// FIREFLY_MIXED_PRECISION build option
+#ifdef FIREFLY_MIXED_PRECISION
+typedef float MatrixReal;
+#else
+typedef double MatrixReal;
+#endif
 
+typedef Solver<MatrixReal, amgcl::relaxation::gauss_seidel> Solver_G_S;
+typedef Solver<MatrixReal, amgcl::relaxation::ilu0> Solver_ILU0;
+typedef Solver<MatrixReal, amgcl::relaxation::spai0> Solver_SPAI0;
+
+#ifdef FIREFLY_AMGCL_RUNTIME
+// Krylov solver, preconditioner class, coarsening and relaxation chosen at run time
 typedef amgcl::make_solver<
+    amgcl::runtime::preconditioner<amgcl::backend::builtin<MatrixReal>>,
+    amgcl::runtime::solver::wrapper<Backend>> RuntimeSolver;
+#endif
+
+/*
+Solve with AMGCL from zero-based CRS arrays of any index and value type.
+Input: see solveAMGCL, n is the number of rows, Real is the precision the
+preconditioner and the matrix are stored in for the solve.
+Returns: tuple of number of iterations used and the error.
+*/
+template <typename Real, typename Index, typename Value>
+static SolverResult amgclSolve(
+    const AmgclPrecondType &preconditioner,
+    Index n,
+    const std::vector<Index> &row_endpoints,
+    const std::vector<Index> &col_indices,
+    const std::vector<Value> &values,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+)
+{
+    if (x.size() != static_cast<std::size_t>(n))
+        x.assign(n, 0);
+
+    // Define the solver type
+    if (preconditioner == AmgclPrecond_GaussSeidel)
+    {
+        Solver<Real, amgcl::relaxation::gauss_seidel> solve(std::tie(n, row_endpoints, col_indices, values));
+        return solve(rhs, x);
+    }
+    else if (preconditioner == AmgclPrecond_ILU0)
+    {
+        Solver<Real, amgcl::relaxation::ilu0> solve(std::tie(n, row_endpoints, col_indices, values));
+        return solve(rhs, x);
+    }
+    else if (preconditioner == AmgclPrecond_SPAI0)
+    {
+        Solver<Real, amgcl::relaxation::spai0> solve(std::tie(n, row_endpoints, col_indices, values));
+        return solve(rhs, x);
+    }
+    else
+    {
+        throw -1;
+    }
+}
+
+// Type-erased AMGCL solver of AmgclSolver, a Model per preconditioner type
+struct AmgclSolver::Impl
+{
+    template <class AmgSolver> struct Model;
+    struct RuntimeModel;
+    virtual ~Impl() = default;
+    virtual SolverResult solve(const std::vector<double> &rhs, std::vector<double> &x) const = 0;
+    virtual void refresh(
+        const std::vector<int> &row_endpoints,
+        const std::vector<int> &col_indices,
+        const std::vector<double> &values) = 0;
+    virtual bool refreshable() const { return true; }
+    virtual std::size_t rows() const = 0;
+};
+
+template <class AmgSolver>
+struct AmgclSolver::Impl::Model : AmgclSolver::Impl
+{
+    template <class Matrix>
+    explicit Model(const Matrix &A, const typename AmgSolver::params &prm = rebuildable())
+        : solver(A, prm) {}
+
+    // parameters of the compile-time solvers: keep the transfer operators of
+    // the setup for refresh()
+    static typename AmgSolver::params rebuildable()
+    {
+        typename AmgSolver::params prm;
+        prm.precond.allow_rebuild = true;
+        return prm;
+    }
+
+    SolverResult solve(const std::vector<double> &rhs, std::vector<double> &x) const override
+    {
+        return solver(rhs, x);
+    }
+
+    // Galerkin products, smoothers and coarse solver from the new values;
+    // the Krylov solver multiplies with the refreshed top level matrix
+    void refresh(
+        const std::vector<int> &row_endpoints,
+        const std::vector<int> &col_indices,
+        const std::vector<double> &values) override
+    {
+        int n = row_endpoints.size() - 1;
+        solver.precond().rebuild(std::tie(n, row_endpoints, col_indices, values));
+    }
+
+    std::size_t rows() const override { return solver.size(); }
+    AmgSolver solver;
+};
+
+#ifdef FIREFLY_AMGCL_RUNTIME
+// Only an AMG preconditioner can be refreshed, the others are set up anew
+struct AmgclSolver::Impl::RuntimeModel : AmgclSolver::Impl::Model<RuntimeSolver>
+{
+    template <class Matrix>
+    RuntimeModel(const Matrix &A, const RuntimeSolver::params &prm, bool amg)
+        : Model(A, prm), amg(amg) {}
+    bool refreshable() const override { return amg; }
+    bool amg;
+};
+#endif
+
+AmgclSolver::AmgclSolver(const AmgclPrecondType &preconditioner, const SparseCSR<> &A)
+    : precond(preconditioner)
+{
+    // AMGCL needs all nonzeros
+    if (A.isSymmetric()) {
+        SparseCSR<> full(A);
+        full.toFull();
+        setup(full.getRPtr(), full.getCols(), full.getVals());
+    } else {
+        setup(A.getRPtr(), A.getCols(), A.getVals());
+    }
+}
+
+AmgclSolver::AmgclSolver(
+    const AmgclPrecondType &preconditioner,
+    const std::vector<int> &row_endpoints,
+    const std::vector<int> &col_indices,
+    const std::vector<double> &values
+)
+    : precond(preconditioner)
+{
+    setup(row_endpoints, col_indices, values);
+}
+
+#ifdef FIREFLY_AMGCL_RUNTIME
+AmgclSolver::AmgclSolver(const std::string &config_file, const SparseCSR<> &A)
+{
+    std::ifstream in(config_file);
+    if (!in)
+        throw std::runtime_error("AmgclSolver: cannot read " + config_file);
+    std::ostringstream text;
+    text << in.rdbuf();
+    config = text.str();
+
+    // AMGCL needs all nonzeros
+    if (A.isSymmetric()) {
+        SparseCSR<> full(A);
+        full.toFull();
+        setup(full.getRPtr(), full.getCols(), full.getVals());
+    } else {
+        setup(A.getRPtr(), A.getCols(), A.getVals());
+    }
+}
+#endif
+
+AmgclSolver::AmgclSolver(AmgclSolver &&) noexcept = default;
+AmgclSolver &AmgclSolver::operator=(AmgclSolver &&) noexcept = default;
+AmgclSolver::~AmgclSolver() = default;
+
+void AmgclSolver::setup(
+    const std::vector<int> &row_endpoints,
+    const std::vector<int> &col_indices,
+    const std::vector<double> &values
+)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    int n = row_endpoints.size() - 1;
+    auto csr = std::tie(n, row_endpoints, col_indices, values);
+    if (!config.empty())
+    {
+#ifdef FIREFLY_AMGCL_RUNTIME
+        boost::property_tree::ptree prm;
+        std::istringstream in(config);
+        boost::property_tree::read_json(in, prm);
+        bool amg = prm.get("precond.class", std::string("amg")) == "amg";
+        if (amg)
+            prm.put("precond.allow_rebuild", true);
+        impl.reset(new Impl::RuntimeModel(csr, prm, amg));
+#else
+        throw std::runtime_error("AmgclSolver: built without the runtime interface (Boost)");
+#endif
+    }
+    else if (precond == AmgclPrecond_GaussSeidel)
+        impl.reset(new Impl::Model<Solver<MatrixReal, amgcl::relaxation::gauss_seidel>>(csr));
+    else if (precond == AmgclPrecond_ILU0)
+        impl.reset(new Impl::Model<Solver<MatrixReal, amgcl::relaxation::ilu0>>(csr));
+    else if (precond == AmgclPrecond_SPAI0)
+        impl.reset(new Impl::Model<Solver<MatrixReal, amgcl::relaxation::spai0>>(csr));
+    else
+        throw -1;
+    nonzeros = col_indices.size();
+    baseline = -1;
+    degraded = false;
+    setup_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+SolverResult AmgclSolver::solve(const std::vector<double> &rhs, std::vector<double> &x)
+{
+    if (x.size() != impl->rows())
+        x.assign(impl->rows(), 0);
+    auto t0 = std::chrono::steady_clock::now();
+    SolverResult result = impl->solve(rhs, x);
+    solve_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    ++nsolves;
+
+    int iters = std::get<0>(result);
+    if (baseline < 0)
+        baseline = iters;
+    else if (iters > threshold * std::max(baseline, 1))
+        degraded = true;
+    return result;
+}
+
+void AmgclSolver::refresh(const SparseCSR<> &A)
+{
+    // AMGCL needs all nonzeros
+    if (A.isSymmetric()) {
+        SparseCSR<> full(A);
+        full.toFull();
+        return refresh(full);
+    }
+    if (A.rows() != impl->rows() || A.getCols().size() != nonzeros)
+        throw std::invalid_argument("AmgclSolver::refresh: the sparsity pattern has changed");
+    if (!impl->refreshable()) {
+        setup(A.getRPtr(), A.getCols(), A.getVals());
+        ++nrefreshes;
+        return;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    impl->refresh(A.getRPtr(), A.getCols(), A.getVals());
+    degraded = false;
+    ++nrefreshes;
+    setup_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void AmgclSolver::rebuild(const SparseCSR<> &A)
+{
+    // AMGCL needs all nonzeros
+    if (A.isSymmetric()) {
+        SparseCSR<> full(A);
+        full.toFull();
+        return rebuild(full);
+    }
+    impl.reset();       // release the old hierarchy before building the new one
+    setup(A.getRPtr(), A.getCols(), A.getVals());
+    ++nrebuilds;
+}
+
+bool AmgclSolver::update(const SparseCSR<> &A)
+{
+    if (degraded) {
+        rebuild(A);
+        return true;
+    }
+    refresh(A);
+    return false;
+}
+
+std::size_t AmgclSolver::rows() const
+{
+    return impl->rows();
+}
+
+// AMG on the builtin backend with the index types of a SparseCSR, so that its
+// arrays can be the top level matrix of the hierarchy as they are
+template <typename Index, template <class> class Relaxation>
+using ZeroCopySolver = amgcl::make_solver<
     amgcl::amg<
-        Backend,
+        amgcl::backend::builtin<double, Index, Index>,
         amgcl::coarsening::smoothed_aggregation,
-        amgcl::relaxation::spai0>,
-    amgcl::solver::bicgstab<Backend>>
-    Solver_SPAI0;
+        Relaxation>,
+    amgcl::solver::bicgstab<amgcl::backend::builtin<double, Index, Index>>>;
+
+/*
+Solve with AMGCL from a SparseCSR without copying it: zero_copy_direct wraps
+its arrays in the internal matrix type of AMGCL, which the hierarchy and the
+Krylov solver use from then on. The columns of SparseCSR rows are sorted, as
+AMGCL requires. Symmetric storage needs a full copy, and float values of the
+mixed precision build a converted one, both through amgclSolve.
+Returns: tuple of number of iterations used and the error.
+*/
+template <typename Index>
+static SolverResult zeroCopySolve(
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<Index> &A,
+    std::vector<double> &x,
+    const std::vector<double> &b
+)
+{
+    Index n = A.rows();
+    if (A.isSymmetric() || !std::is_same<MatrixReal, double>::value) {
+        SparseCSR<Index> full(A);
+        full.toFull();
+        return amgclSolve<MatrixReal>(preconditioner, n, full.getRPtr(), full.getCols(), full.getVals(), b, x);
+    }
+
+    if (x.size() != static_cast<std::size_t>(n))
+        x.assign(n, 0);
+    auto M = amgcl::adapter::zero_copy_direct(
+        static_cast<std::size_t>(n), A.getRPtr().data(), A.getCols().data(), A.getVals().data());
+
+    if (preconditioner == AmgclPrecond_GaussSeidel)
+    {
+        ZeroCopySolver<Index, amgcl::relaxation::gauss_seidel> solve(M);
+        return solve(b, x);
+    }
+    else if (preconditioner == AmgclPrecond_ILU0)
+    {
+        ZeroCopySolver<Index, amgcl::relaxation::ilu0> solve(M);
+        return solve(b, x);
+    }
+    else if (preconditioner == AmgclPrecond_SPAI0)
+    {
+        ZeroCopySolver<Index, amgcl::relaxation::spai0> solve(M);
+        return solve(b, x);
+    }
+    else
+    {
+        throw -1;
+    }
+}
 
 /*
 Input:
@@ -60,35 +425,84 @@ SolverResult solveAMGCL(
 )
 {
     int n = row_endpoints.size() - 1;
+    return amgclSolve<MatrixReal>(preconditioner, n, row_endpoints, col_indices, values, rhs, x);
+}
+
+SolverResult solveAMGCL(
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<> &A,
+    std::vector<double> &x,
+    const std::vector<double> &b
+)
+{
+    return zeroCopySolve(preconditioner, A, x, b);
+}
 
-    if (x.size() != n)
+SolverResult solveAMGCL(
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<std::int64_t> &A,
+    std::vector<double> &x,
+    const std::vector<double> &b
+)
+{
+    return zeroCopySolve(preconditioner, A, x, b);
+}
+
+SolverResult solveAMGCL(
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<std::int32_t, float> &A,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+)
+{
+    // AMGCL needs all nonzeros
+    if (A.isSymmetric()) {
+        SparseCSR<std::int32_t, float> full(A);
+        full.toFull();
+        return solveAMGCL(preconditioner, full, rhs, x);
+    }
+
+    // float values: mixed precision regardless of the build option
+    int n = A.getRPtr().size() - 1;
+    return amgclSolve<float>(preconditioner, n, A.getRPtr(), A.getCols(), A.getVals(), rhs, x);
+}
+
+SolverResult solveAMGCL(
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<> &A,
+    const SellCSigma &S,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+)
+{
+    // AMGCL needs all nonzeros for the setup
+    if (A.isSymmetric()) {
+        SparseCSR<> full(A);
+        full.toFull();
+        return solveAMGCL(preconditioner, full, S, rhs, x);
+    }
+
+    int n = A.getRPtr().size() - 1;
+    if (x.size() != static_cast<std::size_t>(n))
         x.assign(n, 0);
-    
-    // std::cerr << "x length: " << x.size() << std::endl;
-    // std::cerr << "rhs length: " << rhs.size() << std::endl;
-    // std::cerr << "values length: " << values.size() << std::endl;
-    // std::cerr << "row_endpoints length: " << row_endpoints.size() << std::endl;
-    // std::cerr << "col_indices length: " << col_indices.size() << std::endl;
-    // std::cerr << "row_endpoints first: " << row_endpoints[0] << " row_endpoints last: "
-    //     << row_endpoints[row_endpoints.size() - 1] << std::endl;
-    // std::cerr << "col_indices first: " << col_indices[0] << " col_indices last: "
-    //     << col_indices[col_indices.size() - 1] << std::endl;
+    auto csr = std::tie(n, A.getRPtr(), A.getCols(), A.getVals());
 
-    // Define the solver type
+    // The hierarchy is built from the CSR arrays in the build precision, the
+    // Krylov iterations multiply with S
     if (preconditioner == AmgclPrecond_GaussSeidel)
     {
-        Solver_G_S solve(std::tie(n, row_endpoints, col_indices, values));
-        return solve(rhs, x);
+        Solver_G_S solve(csr);
+        return solve(S, rhs, x);
     }
     else if (preconditioner == AmgclPrecond_ILU0)
     {
-        Solver_ILU0 solve(std::tie(n, row_endpoints, col_indices, values));
-        return solve(rhs, x);
+        Solver_ILU0 solve(csr);
+        return solve(S, rhs, x);
     }
     else if (preconditioner == AmgclPrecond_SPAI0)
     {
-        Solver_SPAI0 solve(std::tie(n, row_endpoints, col_indices, values));
-        return solve(rhs, x);
+        Solver_SPAI0 solve(csr);
+        return solve(S, rhs, x);
     }
     else
     {
@@ -96,36 +510,28 @@ SolverResult solveAMGCL(
     }
 }
 
-SolverResult solveAMGCL(
+std::vector<SolverResult> solveAMGCL(
     const AmgclPrecondType &preconditioner,
-    SparseCSR A,
-    std::vector<double> x,
-    std::vector<double> b
+    const SparseCSR<> &A,
+    const std::vector<std::vector<double>> &rhs,
+    std::vector<std::vector<double>> &x
 )
 {
-    auto rptr = A.getRPtr();
-    auto cols = A.getCols();
-    
-    // shift indices by 1 - this is what AMGCL expects
-    for (auto& n : rptr) --n;
-    for (auto& n : cols) --n;
-
-    int iters; double error;
-    return solveAMGCL(
-        preconditioner,
-        rptr,
-        cols,
-        A.getVals(),
-        b,
-        x
-    );
+    // The setup, the expensive part for few iterations, is shared by all solves
+    AmgclSolver solver(preconditioner, A);
+    x.resize(rhs.size());
+    std::vector<SolverResult> results;
+    for (std::size_t c = 0; c < rhs.size(); ++c)
+        results.push_back(solver.solve(rhs[c], x[c]));
+    return results;
 }
 
 SolverResult solveAMGCL(
     const AmgclPrecondType &preconditioner,
-    std::tuple<SparseCSR, std::vector<double>, std::vector<double>> laplaceResults
+    const std::tuple<SparseCSR<>, std::vector<double>, std::vector<double>> &laplaceResults
 )
 {
-    auto [A, x, b] = laplaceResults;
+    const auto &[A, x0, b] = laplaceResults;
+    std::vector<double> x(x0);
     return solveAMGCL(preconditioner, A, x, b);
-}
\ No newline at end of file
+}
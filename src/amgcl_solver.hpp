@@ -1,7 +1,10 @@
 #ifndef AMGCL_FIREFLY
 #define AMGCL_FIREFLY
 
+#include <memory>
+#include <string>
 #include <SparseCSR.h>
+#include <SellCSigma.h>
 
 typedef std::tuple<int, double> SolverResult;
 
@@ -12,6 +15,108 @@ enum AmgclPrecondType
     AmgclPrecond_SPAI0
 };
 
+/*
+AMGCL solver set up once from a matrix and kept for repeated solves, e.g., with
+a new right-hand side every time step of an unchanged operator. The constructor
+builds the AMG hierarchy, solve() only runs the Krylov iterations. Setup and
+solve wall-clock times [s] are reported separately, each summed over all setups
+(including refreshes and rebuilds) and solves.
+Input of the constructors:
+- preconditioner: AmgclPrecondType enum value specifying preconditioner
+- A: SparseCSR matrix (a full copy is made for the setup if it is symmetric)
+- or row_endpoints, col_indices, values: the matrix in zero-based CRS format
+
+When the values of the matrix change but its sparsity pattern does not (moving
+mesh, variable coefficients), refresh() recomputes only the numeric part of the
+hierarchy: the Galerkin products of every level, the smoothers and the coarse
+solver, reusing the aggregates and transfer operators of the last full setup.
+The reused transfer operators fit the new values less and less, so update()
+applies a policy: it refreshes, unless a solve since the last refresh needed
+more than rebuildThreshold() times the iterations of the first solve after the
+last full setup, in which case it rebuilds the hierarchy from scratch.
+
+If built with FIREFLY_AMGCL_RUNTIME (the Boost headers are found), the solver
+stack can instead be read at run time from a JSON file of AMGCL parameters, e.g.
+  { "solver":  { "type": "cg", "tol": 1e-8, "maxiter": 500 },
+    "precond": { "coarsening": { "type": "smoothed_aggregation" },
+                 "relax": { "type": "chebyshev" } } }
+with solver.type one of cg, bicgstab, bicgstabl, gmres, fgmres, lgmres, idrs,
+richardson, preonly; precond.class amg (default), relaxation or dummy; for amg,
+coarsening.type one of aggregation, smoothed_aggregation, ruge_stuben,
+smoothed_aggr_emin and relax.type one of gauss_seidel, ilu0, iluk, ilut,
+damped_jacobi, spai0, spai1, chebyshev, each with its AMGCL parameters. Omitted
+entries take the AMGCL defaults (BiCGStab, smoothed aggregation, SPAI0).
+See Resources/amgcl_cg.json.
+*/
+class AmgclSolver
+{
+public:
+    AmgclSolver(const AmgclPrecondType &preconditioner, const SparseCSR<> &A);
+    AmgclSolver(
+        const AmgclPrecondType &preconditioner,
+        const std::vector<int> &row_endpoints,
+        const std::vector<int> &col_indices,
+        const std::vector<double> &values
+    );
+#ifdef FIREFLY_AMGCL_RUNTIME
+    AmgclSolver(const std::string &config_file, const SparseCSR<> &A);
+#endif
+    AmgclSolver(AmgclSolver &&) noexcept;
+    AmgclSolver &operator=(AmgclSolver &&) noexcept;
+    ~AmgclSolver();
+
+    /*
+    Input:
+    - rhs: vector representing the right-hand-side
+    - x: initial guess on input, solution on output (resized to zero if its size is wrong)
+    Returns: tuple of number of iterations used and the error.
+    */
+    SolverResult solve(const std::vector<double> &rhs, std::vector<double> &x);
+
+    /*
+    Input:
+    - A: matrix with the sparsity pattern (storage order included) of the one of
+      the last full setup and new values; throws std::invalid_argument if the
+      number of rows or nonzeros differ
+    */
+    void refresh(const SparseCSR<> &A);     // numeric part of the hierarchy only
+    void rebuild(const SparseCSR<> &A);     // full setup, any sparsity pattern
+    bool update(const SparseCSR<> &A);      // refresh or rebuild, true: rebuilt
+
+    // Iteration growth over the first solve after a full setup above which
+    // update() rebuilds, default 1.5
+    double rebuildThreshold() const { return threshold; }
+    void setRebuildThreshold(double growth) { threshold = growth; }
+
+    std::size_t rows() const;
+    double setupTime() const { return setup_time; }
+    double solveTime() const { return solve_time; }
+    int solves() const { return nsolves; }
+    int refreshes() const { return nrefreshes; }
+    int rebuilds() const { return nrebuilds; }
+
+private:
+    void setup(
+        const std::vector<int> &row_endpoints,
+        const std::vector<int> &col_indices,
+        const std::vector<double> &values
+    );
+
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+    AmgclPrecondType precond = AmgclPrecond_SPAI0;
+    std::string config;             // JSON parameters of the runtime solver, if any
+    std::size_t nonzeros = 0;       // of the last full setup
+    double threshold = 1.5;
+    int baseline = -1;              // iterations of the first solve after the last full setup
+    bool degraded = false;          // a solve since the last refresh exceeded the threshold
+    double setup_time = 0.0;
+    double solve_time = 0.0;
+    int nsolves = 0;
+    int nrefreshes = 0;
+    int nrebuilds = 0;
+};
+
 /*
 Input:
 - preconditioner: AmgclPrecondType enum value specifying preconditioner
@@ -35,27 +140,98 @@ SolverResult solveAMGCL(
 /*
 Input:
 - preconditioner: AmgclPrecondType enum value specifying preconditioner
-- A: SparseCSR matrix
-- x: unknown x vector
+- A: SparseCSR matrix, used in place: its arrays are the top level of the AMG
+  hierarchy and the matrix of the Krylov products, nothing is copied (except
+  for a full copy if it is stored symmetric, or converted values if built with
+  FIREFLY_MIXED_PRECISION)
+- x: initial guess on input, solution on output (resized to zero if its size is wrong)
 - b: RHS b vector
 Returns: tuple of number of iterations used and the error.
 */
 SolverResult solveAMGCL(
     const AmgclPrecondType &preconditioner,
-    SparseCSR A,
-    std::vector<double> x,
-    std::vector<double> b
+    const SparseCSR<> &A,
+    std::vector<double> &x,
+    const std::vector<double> &b
+);
+
+/*
+Input:
+- preconditioner: AmgclPrecondType enum value specifying preconditioner
+- A: SparseCSR matrix with 64-bit indices, used in place as above
+- x: initial guess on input, solution on output (resized to zero if its size is wrong)
+- b: RHS b vector
+Returns: tuple of number of iterations used and the error.
+*/
+SolverResult solveAMGCL(
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<std::int64_t> &A,
+    std::vector<double> &x,
+    const std::vector<double> &b
+);
+
+/*
+Input:
+- preconditioner: AmgclPrecondType enum value specifying preconditioner
+- A: SparseCSR matrix with single precision values, e.g., SparseCSR<int,float>(A)
+  of an assembled matrix; the preconditioner and the Krylov products use float
+  matrix values, the Krylov vectors and accumulations stay double
+- rhs: vector representing the right-hand-side
+- x: initial guess on input, solution on output (resized to zero if its size is wrong)
+Returns: tuple of number of iterations used and the error.
+*/
+SolverResult solveAMGCL(
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<std::int32_t, float> &A,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+);
+
+/*
+Input:
+- preconditioner: AmgclPrecondType enum value specifying preconditioner
+- A: SparseCSR matrix, used to set up the AMG preconditioner (stored in single
+  precision if built with FIREFLY_MIXED_PRECISION, as for the other solves)
+- S: the same matrix in SELL-C-sigma format, used for the SpMVs of the Krylov solver
+  (always double)
+- rhs: vector representing the right-hand-side
+- x: initial guess on input, solution on output (resized to zero if its size is wrong)
+Returns: tuple of number of iterations used and the error.
+*/
+SolverResult solveAMGCL(
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<> &A,
+    const SellCSigma &S,
+    const std::vector<double> &rhs,
+    std::vector<double> &x
+);
+
+/*
+Input:
+- preconditioner: AmgclPrecondType enum value specifying preconditioner
+- A: SparseCSR matrix, the AMG hierarchy is set up once for all right-hand sides
+- rhs: vectors representing the right-hand sides
+- x: initial guesses on input, solutions on output (one per rhs; resized to zero if
+  the size of one is wrong)
+Returns: tuple of number of iterations used and the error, per right-hand side.
+*/
+std::vector<SolverResult> solveAMGCL(
+    const AmgclPrecondType &preconditioner,
+    const SparseCSR<> &A,
+    const std::vector<std::vector<double>> &rhs,
+    std::vector<std::vector<double>> &x
 );
 
 /*
 Input:
 - preconditioner: AmgclPrecondType enum value specifying preconditioner
-- laplaceResults: a tuple of A, x and b, taken from the output of laplacian
+- laplaceResults: a tuple of A, x and b, taken from the output of laplacian;
+  A is used in place, x only as initial guess
 Returns: tuple of number of iterations used and the error.
 */
 SolverResult solveAMGCL(
     const AmgclPrecondType &preconditioner,
-    std::tuple<SparseCSR, std::vector<double>, std::vector<double>> laplaceResults
+    const std::tuple<SparseCSR<>, std::vector<double>, std::vector<double>> &laplaceResults
 );
 
 #endif
\ No newline at end of file
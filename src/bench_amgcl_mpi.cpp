@@ -0,0 +1,79 @@
+// *****************************************************************************
+/*!
+  \file      src/bench_amgcl_mpi.cpp
+  \brief     Time the distributed-memory AMGCL solve on the ranks of mpirun
+*/
+// *****************************************************************************
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <mpi.h>
+
+#include "CubeMesh.hpp"
+#include "amgcl_mpi_solver.hpp"
+
+int
+main( int argc, char* argv[] )
+// *****************************************************************************
+// Benchmark main
+//! \details Usage: mpirun -np <ranks> AmgclMPIBench [cube size]. Every rank
+//!   assembles the whole cube Laplacian, keeps its amgclRowBlock rows and
+//!   solves with each relaxation. Rank 0 prints the iterations and the
+//!   slowest rank's wall-clock time of the setup and solve; run with 1, 2,
+//!   4, ... ranks for the strong scaling. The z-major node numbering of the
+//!   cube makes the row blocks slabs, so the halo grows with n^2 per rank.
+// *****************************************************************************
+{
+  MPI_Init( &argc, &argv );
+  int rank, size;
+  MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+  MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+  std::size_t n = argc > 1 ? std::stoul( argv[1] ) : 48;
+  auto A = cubeLaplacian( n );
+  const std::size_t N = A.rows();
+
+  auto [first, last] = amgclRowBlock( MPI_COMM_WORLD, N );
+  const auto& rptr = A.getRPtr();
+  std::vector< int > ptr( 1, 0 ), col;
+  std::vector< double > val;
+  for (std::size_t i=first; i<last; ++i) {
+    for (SparseCSR<>::index_type k=rptr[i]; k<rptr[i+1]; ++k) {
+      col.push_back( static_cast< int >( A.getCols()[k] ) );
+      val.push_back( A.getVals()[k] );
+    }
+    ptr.push_back( static_cast< int >( col.size() ) );
+  }
+  std::vector< double > b( last - first );
+  for (std::size_t i=first; i<last; ++i) b[i-first] = std::sin( 0.01*i );
+
+  if (rank == 0)
+    std::cout << "cube " << n << "^3: " << N << " rows, " << A.getVals().size()
+              << " nonzeros, " << size << " ranks, " << last - first
+              << " rows on rank 0\n"
+              << std::setw(14) << "relaxation" << std::setw(8) << "iters"
+              << std::setw(12) << "error" << std::setw(12) << "time [s]" << '\n';
+
+  const std::pair< AmgclPrecondType, const char* > precond[] = {
+    { AmgclPrecond_GaussSeidel, "Gauss-Seidel" }, { AmgclPrecond_ILU0, "ILU0" },
+    { AmgclPrecond_SPAI0, "SPAI0" } };
+  for (const auto& p : precond) {
+    std::vector< double > x;
+    MPI_Barrier( MPI_COMM_WORLD );
+    double t0 = MPI_Wtime();
+    auto [iters, error] = solveAMGCL( MPI_COMM_WORLD, p.first, ptr, col, val, b, x );
+    double t = MPI_Wtime() - t0, tmax;
+    MPI_Reduce( &t, &tmax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD );
+    if (rank == 0)
+      std::cout << std::setw(14) << p.second << std::setw(8) << iters
+                << std::setw(12) << std::setprecision(3) << error
+                << std::setw(12) << std::setprecision(4) << tmax << '\n';
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,92 @@
+// *****************************************************************************
+/*!
+  \file      src/bench_block_cg.cpp
+  \brief     Compare k separate products and CG solves with the multi-vector
+             product (SpMM) and block CG for k right-hand sides
+*/
+// *****************************************************************************
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CubeMesh.hpp"
+#include "CG/CGMatrix.h"
+#include "CG/BlockCG.h"
+#include "CG/Preconditioner.h"
+
+template< class Run >
+double
+best( Run run )
+// *****************************************************************************
+//  Best wall-clock time [s] of a few runs
+// *****************************************************************************
+{
+  double t = 0.0;
+  for (int r=0; r<3; ++r) {
+    auto t0 = std::chrono::steady_clock::now();
+    run();
+    double s = std::chrono::duration< double >( std::chrono::steady_clock::now() - t0 ).count();
+    if (r == 0 || s < t) t = s;
+  }
+  return t;
+}
+
+int
+main( int argc, char* argv[] )
+// *****************************************************************************
+// Benchmark main
+//! \details Usage: BlockCGBench [cube size] [iterations]. For k = 1, 2, 4, 8,
+//!   16 right-hand sides prints the speedup of one SpMM over k SpMVs and of
+//!   a Jacobi-preconditioned block CG over k CG solves, both running the
+//!   same fixed number of iterations (no tolerance). The SpMM reads the
+//!   matrix once for all k vectors: on a bandwidth-bound product its speedup
+//!   approaches k while the matrix, not the vectors, dominates the traffic
+//!   (12 bytes per nonzero versus 8 bytes per vector entry and row).
+// *****************************************************************************
+{
+  std::size_t n = argc > 1 ? std::stoul( argv[1] ) : 48;
+  int iters = argc > 2 ? std::stoi( argv[2] ) : 50;
+
+  auto A = cubeLaplacian( n );
+  JacobiPreconditioner<> M( A );
+  const std::size_t N = A.rows();
+  std::cout << "cube " << n << "^3: " << N << " rows, " << A.getVals().size()
+            << " nonzeros, " << iters << " CG iterations\n"
+            << std::setw(6) << "k" << std::setw(14) << "SpMV [ms]" << std::setw(14) << "SpMM [ms]"
+            << std::setw(10) << "speedup" << std::setw(14) << "CG [ms]"
+            << std::setw(14) << "block [ms]" << std::setw(10) << "speedup" << '\n';
+
+  CGOptions opt;
+  opt.rtol = 0.0;
+  opt.atol = 0.0;
+  opt.maxit = iters;
+  opt.warm_start = false;
+
+  for (std::size_t k=1; k<=16; k*=2) {
+    std::vector< std::vector< double > > b( k, std::vector< double >( N ) ), x, y( k );
+    std::vector< double > B( N*k ), Y;
+    for (std::size_t c=0; c<k; ++c)
+      for (std::size_t i=0; i<N; ++i) B[i*k+c] = b[c][i] = std::sin( 0.01*(c+1)*i );
+
+    double tmv = best( [&]{ for (std::size_t c=0; c<k; ++c) A.mult( b[c], y[c] ); } );
+    double tmm = best( [&]{ A.multBlock( k, B, Y ); } );
+    double tcg = best( [&]{
+      for (std::size_t c=0; c<k; ++c) conjugateGradient( A, M, b[c], y[c], opt ); } );
+    double tbl = best( [&]{ conjugateGradient( A, M, b, x, opt ); } );
+
+    std::cout << std::setw(6) << k
+              << std::setw(14) << std::setprecision(4) << tmv*1.0e3
+              << std::setw(14) << std::setprecision(4) << tmm*1.0e3
+              << std::setw(10) << std::setprecision(3) << tmv/tmm
+              << std::setw(14) << std::setprecision(4) << tcg*1.0e3
+              << std::setw(14) << std::setprecision(4) << tbl*1.0e3
+              << std::setw(10) << std::setprecision(3) << tcg/tbl << '\n';
+  }
+
+  return 0;
+}
@@ -0,0 +1,178 @@
+// *****************************************************************************
+/*!
+  \file      src/bench_mixed_precision.cpp
+  \brief     Compare double and mixed (float values, double vectors) precision
+             SpMV and AMGCL solves of the Laplacian on an ASC mesh
+*/
+// *****************************************************************************
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <amgcl_solver.hpp>
+#include "Laplacian.hpp"
+#include "asc/asc.h"
+
+template< class Matrix >
+double
+timeSpMV( const Matrix& A, const std::vector< double >& x )
+// *****************************************************************************
+//  Time the in-place product r = A * x
+//! \param[in] A Matrix
+//! \param[in] x Vector to multiply with
+//! \return Best wall-clock time of a product in seconds
+// *****************************************************************************
+{
+  std::vector< double > r( x.size() );
+  A.mult( x, r );
+  double best = 0.0;
+  for (int k=0; k<20; ++k) {
+    auto t0 = std::chrono::steady_clock::now();
+    A.mult( x, r );
+    auto t1 = std::chrono::steady_clock::now();
+    double t = std::chrono::duration< double >( t1 - t0 ).count();
+    if (k == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+double
+maxError( const std::vector< double >& x, const std::vector< double >& exact )
+// *****************************************************************************
+//  Maximum norm of the difference of two vectors
+// *****************************************************************************
+{
+  double e = 0.0;
+  for (std::size_t i=0; i<x.size(); ++i) e = std::max( e, std::abs( x[i] - exact[i] ) );
+  return e;
+}
+
+std::vector< std::size_t >
+readNodeset( const std::string& mesh, const std::string& name )
+// *****************************************************************************
+//  Read a node set of an ASC mesh (not supported by ASCReader)
+//! \param[in] mesh File name of the ASC mesh
+//! \param[in] name Node set name, e.g., "*nodeset_0"
+//! \return Zero-based node ids of the node set, empty if not found
+//! \details The header line is "name <id> <count>", followed by count ids.
+// *****************************************************************************
+{
+  std::ifstream in( mesh );
+  std::string word;
+  std::vector< std::size_t > nodes;
+  while (in >> word) {
+    if (word != name) continue;
+    std::size_t id, count;
+    in >> id >> count;
+    nodes.resize( count );
+    for (auto& p : nodes) { in >> p; --p; }
+    break;
+  }
+  return nodes;
+}
+
+int
+main( int argc, char* argv[] )
+// *****************************************************************************
+// Benchmark main
+//! \details Usage: MixedPrecisionBench [asc mesh]. Solves the Laplace equation
+//!   with Dirichlet BCs u = x + 2y - z on the nodes of nodeset_0 (the boundary
+//!   of the sedov meshes). Linear elements reproduce this solution exactly, so
+//!   the error of the discrete solution only measures the solver and the
+//!   matrix precision.
+// *****************************************************************************
+{
+  std::string mesh = argc > 1 ? argv[1] : "Resources/sedov_coarse.asc_mesh";
+
+  ASCReader reader( mesh );
+  if (!reader.readFile() || reader.getConnectionsCount() == 0) {
+    std::cerr << "Cannot read mesh " << mesh << std::endl;
+    return 1;
+  }
+
+  std::array< std::vector< double >, 3 > coord;
+  for (const auto& p : reader.getCoordinates()) {
+    coord[0].push_back( p.x );
+    coord[1].push_back( p.y );
+    coord[2].push_back( p.z );
+  }
+
+  // tetrahedra, renumbered to positive orientation
+  std::vector< std::size_t > inpoel;
+  for (const auto& c : reader.getConnections()) {
+    std::array< std::size_t, 4 > N{{ std::size_t(c.z - 1), std::size_t(c.a - 1),
+                                      std::size_t(c.b - 1), std::size_t(c.c - 1) }};
+    std::array< std::array< double, 3 >, 3 > d;
+    for (std::size_t a=0; a<3; ++a)
+      for (std::size_t k=0; k<3; ++k) d[a][k] = coord[k][N[a+1]] - coord[k][N[0]];
+    double J = d[0][0]*(d[1][1]*d[2][2] - d[1][2]*d[2][1])
+             - d[0][1]*(d[1][0]*d[2][2] - d[1][2]*d[2][0])
+             + d[0][2]*(d[1][0]*d[2][1] - d[1][1]*d[2][0]);
+    if (J < 0) std::swap( N[2], N[3] );
+    inpoel.insert( inpoel.end(), N.begin(), N.end() );
+  }
+
+  // laplacian() assembles the negative (semi-)definite operator: negate it
+  // so that the system with identity rows at the Dirichlet nodes is SPD
+  auto [A, x, b] = laplacian( inpoel, coord );
+  const auto n = x.size();
+  for (std::size_t k=0; k<A.getVals().size(); ++k) A.data()[k] = -A.data()[k];
+
+  // Dirichlet BCs on the boundary node set
+  auto nodes = readNodeset( mesh, "*nodeset_0" );
+  std::vector< double > exact( n ), g;
+  for (std::size_t i=0; i<n; ++i)
+    exact[i] = coord[0][i] + 2.0*coord[1][i] - coord[2][i];
+  for (auto p : nodes) g.push_back( exact[p] );
+  A.dirichlet( nodes, g, b, true );
+
+  SparseCSR< std::int32_t, float > Af( A );
+
+  std::cout << "mesh: " << mesh << ", " << n << " nodes, "
+            << A.getVals().size() << " nonzeros, " << nodes.size()
+            << " Dirichlet nodes\n\n";
+
+  // SpMV time and accuracy
+  std::vector< double > r, rf;
+  A.mult( exact, r );
+  Af.mult( exact, rf );
+  double td = timeSpMV( A, exact ), tf = timeSpMV( Af, exact );
+  std::cout << std::setw(10) << "SpMV" << std::setw(14) << "time [ms]"
+            << std::setw(14) << "speedup" << std::setw(14) << "max diff\n"
+            << std::setw(10) << "double" << std::setw(14) << std::setprecision(4) << td*1.0e3
+            << std::setw(14) << 1.0 << std::setw(14) << 0.0 << '\n'
+            << std::setw(10) << "mixed" << std::setw(14) << std::setprecision(4) << tf*1.0e3
+            << std::setw(14) << td/tf << std::setw(14) << maxError( rf, r ) << "\n\n";
+
+  // AMGCL solves
+  std::cout << std::setw(10) << "solve" << std::setw(14) << "time [ms]"
+            << std::setw(8) << "iters" << std::setw(14) << "residual"
+            << std::setw(14) << "max error" << '\n';
+  const std::pair< AmgclPrecondType, const char* > precs[] = {
+    { AmgclPrecond_GaussSeidel, "GS" }, { AmgclPrecond_ILU0, "ILU0" },
+    { AmgclPrecond_SPAI0, "SPAI0" } };
+  for (const auto& p : precs) {
+    for (int mixed=0; mixed<2; ++mixed) {
+      std::vector< double > sol;
+      auto t0 = std::chrono::steady_clock::now();
+      auto [iters, error] = mixed
+        ? solveAMGCL( p.first, Af, b, sol )
+        : solveAMGCL( p.first, A.getRPtr(), A.getCols(), A.getVals(), b, sol );
+      auto t1 = std::chrono::steady_clock::now();
+      std::cout << std::setw(10) << std::string(p.second) + (mixed ? " mixed" : "")
+                << std::setw(14) << std::setprecision(4)
+                << std::chrono::duration< double >( t1 - t0 ).count()*1.0e3
+                << std::setw(8) << iters << std::setw(14) << error
+                << std::setw(14) << maxError( sol, exact ) << '\n';
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+// *****************************************************************************
+/*!
+  \file      src/bench_pipelined_cg.cpp
+  \brief     Compare the time per iteration of classical and pipelined
+             Jacobi-preconditioned CG over problem sizes and thread counts
+*/
+// *****************************************************************************
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "CubeMesh.hpp"
+#include "CG/CGMatrix.h"
+#include "CG/PipelinedCG.h"
+#include "CG/Preconditioner.h"
+
+template< class Solve >
+double
+timePerIteration( Solve solve )
+// *****************************************************************************
+//  Best wall-clock time per iteration [s] of a few runs of a solver
+//! \param[in] solve Callable running the solver, returning its iterations
+// *****************************************************************************
+{
+  double best = 0.0;
+  for (int k=0; k<3; ++k) {
+    auto t0 = std::chrono::steady_clock::now();
+    int done = solve();
+    auto t1 = std::chrono::steady_clock::now();
+    double t = std::chrono::duration< double >( t1 - t0 ).count() / std::max( done, 1 );
+    if (k == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+int
+main( int argc, char* argv[] )
+// *****************************************************************************
+// Benchmark main
+//! \details Usage: PipelinedCGBench [largest cube size] [iterations]. Both
+//!   solvers run a fixed number of iterations (no tolerance), so the times
+//!   compare the cost of an iteration only. Pipelined CG replaces the two
+//!   reductions of an iteration by one fused with the vector updates, at the
+//!   price of more vector traffic: it wins when the synchronization, not the
+//!   memory bandwidth, dominates, i.e., on small problems per thread and with
+//!   many threads (or processes).
+// *****************************************************************************
+{
+  std::size_t nmax = argc > 1 ? std::stoul( argv[1] ) : 64;
+  int iters = argc > 2 ? std::stoi( argv[2] ) : 100;
+
+#ifdef _OPENMP
+  const int maxthreads = omp_get_max_threads();
+#else
+  const int maxthreads = 1;
+#endif
+
+  CGOptions opt;
+  opt.rtol = 0.0;
+  opt.atol = 0.0;
+  opt.maxit = iters;
+  opt.warm_start = false;
+
+  std::cout << std::setw(10) << "cube" << std::setw(10) << "rows"
+            << std::setw(9) << "threads" << std::setw(14) << "CG [us/it]"
+            << std::setw(14) << "pipe [us/it]" << std::setw(10) << "speedup" << '\n';
+  for (std::size_t n=8; n<=nmax; n*=2) {
+    auto A = cubeLaplacian( n );
+    JacobiPreconditioner<> M( A );
+    std::vector< double > b( A.rows(), 1.0 ), x;
+    for (int threads=1; threads<=maxthreads; threads*=2) {
+#ifdef _OPENMP
+      omp_set_num_threads( threads );
+#endif
+      double tc = timePerIteration(
+        [&]{ return conjugateGradient( A, M, b, x, opt ).iterations; } );
+      double tp = timePerIteration(
+        [&]{ return pipelinedConjugateGradient( A, M, b, x, opt ).iterations; } );
+      std::cout << std::setw(10) << std::to_string(n) + "^3" << std::setw(10) << A.rows()
+                << std::setw(9) << threads
+                << std::setw(14) << std::setprecision(4) << tc*1.0e6
+                << std::setw(14) << std::setprecision(4) << tp*1.0e6
+                << std::setw(10) << std::setprecision(3) << tc/tp << '\n';
+    }
+  }
+
+  return 0;
+}
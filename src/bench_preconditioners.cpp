@@ -0,0 +1,239 @@
+// *****************************************************************************
+/*!
+  \file      src/bench_preconditioners.cpp
+  \brief     Compare the native CG preconditioners (Jacobi, multicolor SSOR,
+             IC(0)) with unpreconditioned CG and AMGCL on Laplace problems
+             of increasing size
+*/
+// *****************************************************************************
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <amgcl_solver.hpp>
+#include "CubeMesh.hpp"
+#include "CG/CGMatrix.h"
+#include "CG/Preconditioner.h"
+#include "asc/asc.h"
+
+//! Laplace problem -A u = 0 with Dirichlet BCs of a linear field u
+struct Problem {
+  std::string name;
+  SparseCSR<> A;                        //!< SPD: negated, BCs eliminated
+  std::vector< double > b;              //!< Right hand side
+  std::vector< double > exact;          //!< Linear field, the exact solution
+};
+
+Problem
+setup( const std::string& name,
+       const std::vector< std::size_t >& inpoel,
+       const std::array< std::vector< double >, 3 >& coord,
+       const std::vector< std::size_t >& boundary )
+// *****************************************************************************
+//  Assemble the Laplacian and apply Dirichlet BCs u = x + 2y - z
+//! \param[in] name Name of the problem in the table
+//! \param[in] inpoel Positively oriented tetrahedra, zero-based
+//! \param[in] coord Node coordinates
+//! \param[in] boundary Dirichlet nodes
+//! \return SPD system whose solution is exactly the linear field
+// *****************************************************************************
+{
+  auto [A, x, b] = laplacian( inpoel, coord );
+  for (std::size_t k=0; k<A.getVals().size(); ++k) A.data()[k] = -A.data()[k];
+  std::vector< double > exact( x.size() ), g;
+  for (std::size_t i=0; i<x.size(); ++i)
+    exact[i] = coord[0][i] + 2.0*coord[1][i] - coord[2][i];
+  for (auto p : boundary) g.push_back( exact[p] );
+  A.dirichlet( boundary, g, b, true );
+  return Problem{ name, std::move(A), std::move(b), std::move(exact) };
+}
+
+Problem
+cube( std::size_t n )
+// *****************************************************************************
+//  Laplace problem on the unit cube split into n^3 hexahedra of 6 tetrahedra
+// *****************************************************************************
+{
+  return setup( "cube " + std::to_string(n) + "^3", cubeMesh(n), cubeCoord(n),
+                cubeBoundary(n) );
+}
+
+bool
+sedov( const std::string& mesh, std::vector< Problem >& problems )
+// *****************************************************************************
+//  Laplace problem on an ASC mesh, Dirichlet BCs on its node set 0
+//! \param[in] mesh File name of the ASC mesh
+//! \param[in,out] problems Problems, the assembled problem is appended
+//! \return False if the mesh cannot be read
+// *****************************************************************************
+{
+  ASCReader reader( mesh );
+  if (!reader.readFile() || reader.getConnectionsCount() == 0) return false;
+
+  std::array< std::vector< double >, 3 > coord;
+  for (const auto& p : reader.getCoordinates()) {
+    coord[0].push_back( p.x );
+    coord[1].push_back( p.y );
+    coord[2].push_back( p.z );
+  }
+
+  // tetrahedra, renumbered to positive orientation
+  std::vector< std::size_t > inpoel;
+  for (const auto& c : reader.getConnections()) {
+    std::array< std::size_t, 4 > N{{ std::size_t(c.z - 1), std::size_t(c.a - 1),
+                                      std::size_t(c.b - 1), std::size_t(c.c - 1) }};
+    std::array< std::array< double, 3 >, 3 > d;
+    for (std::size_t a=0; a<3; ++a)
+      for (std::size_t k=0; k<3; ++k) d[a][k] = coord[k][N[a+1]] - coord[k][N[0]];
+    double J = d[0][0]*(d[1][1]*d[2][2] - d[1][2]*d[2][1])
+             - d[0][1]*(d[1][0]*d[2][2] - d[1][2]*d[2][0])
+             + d[0][2]*(d[1][0]*d[2][1] - d[1][1]*d[2][0]);
+    if (J < 0) std::swap( N[2], N[3] );
+    inpoel.insert( inpoel.end(), N.begin(), N.end() );
+  }
+
+  // node set 0: the header line is "*nodeset_0 <id> <count>", then count ids
+  std::ifstream in( mesh );
+  std::string word;
+  std::vector< std::size_t > boundary;
+  while (in >> word) {
+    if (word != "*nodeset_0") continue;
+    std::size_t id, count;
+    in >> id >> count;
+    boundary.resize( count );
+    for (auto& p : boundary) { in >> p; --p; }
+    break;
+  }
+
+  problems.push_back( setup( "sedov", inpoel, coord, boundary ) );
+  return true;
+}
+
+double
+maxError( const std::vector< double >& x, const std::vector< double >& exact )
+// *****************************************************************************
+//  Maximum norm of the difference of two vectors
+// *****************************************************************************
+{
+  double e = 0.0;
+  for (std::size_t i=0; i<x.size(); ++i) e = std::max( e, std::abs( x[i] - exact[i] ) );
+  return e;
+}
+
+void
+row( const std::string& method, double tsetup, double tsolve, int iters,
+     double residual, double error )
+// *****************************************************************************
+//  Print one row of the comparison table, times in ms
+// *****************************************************************************
+{
+  std::cout << std::setw(12) << method
+            << std::setw(12) << std::setprecision(4) << tsetup*1.0e3
+            << std::setw(12) << std::setprecision(4) << tsolve*1.0e3
+            << std::setw(12) << std::setprecision(4) << (tsetup + tsolve)*1.0e3
+            << std::setw(8) << iters
+            << std::setw(12) << std::setprecision(3) << residual
+            << std::setw(12) << std::setprecision(3) << error << '\n';
+}
+
+template< class Make >
+void
+native( const std::string& method, const Problem& p, const CGOptions& opt,
+        Make make )
+// *****************************************************************************
+//  Time setup and solve of CG with a native preconditioner
+// *****************************************************************************
+{
+  using clock = std::chrono::steady_clock;
+  auto t0 = clock::now();
+  auto M = make();
+  auto t1 = clock::now();
+  std::vector< double > x;
+  auto st = conjugateGradient( p.A, M, p.b, x, opt );
+  auto t2 = clock::now();
+  row( method, std::chrono::duration< double >( t1 - t0 ).count(),
+       std::chrono::duration< double >( t2 - t1 ).count(), st.iterations,
+       st.relative_residual, maxError( x, p.exact ) );
+}
+
+int
+main( int argc, char* argv[] )
+// *****************************************************************************
+// Benchmark main
+//! \details Usage: PreconditionerBench [largest cube size] [asc mesh]
+//!   [AMGCL config]. Solves the Laplace problems on cubes of 8^3, 16^3, ...
+//!   hexahedra and on the mesh to a relative residual of 1e-8 with each
+//!   method. Linear elements
+//!   reproduce the linear solution exactly, so the max error measures the
+//!   solver only. AMGCL runs smoothed aggregation AMG with BiCGStab, and,
+//!   if built with the runtime interface, the solver stack of the JSON config
+//!   file (AMG config, by default CG with smoothed aggregation).
+// *****************************************************************************
+{
+  std::size_t nmax = argc > 1 ? std::stoul( argv[1] ) : 32;
+  std::string mesh = argc > 2 ? argv[2] : "Resources/sedov_coarse.asc_mesh";
+  std::string config = argc > 3 ? argv[3] : "Resources/amgcl_cg.json";
+
+  std::vector< Problem > problems;
+  for (std::size_t n=8; n<=nmax; n*=2) problems.push_back( cube( n ) );
+  if (!sedov( mesh, problems ))
+    std::cerr << "Cannot read mesh " << mesh << ", skipping it\n";
+
+  CGOptions opt;
+  opt.rtol = 1e-8;
+  opt.warm_start = false;
+  opt.maxit = 20000;
+
+  using clock = std::chrono::steady_clock;
+  for (const auto& p : problems) {
+    std::cout << '\n' << p.name << ": " << p.A.rows() << " rows, "
+              << p.A.getVals().size() << " nonzeros\n"
+              << std::setw(12) << "method" << std::setw(12) << "setup"
+              << std::setw(12) << "solve" << std::setw(12) << "total"
+              << std::setw(8) << "iters" << std::setw(12) << "rel. res."
+              << std::setw(12) << "max error" << '\n';
+
+    {
+      auto t0 = clock::now();
+      std::vector< double > x;
+      auto st = conjugateGradient( p.A, p.b, x, opt );
+      auto t1 = clock::now();
+      row( "CG", 0.0, std::chrono::duration< double >( t1 - t0 ).count(),
+           st.iterations, st.relative_residual, maxError( x, p.exact ) );
+    }
+    native( "Jacobi", p, opt,
+      [&]{ return JacobiPreconditioner<>( p.A ); } );
+    native( "SSOR", p, opt,
+      [&]{ return SSORPreconditioner<>( p.A ); } );
+    native( "IC(0)", p, opt,
+      [&]{ return IC0Preconditioner<>( p.A ); } );
+
+    const std::pair< AmgclPrecondType, const char* > amg[] = {
+      { AmgclPrecond_GaussSeidel, "AMG GS" }, { AmgclPrecond_SPAI0, "AMG SPAI0" } };
+    for (const auto& a : amg) {
+      std::vector< double > x;
+      AmgclSolver solver( a.first, p.A );
+      auto [iters, error] = solver.solve( p.b, x );
+      row( a.second, solver.setupTime(), solver.solveTime(), iters, error,
+           maxError( x, p.exact ) );
+    }
+#ifdef FIREFLY_AMGCL_RUNTIME
+    {
+      std::vector< double > x;
+      AmgclSolver solver( config, p.A );
+      auto [iters, error] = solver.solve( p.b, x );
+      row( "AMG config", solver.setupTime(), solver.solveTime(), iters, error,
+           maxError( x, p.exact ) );
+    }
+#endif
+  }
+
+  return 0;
+}
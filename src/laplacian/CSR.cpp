@@ -6,6 +6,7 @@
 // *****************************************************************************
 
 #include <cassert>
+#include <stdexcept>
 
 #include "CSR.hpp"
 
@@ -16,7 +17,7 @@ try :
   ia( rnz.size()+1 )
 // *****************************************************************************
 //  Constructor: Create a CSR symmetric matrix with 1 scalar component per
-//  non-zero matrix entry, storing only the upper triangular part
+//  non-zero matrix entry, storing all nonzeros of each row
 //! \param[in] psup Points surrounding points of mesh graph, see tk::genPsup
 // *****************************************************************************
 {
@@ -29,7 +30,7 @@ try :
   // nonzeros (nnz), and fill in row indices (ia)
   std::size_t nnz, i;
   for (ia[0]=1, nnz=i=0; i<psup2.size()-1; ++i) {
-    // add up and store nonzeros of row i (only upper triangular part)
+    // add up and store nonzeros of row i (diagonal + all neighbours)
     std::size_t j;
     for (rnz[i]=1, j=psup2[i]+1; j<=psup2[i+1]; ++j)
       ++rnz[i];
@@ -94,13 +95,19 @@ CSR::dirichlet( std::size_t i, double val, std::vector< double >& b )
 //! \param[in] i Local id at which to set Dirichlet BC
 //! \param[in] val Value of Dirichlet BC
 //! \param[in,out] b RHS to modify as a result of setting the Dirichlet BC
+//! \details Symmetric elimination, b_r -= A(r,i) * val, identity row and
+//!   b_i = val: same as dirichlet( {i}, {val}, b, true ).
 // *****************************************************************************
 {
+  if (i >= rnz.size())
+    throw std::out_of_range( "CSR::dirichlet: node id out of range" );
+
   // apply Dirichlet BC on rhs, zero column
   for (std::size_t r=0; r<rnz.size(); ++r) {
+    if (r == i) continue;
     for (std::size_t j=ia[r]-1; j<ia[r+1]-1; ++j) {
       if (i+1 == ja[j]) {
-        b[r] += a[j] * val;
+        b[r] -= a[j] * val;
         a[j] = 0.0;
         break;
       }
@@ -111,6 +118,58 @@ CSR::dirichlet( std::size_t i, double val, std::vector< double >& b )
   for (std::size_t j=ia[i]-1; j<ia[i+1]-1; ++j) {
     if (i+1 == ja[j]) a[j] = 1.0; else a[j] = 0.0;
   }
+  b[i] = val;
+}
+
+void
+CSR::dirichlet( const std::vector< std::size_t >& nodes,
+                const std::vector< double >& vals,
+                std::vector< double >& b,
+                bool eliminate )
+// *****************************************************************************
+//  Set Dirichlet boundary conditions at a list of nodes in one pass
+//! \param[in] nodes Local ids at which to set Dirichlet BCs
+//! \param[in] vals Values of Dirichlet BCs, one per node
+//! \param[in,out] b RHS to modify as a result of setting the Dirichlet BCs
+//! \param[in] eliminate If true, also move the constrained columns to the rhs
+//!   and zero them, keeping a symmetric positive definite matrix SPD
+//! \details The constrained nodes are marked in a mask, then every row is
+//!   visited once: constrained rows become identity rows with b set to the BC
+//!   value, free rows only have their constrained columns eliminated.
+// *****************************************************************************
+{
+  assert( nodes.size() == vals.size() );
+
+  std::vector< char > mask( rnz.size(), 0 );
+  std::vector< double > g( rnz.size(), 0.0 );
+  for (std::size_t k=0; k<nodes.size(); ++k) {
+    if (nodes[k] >= rnz.size())
+      throw std::out_of_range( "CSR::dirichlet: node id out of range" );
+    mask[ nodes[k] ] = 1;
+    g[ nodes[k] ] = vals[k];
+  }
+
+  const auto nrow = static_cast< std::ptrdiff_t >( rnz.size() );
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (std::ptrdiff_t ir=0; ir<nrow; ++ir) {
+    auto r = static_cast< std::size_t >( ir );
+    if (mask[r]) {
+      // zero row and put in diagonal
+      for (std::size_t j=ia[r]-1; j<ia[r+1]-1; ++j)
+        a[j] = (r+1 == ja[j]) ? 1.0 : 0.0;
+      b[r] = g[r];
+    } else if (eliminate) {
+      // apply Dirichlet BCs on rhs, zero columns
+      for (std::size_t j=ia[r]-1; j<ia[r+1]-1; ++j) {
+        if (mask[ ja[j]-1 ]) {
+          b[r] -= a[j] * g[ ja[j]-1 ];
+          a[j] = 0.0;
+        }
+      }
+    }
+  }
 }
 
 void
@@ -9,12 +9,14 @@
 #include <iostream>
 #include <vector>
 
+#include "../matrix/LinearOperator.h"
+
 //! Compressed sparse row (CSR) storage for a sparse matrix
-class CSR {
+class CSR : public LinearOperator< CSR > {
 
   public:
     //! \brief Constructor: Create a CSR symmetric matrix with one scalar
-    //!   component, storing only the upper triangular part
+    //!   component, storing all nonzeros of each row
     explicit CSR( const std::pair< std::vector< std::size_t >,
                                    std::vector< std::size_t > >& psup );
 
@@ -36,14 +38,28 @@ class CSR {
                     double val,
                     std::vector< double >& b );
 
+    //! Set Dirichlet boundary conditions at a list of nodes in one pass
+    void dirichlet( const std::vector< std::size_t >& nodes,
+                    const std::vector< double >& vals,
+                    std::vector< double >& b,
+                    bool eliminate = false );
+
     //! Multiply CSR matrix with vector from the right: r = A * x
     void mult( const std::vector< double >& x, std::vector< double >& r ) const;
 
+    //! Linear operator interface: y = A * x, y resized to the number of rows
+    void apply( const std::vector< double >& x, std::vector< double >& y ) const
+    { y.resize( rows() ); mult( x, y ); }
+
     //! Zero matrix values
     void zero();
 
     //! Access real size of matrix
     std::size_t rsize() const { return rnz.size(); }
+    //! Number of rows
+    std::size_t rows() const { return rnz.size(); }
+    //! Number of columns (square)
+    std::size_t cols() const { return rnz.size(); }
 
     //! Write out CSR as stored
     std::ostream& write_stored( std::ostream &os ) const;
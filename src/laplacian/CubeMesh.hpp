@@ -0,0 +1,98 @@
+// *****************************************************************************
+/*!
+  \file      src/laplacian/CubeMesh.hpp
+  \brief     Structured tetrahedron mesh of the unit cube and its Laplacian,
+             shared by the benchmarks and tests
+*/
+// *****************************************************************************
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "Laplacian.hpp"
+
+inline std::vector< std::size_t >
+cubeMesh( std::size_t n )
+// *****************************************************************************
+//  Generate the connectivity of a structured tetrahedron mesh
+//! \param[in] n Number of hexahedra in each direction
+//! \return Tetrahedron connectivity, node ids starting from zero
+//! \details Each of the n^3 hexahedra is split into 6 tetrahedra sharing the
+//!   main diagonal of the hexahedron, all positively oriented for cubeCoord().
+//!   Node (i,j,k) of the (n+1)^3 grid has the id i + (n+1)*(j + (n+1)*k).
+// *****************************************************************************
+{
+  auto id = [n]( std::size_t i, std::size_t j, std::size_t k )
+  { return i + (n+1)*(j + (n+1)*k); };
+
+  // local tetrahedra of a hexahedron, vertices given as bits: x=1, y=2, z=4
+  const std::size_t tets[6][4] = { {0,1,3,7}, {0,5,1,7}, {0,3,2,7},
+                                   {0,2,6,7}, {0,4,5,7}, {0,6,4,7} };
+
+  std::vector< std::size_t > inpoel;
+  inpoel.reserve( n*n*n*6*4 );
+  for (std::size_t k=0; k<n; ++k)
+    for (std::size_t j=0; j<n; ++j)
+      for (std::size_t i=0; i<n; ++i)
+        for (const auto& t : tets)
+          for (auto v : t)
+            inpoel.push_back( id( i+(v&1), j+((v>>1)&1), k+((v>>2)&1) ) );
+
+  return inpoel;
+}
+
+inline std::array< std::vector< double >, 3 >
+cubeCoord( std::size_t n )
+// *****************************************************************************
+//  Generate the node coordinates of the unit cube mesh of cubeMesh()
+//! \param[in] n Number of hexahedra in each direction
+//! \return Node coordinates
+// *****************************************************************************
+{
+  std::array< std::vector< double >, 3 > coord;
+  for (std::size_t k=0; k<=n; ++k)
+    for (std::size_t j=0; j<=n; ++j)
+      for (std::size_t i=0; i<=n; ++i) {
+        coord[0].push_back( static_cast< double >(i)/n );
+        coord[1].push_back( static_cast< double >(j)/n );
+        coord[2].push_back( static_cast< double >(k)/n );
+      }
+  return coord;
+}
+
+inline std::vector< std::size_t >
+cubeBoundary( std::size_t n )
+// *****************************************************************************
+//  Nodes on the boundary of the unit cube mesh of cubeMesh()
+//! \param[in] n Number of hexahedra in each direction
+//! \return Boundary node ids in increasing order
+// *****************************************************************************
+{
+  std::vector< std::size_t > boundary;
+  for (std::size_t k=0; k<=n; ++k)
+    for (std::size_t j=0; j<=n; ++j)
+      for (std::size_t i=0; i<=n; ++i)
+        if (i == 0 || j == 0 || k == 0 || i == n || j == n || k == n)
+          boundary.push_back( i + (n+1)*(j + (n+1)*k) );
+  return boundary;
+}
+
+inline SparseCSR<>
+cubeLaplacian( std::size_t n )
+// *****************************************************************************
+//  SPD Laplacian on the unit cube split into n^3 hexahedra of 6 tetrahedra
+//! \param[in] n Number of hexahedra in each direction
+//! \details The assembled operator is negated and its boundary rows are
+//!   replaced by identity rows, as for Dirichlet BCs.
+// *****************************************************************************
+{
+  auto boundary = cubeBoundary( n );
+  auto [A, x, b] = laplacian( cubeMesh( n ), cubeCoord( n ) );
+  for (std::size_t k=0; k<A.getVals().size(); ++k) A.data()[k] = -A.data()[k];
+  std::vector< double > g( boundary.size(), 0.0 );
+  A.dirichlet( boundary, g, b, true );
+  return std::move( A );
+}
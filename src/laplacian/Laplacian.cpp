@@ -8,7 +8,11 @@
 #include <tuple>
 #include <cassert>
 #include <algorithm>
+#include <stdexcept>
 #include "Laplacian.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 std::pair< std::vector< std::size_t >, std::vector< std::size_t > >
@@ -257,52 +261,326 @@ triple( const std::array< double, 3 >& v1,
   return dot( v1, cross(v2,v3) );
 }
 
-std::tuple< SparseCSR, std::vector< double >, std::vector< double > >
+//! Compute the gradients of the linear shape functions of a tetrahedron
+//! \param[in] N Node ids of the tetrahedron
+//! \param[in] coord Mesh node coordinates
+//! \param[out] grad Shape function gradients of the 4 nodes
+//! \return Element Jacobian, J = 6V
+inline double
+gradients( const std::size_t* N,
+           const std::array< std::vector< double >, 3 >& coord,
+           std::array< std::array< double, 3 >, 4 >& grad )
+{
+  const auto& X = coord[0];
+  const auto& Y = coord[1];
+  const auto& Z = coord[2];
+
+  const std::array< double, 3 >
+    ba{{ X[N[1]]-X[N[0]], Y[N[1]]-Y[N[0]], Z[N[1]]-Z[N[0]] }},
+    ca{{ X[N[2]]-X[N[0]], Y[N[2]]-Y[N[0]], Z[N[2]]-Z[N[0]] }},
+    da{{ X[N[3]]-X[N[0]], Y[N[3]]-Y[N[0]], Z[N[3]]-Z[N[0]] }};
+  const auto J = triple( ba, ca, da );        // J = 6V
+  assert( J > 0 ); // Element Jacobian non-positive
+  grad[1] = crossdiv( ca, da, J );
+  grad[2] = crossdiv( da, ba, J );
+  grad[3] = crossdiv( ba, ca, J );
+  for (std::size_t i=0; i<3; ++i)
+    grad[0][i] = -grad[1][i]-grad[2][i]-grad[3][i];
+  return J;
+}
+
+template< typename Index >
+AssemblyPlan< Index >::AssemblyPlan( const std::vector< std::size_t >& inpoel,
+                                     const SparseCSR< Index >& A )
+  : slot( inpoel.size()/4*16 )
+// *****************************************************************************
+//  Constructor: find the value slots of all element contributions
+//! \param[in] inpoel Mesh node connectivity
+//! \param[in] A Matrix whose sparsity pattern was built from inpoel
+// *****************************************************************************
+{
+  assert( inpoel.size()%4 == 0 ); // Size of inpoel must be divisible by 4
+
+  for (std::size_t e=0; e<inpoel.size()/4; ++e) {
+    const auto N = inpoel.data() + e*4;
+    for (std::size_t a=0; a<4; ++a)
+      for (std::size_t b=0; b<4; ++b)
+        slot[ e*16 + a*4 + b ] =
+          A.isSymmetric() && N[b] < N[a] ? npos : static_cast< Index >(
+            A.slot( static_cast< Index >( N[a] ), static_cast< Index >( N[b] ) ) );
+  }
+}
+
+std::tuple< SparseCSR<>, std::vector< double >, std::vector< double > >
 laplacian( const std::vector< std::size_t >& inpoel,
            const std::array< std::vector< double >, 3 >& coord )
 // *****************************************************************************
 //  Setup matrix with Laplacian
 //! \param[in] inpoel Mesh node connectivity
 //! \param[in] coord Mesh node coordinates
-//! \param[in] psup Points surrounding points
 //! \return { A, x, b } in linear system A * x = b to solve
 // *****************************************************************************
 {
-  const auto& X = coord[0];
-  const auto& Y = coord[1];
-  const auto& Z = coord[2];
-
-  // compute points surrounding points
-  auto psup = genPsup( inpoel, 4, genEsup(inpoel,4) );
-
   // Matrix with compressed sparse row storage
-  SparseCSR A( inpoel, 4);
-
-
+  SparseCSR<> A( inpoel, 4);
 
   // fill matrix with Laplacian
   for (std::size_t e=0; e<inpoel.size()/4; ++e) {
     const auto N = inpoel.data() + e*4;
-    const std::array< double, 3 >
-      ba{{ X[N[1]]-X[N[0]], Y[N[1]]-Y[N[0]], Z[N[1]]-Z[N[0]] }},
-      ca{{ X[N[2]]-X[N[0]], Y[N[2]]-Y[N[0]], Z[N[2]]-Z[N[0]] }},
-      da{{ X[N[3]]-X[N[0]], Y[N[3]]-Y[N[0]], Z[N[3]]-Z[N[0]] }};
-    const auto J = triple( ba, ca, da );        // J = 6V
-    assert( J > 0 ); // Element Jacobian non-positive
     std::array< std::array< double, 3 >, 4 > grad;
-    grad[1] = crossdiv( ca, da, J );
-    grad[2] = crossdiv( da, ba, J );
-    grad[3] = crossdiv( ba, ca, J );
-    for (std::size_t i=0; i<3; ++i)
-      grad[0][i] = -grad[1][i]-grad[2][i]-grad[3][i];
+    const auto J = gradients( N, coord, grad );
     for (std::size_t a=0; a<4; ++a)
       for (std::size_t b=0; b<4; ++b)
          for (std::size_t k=0; k<3; ++k)
            A.at(N[a],N[b]) -= J/6.0 * grad[a][k] * grad[b][k];
   }
 
-  auto nunk = X.size();
+  auto nunk = coord[0].size();
   std::vector< double > x( nunk, 0.0 ), b( nunk, 0.0 );
 
   return { std::move(A), std::move(x), std::move(b) };
 }
+
+template< typename Index >
+void
+laplacian( const std::vector< std::size_t >& inpoel,
+           const std::array< std::vector< double >, 3 >& coord,
+           const AssemblyPlan< Index >& plan,
+           SparseCSR< Index >& A )
+// *****************************************************************************
+//  Refill matrix with Laplacian using a precomputed assembly plan
+//! \param[in] inpoel Mesh node connectivity
+//! \param[in] coord Mesh node coordinates
+//! \param[in] plan Value slots of element contributions, built from inpoel
+//!   and the sparsity pattern of A
+//! \param[in,out] A Matrix to (re-)assemble, its values are overwritten
+//! \details Use this when the mesh connectivity is fixed and the matrix is
+//!   reassembled many times, e.g., every time step with moving coordinates.
+//!   Element contributions are scattered directly to their value slots.
+// *****************************************************************************
+{
+  assert( plan.nelem() == inpoel.size()/4 ); // Plan built for another mesh
+
+  A.zero();
+  double* const val = A.data();
+
+  for (std::size_t e=0; e<inpoel.size()/4; ++e) {
+    const auto N = inpoel.data() + e*4;
+    std::array< std::array< double, 3 >, 4 > grad;
+    const auto J = gradients( N, coord, grad );
+    for (std::size_t a=0; a<4; ++a)
+      for (std::size_t b=0; b<4; ++b) {
+        const auto s = plan(e,a,b);
+        if (s == AssemblyPlan< Index >::npos) continue;
+        for (std::size_t k=0; k<3; ++k)
+          val[s] -= J/6.0 * grad[a][k] * grad[b][k];
+      }
+  }
+}
+
+LaplacianOperator::LaplacianOperator(
+  const std::vector< std::size_t >& inpoel,
+  const std::array< std::vector< double >, 3 >& coord_,
+  bool cache )
+  : coord( coord_ ), npoin( coord_[0].size() )
+// *****************************************************************************
+//  Constructor: color the elements and optionally cache the gradients
+//! \param[in] inpoel Mesh node connectivity, zero-based
+//! \param[in] coord_ Mesh node coordinates, referenced
+//! \param[in] cache True to store the shape function gradients of each
+//!   element, false to recompute them in every product
+//! \details Greedy coloring: each element gets the smallest color not used by
+//!   an already colored element sharing one of its nodes (elements surrounding
+//!   points, see genEsup). Tetrahedron meshes typically need 20-30 colors.
+// *****************************************************************************
+{
+  assert( inpoel.size()%4 == 0 ); // Size of inpoel must be divisible by 4
+  const auto nelem = inpoel.size()/4;
+
+  if (nelem) {
+    auto esup = genEsup( inpoel, 4 );
+    const auto& esup1 = esup.first;
+    const auto& esup2 = esup.second;
+
+    const auto unset = static_cast< std::size_t >( -1 );
+    std::vector< std::size_t > ecolor( nelem, unset );
+    std::vector< std::size_t > mark;   // mark[c] == e: color c used next to e
+    std::vector< std::size_t > count;  // number of elements of each color
+    for (std::size_t e=0; e<nelem; ++e) {
+      for (std::size_t a=0; a<4; ++a) {
+        const auto p = inpoel[e*4+a];
+        for (auto i=esup2[p]+1; i<=esup2[p+1]; ++i) {
+          const auto c = ecolor[ esup1[i] ];
+          if (c != unset) mark[c] = e;
+        }
+      }
+      std::size_t c = 0;
+      while (c < mark.size() && mark[c] == e) ++c;
+      if (c == mark.size()) { mark.push_back( unset ); count.push_back( 0 ); }
+      ecolor[e] = c;
+      ++count[c];
+    }
+
+    // store connectivity in color order
+    color.assign( count.size()+1, 0 );
+    for (std::size_t c=0; c<count.size(); ++c) color[c+1] = color[c] + count[c];
+    conn.resize( nelem*4 );
+    auto pos = color;
+    for (std::size_t e=0; e<nelem; ++e) {
+      const auto k = pos[ ecolor[e] ]++;
+      for (std::size_t a=0; a<4; ++a) conn[k*4+a] = inpoel[e*4+a];
+    }
+  } else {
+    color.assign( 1, 0 );
+  }
+
+  if (cache) {
+    geo.resize( nelem*13 );
+    update();
+  }
+}
+
+void
+LaplacianOperator::update()
+// *****************************************************************************
+//  Recompute the cached gradients after the coordinates changed
+//! \details Does nothing if the gradients are not cached.
+// *****************************************************************************
+{
+  if (geo.empty()) return;
+
+  const auto nelem = static_cast< std::ptrdiff_t >( conn.size()/4 );
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (std::ptrdiff_t e=0; e<nelem; ++e) {
+    std::array< std::array< double, 3 >, 4 > grad;
+    auto g = geo.data() + e*13;
+    g[0] = gradients( conn.data() + e*4, coord, grad ) / 6.0;
+    for (std::size_t a=0; a<4; ++a)
+      for (std::size_t k=0; k<3; ++k)
+        g[1 + a*3 + k] = grad[a][k];
+  }
+}
+
+void
+LaplacianOperator::dirichlet( const std::vector< std::size_t >& nodes )
+// *****************************************************************************
+//  Act as the matrix with Dirichlet BCs at nodes, applied by symmetric
+//  elimination
+//! \param[in] nodes Node ids with Dirichlet BCs
+//! \details The operator then equals the matrix modified by
+//!   SparseCSR::dirichlet( nodes, values, b, true ): identity rows and zero
+//!   columns at the constrained nodes. The right-hand side has to be modified
+//!   the same way by the caller, e.g., b -= A * g with g the BC values at the
+//!   constrained nodes and zero elsewhere, then b_i = g_i.
+// *****************************************************************************
+{
+  bc.assign( npoin, 0 );
+  for (auto p : nodes) {
+    if (p >= npoin) throw std::out_of_range( "LaplacianOperator::dirichlet: node id out of range" );
+    bc[p] = 1;
+  }
+}
+
+std::size_t
+LaplacianOperator::bytes() const
+{
+  return (color.size() + conn.size()) * sizeof(std::size_t) +
+         geo.size() * sizeof(double) + bc.size();
+}
+
+void
+LaplacianOperator::mult( const std::vector< double >& x,
+                         std::vector< double >& r ) const
+// *****************************************************************************
+//  Multiply with vector from the right: r = A * x
+//! \param[in] x Vector to multiply with from the right
+//! \param[in,out] r Result vector, only (re)allocated if its size is wrong
+// *****************************************************************************
+{
+  multAdd( 1.0, x, 0.0, x, r );
+}
+
+void
+LaplacianOperator::multAdd( double alpha, const std::vector< double >& x,
+                            double beta, const std::vector< double >& y,
+                            std::vector< double >& r ) const
+// *****************************************************************************
+//  Fused multiply-add with vector from the right: r = alpha * A * x + beta * y
+//! \param[in] alpha Scalar multiplying A * x
+//! \param[in] x Vector to multiply with from the right
+//! \param[in] beta Scalar multiplying y
+//! \param[in] y Vector to add, may be the same object as r
+//! \param[in,out] r Result vector, only (re)allocated if its size is wrong
+//! \details One parallel region: r is initialized with beta * y, then the
+//!   colors are processed one after the other, the elements of a color in
+//!   parallel.
+// *****************************************************************************
+{
+  if (x.size() != npoin || y.size() != npoin)
+    throw std::length_error( "LaplacianOperator::multAdd: wrong shapes" );
+  if (r.size() != npoin) r.resize( npoin );
+
+  const bool hasbc = !bc.empty();
+  const bool cached = !geo.empty();
+  const auto n = static_cast< std::ptrdiff_t >( npoin );
+
+#ifdef _OPENMP
+  #pragma omp parallel
+#endif
+  {
+#ifdef _OPENMP
+    #pragma omp for schedule(static)
+#endif
+    for (std::ptrdiff_t i=0; i<n; ++i) {
+      const double by = beta != 0.0 ? beta * y[i] : 0.0;
+      r[i] = hasbc && bc[i] ? alpha * x[i] + by : by;
+    }
+
+    for (std::size_t c=0; c<color.size()-1; ++c) {
+      const auto first = static_cast< std::ptrdiff_t >( color[c] );
+      const auto last = static_cast< std::ptrdiff_t >( color[c+1] );
+#ifdef _OPENMP
+      #pragma omp for schedule(static)
+#endif
+      for (std::ptrdiff_t k=first; k<last; ++k) {
+        const auto N = conn.data() + k*4;
+
+        std::array< std::array< double, 3 >, 4 > grad;
+        double w;
+        if (cached) {
+          const auto g = geo.data() + k*13;
+          w = g[0];
+          for (std::size_t a=0; a<4; ++a)
+            for (std::size_t d=0; d<3; ++d)
+              grad[a][d] = g[1 + a*3 + d];
+        } else {
+          w = gradients( N, coord, grad ) / 6.0;
+        }
+
+        // gradient of x in the element, constrained nodes eliminated
+        std::array< double, 3 > s{{ 0.0, 0.0, 0.0 }};
+        for (std::size_t b=0; b<4; ++b) {
+          if (hasbc && bc[N[b]]) continue;
+          for (std::size_t d=0; d<3; ++d) s[d] += grad[b][d] * x[N[b]];
+        }
+
+        for (std::size_t a=0; a<4; ++a) {
+          if (hasbc && bc[N[a]]) continue;
+          r[N[a]] -= alpha * w * dot( grad[a], s );
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiations for the index types SparseCSR is instantiated with
+template class AssemblyPlan< std::int32_t >;
+template class AssemblyPlan< std::int64_t >;
+template void laplacian( const std::vector< std::size_t >&,
+                         const std::array< std::vector< double >, 3 >&,
+                         const AssemblyPlan< std::int32_t >&, SparseCSR< std::int32_t >& );
+template void laplacian( const std::vector< std::size_t >&,
+                         const std::array< std::vector< double >, 3 >&,
+                         const AssemblyPlan< std::int64_t >&, SparseCSR< std::int64_t >& );
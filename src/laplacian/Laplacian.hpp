@@ -23,7 +23,104 @@ genPsup( const std::vector< std::size_t >& inpoel,
          const std::pair< std::vector< std::size_t >,
                           std::vector< std::size_t > >& esup );
 
+//! Precomputed matrix value slots for element-by-element assembly
+//! \details Stores, for each tetrahedron e and local node pair (a,b), the
+//!   index into the values vector of SparseCSR at which the element
+//!   contribution A(N[a],N[b]) is summed. Build it once for a fixed mesh and
+//!   sparsity pattern, then assemble without searching the matrix rows.
+//!   If the matrix stores only its upper triangle (SparseCSR::isSymmetric()),
+//!   contributions below the diagonal have no slot and are skipped.
+//! \tparam Index Index type of the matrix: the slots are stored in it, so a
+//!   plan for SparseCSR<std::int32_t> takes 64 bytes per element
+template< typename Index = std::int32_t >
+class AssemblyPlan {
+
+  public:
+    //! Constructor: find the value slots of all element contributions
+    explicit AssemblyPlan( const std::vector< std::size_t >& inpoel,
+                           const SparseCSR< Index >& A );
+
+    //! Value slot of the contribution of element e to A(N[a],N[b])
+    Index operator()( std::size_t e, std::size_t a, std::size_t b ) const
+    { return slot[ e*16 + a*4 + b ]; }
+
+    //! Slot value of contributions that are not stored (symmetric storage)
+    static constexpr Index npos = static_cast< Index >( -1 );
+
+    //! Number of elements the plan was built for
+    std::size_t nelem() const { return slot.size()/16; }
+
+  private:
+    std::vector< Index > slot;          //!< Value slots, 4x4 per element
+};
+
+extern template class AssemblyPlan< std::int32_t >;
+extern template class AssemblyPlan< std::int64_t >;
+
+//! Matrix-free Laplacian operator on a tetrahedron mesh
+//! \details Computes y = A*x element by element, with A the matrix assembled
+//!   by laplacian(), without storing A. Each element adds
+//!   -J/6 * grad_a . (sum_b grad_b x_b) to its nodes a, i.e., the gradient of
+//!   x in the element is formed once instead of applying the 4x4 element
+//!   matrix. The shape function gradients are either cached per element (13
+//!   doubles) or recomputed from the coordinates in every product; only the
+//!   latter needs less memory than the assembled matrix. Elements are grouped
+//!   into colors such that no two elements of a color share a node, so the
+//!   elements of a color are processed in parallel without write conflicts.
+//!   The connectivity and the cached gradients are stored in color order, so
+//!   the products stream through them. The coordinates are referenced, not
+//!   copied: they must outlive the operator, and update() must be called
+//!   after moving them if the gradients are cached.
+class LaplacianOperator : public LinearOperator< LaplacianOperator > {
+
+  public:
+    using value_type = double;
+
+    //! Constructor: color the elements and optionally cache the gradients
+    explicit LaplacianOperator( const std::vector< std::size_t >& inpoel,
+                                const std::array< std::vector< double >, 3 >& coord,
+                                bool cache = true );
+
+    //! Recompute the cached gradients after the coordinates changed
+    void update();
+
+    //! Act as the matrix with Dirichlet BCs at nodes, applied by symmetric elimination
+    void dirichlet( const std::vector< std::size_t >& nodes );
+
+    std::size_t rows() const { return npoin; }
+    std::size_t cols() const { return npoin; }
+    std::size_t ncolors() const { return color.size()-1; }
+    //! Memory footprint of the operator data (connectivity, gradients, BCs)
+    std::size_t bytes() const;
+
+    //! r = A * x
+    void mult( const std::vector< double >& x, std::vector< double >& r ) const;
+    //! r = alpha * A * x + beta * y, y may be the same object as r
+    void multAdd( double alpha, const std::vector< double >& x,
+                  double beta, const std::vector< double >& y,
+                  std::vector< double >& r ) const;
+    //! Linear operator interface: y = A * x
+    void apply( const std::vector< double >& x, std::vector< double >& y ) const
+    { mult( x, y ); }
+
+  private:
+    const std::array< std::vector< double >, 3 >& coord; //!< Node coordinates
+    std::size_t npoin;                  //!< Number of nodes (rows)
+    std::vector< std::size_t > color;   //!< Offsets of colors in conn/4 and geo/13
+    std::vector< std::size_t > conn;    //!< Element connectivity in color order
+    std::vector< double > geo;          //!< Cached J/6 and gradients, 13 per element
+    std::vector< char > bc;             //!< Dirichlet mask, empty if no BCs
+};
+
 //  Setup matrix with Laplacian
-std::tuple< SparseCSR, std::vector< double >, std::vector< double > >
+std::tuple< SparseCSR<>, std::vector< double >, std::vector< double > >
 laplacian( const std::vector< std::size_t >& inpoel,
            const std::array< std::vector< double >, 3 >& coord );
+
+//  Refill matrix with Laplacian using a precomputed assembly plan
+template< typename Index >
+void
+laplacian( const std::vector< std::size_t >& inpoel,
+           const std::array< std::vector< double >, 3 >& coord,
+           const AssemblyPlan< Index >& plan,
+           SparseCSR< Index >& A );
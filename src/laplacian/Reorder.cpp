@@ -0,0 +1,511 @@
+// *****************************************************************************
+/*!
+  \file      src/laplacian/Reorder.cpp
+  \brief     Renumbering of mesh nodes for locality of the assembled matrix
+  \details   Node ids read from mesh files are in arbitrary order, so the
+    nonzeros of a row of the assembled matrix, and the nodes of an element, are
+    scattered over the whole vector. Reverse Cuthill-McKee (RCM) renumbers the
+    nodes level by level of a breadth-first search of the node graph, which
+    keeps neighbours close in the numbering: the matrix bandwidth and profile
+    shrink, and the gathers of SpMV and assembly hit the cache. The level
+    traversal is AMGCL's amgcl::reorder::cuthill_mckee, started from a
+    pseudo-peripheral node found here, and its order is reversed.
+
+    Sorting along a space-filling curve (Hilbert or Morton) is the geometric
+    alternative: nodes, and elements by their centroids, that are close in
+    space get close ids. It needs no graph, only a key per point and a radix
+    sort, so it is cheap enough to run on every mesh load, and it also orders
+    the elements, which RCM leaves alone, for the element loops of assembly
+    and of the matrix-free operator.
+*/
+// *****************************************************************************
+
+#define AMGCL_NO_BOOST
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <tuple>
+
+#include <amgcl/adapter/crs_tuple.hpp>
+#include <amgcl/reorder/cuthill_mckee.hpp>
+
+#include "Reorder.hpp"
+#include "Laplacian.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+std::vector< std::size_t >
+bfsLevels( const std::pair< std::vector< std::size_t >,
+                            std::vector< std::size_t > >& psup,
+           std::size_t root,
+           std::size_t& depth )
+// *****************************************************************************
+//  Breadth-first search of the node graph
+//! \param[in] psup Points surrounding points
+//! \param[in] root Start node
+//! \param[out] depth Number of levels (eccentricity of root + 1)
+//! \return Nodes of the last level
+// *****************************************************************************
+{
+  const auto& psup1 = psup.first;
+  const auto& psup2 = psup.second;
+  const std::size_t npoin = psup2.size()-1;
+  std::vector< char > seen( npoin, 0 );
+  std::vector< std::size_t > level{ root }, next;
+  seen[root] = 1;
+  depth = 1;
+  while (true) {
+    next.clear();
+    for (auto p : level)
+      for (auto i=psup2[p]+1; i<=psup2[p+1]; ++i) {
+        auto q = psup1[i];
+        if (!seen[q]) { seen[q] = 1; next.push_back( q ); }
+      }
+    if (next.empty()) return level;
+    level.swap( next );
+    ++depth;
+  }
+}
+
+std::size_t
+peripheral( const std::pair< std::vector< std::size_t >,
+                             std::vector< std::size_t > >& psup )
+// *****************************************************************************
+//  Find a pseudo-peripheral node of the node graph (George and Liu)
+//! \param[in] psup Points surrounding points
+//! \return A node of large eccentricity in the component of the node with
+//!   the smallest degree
+//! \details Starting from a node of minimum degree, repeatedly move to the
+//!   node of minimum degree in the last BFS level while that increases the
+//!   number of levels. RCM started from such a node produces long, narrow
+//!   level sets, i.e., a small bandwidth.
+// *****************************************************************************
+{
+  const auto& psup2 = psup.second;
+  const std::size_t npoin = psup2.size()-1;
+  auto degree = [&]( std::size_t p ){ return psup2[p+1] - psup2[p]; };
+
+  std::size_t root = 0;
+  for (std::size_t p=1; p<npoin; ++p) if (degree(p) < degree(root)) root = p;
+
+  std::size_t depth = 0;
+  auto last = bfsLevels( psup, root, depth );
+  for (int k=0; k<8; ++k) {
+    auto cand = *std::min_element( begin(last), end(last),
+      [&]( std::size_t a, std::size_t b ){ return degree(a) < degree(b); } );
+    std::size_t d = 0;
+    auto l = bfsLevels( psup, cand, d );
+    if (d <= depth) break;
+    root = cand;
+    depth = d;
+    last.swap( l );
+  }
+  return root;
+}
+
+//! Bits per coordinate of the space-filling curve keys, 3*21 = 63 bits
+constexpr unsigned sfc_bits = 21;
+
+std::uint64_t
+spread( std::uint64_t v )
+// *****************************************************************************
+//  Spread the lower 21 bits of an integer to every third bit
+//! \param[in] v Integer whose bits b are moved to bit 3*b
+//! \return Integer with the bits of v two zero bits apart
+// *****************************************************************************
+{
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffff;
+  v = (v | v << 16) & 0x1f0000ff0000ff;
+  v = (v | v << 8)  & 0x100f00f00f00f00f;
+  v = (v | v << 4)  & 0x10c30c30c30c30c3;
+  v = (v | v << 2)  & 0x1249249249249249;
+  return v;
+}
+
+std::uint64_t
+hilbert( std::array< std::uint32_t, 3 > X )
+// *****************************************************************************
+//  Index of a point on the 3D Hilbert curve
+//! \param[in] X Integer coordinates of the point, sfc_bits bits each
+//! \return Hilbert index, 3*sfc_bits bits
+//! \details Skilling's transform (AIP Conf. Proc. 707, 2004) turns the
+//!   coordinates into the "transposed" Hilbert index in place, whose bits
+//!   interleaved, as for the Morton key, give the index along the curve.
+// *****************************************************************************
+{
+  const std::uint32_t M = 1u << (sfc_bits-1);
+  // inverse undo excess work
+  for (std::uint32_t Q=M; Q>1; Q>>=1) {
+    const std::uint32_t P = Q-1;
+    for (std::size_t i=0; i<3; ++i)
+      if (X[i] & Q) {
+        X[0] ^= P;
+      } else {
+        const std::uint32_t t = (X[0] ^ X[i]) & P;
+        X[0] ^= t;
+        X[i] ^= t;
+      }
+  }
+  // Gray encode
+  X[1] ^= X[0];
+  X[2] ^= X[1];
+  std::uint32_t t = 0;
+  for (std::uint32_t Q=M; Q>1; Q>>=1) if (X[2] & Q) t ^= Q-1;
+  for (auto& x : X) x ^= t;
+
+  return spread( X[0] ) << 2 | spread( X[1] ) << 1 | spread( X[2] );
+}
+
+} // namespace
+
+GraphBandwidth
+bandwidth( const std::pair< std::vector< std::size_t >,
+                            std::vector< std::size_t > >& psup )
+// *****************************************************************************
+//  Bandwidth and profile of the node graph in its current numbering
+//! \param[in] psup Points surrounding points, see genPsup
+//! \return Bandwidth and profile of the symmetric matrix of the node graph
+// *****************************************************************************
+{
+  std::vector< std::size_t > id( psup.second.size()-1 );
+  for (std::size_t p=0; p<id.size(); ++p) id[p] = p;
+  return bandwidth( psup, id );
+}
+
+GraphBandwidth
+bandwidth( const std::pair< std::vector< std::size_t >,
+                            std::vector< std::size_t > >& psup,
+           const std::vector< std::size_t >& newid )
+// *****************************************************************************
+//  Bandwidth and profile of the node graph after renumbering
+//! \param[in] psup Points surrounding points in the current numbering
+//! \param[in] newid New id of each node, see inverse()
+//! \return Bandwidth and profile of the symmetric matrix of the node graph
+//!   in the new numbering
+//! \details The profile (envelope size) is the number of entries between the
+//!   first nonzero of each row and the diagonal, which is the fill of a
+//!   skyline factorization and a measure of how far back in x the products
+//!   of a row reach.
+// *****************************************************************************
+{
+  const auto& psup1 = psup.first;
+  const auto& psup2 = psup.second;
+  GraphBandwidth b{ 0, 0 };
+  for (std::size_t p=0; p<psup2.size()-1; ++p) {
+    std::size_t i = newid[p], first = i;
+    for (auto k=psup2[p]+1; k<=psup2[p+1]; ++k) {
+      std::size_t j = newid[ psup1[k] ];
+      b.bandwidth = std::max( b.bandwidth, i > j ? i-j : j-i );
+      first = std::min( first, j );
+    }
+    b.profile += i - first;
+  }
+  return b;
+}
+
+std::vector< std::size_t >
+rcm( const std::pair< std::vector< std::size_t >,
+                      std::vector< std::size_t > >& psup )
+// *****************************************************************************
+//  Reverse Cuthill-McKee ordering of the node graph
+//! \param[in] psup Points surrounding points, see genPsup
+//! \return Permutation, perm[new] = old
+//! \details amgcl::reorder::cuthill_mckee always starts from node 0, so the
+//!   graph is handed to it with the pseudo-peripheral start node and node 0
+//!   swapped. Further connected components are started from their smallest
+//!   node id.
+// *****************************************************************************
+{
+  const auto& psup1 = psup.first;
+  const auto& psup2 = psup.second;
+  const std::size_t npoin = psup2.size()-1;
+  if (npoin == 0) return {};
+
+  // relabel: swap the start node and node 0
+  const std::size_t s = peripheral( psup );
+  auto swp = [s]( std::size_t p ){ return p == s ? 0 : p == 0 ? s : p; };
+
+  std::vector< std::ptrdiff_t > ptr( npoin+1, 0 ), col;
+  col.reserve( psup1.size() );
+  for (std::size_t p=0; p<npoin; ++p) {
+    auto q = swp( p );
+    for (auto i=psup2[q]+1; i<=psup2[q+1]; ++i)
+      col.push_back( static_cast< std::ptrdiff_t >( swp( psup1[i] ) ) );
+    ptr[p+1] = static_cast< std::ptrdiff_t >( col.size() );
+  }
+  std::vector< double > val( col.size(), 1.0 );
+
+  std::vector< std::ptrdiff_t > cm( npoin );
+  amgcl::reorder::cuthill_mckee< false >::get(
+    std::tie( npoin, ptr, col, val ), cm );
+
+  std::vector< std::size_t > perm( npoin );
+  for (std::size_t i=0; i<npoin; ++i)
+    perm[i] = swp( static_cast< std::size_t >( cm[npoin-1-i] ) );
+  return perm;
+}
+
+std::vector< std::size_t >
+inverse( const std::vector< std::size_t >& perm )
+// *****************************************************************************
+//  Inverse of a permutation
+//! \param[in] perm Permutation, perm[new] = old
+//! \return New id of each old node, newid[old] = new
+// *****************************************************************************
+{
+  std::vector< std::size_t > newid( perm.size() );
+  for (std::size_t i=0; i<perm.size(); ++i) newid[ perm[i] ] = i;
+  return newid;
+}
+
+void
+renumber( const std::vector< std::size_t >& perm,
+          std::vector< std::size_t >& inpoel,
+          std::array< std::vector< double >, 3 >& coord )
+// *****************************************************************************
+//  Renumber mesh connectivity and coordinates
+//! \param[in] perm Permutation, perm[new] = old
+//! \param[in,out] inpoel Element connectivity, zero-based node ids
+//! \param[in,out] coord Node coordinates
+// *****************************************************************************
+{
+  auto newid = inverse( perm );
+  for (auto& p : inpoel) p = newid[p];
+  for (auto& c : coord) {
+    std::vector< double > r( c.size() );
+    for (std::size_t i=0; i<perm.size(); ++i) r[i] = c[ perm[i] ];
+    c.swap( r );
+  }
+}
+
+std::vector< double >
+unpermute( const std::vector< std::size_t >& perm,
+           const std::vector< double >& x )
+// *****************************************************************************
+//  Map a nodal field of the renumbered mesh back to the original node ids
+//! \param[in] perm Permutation used to renumber the mesh, perm[new] = old
+//! \param[in] x Nodal field in the new numbering, e.g., the solution
+//! \return The field in the original numbering of the mesh file
+// *****************************************************************************
+{
+  std::vector< double > y( x.size() );
+  for (std::size_t i=0; i<perm.size(); ++i) y[ perm[i] ] = x[i];
+  return y;
+}
+
+std::vector< std::size_t >
+renumberRCM( std::vector< std::size_t >& inpoel,
+             std::array< std::vector< double >, 3 >& coord,
+             std::size_t nnpe,
+             std::ostream* report )
+// *****************************************************************************
+//  Renumber a mesh with RCM before assembly
+//! \param[in,out] inpoel Element connectivity, zero-based node ids
+//! \param[in,out] coord Node coordinates
+//! \param[in] nnpe Number of nodes per element
+//! \param[in] report If not null, bandwidth and profile before and after the
+//!   renumbering are written to this stream
+//! \return Permutation applied, perm[new] = old, to unpermute the solution
+// *****************************************************************************
+{
+  auto psup = genPsup( inpoel, nnpe, genEsup( inpoel, nnpe ) );
+  auto perm = rcm( psup );
+
+  if (report) {
+    auto before = bandwidth( psup );
+    auto after = bandwidth( psup, inverse( perm ) );
+    *report << "RCM renumbering of " << perm.size() << " nodes: bandwidth "
+            << before.bandwidth << " -> " << after.bandwidth << ", profile "
+            << before.profile << " -> " << after.profile << '\n';
+  }
+
+  renumber( perm, inpoel, coord );
+  return perm;
+}
+
+std::vector< std::uint64_t >
+sfcKeys( const std::array< std::vector< double >, 3 >& coord, Curve curve )
+// *****************************************************************************
+//  Keys of points along a space-filling curve through their bounding box
+//! \param[in] coord Point coordinates
+//! \param[in] curve Hilbert or Morton (Z-order) curve
+//! \return Key of each point, points close on the curve are close in space
+//! \details The bounding box is scaled uniformly, keeping its aspect ratio, to
+//!   a grid of 2^21 cells along its longest side. The Hilbert curve has no
+//!   jumps, so consecutive keys are always neighbouring cells; the Morton key
+//!   is only a bit interleave, cheaper, but jumps across the box at powers
+//!   of two.
+// *****************************************************************************
+{
+  const auto& x = coord[0];
+  const auto& y = coord[1];
+  const auto& z = coord[2];
+  const auto n = static_cast< std::ptrdiff_t >( x.size() );
+  std::vector< std::uint64_t > key( x.size() );
+  if (n == 0) return key;
+
+  std::array< double, 3 > lo, hi;
+  for (std::size_t d=0; d<3; ++d) {
+    auto mm = std::minmax_element( begin(coord[d]), end(coord[d]) );
+    lo[d] = *mm.first;
+    hi[d] = *mm.second;
+  }
+  const double len = std::max( { hi[0]-lo[0], hi[1]-lo[1], hi[2]-lo[2] } );
+  const double cells = static_cast< double >( (1u << sfc_bits) - 1 );
+  const double scale = len > 0.0 ? cells / len : 0.0;
+  auto cell = [&]( double c, std::size_t d ) {
+    return static_cast< std::uint32_t >( (c - lo[d]) * scale ); };
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for (std::ptrdiff_t p=0; p<n; ++p) {
+    std::array< std::uint32_t, 3 > X{{ cell(x[p],0), cell(y[p],1), cell(z[p],2) }};
+    key[p] = curve == Curve::Hilbert ? hilbert( X )
+           : spread( X[0] ) << 2 | spread( X[1] ) << 1 | spread( X[2] );
+  }
+  return key;
+}
+
+std::vector< std::size_t >
+radixSort( const std::vector< std::uint64_t >& keys )
+// *****************************************************************************
+//  Stable parallel least-significant-digit radix sort of 64-bit keys
+//! \param[in] keys Keys to sort
+//! \return Permutation perm such that keys[perm[i]] is ascending, equal keys
+//!   in their original order
+//! \details Eight passes of 8-bit digits over (key, index) pairs. In each
+//!   pass every thread counts the digits of its contiguous block of the
+//!   input; the counts prefix-summed digit-major, thread-minor give every
+//!   block its own output positions for every digit, so the scatter is parallel and stays stable.
+//!   Passes in which all keys have the same digit, e.g., the top bits of
+//!   63-bit curve keys or of a small mesh, are skipped.
+// *****************************************************************************
+{
+  const std::size_t n = keys.size();
+  std::vector< std::uint64_t > k( keys ), kt( n );
+  std::vector< std::size_t > perm( n ), pt( n );
+  for (std::size_t i=0; i<n; ++i) perm[i] = i;
+
+#ifdef _OPENMP
+  const std::size_t nthreads =
+    n < 65536 ? 1 : static_cast< std::size_t >( omp_get_max_threads() );
+#else
+  const std::size_t nthreads = 1;
+#endif
+  std::vector< std::size_t > count( 256 * nthreads );
+
+  auto block = [&]( std::size_t t ){ return n * t / nthreads; };
+  auto digit = [&]( std::size_t i, unsigned shift ){
+    return static_cast< std::size_t >( (k[i] >> shift) & 0xff ); };
+
+  for (unsigned shift=0; shift<64 && n>0; shift+=8) {
+    std::fill( begin(count), end(count), 0 );
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nthreads) schedule(static,1)
+#endif
+    for (std::size_t t=0; t<nthreads; ++t) {
+      for (std::size_t i=block(t); i<block(t+1); ++i)
+        ++count[ digit(i,shift) * nthreads + t ];
+    }
+
+    // all keys share this digit: the pass would not move anything
+    const std::size_t d = digit( 0, shift );
+    std::size_t same = 0;
+    for (std::size_t t=0; t<nthreads; ++t) same += count[ d * nthreads + t ];
+    if (same == n) continue;
+
+    std::size_t sum = 0;
+    for (auto& c : count) { auto m = c; c = sum; sum += m; }
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nthreads) schedule(static,1)
+#endif
+    for (std::size_t t=0; t<nthreads; ++t) {
+      for (std::size_t i=block(t); i<block(t+1); ++i) {
+        auto& pos = count[ digit(i,shift) * nthreads + t ];
+        kt[pos] = k[i];
+        pt[pos] = perm[i];
+        ++pos;
+      }
+    }
+    k.swap( kt );
+    perm.swap( pt );
+  }
+  return perm;
+}
+
+std::vector< std::size_t >
+sfcOrder( const std::array< std::vector< double >, 3 >& coord, Curve curve )
+// *****************************************************************************
+//  Order of the nodes along a space-filling curve
+//! \param[in] coord Node coordinates
+//! \param[in] curve Hilbert or Morton curve
+//! \return Permutation, perm[new] = old
+// *****************************************************************************
+{
+  return radixSort( sfcKeys( coord, curve ) );
+}
+
+std::vector< std::size_t >
+renumberSFC( std::vector< std::size_t >& inpoel,
+             std::array< std::vector< double >, 3 >& coord,
+             std::size_t nnpe,
+             Curve curve,
+             std::ostream* report )
+// *****************************************************************************
+//  Renumber nodes and reorder elements along a space-filling curve
+//! \param[in,out] inpoel Element connectivity, zero-based node ids
+//! \param[in,out] coord Node coordinates
+//! \param[in] nnpe Number of nodes per element
+//! \param[in] curve Hilbert or Morton curve
+//! \param[in] report If not null, bandwidth and profile before and after the
+//!   renumbering are written to this stream
+//! \return Node permutation applied, perm[new] = old, to unpermute the
+//!   solution
+//! \details The nodes are renumbered along the curve, then the elements are
+//!   sorted along the same curve by their centroids, so an element loop walks
+//!   through the nodes, and the matrix rows, in nearly ascending order.
+// *****************************************************************************
+{
+  auto perm = sfcOrder( coord, curve );
+
+  if (report) {
+    auto psup = genPsup( inpoel, nnpe, genEsup( inpoel, nnpe ) );
+    auto before = bandwidth( psup );
+    auto after = bandwidth( psup, inverse( perm ) );
+    *report << (curve == Curve::Hilbert ? "Hilbert" : "Morton")
+            << " renumbering of " << perm.size() << " nodes: bandwidth "
+            << before.bandwidth << " -> " << after.bandwidth << ", profile "
+            << before.profile << " -> " << after.profile << '\n';
+  }
+
+  renumber( perm, inpoel, coord );
+
+  // element centroids, the same bounding box as the nodes
+  const std::size_t nelem = inpoel.size() / nnpe;
+  std::array< std::vector< double >, 3 > centroid;
+  for (std::size_t d=0; d<3; ++d) {
+    centroid[d].resize( nelem );
+    for (std::size_t e=0; e<nelem; ++e) {
+      double s = 0.0;
+      for (std::size_t a=0; a<nnpe; ++a) s += coord[d][ inpoel[e*nnpe+a] ];
+      centroid[d][e] = s / static_cast< double >( nnpe );
+    }
+  }
+  auto eperm = sfcOrder( centroid, curve );
+  std::vector< std::size_t > conn( inpoel.size() );
+  for (std::size_t e=0; e<nelem; ++e)
+    for (std::size_t a=0; a<nnpe; ++a)
+      conn[e*nnpe+a] = inpoel[ eperm[e]*nnpe+a ];
+  inpoel.swap( conn );
+
+  return perm;
+}
@@ -0,0 +1,83 @@
+// *****************************************************************************
+/*!
+  \file      src/laplacian/Reorder.hpp
+  \brief     Renumbering of mesh nodes for locality of the assembled matrix
+*/
+// *****************************************************************************
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+//! Bandwidth and profile of the node graph of a mesh
+struct GraphBandwidth {
+  std::size_t bandwidth;        //!< max |i-j| over all edges (i,j)
+  std::size_t profile;          //!< sum over rows i of i - (smallest j <= i in row i)
+};
+
+//! Bandwidth and profile of the node graph in its current numbering
+GraphBandwidth
+bandwidth( const std::pair< std::vector< std::size_t >,
+                            std::vector< std::size_t > >& psup );
+
+//! Bandwidth and profile of the node graph after renumbering node p to newid[p]
+GraphBandwidth
+bandwidth( const std::pair< std::vector< std::size_t >,
+                            std::vector< std::size_t > >& psup,
+           const std::vector< std::size_t >& newid );
+
+//! Reverse Cuthill-McKee ordering of the node graph, perm[new] = old
+std::vector< std::size_t >
+rcm( const std::pair< std::vector< std::size_t >,
+                      std::vector< std::size_t > >& psup );
+
+//! Inverse of a permutation: newid[perm[i]] = i
+std::vector< std::size_t >
+inverse( const std::vector< std::size_t >& perm );
+
+//! Renumber mesh connectivity and coordinates, node perm[i] becomes node i
+void
+renumber( const std::vector< std::size_t >& perm,
+          std::vector< std::size_t >& inpoel,
+          std::array< std::vector< double >, 3 >& coord );
+
+//! Map a nodal field of the renumbered mesh back to the original node ids
+std::vector< double >
+unpermute( const std::vector< std::size_t >& perm,
+           const std::vector< double >& x );
+
+//! Renumber a mesh with RCM before assembly, reporting bandwidth and profile
+std::vector< std::size_t >
+renumberRCM( std::vector< std::size_t >& inpoel,
+             std::array< std::vector< double >, 3 >& coord,
+             std::size_t nnpe = 4,
+             std::ostream* report = nullptr );
+
+//! Space-filling curve along which nodes and elements are sorted
+enum class Curve { Morton, Hilbert };
+
+//! Keys of points along a space-filling curve through their bounding box
+std::vector< std::uint64_t >
+sfcKeys( const std::array< std::vector< double >, 3 >& coord,
+         Curve curve = Curve::Hilbert );
+
+//! Stable parallel LSD radix sort of 64-bit keys, returns perm with ascending keys[perm[i]]
+std::vector< std::size_t >
+radixSort( const std::vector< std::uint64_t >& keys );
+
+//! Order of the nodes along a space-filling curve, perm[new] = old
+std::vector< std::size_t >
+sfcOrder( const std::array< std::vector< double >, 3 >& coord,
+          Curve curve = Curve::Hilbert );
+
+//! Renumber nodes and reorder elements along a space-filling curve
+std::vector< std::size_t >
+renumberSFC( std::vector< std::size_t >& inpoel,
+             std::array< std::vector< double >, 3 >& coord,
+             std::size_t nnpe = 4,
+             Curve curve = Curve::Hilbert,
+             std::ostream* report = nullptr );
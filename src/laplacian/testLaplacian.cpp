@@ -5,12 +5,24 @@
 */
 // *****************************************************************************
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <iostream>
 #include <algorithm>
 #include <sstream>
+#include <cmath>
+#include <stdexcept>
 #include "../laplacian/Laplacian.hpp"
+#include "../laplacian/CubeMesh.hpp"
+#include "../laplacian/CSR.hpp"
+#include "../laplacian/Reorder.hpp"
+#include "../CG/CGMatrix.h"
+
+static_assert( is_linear_operator_v< CSR >, "CSR is not a linear operator" );
+static_assert( is_linear_operator_v< LaplacianOperator >,
+               "LaplacianOperator is not a linear operator" );
 
 
 std::size_t
@@ -115,13 +127,457 @@ testLaplacian()
   return 0;
 }
 
+int
+testLaplacianAssemblyPlan()
+// *****************************************************************************
+// Test reassembling the Laplace operator with a precomputed assembly plan
+// *****************************************************************************
+{
+  // Mesh connectivity for simple tetrahedron-only mesh
+  std::vector< std::size_t > inpoel {
+    3, 13, 8, 14,
+    12, 3, 13, 8,
+    8, 3, 14, 11,
+    12, 3, 8, 11,
+    1, 2, 3, 13,
+    6, 13, 7, 8,
+    5, 9, 14, 11,
+    5, 1, 3, 14,
+    10, 4, 12, 11,
+    2, 6, 12, 13,
+    8, 7, 9, 14,
+    13, 1, 7, 14,
+    5, 3, 4, 11,
+    6, 10, 12, 8,
+    3, 2, 4, 12,
+    10, 8, 9, 11,
+    3, 1, 13, 14,
+    13, 7, 8, 14,
+    6, 12, 13, 8,
+    9, 8, 14, 11,
+    3, 5, 14, 11,
+    4, 3, 12, 11,
+    3, 2, 12, 13,
+    10, 12, 8, 11 };
+
+  // Mesh node coordinates for simple tet mesh above
+  std::array< std::vector< double >, 3 > coord {{
+    {{ -0.5, -0.5, -0.5, -0.5, -0.5, 0.5, 0.5, 0.5, 0.5, 0.5, 0, 0, 0, 0 }},
+    {{ 0.5, 0.5, 0, -0.5, -0.5, 0.5, 0.5, 0, -0.5, -0.5, -0.5, 0, 0.5, 0 }},
+    {{ -0.5, 0.5, 0, 0.5, -0.5, 0.5, -0.5, 0, -0.5, 0.5, 0, 0.5, 0, -0.5 }} }};
+
+  // Shift node IDs to start from zero
+  shiftToZero( inpoel );
+
+  // Fill matrix with Laplace operator values by searching rows
+  auto [A,x,b] = laplacian( inpoel, coord );
+  std::stringstream correct;
+  A.write_matlab( correct );
+
+  // Reassemble (twice, to check values are not accumulated) with a plan
+  AssemblyPlan plan( inpoel, A );
+  laplacian( inpoel, coord, plan, A );
+  laplacian( inpoel, coord, plan, A );
+
+  std::stringstream ss;
+  A.write_matlab( ss );
+
+  if (ss.str() != correct.str()) {
+    std::cerr << "Laplace operator assembled with plan incorrect";
+    return -1;
+  }
+
+  // Assemble only the upper triangle with a plan, then restore full storage
+  SparseCSR S( inpoel, 4, true );
+  AssemblyPlan splan( inpoel, S );
+  laplacian( inpoel, coord, splan, S );
+  S.toFull();
+
+  std::stringstream sf;
+  S.write_matlab( sf );
+
+  if (sf.str() != correct.str()) {
+    std::cerr << "Laplace operator assembled in symmetric storage incorrect";
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+testLaplacianOperator()
+// *****************************************************************************
+// Test the matrix-free Laplace operator against the assembled matrix
+// *****************************************************************************
+{
+  // Mesh connectivity for simple tetrahedron-only mesh
+  std::vector< std::size_t > inpoel {
+    3, 13, 8, 14,
+    12, 3, 13, 8,
+    8, 3, 14, 11,
+    12, 3, 8, 11,
+    1, 2, 3, 13,
+    6, 13, 7, 8,
+    5, 9, 14, 11,
+    5, 1, 3, 14,
+    10, 4, 12, 11,
+    2, 6, 12, 13,
+    8, 7, 9, 14,
+    13, 1, 7, 14,
+    5, 3, 4, 11,
+    6, 10, 12, 8,
+    3, 2, 4, 12,
+    10, 8, 9, 11,
+    3, 1, 13, 14,
+    13, 7, 8, 14,
+    6, 12, 13, 8,
+    9, 8, 14, 11,
+    3, 5, 14, 11,
+    4, 3, 12, 11,
+    3, 2, 12, 13,
+    10, 12, 8, 11 };
+
+  // Mesh node coordinates for simple tet mesh above
+  std::array< std::vector< double >, 3 > coord {{
+    {{ -0.5, -0.5, -0.5, -0.5, -0.5, 0.5, 0.5, 0.5, 0.5, 0.5, 0, 0, 0, 0 }},
+    {{ 0.5, 0.5, 0, -0.5, -0.5, 0.5, 0.5, 0, -0.5, -0.5, -0.5, 0, 0.5, 0 }},
+    {{ -0.5, 0.5, 0, 0.5, -0.5, 0.5, -0.5, 0, -0.5, 0.5, 0, 0.5, 0, -0.5 }} }};
+
+  // Shift node IDs to start from zero
+  shiftToZero( inpoel );
+
+  auto [A,x,b] = laplacian( inpoel, coord );
+  const auto n = x.size();
+  for (std::size_t i=0; i<n; ++i) x[i] = 1.0 + 0.5*i*i;
+
+  // without BCs, with cached and recomputed gradients
+  std::vector< double > y( n ), ref, r;
+  for (std::size_t i=0; i<n; ++i) y[i] = 0.1*i;
+  A.multAdd( 2.0, x, -1.0, y, ref );
+  for (bool cache : { true, false }) {
+    LaplacianOperator L( inpoel, coord, cache );
+    L.multAdd( 2.0, x, -1.0, y, r );
+    for (std::size_t i=0; i<n; ++i)
+      if (std::abs( r[i] - ref[i] ) > 1e-12) {
+        std::cerr << "Matrix-free Laplace operator incorrect at row " << i;
+        return -1;
+      }
+  }
+
+  // with BCs: same as the matrix after symmetric elimination
+  std::vector< std::size_t > nodes{ 0, 4, 9 };
+  std::vector< double > g{ 1.0, 2.0, 3.0 };
+  A.dirichlet( nodes, g, b, true );
+  A.mult( x, ref );
+  LaplacianOperator L( inpoel, coord );
+  L.dirichlet( nodes );
+  L.mult( x, r );
+  for (std::size_t i=0; i<n; ++i)
+    if (std::abs( r[i] - ref[i] ) > 1e-12) {
+      std::cerr << "Matrix-free Laplace operator with Dirichlet BCs incorrect at row " << i;
+      return -1;
+    }
+
+  return 0;
+}
+
+void
+scrambledCube( std::vector< std::size_t >& inpoel,
+               std::array< std::vector< double >, 3 >& coord )
+// *****************************************************************************
+// Tetrahedron mesh of a cube with scrambled node ids
+//! \param[out] inpoel Connectivity: 6x6x6 hexahedra, 6 tetrahedra each
+//! \param[out] coord Node coordinates, node ids scrambled by p -> 7919 p mod npoin
+// *****************************************************************************
+{
+  const std::size_t m = 6, np = m+1, npoin = np*np*np;
+  auto id = [&]( std::size_t p ) { return (7919 * p) % npoin; };
+  inpoel = cubeMesh( m );
+  for (auto& p : inpoel) p = id( p );
+  for (auto& c : coord) c.assign( npoin, 0.0 );
+  for (std::size_t p=0; p<npoin; ++p) {
+    coord[0][ id(p) ] = 0.1*(p % np);
+    coord[1][ id(p) ] = 0.1*(p / np % np);
+    coord[2][ id(p) ] = 0.1*(p / (np*np));
+  }
+}
+
+int
+testRenumberRCM()
+// *****************************************************************************
+// Test RCM renumbering on a cube mesh with scrambled node ids
+// *****************************************************************************
+{
+  std::vector< std::size_t > inpoel;
+  std::array< std::vector< double >, 3 > coord;
+  scrambledCube( inpoel, coord );
+  const std::size_t np = 7, npoin = coord[0].size();
+
+  auto A = std::get< 0 >( laplacian( inpoel, coord ) );
+  std::vector< double > x( npoin ), ref;
+  for (std::size_t p=0; p<npoin; ++p) x[p] = coord[0][p] + std::sin( 3.0*coord[1][p] );
+  A.mult( x, ref );
+
+  auto before = bandwidth( genPsup( inpoel, 4, genEsup( inpoel, 4 ) ) );
+  std::stringstream report;
+  auto inpoel_rcm = inpoel;
+  auto coord_rcm = coord;
+  auto perm = renumberRCM( inpoel_rcm, coord_rcm, 4, &report );
+  auto after = bandwidth( genPsup( inpoel_rcm, 4, genEsup( inpoel_rcm, 4 ) ) );
+
+  auto sorted = perm;
+  std::sort( begin(sorted), end(sorted) );
+  for (std::size_t p=0; p<npoin; ++p)
+    if (sorted[p] != p) {
+      std::cerr << "RCM renumbering is not a permutation";
+      return -1;
+    }
+
+  // a plane of the cube has 49 nodes, so RCM must get close to that
+  if (after.bandwidth >= before.bandwidth || after.profile >= before.profile ||
+      after.bandwidth > 2*np*np || report.str().find( "bandwidth" ) == std::string::npos) {
+    std::cerr << "RCM renumbering did not reduce the bandwidth: " << report.str();
+    return -1;
+  }
+
+  // the renumbered operator is the same operator
+  auto B = std::get< 0 >( laplacian( inpoel_rcm, coord_rcm ) );
+  std::vector< double > xr( npoin ), r;
+  for (std::size_t i=0; i<npoin; ++i) xr[i] = x[ perm[i] ];
+  B.mult( xr, r );
+  r = unpermute( perm, r );
+  for (std::size_t p=0; p<npoin; ++p)
+    if (std::abs( r[p] - ref[p] ) > 1e-12) {
+      std::cerr << "Laplace operator of the RCM renumbered mesh incorrect at node " << p;
+      return -1;
+    }
+
+  return 0;
+}
+
+int
+testRenumberSFC()
+// *****************************************************************************
+// Test space-filling curve renumbering and the radix sort it is built on
+// *****************************************************************************
+{
+  // radix sort: same order as a stable comparison sort, also multi-threaded
+  std::vector< std::uint64_t > keys( 100000 );
+  std::uint64_t h = 88172645463325252ull;
+  for (auto& k : keys) {
+    h ^= h << 13; h ^= h >> 7; h ^= h << 17;
+    k = h % 3 == 0 ? h >> 40 : h;       // many equal high digits, some duplicates
+  }
+  for (std::size_t i=0; i<1000; ++i) keys[i] = keys[ 1000+i ];
+  auto perm = radixSort( keys );
+  std::vector< std::size_t > ref( keys.size() );
+  for (std::size_t i=0; i<ref.size(); ++i) ref[i] = i;
+  std::stable_sort( begin(ref), end(ref),
+    [&]( std::size_t a, std::size_t b ){ return keys[a] < keys[b]; } );
+  if (perm != ref) {
+    std::cerr << "radix sort order incorrect";
+    return -1;
+  }
+
+  for (auto curve : { Curve::Hilbert, Curve::Morton }) {
+    std::vector< std::size_t > inpoel;
+    std::array< std::vector< double >, 3 > coord;
+    scrambledCube( inpoel, coord );
+    const std::size_t npoin = coord[0].size();
+
+    auto A = std::get< 0 >( laplacian( inpoel, coord ) );
+    std::vector< double > x( npoin ), r0;
+    for (std::size_t p=0; p<npoin; ++p) x[p] = coord[0][p] + std::sin( 3.0*coord[1][p] );
+    A.mult( x, r0 );
+
+    auto before = bandwidth( genPsup( inpoel, 4, genEsup( inpoel, 4 ) ) );
+    std::stringstream report;
+    auto inpoel_sfc = inpoel;
+    auto coord_sfc = coord;
+    auto p = renumberSFC( inpoel_sfc, coord_sfc, 4, curve, &report );
+    auto after = bandwidth( genPsup( inpoel_sfc, 4, genEsup( inpoel_sfc, 4 ) ) );
+
+    if (after.profile >= before.profile ||
+        report.str().find( "profile" ) == std::string::npos) {
+      std::cerr << "SFC renumbering did not reduce the profile: " << report.str();
+      return -1;
+    }
+
+    // the same elements, in a different order, with renumbered nodes
+    auto newid = inverse( p );
+    std::vector< std::array< std::size_t, 4 > > e0, e1;
+    for (std::size_t e=0; e<inpoel.size()/4; ++e) {
+      std::array< std::size_t, 4 > a, b;
+      for (std::size_t k=0; k<4; ++k) {
+        a[k] = newid[ inpoel[e*4+k] ];
+        b[k] = inpoel_sfc[e*4+k];
+      }
+      e0.push_back( a );
+      e1.push_back( b );
+    }
+    std::sort( begin(e0), end(e0) );
+    std::sort( begin(e1), end(e1) );
+    if (e0 != e1) {
+      std::cerr << "SFC reordering changed the elements";
+      return -1;
+    }
+
+    // the renumbered operator is the same operator
+    auto B = std::get< 0 >( laplacian( inpoel_sfc, coord_sfc ) );
+    std::vector< double > xs( npoin ), r;
+    for (std::size_t i=0; i<npoin; ++i) xs[i] = x[ p[i] ];
+    B.mult( xs, r );
+    r = unpermute( p, r );
+    for (std::size_t q=0; q<npoin; ++q)
+      if (std::abs( r[q] - r0[q] ) > 1e-12) {
+        std::cerr << "Laplace operator of the SFC renumbered mesh incorrect at node " << q;
+        return -1;
+      }
+  }
+
+  return 0;
+}
+
+int
+testSolveLaplacian()
+// *****************************************************************************
+// Test solving the assembled Laplacian with the sparse conjugate gradients
+//! \details Linear fields are reproduced exactly by linear tetrahedra, so with
+//!   Dirichlet BCs of a linear field on the boundary of the cube, CG on the
+//!   SparseCSR returned by laplacian() must recover that field everywhere.
+//!   laplacian() assembles the negative semi-definite operator, so the
+//!   matrix is negated to -A, SPD once the BCs are eliminated.
+// *****************************************************************************
+{
+  std::vector< std::size_t > inpoel;
+  std::array< std::vector< double >, 3 > coord;
+  scrambledCube( inpoel, coord );
+  const auto& X = coord[0];
+  const auto& Y = coord[1];
+  const auto& Z = coord[2];
+
+  auto [A,x,b] = laplacian( inpoel, coord );
+  const auto npoin = x.size();
+  auto exact = [&]( std::size_t p ){ return 1.0 + 2.0*X[p] - 3.0*Y[p] + 0.5*Z[p]; };
+  const auto nnz = A.getVals().size();
+  for (std::size_t k=0; k<nnz; ++k) A.data()[k] = -A.data()[k];
+
+  std::vector< std::size_t > nodes;
+  std::vector< double > g;
+  for (std::size_t p=0; p<npoin; ++p)
+    for (const auto& c : coord)
+      if (c[p] < 1e-12 || c[p] > 0.6-1e-12) {
+        nodes.push_back( p );
+        g.push_back( exact(p) );
+        break;
+      }
+  A.dirichlet( nodes, g, b, true );
+
+  CGOptions opt;
+  opt.rtol = 1e-12;
+  opt.warm_start = false;
+  auto stats = conjugateGradient( A, b, x, opt );
+  if (!stats.converged || stats.iterations == 0) {
+    std::cerr << "CG on the Laplacian did not converge: " << stats.iterations
+              << " iterations, relative residual " << stats.relative_residual;
+    return -1;
+  }
+  for (std::size_t p=0; p<npoin; ++p)
+    if (std::abs( x[p] - exact(p) ) > 1e-9) {
+      std::cerr << "CG solution of the Laplacian incorrect at node " << p;
+      return -1;
+    }
+
+  return 0;
+}
+
+int
+testCSRDirichlet()
+// *****************************************************************************
+// Test batched Dirichlet BCs on CSR against a loop of single-node BCs
+//! \details The Laplacian is copied into CSR. With x satisfying the BCs and
+//!   b = A*x, both batched variants must keep A*x = b. The batched symmetric
+//!   elimination must give the same matrix and rhs as the single-node calls.
+// *****************************************************************************
+{
+  std::vector< std::size_t > inpoel;
+  std::array< std::vector< double >, 3 > coord;
+  scrambledCube( inpoel, coord );
+  auto [S,x,b] = laplacian( inpoel, coord );
+  const auto npoin = x.size();
+
+  CSR A( genPsup( inpoel, 4, genEsup( inpoel, 4 ) ) );
+  for (std::size_t i=0; i<S.rows(); ++i)
+    for (auto j=S.getRPtr()[i]; j<S.getRPtr()[i+1]; ++j)
+      A( i, static_cast< std::size_t >( S.getCols()[j] ) ) = S.getVals()[j];
+
+  std::vector< std::size_t > nodes;
+  std::vector< double > g;
+  for (std::size_t p=0; p<npoin; ++p) {
+    x[p] = 1.0 + 0.1*p;
+    if (coord[0][p] < 1e-12 || coord[1][p] > 0.6-1e-12) {
+      nodes.push_back( p );
+      g.push_back( x[p] );
+    }
+  }
+  std::vector< double > b0( npoin );
+  A.mult( x, b0 );
+
+  for (bool eliminate : { false, true }) {
+    CSR B( A );
+    std::vector< double > bb( b0 ), Bx( npoin );
+    B.dirichlet( nodes, g, bb, eliminate );
+    B.mult( x, Bx );
+    for (std::size_t p=0; p<npoin; ++p)
+      if (std::abs( Bx[p] - bb[p] ) > 1e-12) {
+        std::cerr << "CSR batched Dirichlet BCs incorrect at node " << p;
+        return -1;
+      }
+  }
+
+  CSR B( A ), L( A );
+  std::vector< double > bb( b0 ), bl( b0 );
+  B.dirichlet( nodes, g, bb, true );
+  for (std::size_t k=0; k<nodes.size(); ++k) L.dirichlet( nodes[k], g[k], bl );
+  std::stringstream sb, sl;
+  B.write_stored( sb );
+  L.write_stored( sl );
+  if (sb.str() != sl.str()) {
+    std::cerr << "CSR batched Dirichlet matrix differs from single-node BCs";
+    return -1;
+  }
+  for (std::size_t p=0; p<npoin; ++p)
+    if (std::abs( bb[p] - bl[p] ) > 1e-12) {
+      std::cerr << "CSR batched Dirichlet rhs differs from single-node BCs at " << p;
+      return -1;
+    }
+
+  try {
+    B.dirichlet( { npoin }, { 1.0 }, bb );
+    std::cerr << "CSR batched Dirichlet BCs accepted a node out of range";
+    return -1;
+  } catch (const std::out_of_range&) {}
+
+  return 0;
+}
+
 int
 main(int argc, char * argv[])
 // *****************************************************************************
 // Test main
 // *****************************************************************************
 {
-  return testLaplacian();
+  int result = 0;
+
+  result |= testLaplacian();
+  result |= testLaplacianAssemblyPlan();
+  result |= testLaplacianOperator();
+  result |= testRenumberRCM();
+  result |= testRenumberSFC();
+  result |= testSolveLaplacian();
+  result |= testCSRDirichlet();
+
+  return result;
 }
 
 
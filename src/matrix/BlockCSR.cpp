@@ -0,0 +1,324 @@
+/*
+    Block CSR storage:
+    For a system with B unknowns per mesh node (e.g., 3 velocity components) every
+    nonzero of the mesh graph becomes a dense B x B block. The block pattern is the
+    node pattern of SparseCSR: block row i has a block for node i (diagonal) and one
+    for each point surrounding point i, with sorted block columns.
+
+    For example, with B = 2 and the node graph
+    1  1  0
+    1  1  1
+    0  1  1
+    the block row pointers are [0, 2, 5, 7], the block columns [0, 1, 0, 1, 2, 1, 2]
+    and block k occupies vals[4k .. 4k+3] as (a00, a01, a10, a11).
+
+    The block SpMV keeps the B partial sums of a block row in registers and reads one
+    column index per B*B values; the block size is a template parameter, so the
+    inner B x B loops are fully unrolled by the compiler.
+*/
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include <stdexcept>
+#include "BlockCSR.h"
+#include "../laplacian/Laplacian.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+template< int B, typename Index >
+BlockCSR<B,Index>::BlockCSR(const std::pair< std::vector<std::size_t>,
+                                             std::vector<std::size_t> >& psup)
+// *****************************************************************************
+//  Constructor: create the block pattern from points surrounding points
+//! \param[in] psup Points surrounding points of the mesh graph, see genPsup;
+//!   node ids start from zero, every node gets a block row
+//! \details Count-then-fill as in SparseCSR: the first pass counts the blocks
+//!   of each block row (neighbours + diagonal), the second writes the sorted
+//!   block columns, merging the diagonal into the sorted neighbour list.
+// *****************************************************************************
+{
+   const auto& psup1 = psup.first;
+   const auto& psup2 = psup.second;
+   assert(!psup2.empty());
+   const std::size_t npoin = psup2.size() - 1;
+
+   // pass 1: count blocks of each block row
+   rows_ptr.resize(npoin + 1);
+   rows_ptr[0] = 0;
+   for (std::size_t p = 0; p < npoin; ++p)
+      rows_ptr[p+1] = rows_ptr[p] + static_cast<Index>(psup2[p+1] - psup2[p]) + 1;
+
+   // pass 2: fill block columns
+   colidx.resize(static_cast<std::size_t>(rows_ptr.back()));
+   std::size_t n = 0;
+   for (std::size_t p = 0; p < npoin; ++p) {
+      bool diag = false;
+      for (std::size_t i = psup2[p] + 1; i <= psup2[p+1]; ++i) {
+         if (!diag && psup1[i] > p) {
+            colidx[n++] = static_cast<Index>(p);
+            diag = true;
+         }
+         colidx[n++] = static_cast<Index>(psup1[i]);
+      }
+      if (!diag) colidx[n++] = static_cast<Index>(p);
+   }
+
+   vals.assign(colidx.size() * B * B, 0.0);
+   partition();
+}
+
+template< int B, typename Index >
+BlockCSR<B,Index>::BlockCSR(const std::vector<std::size_t>& connectivity, int shape_points)
+   : BlockCSR(genPsup(connectivity, static_cast<std::size_t>(shape_points),
+                      genEsup(connectivity, static_cast<std::size_t>(shape_points))))
+// *****************************************************************************
+//  Constructor: create the block pattern from mesh connectivity
+//! \param[in] connectivity Element connectivity, node ids starting from zero
+//! \param[in] shape_points Number of nodes per element
+// *****************************************************************************
+{}
+
+template< int B, typename Index >
+void BlockCSR<B,Index>::partition() {
+// *****************************************************************************
+//  Split the block rows into contiguous chunks, one per thread, with about the
+//  same number of blocks in each chunk
+// *****************************************************************************
+   Index nthreads = 1;
+#ifdef _OPENMP
+   nthreads = omp_get_max_threads();
+#endif
+   Index nrows = static_cast<Index>(rows_ptr.size()) - 1;
+   if (nthreads > nrows) nthreads = nrows > 0 ? nrows : 1;
+
+   part.assign(nthreads + 1, nrows);
+   part[0] = 0;
+   Index nnz = rows_ptr.back();
+   Index row = 0;
+   for (Index t = 1; t < nthreads; ++t) {
+      Index target = static_cast<Index>(static_cast<double>(nnz) * t / nthreads);
+      while (row < nrows && rows_ptr[row] < target) ++row;
+      part[t] = row;
+   }
+}
+
+template< int B, typename Index >
+std::size_t BlockCSR<B,Index>::slot(Index brow, Index bcol) const {
+// *****************************************************************************
+//  Find a block in the pattern
+//! \param[in] brow Block row (node)
+//! \param[in] bcol Block column (node)
+//! \return Position of the block, its values start at vals[B*B*slot]
+// *****************************************************************************
+   if (brow < 0 || brow >= static_cast<Index>(nblockrows()))
+      throw std::out_of_range("BlockCSR::slot: block row out of range");
+   auto first = colidx.begin() + rows_ptr[brow];
+   auto last = colidx.begin() + rows_ptr[brow+1];
+   auto it = std::lower_bound(first, last, bcol);
+   if (it == last || *it != bcol)
+      throw std::out_of_range("BlockCSR::slot: block not in sparsity pattern");
+   return static_cast<std::size_t>(it - colidx.begin());
+}
+
+template< int B, typename Index >
+double* BlockCSR<B,Index>::block(Index brow, Index bcol) {
+   return vals.data() + slot(brow, bcol) * B * B;
+}
+
+template< int B, typename Index >
+const double* BlockCSR<B,Index>::block(Index brow, Index bcol) const {
+   return vals.data() + slot(brow, bcol) * B * B;
+}
+
+template< int B, typename Index >
+double& BlockCSR<B,Index>::at(std::size_t row, std::size_t col) {
+   return block(static_cast<Index>(row / B), static_cast<Index>(col / B))[(row % B) * B + col % B];
+}
+
+template< int B, typename Index >
+double BlockCSR<B,Index>::getAt(std::size_t row, std::size_t col) const {
+// *****************************************************************************
+//  Get scalar entry, zero outside of the block pattern
+// *****************************************************************************
+   const auto brow = static_cast<Index>(row / B);
+   const auto bcol = static_cast<Index>(col / B);
+   auto first = colidx.begin() + rows_ptr.at(brow);
+   auto last = colidx.begin() + rows_ptr.at(brow+1);
+   auto it = std::lower_bound(first, last, bcol);
+   if (it == last || *it != bcol) return 0.0;
+   return vals[static_cast<std::size_t>(it - colidx.begin()) * B * B + (row % B) * B + col % B];
+}
+
+template< int B, typename Index >
+void BlockCSR<B,Index>::zero() {
+   std::fill(vals.begin(), vals.end(), 0.0);
+}
+
+template< int B, typename Index >
+void BlockCSR<B,Index>::dirichlet(std::size_t node, int comp, double val, std::vector<double>& b)
+// *****************************************************************************
+//  Set Dirichlet boundary condition on one component of a node
+//! \param[in] node Node id (block row) at which to set the BC
+//! \param[in] comp Component of the node, 0 <= comp < B
+//! \param[in] val Value of Dirichlet BC
+//! \param[in,out] b RHS to modify as a result of setting the Dirichlet BC
+//! \details The known column is moved to the right-hand side and zeroed, the
+//!   row becomes the identity row and b gets the prescribed value, so the
+//!   matrix stays symmetric. The block pattern is structurally symmetric, so
+//!   only the blocks of the node's neighbours hold entries of the column.
+// *****************************************************************************
+{
+   const auto i = static_cast<Index>(node);
+   const std::size_t row = node * B + static_cast<std::size_t>(comp);
+
+   // move column to rhs: blocks (r,i) for all neighbours r of i
+   for (Index k = rows_ptr[i]; k < rows_ptr[i+1]; ++k) {
+      const Index r = colidx[k];
+      double* blk = block(r, i);
+      for (int a = 0; a < B; ++a) {
+         b[static_cast<std::size_t>(r) * B + a] -= blk[a*B + comp] * val;
+         blk[a*B + comp] = 0.0;
+      }
+   }
+
+   // zero row and put in diagonal
+   for (Index k = rows_ptr[i]; k < rows_ptr[i+1]; ++k) {
+      double* blk = vals.data() + static_cast<std::size_t>(k) * B * B;
+      for (int c = 0; c < B; ++c) blk[comp*B + c] = 0.0;
+      if (colidx[k] == i) blk[comp*B + comp] = 1.0;
+   }
+   b[row] = val;
+}
+
+template< int B, typename Index >
+void BlockCSR<B,Index>::dirichlet(std::size_t node, const std::array<double,B>& val,
+                                  std::vector<double>& b)
+// *****************************************************************************
+//  Set Dirichlet boundary condition on all components of a node
+//! \param[in] node Node id (block row) at which to set the BC
+//! \param[in] val Values of Dirichlet BC, one per component
+//! \param[in,out] b RHS to modify as a result of setting the Dirichlet BC
+//! \details Same as B calls of the single-component dirichlet(), but each
+//!   neighbour block is updated once: b_r -= A_ri * val and A_ri = 0, then
+//!   block row i becomes the identity block row and b_i = val.
+// *****************************************************************************
+{
+   const auto i = static_cast<Index>(node);
+
+   for (Index k = rows_ptr[i]; k < rows_ptr[i+1]; ++k) {
+      const Index r = colidx[k];
+      if (r == i) continue;
+      double* blk = block(r, i);
+      for (int a = 0; a < B; ++a) {
+         double sum = 0.0;
+         for (int c = 0; c < B; ++c) {
+            sum += blk[a*B + c] * val[c];
+            blk[a*B + c] = 0.0;
+         }
+         b[static_cast<std::size_t>(r) * B + a] -= sum;
+      }
+   }
+
+   for (Index k = rows_ptr[i]; k < rows_ptr[i+1]; ++k) {
+      double* blk = vals.data() + static_cast<std::size_t>(k) * B * B;
+      for (int e = 0; e < B*B; ++e) blk[e] = 0.0;
+      if (colidx[k] == i)
+         for (int a = 0; a < B; ++a) blk[a*B + a] = 1.0;
+   }
+   for (int a = 0; a < B; ++a) b[node * B + a] = val[a];
+}
+
+template< int B, typename Index >
+void BlockCSR<B,Index>::mult(const std::vector<double> &x, std::vector<double> &r) const {
+// *****************************************************************************
+//  Multiply with vector from the right in place: r = A * x
+//! \param[in] x Vector to multiply matrix with from the right, B entries per node
+//! \param[in,out] r Result vector, only (re)allocated if its size is wrong
+// *****************************************************************************
+   if (x.size() != rows()) {
+      std::cerr<<"Cannot multiply matrix by vector : Wrong shapes" << x.size() << " != "<< rows()<<std::endl;
+      throw std::length_error("BlockCSR::mult: wrong shapes");
+   }
+   if (r.size() != rows()) r.resize(rows());
+   multAdd(1.0, x, 0.0, x, r);
+}
+
+template< int B, typename Index >
+void BlockCSR<B,Index>::multAdd(double alpha, const std::vector<double> &x,
+                                double beta, const std::vector<double> &y,
+                                std::vector<double> &r) const {
+// *****************************************************************************
+//  Fused multiply-add with vector from the right: r = alpha * A * x + beta * y
+//! \param[in] alpha Scalar multiplying A * x
+//! \param[in] x Vector to multiply matrix with from the right
+//! \param[in] beta Scalar multiplying y
+//! \param[in] y Vector to add, may be the same object as r
+//! \param[in,out] r Result vector, only (re)allocated if its size is wrong
+//! \details Block rows are processed in parallel (if compiled with OpenMP)
+//!   using the static block-balanced partition computed at construction.
+// *****************************************************************************
+   if (x.size() != rows() || y.size() != rows()) {
+      std::cerr<<"Cannot multiply matrix by vector : Wrong shapes" << x.size() << ", " << y.size()
+               << " != "<< rows()<<std::endl;
+      throw std::length_error("BlockCSR::multAdd: wrong shapes");
+   }
+   if (r.size() != rows()) r.resize(rows());
+
+   const Index* rp = rows_ptr.data();
+   const Index* cp = colidx.data();
+   const double* vp = vals.data();
+   const double* xp = x.data();
+   const double* yp = y.data();
+   double* rr = r.data();
+   const Index nparts = static_cast<Index>(part.size()) - 1;
+
+#ifdef _OPENMP
+   #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+   for (Index t = 0; t < nparts; ++t) {
+      for (Index i = part[t]; i < part[t+1]; ++i) {
+         double sum[B] = {};
+         for (Index k = rp[i]; k < rp[i+1]; ++k) {
+            const double* a = vp + static_cast<std::size_t>(k) * B * B;
+            const double* xj = xp + static_cast<std::size_t>(cp[k]) * B;
+            for (int p = 0; p < B; ++p)
+               for (int q = 0; q < B; ++q)
+                  sum[p] += a[p*B + q] * xj[q];
+         }
+         double* ri = rr + static_cast<std::size_t>(i) * B;
+         const double* yi = yp + static_cast<std::size_t>(i) * B;
+         for (int p = 0; p < B; ++p)
+            ri[p] = alpha * sum[p] + (beta != 0.0 ? beta * yi[p] : 0.0);
+      }
+   }
+}
+
+template< int B, typename Index >
+std::ostream& BlockCSR<B,Index>::write_matlab( std::ostream& os ) const
+// *****************************************************************************
+//  Write out the scalar matrix in Matlab/Octave format
+//! \param[in,out] os Output stream to write to
+//! \return Updated output stream
+// *****************************************************************************
+{
+   os << "A = [ ";
+   for (std::size_t i = 0; i < rows(); ++i) {
+      for (std::size_t j = 0; j < rows(); ++j) os << getAt(i, j) << ' ';
+      os << ";\n";
+   }
+   os << "]\n";
+   return os;
+}
+
+template class BlockCSR< 2, std::int32_t >;
+template class BlockCSR< 3, std::int32_t >;
+template class BlockCSR< 4, std::int32_t >;
+template class BlockCSR< 5, std::int32_t >;
+template class BlockCSR< 2, std::int64_t >;
+template class BlockCSR< 3, std::int64_t >;
+template class BlockCSR< 4, std::int64_t >;
+template class BlockCSR< 5, std::int64_t >;
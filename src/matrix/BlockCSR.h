@@ -0,0 +1,80 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include "LinearOperator.h"
+
+//! \brief Block compressed sparse row matrix for B unknowns per mesh node
+//! \tparam B Number of components per node, i.e., the block size (2..5)
+//! \tparam Index Integer type of block row pointers and block column indices
+//! \details The sparsity pattern is that of the mesh graph: block row i holds
+//!   one dense B x B block (stored row-major) for node i and each of its
+//!   neighbours, so one column index is stored per block instead of one per
+//!   scalar entry. Scalar unknowns are numbered node by node, i.e., component
+//!   c of node i is row i*B + c. Explicitly instantiated in BlockCSR.cpp for
+//!   B = 2, 3, 4, 5 and std::int32_t and std::int64_t indices.
+template< int B, typename Index = std::int32_t >
+class BlockCSR : public LinearOperator< BlockCSR<B,Index> >
+{
+    static_assert(B >= 2 && B <= 5, "BlockCSR: block size must be 2, 3, 4 or 5");
+
+private:
+    std::vector<Index> colidx;     // block column indices
+    std::vector<Index> rows_ptr;   // block row pointers
+    std::vector<double> vals;      // B*B values of each block, row-major
+    std::vector<Index> part;       // block row partition for threads, balanced by blocks
+    void partition();
+
+public:
+    using index_type = Index;
+    using value_type = double;
+    static constexpr int block_size = B;
+
+    //! Constructor: block pattern from points surrounding points, see genPsup
+    explicit BlockCSR(const std::pair< std::vector<std::size_t>,
+                                       std::vector<std::size_t> >& psup);
+    //! Constructor: block pattern from zero-based mesh connectivity
+    BlockCSR(const std::vector<std::size_t>& connectivity, int shape_points);
+
+    std::size_t nblockrows() const { return rows_ptr.size() - 1; }
+    std::size_t nblocks() const { return colidx.size(); }
+    std::size_t rows() const { return nblockrows() * B; }         // scalar rows
+    std::size_t cols() const { return rows(); }                   // scalar columns
+    std::size_t nonzeros() const { return vals.size(); }          // stored scalar entries
+
+    std::size_t slot(Index brow, Index bcol) const;  // position of block (brow,bcol) among the blocks
+    double* block(Index brow, Index bcol);           // B*B block, row-major
+    const double* block(Index brow, Index bcol) const;
+    double& at(std::size_t row, std::size_t col);    // scalar entry, row = node*B + component
+    double getAt(std::size_t row, std::size_t col) const;
+    double* data() { return vals.data(); }           // raw access to the values vector
+    void zero();                                      // zero all stored values
+
+    //! Dirichlet BC on all components of a node
+    void dirichlet(std::size_t node, const std::array<double,B>& val, std::vector<double>& b);
+    //! Dirichlet BC on one component of a node
+    void dirichlet(std::size_t node, int comp, double val, std::vector<double>& b);
+
+    const std::vector<Index> &getRPtr() const { return rows_ptr; }  // block row pointers
+    const std::vector<Index> &getCols() const { return colidx; }      // block column indices
+    const std::vector<double> &getVals() const { return vals; }     // block values
+
+    void mult( const std::vector<double> &x, std::vector<double> &r ) const;   // r = A*x
+    void multAdd( double alpha, const std::vector<double> &x,
+                  double beta, const std::vector<double> &y,
+                  std::vector<double> &r ) const;                             // r = alpha*A*x + beta*y
+    void apply( const std::vector<double> &x, std::vector<double> &y ) const { mult(x, y); }
+    std::ostream& write_matlab( std::ostream &os ) const;
+};
+
+extern template class BlockCSR< 2, std::int32_t >;
+extern template class BlockCSR< 3, std::int32_t >;
+extern template class BlockCSR< 4, std::int32_t >;
+extern template class BlockCSR< 5, std::int32_t >;
+extern template class BlockCSR< 2, std::int64_t >;
+extern template class BlockCSR< 3, std::int64_t >;
+extern template class BlockCSR< 4, std::int64_t >;
+extern template class BlockCSR< 5, std::int64_t >;
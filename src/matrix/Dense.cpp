@@ -1,32 +1,101 @@
+/*
+    Dense storage:
+    The matrix is stored row-major in one contiguous buffer aligned to 64 bytes.
+    Rows are ld() = cols rounded up to a multiple of 8 doubles apart, so each row
+    starts on a cache line; the padding entries at the end of the rows are zero.
+    Entry (i,j) is at matrix[i*ld() + j].
+
+    Kernels:
+    The products are blocked for the caches and written so that the innermost
+    loops run over contiguous memory with independent iterations, which the
+    compiler vectorizes (omp simd), and the rows are split among OpenMP threads.
+    GEMV computes the dot products of four rows at a time against a block of x
+    that stays in L1. GEMM updates blocks of C with the axpy form
+    C(i,:) += A(i,k) * B(k,:): a tile of B is reused by all rows of a block of
+    A, and four rows of C share each load of B.
+
+    Transpose and reshape:
+    A square matrix is transposed in place by swapping tiles across the diagonal,
+    a rectangular one by a tiled copy into a single new buffer. Reshape keeps the
+    row-major order of the entries, so it only moves rows within the buffer to
+    their new leading dimension.
+*/
 
 #include "Dense.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <utility>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+constexpr int gemv_block = 2048;  // columns of x per GEMV pass (16 KiB)
+constexpr int gemm_mc = 32;       // rows of A / C per GEMM block
+constexpr int gemm_kc = 128;      // columns of A / rows of B per GEMM block
+constexpr int gemm_nc = 256;      // columns of B / C per GEMM block
+constexpr int tile = 32;          // transpose tile size
+
+} // namespace
 
-Dense::Dense(const std::vector<std::vector<double> > &mat) : matrix(mat) {
+int Dense::leading(int cols) {
+    return (cols + 7) / 8 * 8;
+}
+
+Dense::Dense(const std::vector<std::vector<double> > &mat) {
     //********************************************************************************
     //! \param[in] mat input matrix (2*2 vector)
-    //! \brief this will save #rows, #cols and input matrix in the object
+    //! \brief this will save #rows, #cols and copy the input matrix into the buffer
     //********************************************************************************
 
-    int rows = mat.size();
-    int cols = mat[0].size();
-    this->rows = rows;
-    this->cols = cols;
-    this->matrix = mat;
+    this->nrows = mat.size();
+    this->ncols = mat.empty() ? 0 : mat[0].size();
+    this->stride = leading(this->ncols);
+    matrix.assign(static_cast<std::size_t>(nrows) * stride, 0.0);
+    for (int i = 0; i < nrows; i++)
+        std::copy(mat[i].begin(), mat[i].begin() + ncols, matrix.begin() + std::size_t(i) * stride);
 }
 
+Dense::Dense(int rows, int cols, double value)
+    : nrows(rows), ncols(cols), stride(leading(cols)) {
+    //********************************************************************************
+    //! \param[in] rows number of rows
+    //! \param[in] cols number of columns
+    //! \param[in] value initial value of all entries
+    //********************************************************************************
 
+    matrix.assign(static_cast<std::size_t>(nrows) * stride, 0.0);
+    if (value != 0.0)
+        for (int i = 0; i < nrows; i++)
+            std::fill_n(matrix.begin() + std::size_t(i) * stride, ncols, value);
+}
 
-void Dense::set_matrix(std::vector<std::vector<double> > matrix) {
+void Dense::restride(int new_stride) {
     //********************************************************************************
-    //! \param[in] matrix the matrix you want to set in the object
-    //! \brief this is a simple setter for the matrix
+    //! \param[in] new_stride the new leading dimension, at least cols
+    //! \brief move the rows in place to a new distance, zeroing the new padding
     //********************************************************************************
 
-
-    this->matrix = matrix;
-    this->rows =matrix.size();
-    this->cols = matrix.size() > 0 ? matrix[0].size() : 0;
+    if (new_stride == stride) return;
+    if (new_stride < stride) {
+        for (int i = 1; i < nrows; i++)
+            std::memmove(&matrix[std::size_t(i) * new_stride],
+                         &matrix[std::size_t(i) * stride], sizeof(double) * ncols);
+        matrix.resize(static_cast<std::size_t>(nrows) * new_stride);
+    } else {
+        matrix.resize(static_cast<std::size_t>(nrows) * new_stride);
+        for (int i = nrows - 1; i >= 0; i--) {
+            if (i > 0)
+                std::memmove(&matrix[std::size_t(i) * new_stride],
+                             &matrix[std::size_t(i) * stride], sizeof(double) * ncols);
+            std::fill(matrix.begin() + std::size_t(i) * new_stride + ncols,
+                      matrix.begin() + std::size_t(i + 1) * new_stride, 0.0);
+        }
+    }
+    stride = new_stride;
 }
 
 double& Dense::at(int row, int col){
@@ -36,7 +105,17 @@ double& Dense::at(int row, int col){
     //! \brief this works as setter/getter
     //********************************************************************************
 
-    return this->matrix[row][col];
+    return matrix[std::size_t(row) * stride + col];
+}
+
+double Dense::getAt(int row, int col) const {
+    //********************************************************************************
+    //! \param[in] row the wanted element's row position
+    //! \param[in] col the wanted element's col position
+    //! \brief read-only access to an element
+    //********************************************************************************
+
+    return matrix[std::size_t(row) * stride + col];
 }
 
 // this is just a placeholder for now - it may be deleted in the future
@@ -45,20 +124,20 @@ std::vector<int> Dense::shape() {
     //! \brief to get the shape of the matrix (#rows,#cols)
     //********************************************************************************
     std::vector<int> shape(2);
-    shape[0] = rows;
-    shape[1] = cols;
-    
+    shape[0] = nrows;
+    shape[1] = ncols;
+
     return shape;
 }
 
 void Dense::print() const{
     //********************************************************************************
-    //! \brief to print the matrix 
+    //! \brief to print the matrix
     //********************************************************************************
 
-    for (int i = 0; i < this->rows; i++) {
-        for (int j = 0; j < this->cols; j++) {
-            std::cout << matrix[i][j] << " ";
+    for (int i = 0; i < this->nrows; i++) {
+        for (int j = 0; j < this->ncols; j++) {
+            std::cout << getAt(i, j) << " ";
         }
         std::cout << std::endl;
     }
@@ -66,56 +145,80 @@ void Dense::print() const{
 
 void Dense::reshape(int rows, int cols) {
     //********************************************************************************
-    //! \param[in] rows the required rows 
+    //! \param[in] rows the required rows
     //! \param[in] cols the required cols
-    /*!  
+    /*!
      * \brief this function is used to reshape the array shape to a wanted one
      * for example : if you have a matrix of shape (2,2) you can reshape it to row matrix (4,1)
      * or column matrix (1,4)
-     * \note No broadcasting available - if the provided shape is not valid an error will be thrown!    
-     */ 
+     * \note No broadcasting available - if the provided shape is not valid an error will be thrown!
+     * \details The entries keep their row-major order, so the rows are packed
+     *   together and spread out again to the new leading dimension in place.
+     */
     //********************************************************************************
 
-    if (rows * cols != this->rows * this->cols) {
+    if (rows * cols != this->nrows * this->ncols) {
         std::cout << "Can't reshape this matrix to " << rows << " rows and " << cols
                   << " cols with shape " << rows << "," << cols << std::endl;
         std::cout << "Aborting" << std::endl;
         return ;
     }
 
-    std::vector<std::vector<double> > reshaped_matrix(rows, std::vector<double>(cols));
-    int curr_row = 0, curr_col = 0;
-
-    for (int i = 0; i < this->rows; i++) {
-        for (int j = 0; j < this->cols; j++) {
-            reshaped_matrix[curr_row][curr_col++] = this->matrix[i][j];
-            if (curr_col == cols) {
-                curr_row++;
-                curr_col = 0;
-            }
-        }
-    }
-
-    this->set_matrix(reshaped_matrix);
+    restride(this->ncols);
+    this->nrows = rows;
+    this->ncols = cols;
+    this->stride = cols;
+    restride(leading(cols));
 }
 
 void Dense::T() {
     //********************************************************************************
     /*!
-    * \brief Use this if you want to transpose the matrix 
+    * \brief Use this if you want to transpose the matrix
     Example : a.shape() == (3,1) =>a.T() => a.shape() == (1,3)
+    * \details Square matrices are transposed in place, tile by tile: each pair
+    *   of tiles mirrored across the diagonal is swapped by one thread. Other
+    *   shapes are copied tile by tile into one new buffer.
     */
     //********************************************************************************
 
-    std::vector<std::vector<double> > transposed(cols, std::vector<double>(rows));
+    const int ntiles = (nrows + tile - 1) / tile;
+    if (nrows == ncols) {
+        double* a = matrix.data();
+        const std::size_t ld = stride;
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic)
+#endif
+        for (int ti = 0; ti < ntiles; ti++) {
+            const int i0 = ti * tile, i1 = std::min(i0 + tile, nrows);
+            for (int j0 = i0; j0 < ncols; j0 += tile) {
+                const int j1 = std::min(j0 + tile, ncols);
+                for (int i = i0; i < i1; i++)
+                    for (int j = std::max(j0, i + 1); j < j1; j++)
+                        std::swap(a[i*ld + j], a[j*ld + i]);
+            }
+        }
+        return;
+    }
 
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            transposed[j][i] = matrix[i][j];
+    const int tstride = leading(nrows);
+    std::vector<double, AlignedAllocator<double,64> > transposed(
+        static_cast<std::size_t>(ncols) * tstride, 0.0);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (int ti = 0; ti < ntiles; ti++) {
+        const int i0 = ti * tile, i1 = std::min(i0 + tile, nrows);
+        for (int j0 = 0; j0 < ncols; j0 += tile) {
+            const int j1 = std::min(j0 + tile, ncols);
+            for (int j = j0; j < j1; j++)
+                for (int i = i0; i < i1; i++)
+                    transposed[std::size_t(j) * tstride + i] = matrix[std::size_t(i) * stride + j];
         }
     }
-    
-    set_matrix(transposed);
+    matrix.swap(transposed);
+    std::swap(nrows, ncols);
+    stride = tstride;
 }
 
  std::vector<double> Dense::mult(std::vector<double> &x) const {
@@ -126,20 +229,194 @@ void Dense::T() {
        \return The resulted vector (after multiplication)
     */
     //********************************************************************************
-    if (x.size() != cols) {
-        std::cout << "Shapes don't match: cannot multiply matrix with shape " << rows << ","
-                  << cols << " with vector of size " << x.size() << std::endl;
+    if (x.size() != static_cast<std::size_t>(ncols)) {
+        std::cout << "Shapes don't match: cannot multiply matrix with shape " << nrows << ","
+                  << ncols << " with vector of size " << x.size() << std::endl;
         return x ;
     }
 
-    std::vector<double>  dotted(rows);
-    for (int row = 0; row < rows; row++) {
-        double sum = 0;
-        for (int col = 0; col < cols; col++) {
-            sum += x[col] * matrix[row][col];
+    std::vector<double>  dotted;
+    mult(x, dotted);
+    return dotted;
+}
+
+void Dense::mult(const std::vector<double> &x, std::vector<double> &r) const {
+    //********************************************************************************
+    //! \param[in] x A vector to multiply the matrix with (from the right)
+    //! \param[out] r The result A*x, resized to the number of rows
+    //! \brief In-place variant of mult, r must not be x
+    //********************************************************************************
+
+    multAdd(1.0, x, 0.0, x, r);
+}
+
+void Dense::multAdd(double alpha, const std::vector<double> &x,
+                    double beta, const std::vector<double> &y,
+                    std::vector<double> &r) const {
+    //********************************************************************************
+    //! \param[in] alpha Factor of the product
+    //! \param[in] x A vector to multiply the matrix with (from the right)
+    //! \param[in] beta Factor of y, y is not read if beta is zero
+    //! \param[in] y Vector to add, may be the same as r
+    //! \param[out] r The result alpha*A*x + beta*y, resized to the number of rows
+    /*!
+    * \brief Fused GEMV: each thread takes a contiguous range of rows and sweeps
+    * x in blocks of gemv_block entries, accumulating four rows at a time
+    * directly into r (each thread first sets its rows to beta*y, so y may be r)
+    */
+    //********************************************************************************
+    if (x.size() != static_cast<std::size_t>(ncols) ||
+        (beta != 0.0 && y.size() != static_cast<std::size_t>(nrows))) {
+        std::cerr << "Dense multAdd: wrong vector size" << std::endl;
+        throw std::length_error("Wrong vector size for Dense multiplication");
+    }
+
+    r.resize(nrows);
+    double* sum = r.data();
+    const double* yp = beta != 0.0 ? y.data() : nullptr;
+    const double* a = matrix.data();
+    const double* xp = x.data();
+    const std::size_t ld = stride;
+    const int ngroups = (nrows + 3) / 4;
+
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
+    {
+        int g0 = 0, g1 = ngroups;
+#ifdef _OPENMP
+        const int nt = omp_get_num_threads(), t = omp_get_thread_num();
+        g0 = static_cast<int>(static_cast<long long>(ngroups) * t / nt);
+        g1 = static_cast<int>(static_cast<long long>(ngroups) * (t + 1) / nt);
+#endif
+        for (int i = 4 * g0; i < std::min(4 * g1, nrows); i++)
+            sum[i] = yp ? beta * yp[i] : 0.0;
+        for (int j0 = 0; j0 < ncols; j0 += gemv_block) {
+            const int j1 = std::min(j0 + gemv_block, ncols);
+            for (int g = g0; g < g1; g++) {
+                const int i = 4 * g;
+                if (i + 4 <= nrows) {
+                    const double *a0 = a + i*ld, *a1 = a0 + ld, *a2 = a1 + ld, *a3 = a2 + ld;
+                    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+#ifdef _OPENMP
+                    #pragma omp simd reduction(+:s0,s1,s2,s3)
+#endif
+                    for (int j = j0; j < j1; j++) {
+                        s0 += a0[j] * xp[j];
+                        s1 += a1[j] * xp[j];
+                        s2 += a2[j] * xp[j];
+                        s3 += a3[j] * xp[j];
+                    }
+                    sum[i] += alpha * s0; sum[i+1] += alpha * s1;
+                    sum[i+2] += alpha * s2; sum[i+3] += alpha * s3;
+                } else {
+                    for (int k = i; k < nrows; k++) {
+                        const double* ak = a + k*ld;
+                        double s = 0.0;
+#ifdef _OPENMP
+                        #pragma omp simd reduction(+:s)
+#endif
+                        for (int j = j0; j < j1; j++) s += ak[j] * xp[j];
+                        sum[k] += alpha * s;
+                    }
+                }
+            }
         }
-        dotted[row] = sum;
     }
-    return dotted;
+
 }
 
+void Dense::mult(const Dense &B, Dense &C) const {
+    //********************************************************************************
+    //! \param[in] B Matrix to multiply with (from the right)
+    //! \param[out] C The result A*B, reallocated if its shape does not match
+    //********************************************************************************
+
+    multAdd(1.0, B, 0.0, C);
+}
+
+void Dense::multAdd(double alpha, const Dense &B, double beta, Dense &C) const {
+    //********************************************************************************
+    //! \param[in] alpha Factor of the product
+    //! \param[in] B Matrix to multiply with (from the right)
+    //! \param[in] beta Factor of C, C is not read if beta is zero
+    //! \param[inout] C The result alpha*A*B + beta*C. If beta is zero and the
+    //!   shape of C does not match, C is reallocated. C may be A or B.
+    /*!
+    * \brief Cache-blocked GEMM: the rows of C are split among the threads in
+    * blocks of gemm_mc rows, and each block is updated with tiles of
+    * gemm_kc x gemm_nc entries of B, four rows of C at a time
+    */
+    //********************************************************************************
+    const int m = nrows, n = B.ncols, kk = ncols;
+    if (B.nrows != kk) {
+        std::cerr << "Dense multAdd: shapes " << nrows << "," << ncols << " and "
+                  << B.nrows << "," << B.ncols << " don't match" << std::endl;
+        throw std::length_error("Wrong matrix shapes for Dense multiplication");
+    }
+    if ((C.nrows != m || C.ncols != n) && beta != 0.0) {
+        std::cerr << "Dense multAdd: result has shape " << C.nrows << "," << C.ncols
+                  << " instead of " << m << "," << n << std::endl;
+        throw std::length_error("Wrong result shape for Dense multiplication");
+    }
+    if (&C == this || &C == &B) {
+        Dense P(m, n);
+        multAdd(alpha, B, 0.0, P);
+        if (beta != 0.0)
+            for (std::size_t k = 0; k < P.matrix.size(); k++) P.matrix[k] += beta * C.matrix[k];
+        C = std::move(P);
+        return;
+    }
+    if (C.nrows != m || C.ncols != n) C = Dense(m, n);
+
+    if (beta == 0.0) std::fill(C.matrix.begin(), C.matrix.end(), 0.0);
+    else if (beta != 1.0) for (auto& c : C.matrix) c *= beta;
+
+    const double* a = matrix.data();
+    const double* b = B.matrix.data();
+    double* c = C.matrix.data();
+    const std::size_t lda = stride, ldb = B.stride, ldc = C.stride;
+    const int nblocks = (m + gemm_mc - 1) / gemm_mc;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (int ib = 0; ib < nblocks; ib++) {
+        const int i0 = ib * gemm_mc, i1 = std::min(i0 + gemm_mc, m);
+        for (int k0 = 0; k0 < kk; k0 += gemm_kc) {
+            const int k1 = std::min(k0 + gemm_kc, kk);
+            for (int j0 = 0; j0 < n; j0 += gemm_nc) {
+                const int j1 = std::min(j0 + gemm_nc, n);
+                int i = i0;
+                for (; i + 4 <= i1; i += 4) {
+                    double *c0 = c + i*ldc, *c1 = c0 + ldc, *c2 = c1 + ldc, *c3 = c2 + ldc;
+                    for (int k = k0; k < k1; k++) {
+                        const double a0 = alpha * a[i*lda + k], a1 = alpha * a[(i+1)*lda + k],
+                                     a2 = alpha * a[(i+2)*lda + k], a3 = alpha * a[(i+3)*lda + k];
+                        const double* bk = b + k*ldb;
+#ifdef _OPENMP
+                        #pragma omp simd
+#endif
+                        for (int j = j0; j < j1; j++) {
+                            c0[j] += a0 * bk[j];
+                            c1[j] += a1 * bk[j];
+                            c2[j] += a2 * bk[j];
+                            c3[j] += a3 * bk[j];
+                        }
+                    }
+                }
+                for (; i < i1; i++) {
+                    double* ci = c + i*ldc;
+                    for (int k = k0; k < k1; k++) {
+                        const double ai = alpha * a[i*lda + k];
+                        const double* bk = b + k*ldb;
+#ifdef _OPENMP
+                        #pragma omp simd
+#endif
+                        for (int j = j0; j < j1; j++) ci[j] += ai * bk[j];
+                    }
+                }
+            }
+        }
+    }
+}
@@ -1,20 +1,70 @@
 #pragma once
 #include "Matrix.h"
+#include "LinearOperator.h"
+#include <cstddef>
+#include <cstdlib>
 #include <iostream>
+#include <new>
 
-class Dense : public Matrix
+//! \brief Allocator returning memory aligned to Align bytes, for the Dense rows
+template< typename T, std::size_t Align >
+struct AlignedAllocator
+{
+    using value_type = T;
+    template< typename U > struct rebind { using other = AlignedAllocator<U,Align>; };
+
+    AlignedAllocator() = default;
+    template< typename U > AlignedAllocator(const AlignedAllocator<U,Align>&) {}
+
+    T* allocate(std::size_t n) {
+        if (n == 0) return nullptr;
+        std::size_t bytes = (n * sizeof(T) + Align - 1) / Align * Align;
+        void* p = std::aligned_alloc(Align, bytes);
+        if (!p) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, std::size_t) { std::free(p); }
+
+    template< typename U >
+    bool operator==(const AlignedAllocator<U,Align>&) const { return true; }
+    template< typename U >
+    bool operator!=(const AlignedAllocator<U,Align>&) const { return false; }
+};
+
+//! \brief Dense row-major matrix in one contiguous, 64-byte aligned buffer
+//! \details Row i starts at data() + i*ld(). The leading dimension ld() is the
+//!   number of columns rounded up to a multiple of 8 doubles, so every row
+//!   starts on a cache line and vector loads of a row are aligned. The padding
+//!   entries are kept zero.
+class Dense : public Matrix, public LinearOperator<Dense>
 {
 private:
-    std::vector<std::vector<double> > matrix;
-    int rows,cols;
-    void set_matrix(std::vector<std::vector<double> > matrix);
+    std::vector<double, AlignedAllocator<double,64> > matrix;
+    int nrows,ncols;
+    int stride;                       // leading dimension: distance between rows
+    static int leading(int cols);     // padded row length for cols columns
+    void restride(int new_stride);    // move the rows to a new leading dimension
 
 public:
     Dense(const std::vector<std::vector<double> > &mat);
+    Dense(int rows, int cols, double value = 0.0);
     double& at(int row,int col);
+    double getAt(int row, int col) const;
     std::vector<int> shape() ;
+    std::size_t rows() const { return nrows; }
+    std::size_t cols() const { return ncols; }
+    int ld() const { return stride; }             // leading dimension
+    double* data() { return matrix.data(); }      // row-major, rows ld() apart
+    const double* data() const { return matrix.data(); }
     void print() const;
     void reshape(int rows, int cols);
     void T();
     std::vector<double> mult( std::vector<double> &vec) const;
+    void mult( const std::vector<double> &x, std::vector<double> &r ) const;   // r = A*x
+    void multAdd( double alpha, const std::vector<double> &x,
+                  double beta, const std::vector<double> &y,
+                  std::vector<double> &r ) const;                             // r = alpha*A*x + beta*y
+    void apply( const std::vector<double> &x, std::vector<double> &y ) const { mult(x, y); }
+    void mult( const Dense &B, Dense &C ) const;                              // C = A*B
+    void multAdd( double alpha, const Dense &B, double beta, Dense &C ) const;  // C = alpha*A*B + beta*C
 };
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//! \brief Static interface of a linear operator y = A*x, resolved at compile time
+//! \tparam Derived The operator class (CRTP), which must provide
+//!   - std::size_t rows() const
+//!   - std::size_t cols() const
+//!   - void apply(const std::vector<double>& x, std::vector<double>& y) const,
+//!     computing y = A*x with y resized to rows()
+//! \details Solvers take a const LinearOperator<Op>& and call apply() through
+//!   derived(), so the product of the concrete matrix is called directly and
+//!   can be inlined, unlike the virtual Matrix::mult that returns a new vector
+//!   on every call. The helpers below are built on apply() only.
+template< class Derived >
+class LinearOperator
+{
+public:
+    const Derived& derived() const { return static_cast<const Derived&>(*this); }
+
+    //! r = b - A*x
+    void residual( const std::vector<double>& b, const std::vector<double>& x,
+                   std::vector<double>& r ) const {
+        derived().apply(x, r);
+        for (std::size_t i = 0; i < r.size(); ++i) r[i] = b[i] - r[i];
+    }
+
+    //! Y = A*X for k vectors stored interleaved: X[j*k + c] is entry j of
+    //! vector c. One apply() per vector; operators with a multi-vector kernel
+    //! (SpMM) provide their own applyBlock, which hides this one.
+    void applyBlock( std::size_t k, const std::vector<double>& X,
+                     std::vector<double>& Y ) const {
+        const Derived& A = derived();
+        std::vector<double> x(A.cols()), y;
+        Y.resize(A.rows() * k);
+        for (std::size_t c = 0; c < k; ++c) {
+            for (std::size_t j = 0; j < x.size(); ++j) x[j] = X[j*k + c];
+            A.apply(x, y);
+            for (std::size_t i = 0; i < y.size(); ++i) Y[i*k + c] = y[i];
+        }
+    }
+
+    //! Return A*x in a new vector, for setup code outside of hot loops
+    std::vector<double> operator*( const std::vector<double>& x ) const {
+        std::vector<double> y;
+        derived().apply(x, y);
+        return y;
+    }
+
+protected:
+    LinearOperator() = default;
+    LinearOperator(const LinearOperator&) = default;
+    LinearOperator& operator=(const LinearOperator&) = default;
+    ~LinearOperator() = default;
+};
+
+//! \brief Detects whether Op has the members required by LinearOperator
+//! \details Used in static_assert messages of templates that accept any
+//!   operator type, in place of a C++20 concept.
+template< class Op, class = void >
+struct is_linear_operator : std::false_type {};
+
+template< class Op >
+struct is_linear_operator< Op, std::void_t<
+    decltype( std::size_t( std::declval<const Op&>().rows() ) ),
+    decltype( std::size_t( std::declval<const Op&>().cols() ) ),
+    decltype( std::declval<const Op&>().apply( std::declval<const std::vector<double>&>(),
+                                               std::declval<std::vector<double>&>() ) ) > >
+  : std::true_type {};
+
+template< class Op >
+inline constexpr bool is_linear_operator_v = is_linear_operator<Op>::value;
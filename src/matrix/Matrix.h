@@ -2,6 +2,9 @@
 
 #include <vector>
 
+// Runtime-polymorphic matrix interface. Solvers and other hot loops use the
+// static LinearOperator interface (LinearOperator.h) instead, which avoids the
+// virtual calls and the vector returned by mult().
 class Matrix
 {
 public:
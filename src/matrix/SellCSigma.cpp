@@ -0,0 +1,355 @@
+/*
+    SELL-C-sigma storage:
+    The rows of a CSR matrix are sorted by decreasing length within windows of sigma
+    rows (perm maps a sorted row back to the original one) and cut into chunks of C
+    consecutive sorted rows. A chunk is padded to the length of its longest row and
+    stored column-major: entry k of lane l of chunk c is at chunk_ptr[c] + k*C + l.
+    Padding entries have value zero and repeat the last column of their row, so the
+    gathers stay inside the rows' own part of x.
+
+    For example, with C = 2 the chunk of rows
+        row 4: (0, a) (4, b) (5, c)
+        row 7: (6, d) (7, e)
+    is stored as
+        colidx = [0, 6,  4, 7,  5, 7]
+        vals   = [a, d,  b, e,  c, 0]
+
+    SpMV kernels:
+    One SIMD lane computes one row, so a chunk of C = 8 rows is one AVX-512 vector or
+    two AVX2 vectors per stored column, with the x entries fetched by gather
+    instructions. The kernels are compiled for their instruction sets with function
+    target attributes and chosen at runtime, so the library still runs on CPUs
+    without AVX; the scalar kernel works for any C.
+*/
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include "SellCSigma.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SELL_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+//! Read-only view of the SELL-C-sigma arrays passed to the kernels
+struct SellView {
+   std::size_t C;
+   std::size_t nrows;
+   const std::size_t* cptr;
+   const std::int32_t* clen;
+   const std::int32_t* perm;
+   const std::int32_t* col;
+   const double* val;
+};
+
+//! Write lane results of a chunk: r[row] = alpha*sum + beta*y[row] (y may alias r)
+inline void store( const SellView& A, std::size_t first, const double* sum,
+                   std::size_t lanes, double alpha, double beta,
+                   const double* y, double* r )
+{
+   for (std::size_t l = 0; l < lanes; ++l) {
+      std::size_t i = first + l;
+      if (i >= A.nrows) return;
+      std::int32_t row = A.perm[i];
+      r[row] = alpha * sum[l] + (beta != 0.0 ? beta * y[row] : 0.0);
+   }
+}
+
+void kernelScalar( const SellView& A, std::size_t c0, std::size_t c1,
+                   double alpha, const double* x, double beta,
+                   const double* y, double* r )
+{
+   for (std::size_t c = c0; c < c1; ++c) {
+      const std::size_t off = A.cptr[c];
+      const std::size_t len = static_cast<std::size_t>(A.clen[c]);
+      for (std::size_t l = 0; l < A.C; ++l) {
+         double sum = 0.0;
+         for (std::size_t k = 0; k < len; ++k)
+            sum += A.val[off + k*A.C + l] * x[A.col[off + k*A.C + l]];
+         store(A, c*A.C + l, &sum, 1, alpha, beta, y, r);
+      }
+   }
+}
+
+#ifdef SELL_X86_KERNELS
+__attribute__((target("avx2,fma")))
+void kernelAVX2( const SellView& A, std::size_t c0, std::size_t c1,
+                 double alpha, const double* x, double beta,
+                 const double* y, double* r )
+{
+   alignas(32) double sum[4];
+   // masked gather with a zero source: the unmasked form reads an
+   // uninitialized source register (-Wmaybe-uninitialized)
+   const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+   for (std::size_t c = c0; c < c1; ++c) {
+      const std::size_t off = A.cptr[c];
+      const std::size_t len = static_cast<std::size_t>(A.clen[c]);
+      for (std::size_t g = 0; g < A.C; g += 4) {
+         __m256d acc = _mm256_setzero_pd();
+         for (std::size_t k = 0; k < len; ++k) {
+            const std::size_t e = off + k*A.C + g;
+            __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(A.col + e));
+            __m256d xv = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), x, idx, all, 8);
+            acc = _mm256_fmadd_pd(_mm256_loadu_pd(A.val + e), xv, acc);
+         }
+         _mm256_store_pd(sum, acc);
+         store(A, c*A.C + g, sum, 4, alpha, beta, y, r);
+      }
+   }
+}
+
+__attribute__((target("avx512f")))
+void kernelAVX512( const SellView& A, std::size_t c0, std::size_t c1,
+                   double alpha, const double* x, double beta,
+                   const double* y, double* r )
+{
+   alignas(64) double sum[8];
+   for (std::size_t c = c0; c < c1; ++c) {
+      const std::size_t off = A.cptr[c];
+      const std::size_t len = static_cast<std::size_t>(A.clen[c]);
+      for (std::size_t g = 0; g < A.C; g += 8) {
+         __m512d acc = _mm512_setzero_pd();
+         for (std::size_t k = 0; k < len; ++k) {
+            const std::size_t e = off + k*A.C + g;
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(A.col + e));
+            __m512d xv = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, idx, x, 8);
+            acc = _mm512_fmadd_pd(_mm512_loadu_pd(A.val + e), xv, acc);
+         }
+         _mm512_store_pd(sum, acc);
+         store(A, c*A.C + g, sum, 8, alpha, beta, y, r);
+      }
+   }
+}
+#endif
+
+} // namespace
+
+
+template< typename Index >
+SellCSigma::SellCSigma(const SparseCSR<Index,double> &A, int C_, int sigma_)
+   : C(C_), sigma(sigma_), nrows(0), ncols(0), nnz(0), kern(Scalar) {
+// *****************************************************************************
+//  Convert a CSR matrix to SELL-C-sigma
+//! \param[in] A Matrix to convert, full or symmetric storage, may be rectangular
+//! \param[in] C_ Chunk height, a multiple of 8 allows the AVX-512 kernel and a
+//!   multiple of 4 the AVX2 kernel
+//! \param[in] sigma_ Sorting window in rows, rounded up to a multiple of C_;
+//!   C_ (or 1) keeps the original row order, larger windows reduce padding
+//! \details Stored zeros of A are kept, so the pattern is the same as A's.
+// *****************************************************************************
+   if (C < 1 || sigma < 1)
+      throw std::invalid_argument("SellCSigma: chunk size and sorting window must be positive");
+   sigma = ((sigma + C - 1) / C) * C;
+
+   // symmetric storage only holds the upper triangle: convert a full copy
+   std::optional< SparseCSR<Index,double> > full;
+   const SparseCSR<Index,double>* src = &A;
+   if (A.isSymmetric()) {
+      full.emplace(A);
+      full->toFull();
+      src = &*full;
+   }
+   const auto& rp = src->getRPtr();
+   const auto& ci = src->getCols();
+   const auto& v  = src->getVals();
+
+   nrows = rp.size() - 1;
+   ncols = src->cols();
+   nnz = static_cast<std::size_t>(rp.back());
+   const auto maxidx = static_cast<std::size_t>(std::numeric_limits<index_type>::max());
+   if (nrows > maxidx || ncols > maxidx ||
+       (!ci.empty() && static_cast<std::size_t>(*std::max_element(ci.begin(), ci.end())) > maxidx))
+      throw std::overflow_error("SellCSigma: indices do not fit 32 bits");
+
+   auto length = [&rp](std::size_t i) { return static_cast<std::size_t>(rp[i+1] - rp[i]); };
+
+   // sort rows by decreasing length within each window of sigma rows
+   perm.resize(nrows);
+   std::iota(perm.begin(), perm.end(), 0);
+   for (std::size_t w = 0; w < nrows; w += static_cast<std::size_t>(sigma)) {
+      auto last = perm.begin() + static_cast<std::ptrdiff_t>(std::min(nrows, w + sigma));
+      std::stable_sort(perm.begin() + static_cast<std::ptrdiff_t>(w), last,
+         [&length](index_type a, index_type b) { return length(a) > length(b); });
+   }
+
+   // chunk lengths and offsets
+   const std::size_t c = static_cast<std::size_t>(C);
+   const std::size_t nchunks = (nrows + c - 1) / c;
+   chunk_len.assign(nchunks, 0);
+   chunk_ptr.assign(nchunks + 1, 0);
+   for (std::size_t k = 0; k < nchunks; ++k) {
+      std::size_t len = 0;
+      for (std::size_t i = k*c; i < std::min(nrows, (k+1)*c); ++i)
+         len = std::max(len, length(perm[i]));
+      chunk_len[k] = static_cast<index_type>(len);
+      chunk_ptr[k+1] = chunk_ptr[k] + c * len;
+   }
+
+   // fill column-major chunks, padding with zeros
+   colidx.assign(chunk_ptr.back(), 0);
+   vals.assign(chunk_ptr.back(), 0.0);
+   for (std::size_t k = 0; k < nchunks; ++k) {
+      for (std::size_t l = 0; l < c && k*c + l < nrows; ++l) {
+         const std::size_t row = static_cast<std::size_t>(perm[k*c + l]);
+         const std::size_t len = length(row);
+         index_type lastcol = len ? static_cast<index_type>(ci[rp[row] + len - 1]) : 0;
+         for (std::size_t j = 0; j < static_cast<std::size_t>(chunk_len[k]); ++j) {
+            const std::size_t e = chunk_ptr[k] + j*c + l;
+            if (j < len) {
+               colidx[e] = static_cast<index_type>(ci[rp[row] + j]);
+               vals[e] = v[rp[row] + j];
+            } else {
+               colidx[e] = lastcol;
+            }
+         }
+      }
+   }
+
+   partition();
+
+   // best kernel the CPU and the chunk size allow
+   if (supported(AVX512) && C % 8 == 0) kern = AVX512;
+   else if (supported(AVX2) && C % 4 == 0) kern = AVX2;
+}
+
+void SellCSigma::partition() {
+// *****************************************************************************
+//  Split the chunks into contiguous ranges, one per thread, with about the same
+//  number of stored entries in each range
+// *****************************************************************************
+   const std::size_t nchunks = chunk_len.size();
+   std::size_t nthreads = 1;
+#ifdef _OPENMP
+   nthreads = static_cast<std::size_t>(omp_get_max_threads());
+#endif
+   if (nthreads > nchunks) nthreads = nchunks > 0 ? nchunks : 1;
+
+   part.assign(nthreads + 1, nchunks);
+   part[0] = 0;
+   const std::size_t total = chunk_ptr.back();
+   std::size_t chunk = 0;
+   for (std::size_t t = 1; t < nthreads; ++t) {
+      const std::size_t target = static_cast<std::size_t>(static_cast<double>(total) * t / nthreads);
+      while (chunk < nchunks && chunk_ptr[chunk] < target) ++chunk;
+      part[t] = chunk;
+   }
+}
+
+bool SellCSigma::supported(Kernel k) {
+// *****************************************************************************
+//  Query whether the CPU running the program can execute a kernel
+// *****************************************************************************
+#ifdef SELL_X86_KERNELS
+   if (k == AVX512) return __builtin_cpu_supports("avx512f");
+   if (k == AVX2) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+   return k == Scalar;
+}
+
+const char* SellCSigma::name(Kernel k) {
+   switch (k) {
+      case AVX512: return "AVX-512";
+      case AVX2: return "AVX2";
+      default: return "scalar";
+   }
+}
+
+void SellCSigma::setKernel(Kernel k) {
+// *****************************************************************************
+//  Force the kernel used by the products, e.g., to compare kernels
+//! \param[in] k Kernel to use, must be supported by the CPU and the chunk size
+// *****************************************************************************
+   if (!supported(k) || (k == AVX512 && C % 8) || (k == AVX2 && C % 4))
+      throw std::invalid_argument(std::string("SellCSigma::setKernel: ") + name(k) +
+                                  " kernel not available");
+   kern = k;
+}
+
+std::size_t SellCSigma::bytes() const {
+   return chunk_ptr.size() * sizeof(std::size_t) +
+          (chunk_len.size() + perm.size() + colidx.size()) * sizeof(index_type) +
+          vals.size() * sizeof(double) + part.size() * sizeof(std::size_t);
+}
+
+double SellCSigma::fill() const {
+   return nnz ? static_cast<double>(vals.size()) / static_cast<double>(nnz) : 1.0;
+}
+
+std::vector<double> SellCSigma::mult(const std::vector<double> &x) const {
+   std::vector<double> r(nrows);
+   mult(x, r);
+   return r;
+}
+
+void SellCSigma::mult(const std::vector<double> &x, std::vector<double> &r) const {
+// *****************************************************************************
+//  Multiply with vector from the right in place: r = A * x
+//! \param[in] x Vector to multiply matrix with from the right
+//! \param[in,out] r Result vector, only (re)allocated if its size is wrong
+// *****************************************************************************
+   if (x.size() != ncols) {
+      std::cerr<<"Cannot multiply matrix by vector : Wrong shapes" << x.size() << " != "<< ncols<<std::endl;
+      throw std::length_error("SellCSigma::mult: wrong shapes");
+   }
+   if (r.size() != nrows) r.resize(nrows);
+   multAdd(1.0, x.data(), 0.0, nullptr, r.data());
+}
+
+void SellCSigma::multAdd(double alpha, const std::vector<double> &x,
+                         double beta, const std::vector<double> &y,
+                         std::vector<double> &r) const {
+// *****************************************************************************
+//  Fused multiply-add with vector from the right: r = alpha * A * x + beta * y
+//! \param[in] alpha Scalar multiplying A * x
+//! \param[in] x Vector to multiply matrix with from the right
+//! \param[in] beta Scalar multiplying y
+//! \param[in] y Vector to add, may be the same object as r
+//! \param[in,out] r Result vector, only (re)allocated if its size is wrong
+// *****************************************************************************
+   if (x.size() != ncols || y.size() != nrows) {
+      std::cerr<<"Cannot multiply matrix by vector : Wrong shapes" << x.size() << ", " << y.size()
+               << " != "<< ncols << ", " << nrows<<std::endl;
+      throw std::length_error("SellCSigma::multAdd: wrong shapes");
+   }
+   if (r.size() != nrows) r.resize(nrows);
+   multAdd(alpha, x.data(), beta, y.data(), r.data());
+}
+
+void SellCSigma::multAdd(double alpha, const double* x,
+                         double beta, const double* y, double* r) const {
+// *****************************************************************************
+//  Fused multiply-add on raw arrays, x of cols() and y, r of rows() entries:
+//  r = alpha * A * x + beta * y
+//! \details y is not read if beta is zero and may then be nullptr. Chunks are
+//!   processed in parallel (if compiled with OpenMP) using the static partition
+//!   computed at construction.
+// *****************************************************************************
+   const SellView A{ static_cast<std::size_t>(C), nrows, chunk_ptr.data(), chunk_len.data(),
+                     perm.data(), colidx.data(), vals.data() };
+   auto kernel = kernelScalar;
+#ifdef SELL_X86_KERNELS
+   if (kern == AVX512) kernel = kernelAVX512;
+   else if (kern == AVX2) kernel = kernelAVX2;
+#endif
+   const std::ptrdiff_t nparts = static_cast<std::ptrdiff_t>(part.size()) - 1;
+
+#ifdef _OPENMP
+   #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+   for (std::ptrdiff_t t = 0; t < nparts; ++t)
+      kernel(A, part[t], part[t+1], alpha, x, beta, y, r);
+}
+
+template SellCSigma::SellCSigma(const SparseCSR< std::int32_t, double >&, int, int);
+template SellCSigma::SellCSigma(const SparseCSR< std::int64_t, double >&, int, int);
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "SparseCSR.h"
+
+//! \brief Sliced ELLPACK (SELL-C-sigma) matrix for SIMD sparse matrix-vector products
+//! \details Rows are sorted by length within windows of sigma rows and grouped
+//!   into chunks of C rows. Each chunk is padded to its longest row and stored
+//!   column-major, so one SIMD lane handles one row and consecutive lanes read
+//!   consecutive memory. Tetrahedral Laplacian rows have a narrow range of
+//!   lengths, so the padding overhead stays small. Column indices are 32-bit to
+//!   match the SIMD gather instructions. The products have the same interface
+//!   as SparseCSR and run an AVX-512, AVX2 or scalar kernel, whichever is the
+//!   best the CPU supports at runtime.
+class SellCSigma : public LinearOperator<SellCSigma>
+{
+public:
+    using index_type = std::int32_t;
+    using value_type = double;
+
+    //! SpMV kernel implementations, selected at runtime
+    enum Kernel { Scalar, AVX2, AVX512 };
+
+    template< typename Index >
+    explicit SellCSigma(const SparseCSR<Index,double> &A, int C = 8, int sigma = 256);
+
+    std::size_t rows() const { return nrows; }
+    std::size_t cols() const { return ncols; }
+    std::size_t nonzeros() const { return nnz; }                  // stored nonzeros of A, without padding
+    std::size_t bytes() const;                                    // memory footprint
+    double fill() const;                                          // stored entries (incl. padding) / nonzeros
+    int chunkSize() const { return C; }
+    int sortWindow() const { return sigma; }
+
+    Kernel kernel() const { return kern; }                        // kernel used by the products
+    void setKernel(Kernel k);                                     // force a kernel, throws if unsupported
+    static bool supported(Kernel k);                              // can this CPU run kernel k?
+    static const char* name(Kernel k);
+
+    std::vector<double> mult( const std::vector<double> &x ) const;
+    void mult( const std::vector<double> &x, std::vector<double> &r ) const;  // r = A*x
+    void multAdd( double alpha, const std::vector<double> &x,
+                  double beta, const std::vector<double> &y,
+                  std::vector<double> &r ) const;                            // r = alpha*A*x + beta*y
+    void apply( const std::vector<double> &x, std::vector<double> &y ) const { mult(x, y); }
+    void multAdd( double alpha, const double* x,
+                  double beta, const double* y, double* r ) const;           // raw pointer variant
+
+private:
+    int C;                                  // chunk height (rows per chunk)
+    int sigma;                              // sorting window (rows), a multiple of C
+    std::size_t nrows;                      // number of rows
+    std::size_t ncols;                      // number of columns, the length of x
+    std::size_t nnz;                        // nonzeros of the source matrix
+    std::vector<std::size_t> chunk_ptr;     // start of each chunk in vals/colidx
+    std::vector<index_type> chunk_len;      // padded row length of each chunk
+    std::vector<index_type> perm;           // original row of each sorted row
+    std::vector<index_type> colidx;         // column indices, column-major per chunk
+    std::vector<double> vals;               // values, padding entries are zero
+    std::vector<std::size_t> part;          // chunk partition for threads, balanced by stored entries
+    Kernel kern;
+
+    void partition();
+};
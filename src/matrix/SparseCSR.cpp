@@ -1,18 +1,24 @@
 /*
     Symmetric Matrix Utilization:
     Connectivity points represent shapes connected in space, yielding a symmetric matrix.
-    Storing only the upper triangular part saves both memory and computation time.
+    By default all nonzeros are stored. In symmetric mode (constructor flag or toSymmetric())
+    only the upper triangular part is stored, which saves both memory and memory traffic:
+    the multiplication applies the stored upper part and its transpose.
 
     Row and Column Vectors:
-    From the upper triangular matrix, row_ptr and cols vectors are generated.
-    Each row's non-zero elements are counted to construct row_ptr.
+    From the (full or upper triangular) pattern, row_ptr and cols vectors are generated.
+    Each row's non-zero elements are counted to construct row_ptr. Both are zero-based
+    and of the Index template type (32- or 64-bit), so they can be passed to AMGCL
+    and Eigen as they are.
 
-    Hash Table Usage:
-    A hash table stores intermediate connectivity information to expedite further iterations.
+    Count-then-fill construction:
+    The pattern is generated from the points surrounding points (genPsup) of the mesh.
+    The first pass counts the nonzeros of each row to construct row_ptr, the second pass
+    writes cols directly into the preallocated vector. Both passes are linear in nnz.
     For example:
-    If point 0 connects to point 8, the hash table stores: [8]: [0,...].
-    Later, when processing row 8, pre-saved connections are accessed for efficient computation.
-    
+    If point 8 is surrounded by points [0, 9], row 8 gets 2 + 1 (diagonal) nonzeros
+    and its columns are written as [0, 8, 9].
+
     Example: let's consider this symmetrix matrix
     1  1  0  0  0
     1  1  1  0  0
@@ -20,27 +26,32 @@
     0  0  1  1  1
     0  0  0  1  1
 
-    the upper triangular is :
+    the upper triangular (symmetric mode) is :
     1  1  -  -  -  
        1  1  -  -  
           1  1  -  
              1  1  
                 1
-    the hash table first will contain [1]:[0]
-    when reaching the iteration (i=1) I will check the hash on i=1 -> there is connectivity with point 0 --- and so on ...
+    psup of point 1 is [0, 2], so row 1 gets 3 nonzeros with columns [0, 1, 2] --- and so on ...
 
 */
 
 #include <vector>
-#include <map>
-#include <set>
 #include <algorithm>
 #include <iostream>
 #include "SparseCSR.h"
+#include "../laplacian/Laplacian.hpp"
 #include <cassert>
+#include <stdexcept>
+#include <utility>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
-SparseCSR::SparseCSR(const std::vector<std::size_t> &connectivity, int shape_points) {
+template< typename Index, typename Value >
+SparseCSR<Index,Value>::SparseCSR(const std::vector<std::size_t> &connectivity, int shape_points, bool symmetric)
+   : sym(symmetric) {
    /*!
    * \brief Constructs a SparseCSR object from mesh connectivity data.
    *
@@ -48,28 +59,32 @@ SparseCSR::SparseCSR(const std::vector<std::size_t> &connectivity, int shape_poi
    * of a mesh's connectivity structure.
    *
    * The connectivity data defines how shape nodes are connected in space,
-   * resulting in a symmetric matrix. In order to optimize memory usage and
-   * computational effort, only the upper triangular portion of the matrix
-   * is stored. From this upper triangular matrix, two vectors are created:
+   * resulting in a symmetric matrix. Two vectors are created:
    *
    * - **row_ptr**: This vector records the index in the \c cols vector where
    *   each row's nonzero elements begin.
    * - **cols**: This vector holds the column indices corresponding to the
    *   nonzero entries.
    *
-   * Additionally, a hash table is employed to cache intermediate connectivity
-   * information, which accelerates subsequent computations. For example, if point
-   * 0 connects to point 8, the hash table stores an association such as:
-   *   \code
-   *   [8] : [0, ...]
-   *   \endcode
-   * Later, when processing row 8, the algorithm retrieves the pre-saved connectivity
-   * from the hash table for efficient computation.
+   * The nonzero pattern is taken from the points surrounding points
+   * (genEsup/genPsup) of the mesh graph in two passes: the first pass counts
+   * the nonzeros of each row (neighbours + diagonal) and builds row_ptr, the
+   * second pass fills cols, inserting the diagonal into the already sorted
+   * neighbour list of each row. Both passes are O(nnz) and no node-based
+   * containers are used.
    *
    * \param[in] connectivity A vector that encodes the connectivity of the mesh.
    *                         Its organization produces a symmetric matrix.
    * \param[in] shape_points The number of points per element, which defines
    *                         the overall structure of the mesh.
+   * \param[in] symmetric    If true, only the upper triangular part (j >= i)
+   *                         is stored, see toSymmetric().
+   *
+   * \note Only node ids that appear in the connectivity get a row and a
+   *   column, numbered in increasing node id order. Rows and columns use the
+   *   same numbering: with contiguous zero-based node ids row and column j
+   *   are node j, with one-based or gapped node ids they are compacted, e.g.,
+   *   node ids { 1, 2, 4 } become rows and columns { 0, 1, 2 }.
    *
    * \note Example:
    * Consider the symmetric matrix:
@@ -82,120 +97,743 @@ SparseCSR::SparseCSR(const std::vector<std::size_t> &connectivity, int shape_poi
    *   0  0  0  1  1
    * \endverbatim
    *
-   * Its stored upper triangular part is:
-   *
-   * \verbatim
-   *   1  1  -  -  -
-   *      1  1  -  -
-   *         1  1  -
-   *            1  1
-   *               1
-   * \endverbatim
-   *
-   * Initially, the hash table will, for instance, store an entry like [1] : [0].
-   * When processing row \(i = 1\), the constructor consults the hash table to
-   * quickly access pre-saved connectivity data, and so on.
+   * Row 1 has the neighbours { 0, 2 } in psup, so pass one counts 2+1 = 3
+   * nonzeros for it and pass two writes the columns { 0, 1, 2 }.
    */
 
    assert (connectivity.size() % shape_points == 0) ;
-       
 
-   // Use std::map and std::set for our connectivity hash table.
-   std::map<int, std::set<int> > hash;
-   int curr;    // current element
-   int curr_group, prev_group; // group variables for processing (explanation TBD)
+   rows_ptr.assign(1, 0);
+   colidx.clear();
+   vals.clear();
+   if (connectivity.empty()) {
+      ncol = 0;
+      partition();
+      return;
+   }
 
-   // Construct a sorted set of unique connectivity points.
-   std::set<int> unique_elemnts(connectivity.begin(), connectivity.end());
+   const std::size_t nnpe = static_cast<std::size_t>(shape_points);
 
-   /* In case connectivity vector is not sorted :
-      EX: 2 3 5 6 , 1 2 4 5 , 4 5 7 8 , 5 6 8 9
-      the first element of the matrix is 1, however in this case we will check 2 as first value
-      (which is not good). One solution is to sort groups after sorting elements in the group OR
-      we can save the upper triangular part in a hash table (nonzero) and later construct cols, rows,
-      and values.
-   */
+   // genEsup() and genPsup() expect node ids starting from zero
+   std::size_t minId = *std::min_element(connectivity.begin(), connectivity.end());
+   std::vector<std::size_t> shifted;
+   if (minId != 0) {
+      shifted = connectivity;
+      for (auto& n : shifted) n -= minId;
+   }
+   const auto& inpoel = minId != 0 ? shifted : connectivity;
 
-   for (int i = 0; i < (int)connectivity.size(); i++) {
-       // Initialize prev_group for this outer loop iteration.
-       prev_group = -1;
-       curr = connectivity[i];
-       for (int j = i; j < (int)connectivity.size(); j++) {
-           curr_group = j / shape_points;  // using the passed parameter shape_points
-           if (connectivity[j] != curr || curr_group == prev_group)
-               continue;
-           prev_group = curr_group; // Process this group only once.
-           j = curr_group * shape_points;  // Roll j back to the beginning of the group.
-           // For all points in the current group, record symmetric connectivity.
-           for (int k = 0; k < shape_points; k++) {
-               hash[curr].insert(connectivity[j + k]);
-               hash[connectivity[j + k]].insert(curr);
-           }
-       }
-       prev_group = i / shape_points;
+   // compute elements and points surrounding points
+   auto esup = genEsup(inpoel, nnpe);
+   auto psup = genPsup(inpoel, nnpe, esup);
+   const auto& esup2 = esup.second;
+   const auto& psup1 = psup.first;
+   const auto& psup2 = psup.second;
+   std::size_t npoin = psup2.size() - 1;
+
+   // number the node ids used by any element, the same map for rows and columns
+   std::vector<Index> id(npoin);
+   Index nused = 0;
+   for (std::size_t p = 0; p < npoin; ++p)
+      if (esup2[p + 1] != esup2[p]) id[p] = nused++;
+
+   // pass 1: count nonzeros in each row (neighbours + diagonal), skip node ids
+   // that are not used by any element
+   rows_ptr.reserve(static_cast<std::size_t>(nused) + 1);
+   for (std::size_t p = 0; p < npoin; ++p) {
+      if (esup2[p + 1] == esup2[p]) continue;
+      std::size_t first = psup2[p] + 1;
+      if (sym) // neighbours are sorted, skip those below the diagonal
+         while (first <= psup2[p + 1] && psup1[first] < p) ++first;
+      rows_ptr.push_back(rows_ptr.back() + static_cast<Index>(psup2[p + 1] + 1 - first) + 1);
    }
 
-   // Build the SparseCSR structure.
-   // Conventionally, the first row pointer is 0.
-   rows_ptr.clear();
-   cols.clear();
-   vals.clear();
-   int count = 1;
-   rows_ptr.push_back(count);
-   for (std::set<int>::iterator it = unique_elemnts.begin(); 
-        it != unique_elemnts.end(); 
-        ++it) {
-       // Use operator[] instead of .at() so that it works in older compilers.
-       std::set<int>& connSet = hash[*it];
-       for (std::set<int>::iterator j = connSet.begin(); j != connSet.end(); ++j) {
-           cols.push_back(*j +  1);
-           vals.push_back(0); // all elements values are initialized as 0
-       }
-       count += (int)connSet.size();
-       rows_ptr.push_back(count);
+   // pass 2: fill column indices, psup is sorted and the numbering keeps the
+   // order, so only the diagonal has to be merged in
+   colidx.resize(static_cast<std::size_t>(rows_ptr.back()));
+   vals.assign(colidx.size(), Value(0)); // all elements values are initialized as 0
+   std::size_t n = 0;
+   for (std::size_t p = 0; p < npoin; ++p) {
+      if (esup2[p + 1] == esup2[p]) continue;
+      bool diag = false;
+      for (std::size_t i = psup2[p] + 1; i <= psup2[p + 1]; ++i) {
+         if (sym && psup1[i] < p) continue;
+         if (!diag && psup1[i] > p) {
+            colidx[n++] = id[p];
+            diag = true;
+         }
+         colidx[n++] = id[psup1[i]];
+      }
+      if (!diag) colidx[n++] = id[p];
+   }
+
+   ncol = static_cast<Index>(rows_ptr.size()) - 1;
+   partition();
+}
+
+template< typename Index, typename Value >
+SparseCSR<Index,Value>::SparseCSR(std::vector<Index> rows_ptr_, std::vector<Index> cols_,
+                                  std::vector<Value> vals_, bool symmetric, std::size_t ncols)
+   : colidx(std::move(cols_)), rows_ptr(std::move(rows_ptr_)), vals(std::move(vals_)),
+     sym(symmetric) {
+// *****************************************************************************
+//  Take over existing zero-based CSR arrays, e.g., read from a file
+//! \param[in] rows_ptr_ Row pointers, size rows+1, starting with zero
+//! \param[in] cols_ Column indices, sorted within each row
+//! \param[in] vals_ Values, same size as cols_
+//! \param[in] symmetric True if only the upper triangle (j >= i) is given
+//! \param[in] ncols Number of columns, zero for a square matrix
+// *****************************************************************************
+   if (rows_ptr.empty() || rows_ptr.front() != 0 ||
+       static_cast<std::size_t>(rows_ptr.back()) != colidx.size() ||
+       colidx.size() != vals.size())
+      throw std::invalid_argument("SparseCSR: inconsistent CSR arrays");
+   ncol = ncols ? static_cast<Index>(ncols) : static_cast<Index>(rows_ptr.size()) - 1;
+   if (sym && ncol != static_cast<Index>(rows_ptr.size()) - 1)
+      throw std::invalid_argument("SparseCSR: symmetric storage needs a square matrix");
+   partition();
+}
+
+template< typename Index, typename Value >
+template< typename OtherValue >
+SparseCSR<Index,Value>::SparseCSR(const SparseCSR<Index,OtherValue> &A)
+   : colidx(A.colidx), rows_ptr(A.rows_ptr), vals(A.vals.size()), part(A.part),
+     ncol(A.ncol), sym(A.sym), halo(A.halo) {
+// *****************************************************************************
+//  Convert the values to another precision, keeping the sparsity pattern
+//! \param[in] A Matrix to convert, e.g., SparseCSR<Index,double> to store the
+//!   values of an assembled matrix in float for the products of a solver
+// *****************************************************************************
+   std::transform(A.vals.begin(), A.vals.end(), vals.begin(),
+                  [](OtherValue v) { return static_cast<Value>(v); });
+}
+
+template< typename Index >
+void partitionRows(const Index* rp, const Index* cp, Index nrows, bool sym,
+                   std::vector<Index>& part, std::vector<std::size_t>& halo) {
+// *****************************************************************************
+//  Split the rows into contiguous chunks, one per thread, with about the same
+//  number of nonzeros in each chunk
+//! \param[in] rp Row pointers, nrows+1 entries
+//! \param[in] cp Column indices
+//! \param[in] nrows Number of rows
+//! \param[in] sym True if only the upper triangle (j >= i) is stored
+//! \param[out] part First row of each chunk, and nrows at the end
+//! \param[out] halo Offsets of the per-chunk halo sums of symmetricMultAdd,
+//!   empty unless sym
+//! \details The partition is static: it is computed once for the number of
+//!   threads available at construction and reused by every multiplication.
+// *****************************************************************************
+   Index nthreads = 1;
+#ifdef _OPENMP
+   nthreads = omp_get_max_threads();
+#endif
+   if (nthreads > nrows) nthreads = nrows > 0 ? nrows : 1;
+
+   part.assign(nthreads + 1, nrows);
+   part[0] = 0;
+   Index nnz = rp[nrows];
+   Index row = 0;
+   for (Index t = 1; t < nthreads; ++t) {
+      // first row whose nonzeros start at or beyond the t-th share of nnz
+      Index target = static_cast<Index>(static_cast<double>(nnz) * t / nthreads);
+      while (row < nrows && rp[row] < target) ++row;
+      part[t] = row;
+   }
+
+   // symmetric mult: thread t sums the transposed entries of its rows that
+   // fall beyond them, rows [part[t+1], largest column + 1), in its halo
+   halo.clear();
+   if (sym) {
+      halo.assign(nthreads + 1, 0);
+      for (Index t = 0; t < nthreads; ++t) {
+         Index end = part[t+1];
+         for (Index j = rp[part[t]]; j < rp[part[t+1]]; ++j)
+            end = std::max(end, cp[j] + 1);
+         halo[t+1] = halo[t] + static_cast<std::size_t>(end - part[t+1]);
+      }
    }
+}
+
+template< typename Index, typename Value >
+void SparseCSR<Index,Value>::partition() {
+   partitionRows(rows_ptr.data(), colidx.data(), static_cast<Index>(rows_ptr.size()) - 1,
+                 sym, part, halo);
+}
+
+static double* haloScratch(std::size_t n) {
+// *****************************************************************************
+//  Scratch for the halo sums of the symmetric products
+//! \details Owned by the calling thread: concurrent products, also of the same
+//!   matrix, use different buffers. It only grows, so repeated products do
+//!   not allocate.
+// *****************************************************************************
+   thread_local std::vector<double> scratch;
+   if (scratch.size() < n) scratch.resize(n);
+   return scratch.data();
+}
+
+template< typename Index, typename Value >
+void SparseCSR<Index,Value>::toSymmetric() {
+// *****************************************************************************
+//  Convert to symmetric storage: keep only the upper triangle (j >= i)
+//! \details The values of the lower triangle are dropped, so the matrix must
+//!   be symmetric for this to be lossless. Multiplication then uses the
+//!   symmetric kernel, which also applies the transpose of the stored upper
+//!   triangle, reading about half the matrix data.
+// *****************************************************************************
+   if (sym) return;
+   if (ncol != static_cast<Index>(rows_ptr.size()) - 1)
+      throw std::invalid_argument("SparseCSR::toSymmetric: matrix is not square");
 
+   Index n = 0;
+   Index nrows = static_cast<Index>(rows_ptr.size()) - 1;
+   Index start = rows_ptr[0];
+   for (Index i = 0; i < nrows; ++i) {
+      Index end = rows_ptr[i+1];
+      for (Index j = start; j < end; ++j) {
+         if (colidx[j] < i) continue;
+         colidx[n] = colidx[j];
+         vals[n] = vals[j];
+         ++n;
+      }
+      start = end;
+      rows_ptr[i+1] = n;
+   }
+   colidx.resize(n);
+   vals.resize(n);
+   colidx.shrink_to_fit();
+   vals.shrink_to_fit();
 
-   hash.clear(); //free up map space 
+   sym = true;
+   partition();
 }
 
- void SparseCSR::reshape(int rows, int cols){
-    std::cout<<"Sorry , this functionality is not available in Sparse matrices!";
- };           
- void SparseCSR::T() {
-    std::cout<<"Sorry , this functionality is not available in Sparse matrices!";
- };    
+template< typename Index, typename Value >
+void SparseCSR<Index,Value>::toFull() {
+// *****************************************************************************
+//  Convert from symmetric storage to storing all nonzeros
+//! \details Each stored upper entry (i,j), j > i, is mirrored to (j,i). Rows
+//!   are visited in increasing order, so the mirrored (lower) entries land in
+//!   each row sorted and in front of the row's own upper entries.
+// *****************************************************************************
+   if (!sym) return;
+
+   Index nrows = static_cast<Index>(rows_ptr.size()) - 1;
+
+   // count pass: nonzeros of each full row
+   std::vector<Index> rp(nrows + 1, 0);
+   for (Index i = 0; i < nrows; ++i) {
+      for (Index j = rows_ptr[i]; j < rows_ptr[i+1]; ++j) {
+         ++rp[i+1];
+         if (colidx[j] > i) ++rp[colidx[j]+1];
+      }
+   }
+   for (Index i = 0; i < nrows; ++i) rp[i+1] += rp[i];
+
+   // fill pass
+   std::vector<Index> c(static_cast<std::size_t>(rp.back()));
+   std::vector<Value> v(c.size());
+   std::vector<Index> pos(rp.begin(), rp.end() - 1);
+   for (Index i = 0; i < nrows; ++i) {
+      for (Index j = rows_ptr[i]; j < rows_ptr[i+1]; ++j) {
+         Index k = pos[i]++;
+         c[k] = colidx[j];
+         v[k] = vals[j];
+         Index col = colidx[j];
+         if (col > i) {
+            Index m = pos[col]++;
+            c[m] = i;
+            v[m] = vals[j];
+         }
+      }
+   }
+
+   rows_ptr.swap(rp);
+   colidx.swap(c);
+   vals.swap(v);
+
+   sym = false;
+   partition();
+}
+
+template< typename Index, typename Value >
+void symmetricMultAdd(const Index* rp, const Index* cp, const Value* vp,
+                      const std::vector<Index>& part, const std::vector<std::size_t>& halo,
+                      double alpha, const double* x, double beta, const double* y, double* r) {
+// *****************************************************************************
+//  Symmetric multiply-add using the stored upper triangle:
+//  r = alpha * (U + U^T - D) * x + beta * y
+//! \param[in] rp Row pointers of the upper triangle
+//! \param[in] cp Column indices of the upper triangle, j >= i in row i
+//! \param[in] vp Values of the upper triangle
+//! \param[in] part Row partition from partitionRows
+//! \param[in] halo Halo offsets from partitionRows
+//! \param[in] alpha Scalar multiplying A * x
+//! \param[in] x Vector to multiply matrix with from the right
+//! \param[in] beta Scalar multiplying y
+//! \param[in] y Vector to add, may alias r, unused if beta == 0
+//! \param[out] r Result vector
+//! \details Each thread t owns rows [part[t], part[t+1]). It writes the row
+//!   sums and the transposed contributions that fall into its own rows
+//!   directly to r, and the transposed contributions beyond its rows, which
+//!   reach at most the largest column of its rows, to its halo. After all
+//!   threads are done, each thread adds the halos of the threads before it
+//!   that overlap its rows. Only the owner writes r[i], after reading y[i],
+//!   so y may alias r. The halos are as long as the bandwidth of the rows
+//!   (the whole scratch is O(n) for a banded or renumbered matrix, see
+//!   renumberRCM) and live in the scratch of the calling thread, so a matrix
+//!   may be multiplied from several threads at once.
+// *****************************************************************************
+    const Index nparts = static_cast<Index>(part.size()) - 1;
+    const std::size_t* off = halo.data();
+    double* h = haloScratch(off[nparts]);
+
+    // phase 1: own rows into r, transposed contributions beyond them into the halo
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+    for (Index t = 0; t < nparts; ++t) {
+      const Index end = part[t+1];
+      double* ht = h + off[t];
+      std::fill(ht, h + off[t+1], 0.0);
+      for (Index i = part[t]; i < end; ++i) r[i] = beta != 0.0 ? beta * y[i] : 0.0;
+      for (Index i = part[t]; i < end; ++i) {
+         double sum = 0.0, xi = alpha * x[i];
+         for (Index j = rp[i]; j < rp[i+1]; ++j) {
+            Index c = cp[j];
+            sum += vp[j] * x[c];
+            if (c == i) continue;
+            if (c < end) r[c] += vp[j] * xi; else ht[c - end] += vp[j] * xi;
+         }
+         r[i] += alpha * sum;
+      }
+    }
+
+    // phase 2: add the halos of threads s < t that overlap own rows
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+    for (Index t = 0; t < nparts; ++t) {
+      for (Index q = 0; q < t; ++q) {
+         const Index first = part[q+1];
+         const Index end = std::min(part[t+1], first + static_cast<Index>(off[q+1] - off[q]));
+         for (Index i = part[t]; i < end; ++i) r[i] += h[off[q] + (i - first)];
+      }
+    }
+}
+
+template< typename Index, typename Value >
+ void SparseCSR<Index,Value>::reshape(int rows, int cols){
+// *****************************************************************************
+//  Reshape to rows x cols, keeping the row-major order of the entries
+//! \param[in] rows Number of rows of the reshaped matrix
+//! \param[in] cols Number of columns of the reshaped matrix
+//! \details Entry (i,j) has the linear index l = i*cols() + j and moves to
+//!   (l / cols, l % cols), as Dense::reshape does. The stored entries are
+//!   sorted by l, so one pass rebuilds sorted rows. A matrix in symmetric
+//!   storage is expanded first, as the reshaped one is not symmetric in
+//!   general.
+// *****************************************************************************
+   const std::size_t nrows = rows_ptr.size() - 1;
+   if (rows <= 0 || cols <= 0 ||
+       static_cast<std::size_t>(rows) * static_cast<std::size_t>(cols) != nrows * this->cols())
+      throw std::invalid_argument("SparseCSR::reshape: wrong number of entries");
+
+   toFull();
+
+   const std::size_t nc = this->cols(), c = static_cast<std::size_t>(cols);
+   std::vector<Index> rp(static_cast<std::size_t>(rows) + 1, 0);
+   for (std::size_t i = 0; i < nrows; ++i)
+      for (Index j = rows_ptr[i]; j < rows_ptr[i+1]; ++j)
+         ++rp[(i*nc + static_cast<std::size_t>(colidx[j])) / c + 1];
+   for (std::size_t i = 0; i < static_cast<std::size_t>(rows); ++i) rp[i+1] += rp[i];
+   for (std::size_t i = 0; i < nrows; ++i)
+      for (Index j = rows_ptr[i]; j < rows_ptr[i+1]; ++j)
+         colidx[j] = static_cast<Index>((i*nc + static_cast<std::size_t>(colidx[j])) % c);
+
+   rows_ptr.swap(rp);
+   ncol = static_cast<Index>(cols);
+   partition();
+ }
+
+template< typename Index, typename Value >
+ void SparseCSR<Index,Value>::T() {
+// *****************************************************************************
+//  Transpose in place, see transpose()
+// *****************************************************************************
+    *this = transpose();
+ }
+
+template< typename Index, typename Value >
+SparseCSR<Index,Value> SparseCSR<Index,Value>::transpose() const {
+// *****************************************************************************
+//  Transpose: return A^T
+//! \details Two passes over the nonzeros, both split among the threads by the
+//!   nnz-balanced row partition. The first pass counts the entries of each
+//!   column per thread; a prefix sum over the columns and, within a column,
+//!   over the threads gives every thread its own write position in each row
+//!   of A^T. The second pass scatters the entries. Threads own increasing row
+//!   ranges and walk their rows in order, so the rows of A^T come out sorted.
+//!   A matrix in symmetric storage is its own transpose.
+// *****************************************************************************
+   if (sym) return *this;
+
+   const Index nrows = static_cast<Index>(rows_ptr.size()) - 1;
+   const Index nparts = static_cast<Index>(part.size()) - 1;
+   const std::size_t nc = static_cast<std::size_t>(ncol);
+
+   // count pass: pos[t*nc + c] = entries of column c in the rows of thread t
+   std::vector<Index> pos(static_cast<std::size_t>(nparts) * nc, 0);
+#ifdef _OPENMP
+   #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+   for (Index t = 0; t < nparts; ++t) {
+      Index* cnt = pos.data() + static_cast<std::size_t>(t) * nc;
+      for (Index j = rows_ptr[part[t]]; j < rows_ptr[part[t+1]]; ++j) ++cnt[colidx[j]];
+   }
+
+   // row pointers of A^T and the first write position of each thread
+   std::vector<Index> rp(nc + 1);
+   Index offset = 0;
+   for (std::size_t c = 0; c < nc; ++c) {
+      rp[c] = offset;
+      for (Index t = 0; t < nparts; ++t) {
+         Index n = pos[static_cast<std::size_t>(t) * nc + c];
+         pos[static_cast<std::size_t>(t) * nc + c] = offset;
+         offset += n;
+      }
+   }
+   rp[nc] = offset;
+
+   // fill pass
+   std::vector<Index> c(colidx.size());
+   std::vector<Value> v(vals.size());
+#ifdef _OPENMP
+   #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+   for (Index t = 0; t < nparts; ++t) {
+      Index* next = pos.data() + static_cast<std::size_t>(t) * nc;
+      for (Index i = part[t]; i < part[t+1]; ++i)
+         for (Index j = rows_ptr[i]; j < rows_ptr[i+1]; ++j) {
+            Index k = next[colidx[j]]++;
+            c[k] = i;
+            v[k] = vals[j];
+         }
+   }
+
+   return SparseCSR(std::move(rp), std::move(c), std::move(v), false,
+                    static_cast<std::size_t>(nrows));
+}
+
+template< typename Index, typename Value >
+SparseCSR<Index,Value> SparseCSR<Index,Value>::multiply(const SparseCSR &B) const {
+// *****************************************************************************
+//  Sparse matrix-matrix product (SpGEMM): return C = A * B
+//! \param[in] B Right factor, B.rows() must equal cols()
+//! \details Gustavson's row-by-row algorithm: row i of C is the sum of the
+//!   rows B(k,:) scaled by A(i,k). A symbolic pass counts the nonzeros of
+//!   each row of C with a per-thread marker array over the columns of B, then
+//!   a numeric pass gathers the columns and sums the values in a per-thread
+//!   dense accumulator, in double, and sorts the columns of each row. Rows are
+//!   split among threads by the nnz-balanced partition of A. Matrices in
+//!   symmetric storage are expanded first; C always stores all nonzeros.
+// *****************************************************************************
+   if (cols() != B.rows()) {
+      std::cerr << "Cannot multiply matrices: Wrong shapes " << rows() << "x" << cols()
+                << " * " << B.rows() << "x" << B.cols() << std::endl;
+      throw std::length_error("SparseCSR::multiply: wrong shapes");
+   }
+   if (sym || B.sym) {
+      SparseCSR Af(*this), Bf(B);
+      Af.toFull();
+      Bf.toFull();
+      return Af.multiply(Bf);
+   }
+
+   const Index nrows = static_cast<Index>(rows_ptr.size()) - 1;
+   const Index nparts = static_cast<Index>(part.size()) - 1;
+   const std::size_t nc = B.cols();
+   const Index* brp = B.rows_ptr.data();
+   const Index* bcp = B.colidx.data();
+   const Value* bvp = B.vals.data();
+
+   // symbolic pass: nonzeros of each row of C
+   std::vector<Index> rp(static_cast<std::size_t>(nrows) + 1, 0);
+#ifdef _OPENMP
+   #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+   for (Index t = 0; t < nparts; ++t) {
+      std::vector<Index> marker(nc, Index(-1));
+      for (Index i = part[t]; i < part[t+1]; ++i) {
+         Index n = 0;
+         for (Index j = rows_ptr[i]; j < rows_ptr[i+1]; ++j) {
+            Index k = colidx[j];
+            for (Index l = brp[k]; l < brp[k+1]; ++l)
+               if (marker[bcp[l]] != i) { marker[bcp[l]] = i; ++n; }
+         }
+         rp[i+1] = n;
+      }
+   }
+   for (Index i = 0; i < nrows; ++i) rp[i+1] += rp[i];
+
+   // numeric pass
+   std::vector<Index> c(static_cast<std::size_t>(rp.back()));
+   std::vector<Value> v(c.size());
+#ifdef _OPENMP
+   #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+   for (Index t = 0; t < nparts; ++t) {
+      std::vector<Index> marker(nc, Index(-1));
+      std::vector<double> acc(nc, 0.0);
+      for (Index i = part[t]; i < part[t+1]; ++i) {
+         Index n = rp[i];
+         for (Index j = rows_ptr[i]; j < rows_ptr[i+1]; ++j) {
+            const Index k = colidx[j];
+            const double a = vals[j];
+            for (Index l = brp[k]; l < brp[k+1]; ++l) {
+               const Index col = bcp[l];
+               if (marker[col] != i) { marker[col] = i; c[n++] = col; acc[col] = 0.0; }
+               acc[col] += a * bvp[l];
+            }
+         }
+         std::sort(c.begin() + rp[i], c.begin() + rp[i+1]);
+         for (Index m = rp[i]; m < rp[i+1]; ++m) v[m] = static_cast<Value>(acc[c[m]]);
+      }
+   }
+
+   return SparseCSR(std::move(rp), std::move(c), std::move(v), false, nc);
+}
  
  
- std::vector<double> SparseCSR::mult(std::vector<double> &x)  const{ 
+template< typename Index, typename Value >
+ std::vector<double> SparseCSR<Index,Value>::mult(std::vector<double> &x)  const{ 
 // *****************************************************************************
 //  Multiply CSR matrix with vector from the right: r = A * x
 //! \param[in] x Vector to multiply matrix with from the right
+//! \return Newly allocated result vector, prefer the in-place mult(x,r) in loops
 // *****************************************************************************
-    if(x.size() != rows_ptr.size()-1){
-      std::cerr<<"Cannot multiply matrix by vector : Wrong shapes" << x.size() << " != "<< rows_ptr.size()<<std::endl;
-      throw;
+   std::vector<double> r(rows_ptr.size()-1);
+   mult(static_cast<const std::vector<double>&>(x), r);
+   return r;
+ };
+
+template< typename Index, typename Value >
+ void SparseCSR<Index,Value>::mult(const std::vector<double> &x, std::vector<double> &r) const {
+// *****************************************************************************
+//  Multiply CSR matrix with vector from the right in place: r = A * x
+//! \param[in] x Vector to multiply matrix with from the right
+//! \param[in,out] r Result vector, only (re)allocated if its size is wrong
+//! \details Rows are processed in parallel (if compiled with OpenMP) using the
+//!   static nnz-balanced row partition computed at construction.
+// *****************************************************************************
+    if(x.size() != cols()){
+      std::cerr<<"Cannot multiply matrix by vector : Wrong shapes" << x.size() << " != "<< cols()<<std::endl;
+      throw std::length_error("SparseCSR::mult: wrong shapes");
     }
-   
-   std::vector<double> r;
-   double sum=0.0;
-   int i = 1,j=0;
-   while(i < rows_ptr.size() && j < cols.size()){
-    
-      sum+=vals[j] * x[cols[j] - 1];
-      j++;
-      if(j == rows_ptr[i] -1){ 
-         i++;
-         r.push_back(sum);
-         sum =0;
-         
+    if (r.size() != rows()) r.resize(rows());
+    if (sym) return symmetricMultAdd(rows_ptr.data(), colidx.data(), vals.data(), part, halo,
+                                     1.0, x.data(), 0.0, nullptr, r.data());
+
+    const Index* rp = rows_ptr.data();
+    const Index* cp = colidx.data();
+    const Value* vp = vals.data();
+    const double* xp = x.data();
+    double* rr = r.data();
+    const Index nparts = static_cast<Index>(part.size()) - 1;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+    for (Index t = 0; t < nparts; ++t) {
+      for (Index i = part[t]; i < part[t+1]; ++i) {
+         double sum = 0.0;
+         for (Index j = rp[i]; j < rp[i+1]; ++j)
+            sum += vp[j] * xp[cp[j]];
+         rr[i] = sum;
       }
-   }
+    }
+ }
+
+template< typename Index, typename Value >
+ void SparseCSR<Index,Value>::multAdd(double alpha, const std::vector<double> &x,
+                                      double beta, const std::vector<double> &y,
+                                      std::vector<double> &r) const {
+// *****************************************************************************
+//  Fused multiply-add with vector from the right: r = alpha * A * x + beta * y
+//! \param[in] alpha Scalar multiplying A * x
+//! \param[in] x Vector to multiply matrix with from the right
+//! \param[in] beta Scalar multiplying y
+//! \param[in] y Vector to add, may be the same object as r
+//! \param[in,out] r Result vector, only (re)allocated if its size is wrong
+// *****************************************************************************
+    if(x.size() != cols() || y.size() != rows()){
+      std::cerr<<"Cannot multiply matrix by vector : Wrong shapes" << x.size() << ", " << y.size()
+               << " != "<< cols() << ", " << rows()<<std::endl;
+      throw std::length_error("SparseCSR::multAdd: wrong shapes");
+    }
+    if (r.size() != rows()) r.resize(rows());
+    if (sym) return symmetricMultAdd(rows_ptr.data(), colidx.data(), vals.data(), part, halo,
+                                     alpha, x.data(), beta, y.data(), r.data());
+
+    const Index* rp = rows_ptr.data();
+    const Index* cp = colidx.data();
+    const Value* vp = vals.data();
+    const double* xp = x.data();
+    const double* yp = y.data();
+    double* rr = r.data();
+    const Index nparts = static_cast<Index>(part.size()) - 1;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+    for (Index t = 0; t < nparts; ++t) {
+      for (Index i = part[t]; i < part[t+1]; ++i) {
+         double sum = 0.0;
+         for (Index j = rp[i]; j < rp[i+1]; ++j)
+            sum += vp[j] * xp[cp[j]];
+         rr[i] = alpha * sum + (beta != 0.0 ? beta * yp[i] : 0.0);
+      }
+    }
+ }
 
-    return r;
+template< typename Index, typename Value >
+template< int K >
+void SparseCSR<Index,Value>::multBlockRows(std::size_t k, const double* X, double* Y) const {
+// *****************************************************************************
+//  Rows of the product with k interleaved vectors, Y = A * X
+//! \tparam K Number of vectors known at compile time, 0: use k
+//! \details With K fixed the k row sums stay in registers and the inner loop
+//!   over the vectors is unrolled: every matrix entry is loaded once and
+//!   used k times, and the k entries of X it multiplies are contiguous.
+// *****************************************************************************
+    const std::size_t kk = K > 0 ? static_cast<std::size_t>(K) : k;
+    const Index* rp = rows_ptr.data();
+    const Index* cp = colidx.data();
+    const Value* vp = vals.data();
+    const Index nparts = static_cast<Index>(part.size()) - 1;
 
- };           
- void SparseCSR::print() const {
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+    for (Index t = 0; t < nparts; ++t) {
+      if constexpr (K > 0) {
+        for (Index i = part[t]; i < part[t+1]; ++i) {
+           double sum[K] = {};
+           for (Index j = rp[i]; j < rp[i+1]; ++j) {
+              const double a = vp[j];
+              const double* x = X + static_cast<std::size_t>(cp[j]) * K;
+#ifdef _OPENMP
+              #pragma omp simd
+#endif
+              for (int c = 0; c < K; ++c) sum[c] += a * x[c];
+           }
+           double* y = Y + static_cast<std::size_t>(i) * K;
+           for (int c = 0; c < K; ++c) y[c] = sum[c];
+        }
+      } else {
+        for (Index i = part[t]; i < part[t+1]; ++i) {
+           double* y = Y + static_cast<std::size_t>(i) * kk;
+           std::fill(y, y + kk, 0.0);
+           for (Index j = rp[i]; j < rp[i+1]; ++j) {
+              const double a = vp[j];
+              const double* x = X + static_cast<std::size_t>(cp[j]) * kk;
+              for (std::size_t c = 0; c < kk; ++c) y[c] += a * x[c];
+           }
+        }
+      }
+    }
+}
+
+template< typename Index, typename Value >
+void SparseCSR<Index,Value>::symmetricMultBlock(std::size_t k, const double* X, double* Y) const {
+// *****************************************************************************
+//  Product of the symmetric storage with k interleaved vectors, Y = A * X
+//! \details The two phases of symmetricMultAdd, with k sums per row, in a
+//!   scratch k times as long.
+// *****************************************************************************
+    const Index* rp = rows_ptr.data();
+    const Index* cp = colidx.data();
+    const Value* vp = vals.data();
+    const Index nparts = static_cast<Index>(part.size()) - 1;
+    const std::size_t* off = halo.data();
+    double* h = haloScratch(off[nparts] * k);
+
+    // phase 1: own rows into Y, transposed contributions beyond them into the halo
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+    for (Index t = 0; t < nparts; ++t) {
+      const Index end = part[t+1];
+      double* ht = h + off[t] * k;
+      std::fill(ht, h + off[t+1] * k, 0.0);
+      std::fill(Y + static_cast<std::size_t>(part[t]) * k, Y + static_cast<std::size_t>(end) * k, 0.0);
+      for (Index i = part[t]; i < end; ++i) {
+         const double* xi = X + static_cast<std::size_t>(i) * k;
+         double* yi = Y + static_cast<std::size_t>(i) * k;
+         for (Index j = rp[i]; j < rp[i+1]; ++j) {
+            const Index c = cp[j];
+            const double a = vp[j];
+            const double* xc = X + static_cast<std::size_t>(c) * k;
+            for (std::size_t v = 0; v < k; ++v) yi[v] += a * xc[v];
+            if (c == i) continue;
+            double* wc = c < end ? Y + static_cast<std::size_t>(c) * k
+                                 : ht + static_cast<std::size_t>(c - end) * k;
+            for (std::size_t v = 0; v < k; ++v) wc[v] += a * xi[v];
+         }
+      }
+    }
+
+    // phase 2: add the halos of threads s < t that overlap own rows
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+    for (Index t = 0; t < nparts; ++t) {
+      for (Index q = 0; q < t; ++q) {
+         const Index first = part[q+1];
+         const Index end = std::min(part[t+1], first + static_cast<Index>(off[q+1] - off[q]));
+         for (Index i = part[t]; i < end; ++i) {
+            double* y = Y + static_cast<std::size_t>(i) * k;
+            const double* hq = h + (off[q] + static_cast<std::size_t>(i - first)) * k;
+            for (std::size_t v = 0; v < k; ++v) y[v] += hq[v];
+         }
+      }
+    }
+}
+
+template< typename Index, typename Value >
+void SparseCSR<Index,Value>::multBlock(std::size_t k, const std::vector<double> &X,
+                                       std::vector<double> &Y) const {
+// *****************************************************************************
+//  Multiply with k vectors at once (SpMM): Y = A * X
+//! \param[in] k Number of vectors
+//! \param[in] X cols() x k vectors, interleaved: X[j*k + c] is entry j of vector c
+//! \param[in,out] Y rows() x k result vectors, interleaved, only (re)allocated
+//!   if its size is wrong
+//! \details SpMV is bound by the memory bandwidth of streaming the matrix;
+//!   multiplying k vectors in one pass over the matrix reads it once instead
+//!   of k times, so for small k the product costs little more than one SpMV.
+// *****************************************************************************
+    if (X.size() != cols() * k) {
+      std::cerr << "Cannot multiply matrix by vectors : Wrong shapes" << X.size() << " != "
+                << cols() << " x " << k << std::endl;
+      throw std::length_error("SparseCSR::multBlock: wrong shapes");
+    }
+    if (Y.size() != rows() * k) Y.resize(rows() * k);
+    if (k == 0) return;
+    if (sym) return symmetricMultBlock(k, X.data(), Y.data());
+
+    switch (k) {
+      case 1: return multBlockRows<1>(k, X.data(), Y.data());
+      case 2: return multBlockRows<2>(k, X.data(), Y.data());
+      case 4: return multBlockRows<4>(k, X.data(), Y.data());
+      case 8: return multBlockRows<8>(k, X.data(), Y.data());
+      default: return multBlockRows<0>(k, X.data(), Y.data());
+    }
+}
+
+template< typename Index, typename Value >
+ void SparseCSR<Index,Value>::print() const {
 
 // *****************************************************************************
 //! \short Write out CSR as stored
@@ -206,9 +844,11 @@ SparseCSR::SparseCSR(const std::vector<std::size_t> &connectivity, int shape_poi
   for (i=0; i<rows_ptr.size()-1; ++i) std::cout << rows_ptr[i] << ", ";
   std::cout << rows_ptr[i] << " }\n";
 
-  std::cout << "cols[nnz=" << cols.size() << "] = { ";
-  for (i=0; i<cols.size()-1; ++i) std::cout << cols[i] << ", ";
-  std::cout << cols[i] << " }\n";
+  if (colidx.empty()) return;
+
+  std::cout << "cols[nnz=" << colidx.size() << "] = { ";
+  for (i=0; i<colidx.size()-1; ++i) std::cout << colidx[i] << ", ";
+  std::cout << colidx[i] << " }\n";
 
   std::cout << "vals[nnz=" << vals.size() << "] = { ";
   for (i=0; i<vals.size()-1; ++i) std::cout << vals[i] << ", ";
@@ -216,26 +856,17 @@ SparseCSR::SparseCSR(const std::vector<std::size_t> &connectivity, int shape_poi
 
  };     
  
- void SparseCSR::print_matrix() const {
+template< typename Index, typename Value >
+ void SparseCSR<Index,Value>::print_matrix() const {
  // *****************************************************************************
 //! \short Write out CSR as a real matrix
 // *****************************************************************************
-   int nrows = rows_ptr.size()-1;
-   int ncols = nrows;
-
-   for (int i =0; i < nrows; i++) {
-      int start = rows_ptr[i];
-      int end   = rows_ptr[i + 1];
-
-      for (int j = 0; j < ncols; j++) {
-          double value = 0.0;
-          for (int k = start; k < end; k++) {
-              if (cols[k - 1] -1 == j) {
-                  value = vals[k - 1];
-                  break; 
-              }
-          }
-          std::cout << value << " ";
+   Index nrows = static_cast<Index>(rows_ptr.size())-1;
+   Index ncols = nrows;
+
+   for (Index i =0; i < nrows; i++) {
+      for (Index j = 0; j < ncols; j++) {
+          std::cout << getAt(i, j) << " ";
       }
       std::cout << std::endl; 
   }
@@ -244,52 +875,90 @@ SparseCSR::SparseCSR(const std::vector<std::size_t> &connectivity, int shape_poi
  };     
 
 
- double& SparseCSR::at(int row, int col) { 
+template< typename Index, typename Value >
+ Value& SparseCSR<Index,Value>::at(Index row, Index col) { 
     // this function is to get a value based on 0-indexed matrix (first element is 0 not 1)
-    for(int j = rows_ptr[row] - 1 ; j < rows_ptr[row+1] -1 ; j++)
-        if(cols[j] == col + 1 )  return vals[ j ];
+    for(Index j = rows_ptr[row] ; j < rows_ptr[row+1] ; j++)
+        if(colidx[j] == col )  return vals[ j ];
        
    this->print();
-    std::cerr<<"Out of Range - Element not found!" << row<< " " << col << " where cols length is" << cols.size();
-    throw; 
+    std::cerr<<"Out of Range - Element not found!" << row<< " " << col << " where cols length is" << colidx.size();
+    throw std::out_of_range("SparseCSR::at: entry not in sparsity pattern");
  };
 
- double SparseCSR::getAt(int row, int col) { 
-   if (row > rows_ptr.size() || row < 0 || col > rows_ptr.size() || col < 0)
+template< typename Index, typename Value >
+ Value SparseCSR<Index,Value>::getAt(Index row, Index col) const { 
+   if (row < 0 || row >= static_cast<Index>(rows()) || col < 0 || col >= ncol)
    {
       this->print();
-      std::cerr<<"Out of Range - Element not found!" << row<< " " << col << " where cols length is" << cols.size();
-      throw;
+      std::cerr<<"Out of Range - Element not found!" << row<< " " << col << " where cols length is" << colidx.size();
+      throw std::out_of_range("SparseCSR::getAt: index out of range");
    }
-   for(int j = rows_ptr[row] - 1 ; j < rows_ptr[row+1] -1 ; j++)
-       if(cols[j] == col + 1)  return vals[j];
+   // in symmetric mode the lower triangle is read from the upper one
+   if (sym && col < row) std::swap(row, col);
+   for(Index j = rows_ptr[row] ; j < rows_ptr[row+1] ; j++)
+       if(colidx[j] == col)  return vals[j];
 
    // non-stored elements are 0
    return 0;
 };   
 
+template< typename Index, typename Value >
+ std::size_t SparseCSR<Index,Value>::slot(Index row, Index col) const {
+// *****************************************************************************
+//  Find the position of a stored entry in the values vector
+//! \param[in] row 0-indexed row
+//! \param[in] col 0-indexed column
+//! \return Index into the values vector of entry (row,col)
+//! \details Use this to precompute where matrix entries live, e.g., for
+//!   repeated assembly into a fixed sparsity pattern.
+// *****************************************************************************
+    for(Index j = rows_ptr[row] ; j < rows_ptr[row+1] ; j++)
+        if(colidx[j] == col )  return static_cast<std::size_t>(j);
+
+    std::cerr<<"Out of Range - Element not found!" << row<< " " << col << " where cols length is" << colidx.size();
+    throw std::out_of_range("SparseCSR::slot: entry not in sparsity pattern");
+ };
+
+template< typename Index, typename Value >
+ Value* SparseCSR<Index,Value>::data() {
+    return vals.data();
+ }
+
+template< typename Index, typename Value >
+ void SparseCSR<Index,Value>::zero() {
+// *****************************************************************************
+//  Zero matrix values, keeping the sparsity pattern
+// *****************************************************************************
+    std::fill(vals.begin(), vals.end(), Value(0));
+ }
+
 
- std::vector<int> SparseCSR::shape() {
-   std::vector<int> shape;
+template< typename Index, typename Value >
+ std::vector<Index> SparseCSR<Index,Value>::shape() {
+   std::vector<Index> shape;
 
-   // matrix is squared-symmetric (#cols == #rows)
-   shape.push_back(rows_ptr.size()-1);
-   shape.push_back(rows_ptr.size()-1);
+   // squared-symmetric unless built by a product with a rectangular matrix
+   shape.push_back(static_cast<Index>(rows_ptr.size())-1);
+   shape.push_back(ncol);
 
    return shape;
  };
 
 
  //getters
- const std::vector<int> &SparseCSR::getRPtr(){
+template< typename Index, typename Value >
+ const std::vector<Index> &SparseCSR<Index,Value>::getRPtr() const {
     return rows_ptr;
  };
 
- const std::vector<int>& SparseCSR::getCols(){
-    return cols;
+template< typename Index, typename Value >
+ const std::vector<Index>& SparseCSR<Index,Value>::getCols() const {
+    return colidx;
  }
 
- const std::vector<double>& SparseCSR::getVals(){
+template< typename Index, typename Value >
+ const std::vector<Value>& SparseCSR<Index,Value>::getVals() const {
     return vals;
  }
 
@@ -301,30 +970,32 @@ SparseCSR::SparseCSR(const std::vector<std::size_t> &connectivity, int shape_poi
         return false;
     }
 
-    for(int i =0;i<a.size();i++)
+    for(std::size_t i =0;i<a.size();i++)
         if(a[i]!=b[i]) return false;
     return true;
  }
 
 
 
+template< typename Index, typename Value >
  std::ostream&
-SparseCSR::write_matlab( std::ostream& os ) const
+SparseCSR<Index,Value>::write_matlab( std::ostream& os ) const
 // *****************************************************************************
 //  Write out CSR in Matlab/Octave format
 //! \param[in,out] os Output stream to write to
 //! \return Updated output stream
 // *****************************************************************************
 {
+  const Index nrows = static_cast<Index>(rows_ptr.size())-1;
   os << "A = [ ";
-  for (std::size_t i=0; i<rows_ptr.size()-1 ; ++i) {
-    for (std::size_t j=1; j<cols[rows_ptr[i]-1]; ++j) os << "0 ";
-    for ( std::size_t n=rows_ptr[i]-1; n<rows_ptr[i+1]-1; ++n) {
-      if (n > rows_ptr[i]-1)
-        for (std::size_t j=cols[n-1]; j<cols[n]-1; ++j) os << "0 ";
+  for (Index i=0; i<nrows ; ++i) {
+    Index next = 0;   // next column to write in this row
+    for ( Index n=rows_ptr[i]; n<rows_ptr[i+1]; ++n) {
+      for (; next<colidx[n]; ++next) os << "0 ";
       os << vals[n] << ' ';
+      next = colidx[n] + 1;
     }
-    for (std::size_t j=cols[rows_ptr[i+1]-2]; j<rows_ptr.size()-1 ; ++j) os << "0 ";
+    for (; next<nrows ; ++next) os << "0 ";
     os << ";\n";
   }
   os << "]\n";
@@ -332,20 +1003,155 @@ SparseCSR::write_matlab( std::ostream& os ) const
   return os;
 }
 
-void SparseCSR::dirichlet(std::size_t i, double val, std::vector< double >& b)
+template< typename Index, typename Value >
+void SparseCSR<Index,Value>::dirichlet(std::size_t i, double val, std::vector< double >& b)
+// *****************************************************************************
+//  Set Dirichlet boundary condition at a node
+//! \param[in] i Row (node) id at which to set the Dirichlet BC
+//! \param[in] val Value of the Dirichlet BC
+//! \param[in,out] b RHS to modify as a result of setting the Dirichlet BC
+//! \details Symmetric elimination: the known column is moved to the
+//!   right-hand side, b_r -= A(r,i) * val, and zeroed, the row becomes the
+//!   identity row and b_i = val. Same as dirichlet({i}, {val}, b, true), so a
+//!   loop of these calls and one batched call give the same system.
+// *****************************************************************************
 {
-   for (std::size_t r = 0; r < rows_ptr.size() - 1; ++r) {
-      for (std::size_t j = rows_ptr[r] - 1; j < rows_ptr[r + 1] - 1; ++j) {
-        if (i + 1 == cols[j]) {
-          b[r] += vals[j] * val;
+   const std::size_t nrows = rows_ptr.size() - 1;
+   if (i >= nrows)
+      throw std::out_of_range("SparseCSR::dirichlet: node id out of range");
+   if (b.size() != nrows)
+      throw std::length_error("SparseCSR::dirichlet: wrong number of values");
+   const Index row = static_cast<Index>(i);
+
+   if (sym) {
+      // column i above the diagonal: entries (r,i), r < i
+      for (Index r = 0; r < row; ++r) {
+         for (Index j = rows_ptr[r]; j < rows_ptr[r + 1]; ++j) {
+            if (row == colidx[j]) {
+               b[r] -= vals[j] * val;
+               vals[j] = 0.0;
+               break;
+            }
+         }
+      }
+      // row i also stands for column i below the diagonal, put in diagonal
+      for (Index j = rows_ptr[row]; j < rows_ptr[row + 1]; ++j) {
+         if (row != colidx[j]) b[colidx[j]] -= vals[j] * val;
+         vals[j] = (row == colidx[j]) ? 1.0 : 0.0;
+      }
+      b[i] = val;
+      return;
+   }
+
+   for (Index r = 0; r < static_cast<Index>(nrows); ++r) {
+      if (r == row) continue;
+      for (Index j = rows_ptr[r]; j < rows_ptr[r + 1]; ++j) {
+        if (row == colidx[j]) {
+          b[r] -= vals[j] * val;
           vals[j] = 0.0;
           break;
         }
       }
     }
-  
+
     // zero row and put in diagonal
-    for (std::size_t j=rows_ptr[i] - 1; j < rows_ptr[i + 1] - 1; ++j) {
-      if (i + 1 == cols[j]) vals[j] = 1.0; else vals[j] = 0.0;
+    for (Index j=rows_ptr[row]; j < rows_ptr[row + 1]; ++j) {
+      if (row == colidx[j]) vals[j] = 1.0; else vals[j] = 0.0;
     }
-}
\ No newline at end of file
+    b[i] = val;
+}
+
+template< typename Index, typename Value >
+void SparseCSR<Index,Value>::dirichlet(const std::vector< std::size_t >& nodes,
+                                       const std::vector< double >& values,
+                                       std::vector< double >& b, bool eliminate)
+// *****************************************************************************
+//  Set Dirichlet boundary conditions at a list of nodes in one pass
+//! \param[in] nodes Row (node) ids at which to set Dirichlet BCs
+//! \param[in] values Values of the Dirichlet BCs, one per node
+//! \param[in,out] b RHS to modify as a result of setting the Dirichlet BCs
+//! \param[in] eliminate If false, the constrained rows are replaced by identity
+//!   rows. If true, the constrained columns are also moved to the right-hand
+//!   side and zeroed (symmetric elimination), so a symmetric positive definite
+//!   matrix stays SPD and can be solved with CG.
+//! \details In both variants b gets the prescribed value in the constrained
+//!   rows. The constrained nodes are marked in a mask, then all rows are
+//!   processed once, in parallel (if compiled with OpenMP), instead of one full
+//!   matrix sweep per node. Symmetric storage always uses symmetric
+//!   elimination, as its rows are also its columns.
+// *****************************************************************************
+{
+   const std::size_t nrows = rows_ptr.size() - 1;
+   if (nodes.size() != values.size() || b.size() != nrows)
+      throw std::length_error("SparseCSR::dirichlet: wrong number of values");
+
+   std::vector< char > mask(nrows, 0);
+   std::vector< double > g(nrows, 0.0);
+   for (std::size_t k = 0; k < nodes.size(); ++k) {
+      if (nodes[k] >= nrows)
+         throw std::out_of_range("SparseCSR::dirichlet: node id out of range");
+      mask[nodes[k]] = 1;
+      g[nodes[k]] = values[k];
+   }
+
+   const Index nparts = static_cast<Index>(part.size()) - 1;
+
+#ifdef _OPENMP
+   #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+   for (Index t = 0; t < nparts; ++t) {
+      for (Index r = part[t]; r < part[t+1]; ++r) {
+         if (mask[r]) {
+            for (Index j = rows_ptr[r]; j < rows_ptr[r+1]; ++j) {
+               const Index c = colidx[j];
+               // upper entry (r,c) also stands for (c,r): move it to free row c
+               if (sym && c != r && !mask[c]) {
+#ifdef _OPENMP
+                  #pragma omp atomic
+#endif
+                  b[c] -= vals[j] * g[r];
+               }
+               vals[j] = (c == r) ? 1.0 : 0.0;
+            }
+         } else if (eliminate || sym) {
+            double sum = 0.0;
+            for (Index j = rows_ptr[r]; j < rows_ptr[r+1]; ++j)
+               if (mask[colidx[j]]) {
+                  sum += vals[j] * g[colidx[j]];
+                  vals[j] = 0.0;
+               }
+            if (sum != 0.0) {
+#ifdef _OPENMP
+               #pragma omp atomic
+#endif
+               b[r] -= sum;
+            }
+         }
+      }
+   }
+
+   for (std::size_t k = 0; k < nodes.size(); ++k) b[nodes[k]] = values[k];
+}
+
+template void partitionRows( const std::int32_t*, const std::int32_t*, std::int32_t, bool,
+                             std::vector< std::int32_t >&, std::vector< std::size_t >& );
+template void partitionRows( const std::int64_t*, const std::int64_t*, std::int64_t, bool,
+                             std::vector< std::int64_t >&, std::vector< std::size_t >& );
+#define SYMMETRIC_MULT_ADD( Index, Value ) \
+template void symmetricMultAdd( const Index*, const Index*, const Value*, \
+                                const std::vector< Index >&, const std::vector< std::size_t >&, \
+                                double, const double*, double, const double*, double* );
+SYMMETRIC_MULT_ADD( std::int32_t, double )
+SYMMETRIC_MULT_ADD( std::int64_t, double )
+SYMMETRIC_MULT_ADD( std::int32_t, float )
+SYMMETRIC_MULT_ADD( std::int64_t, float )
+#undef SYMMETRIC_MULT_ADD
+
+template class SparseCSR< std::int32_t, double >;
+template class SparseCSR< std::int64_t, double >;
+template class SparseCSR< std::int32_t, float >;
+template class SparseCSR< std::int64_t, float >;
+template SparseCSR< std::int32_t, float >::SparseCSR( const SparseCSR< std::int32_t, double >& );
+template SparseCSR< std::int64_t, float >::SparseCSR( const SparseCSR< std::int64_t, double >& );
+template SparseCSR< std::int32_t, double >::SparseCSR( const SparseCSR< std::int32_t, float >& );
+template SparseCSR< std::int64_t, double >::SparseCSR( const SparseCSR< std::int64_t, float >& );
@@ -1,29 +1,98 @@
 #pragma once
-#include "Matrix.h"
+#include <cstdint>
+#include <vector>
 #include <iostream>
+#include "LinearOperator.h"
 
-class SparseCSR : public Matrix
+//! \brief Compressed sparse row matrix with zero-based storage
+//! \tparam Index Integer type of row pointers and column indices: std::int32_t
+//!   halves the index bandwidth, std::int64_t is needed for more than 2^31
+//!   nonzeros
+//! \tparam Value Type of the stored matrix values: float halves the value
+//!   bandwidth of the memory-bound products, which still accumulate in double
+//!   and take and return double vectors (mixed precision)
+//! \details Row pointers and column indices start from zero, so the arrays can
+//!   be handed to AMGCL or mapped by Eigen without copying. Explicitly
+//!   instantiated in SparseCSR.cpp for std::int32_t and std::int64_t indices
+//!   and double and float values.
+template< typename Index = std::int32_t, typename Value = double >
+class SparseCSR : public LinearOperator< SparseCSR<Index,Value> >
 {
 private:
-    std::vector<int> cols;
-    std::vector<int> rows_ptr;
-    std::vector<double> vals;
+    std::vector<Index> colidx;
+    std::vector<Index> rows_ptr;
+    std::vector<Value> vals;
+    std::vector<Index> part;  // row partition for threads, balanced by nnz
+    Index ncol = 0;           // number of columns, rows unless built by a product
+    bool sym;                 // true: only the upper triangle (j >= i) is stored
+    std::vector<std::size_t> halo; // symmetric mult: offsets of the per-thread sums beyond own rows
+    void partition();
+    template< int K >
+    void multBlockRows( std::size_t k, const double* X, double* Y ) const;
+    void symmetricMultBlock( std::size_t k, const double* X, double* Y ) const;
 
+    template< typename, typename > friend class SparseCSR;
 
 public:
-    SparseCSR(const std::vector<std::size_t> &connectivity,int shape_points);
-    double& at(int row,int col);
-    double getAt(int row, int col);
-    std::vector<int> shape() ;
+    using index_type = Index;
+    using value_type = Value;
+
+    SparseCSR(const std::vector<std::size_t> &connectivity,int shape_points, bool symmetric = false);
+    SparseCSR(std::vector<Index> rows_ptr, std::vector<Index> cols,
+              std::vector<Value> vals, bool symmetric = false,
+              std::size_t ncols = 0);                   // from zero-based CSR arrays, 0: square
+    template< typename OtherValue >
+    explicit SparseCSR(const SparseCSR<Index,OtherValue> &A);   // same pattern, values converted
+    Value& at(Index row,Index col);
+    Value getAt(Index row, Index col) const;
+    std::size_t slot(Index row, Index col) const; // position of (row,col) in the values vector
+    Value* data();                                // raw access to the values vector
+    void zero();                                  // zero all stored values
+    bool isSymmetric() const { return sym; }      // only upper triangle stored?
+    std::size_t rows() const { return rows_ptr.size() - 1; }
+    std::size_t cols() const { return static_cast<std::size_t>(ncol); }
+    void toSymmetric();                           // drop the lower triangle
+    void toFull();                                // restore the lower triangle from the upper one
+    std::vector<Index> shape() ;
     void print()  const ;
     void print_matrix()  const ;
     void reshape(int rows, int cols);
-    void T();
+    void T();                                     // transpose in place
+    SparseCSR transpose() const;                  // A^T, two-pass and parallel
+    SparseCSR multiply(const SparseCSR &B) const; // A*B, parallel Gustavson SpGEMM
     void dirichlet(std::size_t i, double val, std::vector< double >& b);
-    const std::vector<int> &getRPtr(); //getting rows_ptr vector
-    const std::vector<int> &getCols();    // getting cols vector
-    const std::vector<double> &getVals();    // getting values vector
+    void dirichlet(const std::vector< std::size_t >& nodes,
+                   const std::vector< double >& values,
+                   std::vector< double >& b, bool eliminate = false); // batched, one pass
+    const std::vector<Index> &getRPtr() const; //getting rows_ptr vector
+    const std::vector<Index> &getCols() const;    // getting cols vector
+    const std::vector<Value> &getVals() const;    // getting values vector
     std::vector<double> mult( std::vector<double> &vec) const;
+    void mult( const std::vector<double> &x, std::vector<double> &r ) const;   // r = A*x
+    void multAdd( double alpha, const std::vector<double> &x,
+                  double beta, const std::vector<double> &y,
+                  std::vector<double> &r ) const;                             // r = alpha*A*x + beta*y
+    void apply( const std::vector<double> &x, std::vector<double> &y ) const { mult(x, y); }
+    void multBlock( std::size_t k, const std::vector<double> &X,
+                    std::vector<double> &Y ) const;                           // Y = A*X, k interleaved vectors (SpMM)
+    void applyBlock( std::size_t k, const std::vector<double> &X,
+                     std::vector<double> &Y ) const { multBlock(k, X, Y); }
     std::ostream& write_matlab( std::ostream &os ) const;
-    friend bool operator==(std::vector<int> &a, std::vector<int> &b) ; // this is a helper function to check if two vectors are equal (values)
 };
+
+// Kernels on raw CSR arrays, shared by SparseCSR and MappedCSR (SparseCSRIO.h)
+template< typename Index >
+void partitionRows( const Index* rp, const Index* cp, Index nrows, bool sym,
+                    std::vector<Index>& part, std::vector<std::size_t>& halo );    // nnz-balanced thread rows
+template< typename Index, typename Value >
+void symmetricMultAdd( const Index* rp, const Index* cp, const Value* vp,
+                       const std::vector<Index>& part, const std::vector<std::size_t>& halo,
+                       double alpha, const double* x, double beta, const double* y,
+                       double* r );                                              // r = alpha*A*x + beta*y, upper triangle stored
+
+bool operator==(std::vector<int> &a, std::vector<int> &b) ; // this is a helper function to check if two vectors are equal (values)
+
+extern template class SparseCSR< std::int32_t, double >;
+extern template class SparseCSR< std::int64_t, double >;
+extern template class SparseCSR< std::int32_t, float >;
+extern template class SparseCSR< std::int64_t, float >;
@@ -0,0 +1,396 @@
+/*
+    Binary SparseCSR file format:
+    A fixed size header (CSRFileHeader) followed by the three CSR arrays exactly as
+    they are stored in memory:
+
+        offset 0            header: magic "FFLYCSR", version, byte order mark,
+                            index and value sizes, flags, rows, cols, nnz,
+                            array offsets, file size
+        ptr_offset          rows_ptr[nrows+1]   Index
+        col_offset          cols[nnz]           Index
+        val_offset          vals[nnz]           Value
+
+    Each array starts at a multiple of 64 bytes (a cache line, and more than any
+    SIMD load needs), the gaps are zero filled. Symmetric matrices are written as
+    stored, i.e., only their upper triangle, with bit 0 of flags set. The header is
+    written in native byte order; the byte order mark lets a reader on a machine
+    with the other order reject the file instead of reading garbage.
+
+    Versioning:
+    Readers accept files with a version up to csr_file_version. A change of the
+    layout that old readers cannot handle must increase the version.
+
+    Writing and reading:
+    The header and each array are written with one large write through a 1 MiB
+    stream buffer, so a matrix with millions of nonzeros costs a handful of
+    system calls instead of the millions of formatted writes of write_matlab.
+    MappedCSR maps the file read-only with mmap and points into the mapping, so
+    nothing is copied or parsed; readBinary copies the mapped arrays into an
+    owning SparseCSR.
+
+    Interoperability:
+    writeAmgclBinary/readAmgclBinary use the layout of amgcl/io/binary.hpp (size_t
+    n, ptrdiff_t ptr[n+1], ptrdiff_t col[nnz], double val[nnz]) that AMGCL's
+    example programs and its mm2bin utility read and write. readMatrixMarket goes
+    through amgcl/io/mm.hpp; writeMatrixMarket writes the same coordinate format as
+    amgcl::io::mm_write, but with the actual number of columns (mm_write assumes a
+    square matrix) and round-trip precision. Both formats store the full matrix,
+    so symmetric matrices are expanded on writing.
+*/
+
+#define AMGCL_NO_BOOST
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <amgcl/io/binary.hpp>
+#include <amgcl/io/mm.hpp>
+#include "SparseCSRIO.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+constexpr char csr_magic[8] = "FFLYCSR";
+constexpr std::uint32_t csr_byte_order = 0x01020304;
+constexpr std::uint64_t csr_alignment = 64;
+constexpr std::size_t csr_write_buffer = 1 << 20;
+
+std::uint64_t align( std::uint64_t offset )
+// *****************************************************************************
+//  Round up an offset to the array alignment of the binary format
+// *****************************************************************************
+{
+  return (offset + csr_alignment - 1) / csr_alignment * csr_alignment;
+}
+
+template< typename Index, typename Value >
+SparseCSR< Index, Value >
+fullCopy( const SparseCSR< Index, Value >& A )
+// *****************************************************************************
+//  Copy of a matrix with all nonzeros stored, for the formats without symmetry
+// *****************************************************************************
+{
+  SparseCSR< Index, Value > F( A );
+  if (F.isSymmetric()) F.toFull();
+  return F;
+}
+
+} // namespace
+
+template< typename Index, typename Value >
+void writeBinary(const std::string& filename, const SparseCSR<Index,Value>& A) {
+// *****************************************************************************
+//  Write a matrix in the binary SparseCSR format
+//! \param[in] filename File to write, overwritten if it exists
+//! \param[in] A Matrix to write, symmetric matrices keep their upper triangle
+// *****************************************************************************
+   const auto& ptr = A.getRPtr();
+   const auto& col = A.getCols();
+   const auto& val = A.getVals();
+
+   CSRFileHeader h{};
+   std::memcpy(h.magic, csr_magic, sizeof(h.magic));
+   h.version = csr_file_version;
+   h.byte_order = csr_byte_order;
+   h.index_bytes = sizeof(Index);
+   h.value_bytes = sizeof(Value);
+   h.flags = A.isSymmetric() ? 1u : 0u;
+   h.nrows = ptr.size() - 1;
+   h.ncols = A.cols();
+   h.nnz = col.size();
+   h.ptr_offset = align(sizeof(CSRFileHeader));
+   h.col_offset = align(h.ptr_offset + ptr.size()*sizeof(Index));
+   h.val_offset = align(h.col_offset + col.size()*sizeof(Index));
+   h.file_bytes = h.val_offset + val.size()*sizeof(Value);
+
+   std::unique_ptr<char[]> buffer(new char[csr_write_buffer]);
+   std::ofstream f;
+   f.rdbuf()->pubsetbuf(buffer.get(), csr_write_buffer);
+   f.open(filename, std::ios::binary | std::ios::trunc);
+   if (!f) throw std::runtime_error("writeBinary: cannot open " + filename);
+
+   const char zeros[csr_alignment] = {};
+   std::uint64_t pos = 0;
+   auto put = [&](std::uint64_t offset, const void* data, std::size_t bytes) {
+      f.write(zeros, static_cast<std::streamsize>(offset - pos));
+      f.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+      pos = offset + bytes;
+   };
+   put(0, &h, sizeof(h));
+   put(h.ptr_offset, ptr.data(), ptr.size()*sizeof(Index));
+   put(h.col_offset, col.data(), col.size()*sizeof(Index));
+   put(h.val_offset, val.data(), val.size()*sizeof(Value));
+   f.close();
+   if (!f) throw std::runtime_error("writeBinary: error writing " + filename);
+}
+
+template< typename Index, typename Value >
+MappedCSR<Index,Value>::MappedCSR(const std::string& filename) {
+// *****************************************************************************
+//  Map a binary SparseCSR file read-only into memory
+//! \param[in] filename File written by writeBinary
+//! \details Throws std::runtime_error if the file cannot be mapped, is not a
+//!   SparseCSR file, is truncated, or its index or value type differs from
+//!   Index or Value. The header sizes are checked without overflow against
+//!   the file size, and the row pointers (monotone, from 0 to nnz) and column
+//!   indices (below ncols, j >= i if symmetric) are checked once here, so a
+//!   corrupt or crafted file cannot make the products read out of bounds.
+// *****************************************************************************
+   int fd = ::open(filename.c_str(), O_RDONLY);
+   if (fd < 0) throw std::runtime_error("MappedCSR: cannot open " + filename);
+   struct stat st;
+   if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(CSRFileHeader)) {
+      ::close(fd);
+      throw std::runtime_error("MappedCSR: " + filename + " is not a SparseCSR file");
+   }
+   length = static_cast<std::size_t>(st.st_size);
+   base = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+   ::close(fd);
+   if (base == MAP_FAILED) {
+      base = nullptr;
+      throw std::runtime_error("MappedCSR: cannot map " + filename);
+   }
+
+   auto fail = [&](const std::string& what) {
+      ::munmap(base, length);
+      base = nullptr;
+      throw std::runtime_error("MappedCSR: " + filename + ": " + what);
+   };
+   std::memcpy(&hdr, base, sizeof(hdr));
+   if (std::memcmp(hdr.magic, csr_magic, sizeof(hdr.magic)) != 0)
+      fail("not a SparseCSR file");
+   if (hdr.version == 0 || hdr.version > csr_file_version)
+      fail("unsupported format version " + std::to_string(hdr.version));
+   if (hdr.byte_order != csr_byte_order)
+      fail("written with a different byte order");
+   if (hdr.index_bytes != sizeof(Index) || hdr.value_bytes != sizeof(Value))
+      fail("index/value sizes " + std::to_string(hdr.index_bytes) + "/" +
+           std::to_string(hdr.value_bytes) + " do not match the requested types");
+   // count entries of size bytes from offset fit before end, without overflow
+   auto fits = [](std::uint64_t offset, std::uint64_t count, std::uint64_t bytes,
+                  std::uint64_t end) {
+      return offset <= end && count <= (end - offset) / bytes;
+   };
+   const std::uint64_t index_max = static_cast<std::uint64_t>(std::numeric_limits<Index>::max());
+   if (hdr.file_bytes != length ||
+       hdr.ptr_offset % csr_alignment || hdr.col_offset % csr_alignment ||
+       hdr.val_offset % csr_alignment ||
+       hdr.nrows >= index_max || hdr.ncols > index_max || hdr.nnz > index_max ||
+       !fits(hdr.ptr_offset, hdr.nrows + 1, sizeof(Index), hdr.col_offset) ||
+       !fits(hdr.col_offset, hdr.nnz, sizeof(Index), hdr.val_offset) ||
+       !fits(hdr.val_offset, hdr.nnz, sizeof(Value), length))
+      fail("truncated or corrupt file");
+   if (isSymmetric() && hdr.nrows != hdr.ncols)
+      fail("symmetric storage of a non-square matrix");
+
+   const char* bytes = static_cast<const char*>(base);
+   ptr_ = reinterpret_cast<const Index*>(bytes + hdr.ptr_offset);
+   col_ = reinterpret_cast<const Index*>(bytes + hdr.col_offset);
+   val_ = reinterpret_cast<const Value*>(bytes + hdr.val_offset);
+   const Index nrows = static_cast<Index>(hdr.nrows), ncols = static_cast<Index>(hdr.ncols);
+   if (ptr_[0] != 0 || static_cast<std::uint64_t>(ptr_[nrows]) != hdr.nnz)
+      fail("inconsistent row pointers");
+   for (Index i = 0; i < nrows; ++i) {
+      if (ptr_[i+1] < ptr_[i]) fail("inconsistent row pointers");
+      const Index first = isSymmetric() ? i : 0;
+      for (Index k = ptr_[i]; k < ptr_[i+1]; ++k)
+         if (col_[k] < first || col_[k] >= ncols)
+            fail("column index out of range in row " + std::to_string(i));
+   }
+
+   partitionRows(ptr_, col_, nrows, isSymmetric(), part, halo);
+}
+
+template< typename Index, typename Value >
+MappedCSR<Index,Value>::MappedCSR(MappedCSR&& other) noexcept
+   : hdr(other.hdr), base(other.base), length(other.length),
+     ptr_(other.ptr_), col_(other.col_), val_(other.val_),
+     part(std::move(other.part)), halo(std::move(other.halo)) {
+   other.base = nullptr;
+   other.length = 0;
+}
+
+template< typename Index, typename Value >
+MappedCSR<Index,Value>::~MappedCSR() {
+   if (base) ::munmap(base, length);
+}
+
+template< typename Index, typename Value >
+SparseCSR<Index,Value> MappedCSR<Index,Value>::copy() const {
+// *****************************************************************************
+//  Copy the mapped arrays into an owning matrix
+// *****************************************************************************
+   return SparseCSR<Index,Value>(std::vector<Index>(ptr_, ptr_ + hdr.nrows + 1),
+                                 std::vector<Index>(col_, col_ + hdr.nnz),
+                                 std::vector<Value>(val_, val_ + hdr.nnz),
+                                 isSymmetric(), hdr.ncols);
+}
+
+template< typename Index, typename Value >
+void MappedCSR<Index,Value>::mult( const std::vector<double> &x, std::vector<double> &r ) const {
+// *****************************************************************************
+//  Multiply the mapped matrix by a vector, r = A*x
+// *****************************************************************************
+   multAdd(1.0, x, 0.0, x, r);
+}
+
+template< typename Index, typename Value >
+void MappedCSR<Index,Value>::multAdd( double alpha, const std::vector<double> &x,
+                                      double beta, const std::vector<double> &y,
+                                      std::vector<double> &r ) const {
+// *****************************************************************************
+//  Fused multiply-add with the mapped matrix, r = alpha*A*x + beta*y
+//! \details Same kernels and row partition as SparseCSR::multAdd: symmetric
+//!   matrices apply the stored upper triangle and its transpose with
+//!   symmetricMultAdd.
+// *****************************************************************************
+   if (x.size() != hdr.ncols || (beta != 0.0 && y.size() != hdr.nrows)) {
+      std::cerr << "MappedCSR multAdd: wrong vector size" << std::endl;
+      throw std::length_error("Wrong vector size for MappedCSR multiplication");
+   }
+   r.resize(hdr.nrows);
+
+   if (isSymmetric())
+      return symmetricMultAdd(ptr_, col_, val_, part, halo, alpha, x.data(),
+                              beta, beta != 0.0 ? y.data() : nullptr, r.data());
+
+   const Index nparts = static_cast<Index>(part.size()) - 1;
+#ifdef _OPENMP
+   #pragma omp parallel for num_threads(nparts) schedule(static, 1)
+#endif
+   for (Index t = 0; t < nparts; ++t) {
+      for (Index i = part[t]; i < part[t+1]; ++i) {
+         double sum = 0.0;
+         for (Index k = ptr_[i]; k < ptr_[i+1]; ++k) sum += val_[k] * x[col_[k]];
+         r[i] = alpha * sum + (beta != 0.0 ? beta * y[i] : 0.0);
+      }
+   }
+}
+
+template< typename Index, typename Value >
+SparseCSR<Index,Value> readBinary(const std::string& filename) {
+// *****************************************************************************
+//  Read a matrix in the binary SparseCSR format into memory
+//! \param[in] filename File written by writeBinary
+// *****************************************************************************
+   return MappedCSR<Index,Value>(filename).copy();
+}
+
+template< typename Index, typename Value >
+void writeAmgclBinary(const std::string& filename, const SparseCSR<Index,Value>& A) {
+// *****************************************************************************
+//  Write a matrix in the AMGCL binary CRS format
+//! \param[in] filename File to write, overwritten if it exists
+//! \param[in] A Matrix to write, symmetric matrices are expanded
+// *****************************************************************************
+   const auto F = fullCopy(A);
+   const std::size_t n = F.getRPtr().size() - 1;
+   std::vector<std::ptrdiff_t> ptr(F.getRPtr().begin(), F.getRPtr().end());
+   std::vector<std::ptrdiff_t> col(F.getCols().begin(), F.getCols().end());
+   std::vector<double> val(F.getVals().begin(), F.getVals().end());
+
+   std::unique_ptr<char[]> buffer(new char[csr_write_buffer]);
+   std::ofstream f;
+   f.rdbuf()->pubsetbuf(buffer.get(), csr_write_buffer);
+   f.open(filename, std::ios::binary | std::ios::trunc);
+   if (!f) throw std::runtime_error("writeAmgclBinary: cannot open " + filename);
+   amgcl::io::write(f, n);
+   amgcl::io::write(f, ptr);
+   amgcl::io::write(f, col);
+   amgcl::io::write(f, val);
+   f.close();
+   if (!f) throw std::runtime_error("writeAmgclBinary: error writing " + filename);
+}
+
+template< typename Index, typename Value >
+SparseCSR<Index,Value> readAmgclBinary(const std::string& filename) {
+// *****************************************************************************
+//  Read a matrix in the AMGCL binary CRS format
+//! \param[in] filename File in the layout of amgcl/io/binary.hpp with size_t
+//!   size, ptrdiff_t indices and double values
+// *****************************************************************************
+   std::size_t n;
+   std::vector<std::ptrdiff_t> ptr, col;
+   std::vector<double> val;
+   amgcl::io::read_crs(filename, n, ptr, col, val);
+   // the format has no column count: square unless a column index says otherwise
+   std::size_t ncols = n;
+   for (auto c : col) ncols = std::max(ncols, static_cast<std::size_t>(c) + 1);
+   return SparseCSR<Index,Value>(std::vector<Index>(ptr.begin(), ptr.end()),
+                                 std::vector<Index>(col.begin(), col.end()),
+                                 std::vector<Value>(val.begin(), val.end()), false, ncols);
+}
+
+template< typename Index, typename Value >
+void writeMatrixMarket(const std::string& filename, const SparseCSR<Index,Value>& A) {
+// *****************************************************************************
+//  Write a matrix in Matrix Market coordinate format (general, real)
+//! \param[in] filename File to write, overwritten if it exists
+//! \param[in] A Matrix to write, symmetric matrices are expanded
+// *****************************************************************************
+   const auto F = fullCopy(A);
+   const auto& ptr = F.getRPtr();
+   const auto& col = F.getCols();
+   const auto& val = F.getVals();
+
+   std::unique_ptr<char[]> buffer(new char[csr_write_buffer]);
+   std::ofstream f;
+   f.rdbuf()->pubsetbuf(buffer.get(), csr_write_buffer);
+   f.open(filename, std::ios::trunc);
+   if (!f) throw std::runtime_error("writeMatrixMarket: cannot open " + filename);
+   f << "%%MatrixMarket matrix coordinate real general\n"
+     << F.rows() << " " << F.cols() << " " << col.size() << "\n"
+     << std::scientific << std::setprecision(std::numeric_limits<Value>::max_digits10);
+   for (std::size_t i = 0; i + 1 < ptr.size(); ++i)
+      for (Index k = ptr[i]; k < ptr[i+1]; ++k)
+         f << i + 1 << " " << col[k] + 1 << " " << val[k] << "\n";
+   f.close();
+   if (!f) throw std::runtime_error("writeMatrixMarket: error writing " + filename);
+}
+
+template< typename Index, typename Value >
+SparseCSR<Index,Value> readMatrixMarket(const std::string& filename) {
+// *****************************************************************************
+//  Read a sparse real matrix in Matrix Market coordinate format
+//! \param[in] filename Matrix Market file, general or symmetric, may be rectangular
+//! \details Symmetric files are expanded to the full matrix by the reader.
+// *****************************************************************************
+   amgcl::io::mm_reader read(filename);
+   if (!read.is_sparse())
+      throw std::invalid_argument("readMatrixMarket: " + filename +
+                                  " is not a sparse matrix");
+   std::vector<Index> ptr, col;
+   std::vector<Value> val;
+   read(ptr, col, val);
+   return SparseCSR<Index,Value>(std::move(ptr), std::move(col), std::move(val), false,
+                                 read.cols());
+}
+
+#define FIREFLY_CSR_IO(Index, Value)                                                      \
+   template class MappedCSR< Index, Value >;                                              \
+   template void writeBinary( const std::string&, const SparseCSR< Index, Value >& );     \
+   template SparseCSR< Index, Value > readBinary< Index, Value >( const std::string& );    \
+   template void writeAmgclBinary( const std::string&, const SparseCSR< Index, Value >& );\
+   template SparseCSR< Index, Value > readAmgclBinary< Index, Value >( const std::string& ); \
+   template void writeMatrixMarket( const std::string&, const SparseCSR< Index, Value >& );\
+   template SparseCSR< Index, Value > readMatrixMarket< Index, Value >( const std::string& );
+
+FIREFLY_CSR_IO( std::int32_t, double )
+FIREFLY_CSR_IO( std::int64_t, double )
+FIREFLY_CSR_IO( std::int32_t, float )
+FIREFLY_CSR_IO( std::int64_t, float )
+
+#undef FIREFLY_CSR_IO
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "SparseCSR.h"
+
+//! \brief Header of the binary SparseCSR file format, see SparseCSRIO.cpp
+//! \details All sizes and offsets are in bytes from the start of the file. The
+//!   row pointer, column index and value arrays start at 64-byte aligned
+//!   offsets, so they can be used in place from a memory-mapped file.
+struct CSRFileHeader
+{
+    char magic[8];              // "FFLYCSR" and a terminating zero
+    std::uint32_t version;      // format version, see csr_file_version
+    std::uint32_t byte_order;   // 0x01020304 as written by the producing machine
+    std::uint32_t index_bytes;  // sizeof the row pointer / column index type
+    std::uint32_t value_bytes;  // sizeof the value type: 4 (float) or 8 (double)
+    std::uint32_t flags;        // bit 0: only the upper triangle is stored
+    std::uint32_t reserved;
+    std::uint64_t nrows;
+    std::uint64_t ncols;
+    std::uint64_t nnz;
+    std::uint64_t ptr_offset;   // rows_ptr, nrows+1 entries
+    std::uint64_t col_offset;   // cols, nnz entries
+    std::uint64_t val_offset;   // vals, nnz entries
+    std::uint64_t file_bytes;   // total size, guards against truncated files
+};
+
+constexpr std::uint32_t csr_file_version = 1;
+
+//! \brief Read-only SparseCSR matrix mapped from a binary file without copying
+//! \tparam Index Row pointer and column index type, must match the file
+//! \tparam Value Value type, must match the file
+//! \details The arrays point into the page cache, so several processes
+//!   replaying the same system share one copy in memory. Opening reads the
+//!   row pointers and column indices once to validate them, the values are
+//!   not read until the first product.
+template< typename Index = std::int32_t, typename Value = double >
+class MappedCSR : public LinearOperator< MappedCSR<Index,Value> >
+{
+public:
+    using index_type = Index;
+    using value_type = Value;
+
+    explicit MappedCSR(const std::string& filename);
+    MappedCSR(MappedCSR&& other) noexcept;
+    MappedCSR(const MappedCSR&) = delete;
+    MappedCSR& operator=(const MappedCSR&) = delete;
+    ~MappedCSR();
+
+    std::size_t rows() const { return hdr.nrows; }
+    std::size_t cols() const { return hdr.ncols; }
+    std::size_t nonzeros() const { return hdr.nnz; }
+    bool isSymmetric() const { return hdr.flags & 1u; }  // only upper triangle stored?
+
+    const Index* ptr() const { return ptr_; }   // row pointers, rows()+1 entries
+    const Index* col() const { return col_; }   // column indices, nonzeros() entries
+    const Value* val() const { return val_; }   // values, nonzeros() entries
+
+    SparseCSR<Index,Value> copy() const;        // owning, writable copy
+
+    void mult( const std::vector<double> &x, std::vector<double> &r ) const;   // r = A*x
+    void multAdd( double alpha, const std::vector<double> &x,
+                  double beta, const std::vector<double> &y,
+                  std::vector<double> &r ) const;                             // r = alpha*A*x + beta*y
+    void apply( const std::vector<double> &x, std::vector<double> &y ) const { mult(x, y); }
+
+private:
+    CSRFileHeader hdr;
+    void* base = nullptr;       // start of the mapping
+    std::size_t length = 0;     // length of the mapping
+    const Index* ptr_ = nullptr;
+    const Index* col_ = nullptr;
+    const Value* val_ = nullptr;
+    std::vector<Index> part;        // row partition for threads, see partitionRows
+    std::vector<std::size_t> halo;  // halo offsets of the symmetric product
+};
+
+//! Write a matrix in the binary SparseCSR format
+template< typename Index, typename Value >
+void writeBinary(const std::string& filename, const SparseCSR<Index,Value>& A);
+//! Read a matrix in the binary SparseCSR format into memory
+template< typename Index = std::int32_t, typename Value = double >
+SparseCSR<Index,Value> readBinary(const std::string& filename);
+
+//! Write a matrix in the AMGCL binary CRS format, see amgcl/io/binary.hpp
+template< typename Index, typename Value >
+void writeAmgclBinary(const std::string& filename, const SparseCSR<Index,Value>& A);
+//! Read a matrix in the AMGCL binary CRS format, e.g., written by AMGCL's mm2bin
+template< typename Index = std::int32_t, typename Value = double >
+SparseCSR<Index,Value> readAmgclBinary(const std::string& filename);
+
+//! Write a matrix in Matrix Market coordinate format, see amgcl/io/mm.hpp
+template< typename Index, typename Value >
+void writeMatrixMarket(const std::string& filename, const SparseCSR<Index,Value>& A);
+//! Read a sparse real matrix in Matrix Market coordinate format
+template< typename Index = std::int32_t, typename Value = double >
+SparseCSR<Index,Value> readMatrixMarket(const std::string& filename);
+
+extern template class MappedCSR< std::int32_t, double >;
+extern template class MappedCSR< std::int64_t, double >;
+extern template class MappedCSR< std::int32_t, float >;
+extern template class MappedCSR< std::int64_t, float >;
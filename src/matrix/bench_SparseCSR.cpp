@@ -0,0 +1,280 @@
+// *****************************************************************************
+/*!
+  \file      src/matrix/bench_SparseCSR.cpp
+  \brief     Benchmark SparseCSR construction time versus element count,
+             SpMV throughput of SparseCSR versus SellCSigma kernels and the
+             assembled versus the matrix-free Laplacian, and the effect
+             of RCM and space-filling curve renumbering
+*/
+// *****************************************************************************
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "SparseCSR.h"
+#include "SellCSigma.h"
+#include "../asc/asc.h"
+#include "../laplacian/CubeMesh.hpp"
+#include "../laplacian/Reorder.hpp"
+
+double
+timeConstruction( const std::vector< std::size_t >& inpoel, std::size_t& nnz )
+// *****************************************************************************
+//  Time constructing a SparseCSR from element connectivity
+//! \param[in] inpoel Tetrahedron connectivity
+//! \param[out] nnz Number of nonzeros of the constructed matrix
+//! \return Best wall-clock time of a few constructions in seconds
+// *****************************************************************************
+{
+  double best = 0.0;
+  for (int r=0; r<3; ++r) {
+    auto t0 = std::chrono::steady_clock::now();
+    SparseCSR A( inpoel, 4 );
+    auto t1 = std::chrono::steady_clock::now();
+    nnz = A.getCols().size();
+    double t = std::chrono::duration< double >( t1 - t0 ).count();
+    if (r == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+void
+report( const std::string& name,
+        const std::vector< std::size_t >& inpoel )
+// *****************************************************************************
+//  Print one line of the benchmark table
+//! \param[in] name Name of the mesh
+//! \param[in] inpoel Tetrahedron connectivity
+// *****************************************************************************
+{
+  std::size_t nnz = 0;
+  double t = timeConstruction( inpoel, nnz );
+  std::size_t nelem = inpoel.size()/4;
+  std::cout << std::setw(16) << name
+            << std::setw(12) << nelem
+            << std::setw(14) << nnz
+            << std::setw(14) << std::setprecision(4) << t
+            << std::setw(14) << std::setprecision(4)
+            << (t > 0.0 ? static_cast< double >(nnz)/t/1.0e6 : 0.0)
+            << std::endl;
+}
+
+template< class Op >
+double
+timeSpMV( const Op& A, std::size_t n )
+// *****************************************************************************
+//  Time the in-place product r = A * x
+//! \param[in] A Matrix (SparseCSR or SellCSigma)
+//! \param[in] n Number of rows
+//! \return Best wall-clock time of a product in seconds
+// *****************************************************************************
+{
+  std::vector< double > x( n, 1.0 ), r( n );
+  A.mult( x, r );       // warm up
+  double best = 0.0;
+  for (int k=0; k<10; ++k) {
+    auto t0 = std::chrono::steady_clock::now();
+    A.mult( x, r );
+    auto t1 = std::chrono::steady_clock::now();
+    double t = std::chrono::duration< double >( t1 - t0 ).count();
+    if (k == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+void
+reportSpMV( const std::string& name,
+            const std::vector< std::size_t >& inpoel )
+// *****************************************************************************
+//  Print one line of the SpMV table
+//! \param[in] name Name of the mesh
+//! \param[in] inpoel Tetrahedron connectivity
+//! \details Bandwidth is given for the minimum traffic of CSR (values, 32-bit
+//!   column indices, row pointers, x and r read or written once), so the
+//!   columns compare directly to the memory bandwidth of the machine.
+// *****************************************************************************
+{
+  SparseCSR A( inpoel, 4 );
+  std::size_t nnz = A.getVals().size();
+  double* vals = A.data();
+  for (std::size_t k=0; k<nnz; ++k) vals[k] = 1.0 + 1.0e-3*k;
+  std::size_t n = A.getRPtr().size() - 1;
+  double bytes = 12.0*nnz + 4.0*(n+1) + 16.0*n;
+
+  std::cout << std::setw(16) << name << std::setw(14) << nnz
+            << std::setw(10) << std::setprecision(4) << bytes / timeSpMV( A, n ) / 1.0e9;
+
+  SellCSigma S( A );
+  const SellCSigma::Kernel kernels[] =
+    { SellCSigma::Scalar, SellCSigma::AVX2, SellCSigma::AVX512 };
+  for (auto k : kernels) {
+    if (SellCSigma::supported( k )) {
+      S.setKernel( k );
+      std::cout << std::setw(10) << std::setprecision(4)
+                << bytes / timeSpMV( S, n ) / 1.0e9;
+    } else {
+      std::cout << std::setw(10) << "-";
+    }
+  }
+  std::cout << std::setw(8) << std::setprecision(3) << S.fill() << std::endl;
+}
+
+void
+reportLaplacian( std::size_t n )
+// *****************************************************************************
+//  Print one line of the assembled versus matrix-free Laplacian table
+//! \param[in] n Number of hexahedra in each direction of the cube mesh
+// *****************************************************************************
+{
+  auto inpoel = cubeMesh( n );
+  auto coord = cubeCoord( n );
+  auto A = std::get< 0 >( laplacian( inpoel, coord ) );
+  LaplacianOperator cached( inpoel, coord, true );
+  LaplacianOperator recompute( inpoel, coord, false );
+  std::size_t npoin = coord[0].size();
+
+  std::cout << std::setw(16) << "cube " + std::to_string(n) + "^3"
+            << std::setw(12) << npoin
+            << std::setw(12) << std::setprecision(4) << timeSpMV( A, npoin )*1.0e3
+            << std::setw(12) << std::setprecision(4) << timeSpMV( cached, npoin )*1.0e3
+            << std::setw(12) << std::setprecision(4) << timeSpMV( recompute, npoin )*1.0e3
+            << std::setw(8) << cached.ncolors()
+            << std::setw(10) << std::setprecision(3)
+            << static_cast< double >( 12*A.getVals().size() + 4*(npoin+1) ) / 1.0e6
+            << std::setw(10) << std::setprecision(3)
+            << static_cast< double >( cached.bytes() ) / 1.0e6 << std::endl;
+}
+
+template< class Renumber >
+void
+reportRenumber( const std::string& name,
+                std::vector< std::size_t > inpoel,
+                std::array< std::vector< double >, 3 > coord,
+                Renumber renumber )
+// *****************************************************************************
+//  Print one line of the renumbering table
+//! \param[in] name Name of the mesh and the renumbering
+//! \param[in] inpoel Tetrahedron connectivity, zero-based
+//! \param[in] coord Node coordinates
+//! \param[in] renumber Callable renumbering inpoel and coord in place
+//! \details Time [ms] of the renumbering, and bandwidth and profile of the
+//!   node graph and time [ms] of the assembly of the Laplacian and of the
+//!   product with it, before and after renumbering.
+// *****************************************************************************
+{
+  auto measure = [&]( double& tasm, double& tmul ) {
+    auto t0 = std::chrono::steady_clock::now();
+    auto A = std::get< 0 >( laplacian( inpoel, coord ) );
+    auto t1 = std::chrono::steady_clock::now();
+    tasm = std::chrono::duration< double >( t1 - t0 ).count();
+    tmul = timeSpMV( A, coord[0].size() );
+    return bandwidth( genPsup( inpoel, 4, genEsup( inpoel, 4 ) ) );
+  };
+
+  double a0, m0, a1, m1;
+  auto before = measure( a0, m0 );
+  auto t0 = std::chrono::steady_clock::now();
+  renumber( inpoel, coord );
+  auto t1 = std::chrono::steady_clock::now();
+  double tre = std::chrono::duration< double >( t1 - t0 ).count();
+  auto after = measure( a1, m1 );
+
+  std::cout << std::setw(20) << name
+            << std::setw(9) << std::setprecision(3) << tre*1.0e3
+            << std::setw(11) << before.bandwidth << std::setw(11) << after.bandwidth
+            << std::setw(13) << before.profile << std::setw(13) << after.profile
+            << std::setw(9) << std::setprecision(3) << a0*1.0e3
+            << std::setw(9) << std::setprecision(3) << a1*1.0e3
+            << std::setw(9) << std::setprecision(3) << m0*1.0e3
+            << std::setw(9) << std::setprecision(3) << m1*1.0e3 << std::endl;
+}
+
+int
+main( int argc, char* argv[] )
+// *****************************************************************************
+// Benchmark main
+//! \details Usage: SparseCSRBench [max hexahedra per direction] [asc mesh]
+// *****************************************************************************
+{
+  std::size_t nmax = argc > 1 ? std::stoul( argv[1] ) : 64;
+  std::string mesh = argc > 2 ? argv[2] : "Resources/sedov_coarse.asc_mesh";
+
+  // real mesh, if available
+  std::vector< std::size_t > sedov;
+  std::array< std::vector< double >, 3 > sedov_coord;
+  ASCReader reader( mesh );
+  if (reader.readFile() && reader.getConnectionsCount() > 0) {
+    sedov.reserve( 4 * reader.getConnections().size() );
+    for (const auto& c : reader.getConnections()) {
+      sedov.push_back( c.z - 1 );
+      sedov.push_back( c.a - 1 );
+      sedov.push_back( c.b - 1 );
+      sedov.push_back( c.c - 1 );
+    }
+    for (const auto& p : reader.getCoordinates()) {
+      sedov_coord[0].push_back( p.x );
+      sedov_coord[1].push_back( p.y );
+      sedov_coord[2].push_back( p.z );
+    }
+  }
+
+  std::cout << std::setw(16) << "mesh"
+            << std::setw(12) << "elements"
+            << std::setw(14) << "nnz"
+            << std::setw(14) << "time [s]"
+            << std::setw(14) << "Mnnz/s" << std::endl;
+
+  for (std::size_t n=4; n<=nmax; n*=2)
+    report( "cube " + std::to_string(n) + "^3", cubeMesh(n) );
+
+  if (!sedov.empty()) report( "sedov_coarse", sedov );
+
+  // SpMV throughput, GB/s of minimum CSR traffic
+  std::cout << '\n' << std::setw(16) << "mesh"
+            << std::setw(14) << "nnz"
+            << std::setw(10) << "CSR"
+            << std::setw(10) << "SELL"
+            << std::setw(10) << "AVX2"
+            << std::setw(10) << "AVX-512"
+            << std::setw(8) << "fill" << std::endl;
+
+  for (std::size_t n=4; n<=nmax; n*=2)
+    reportSpMV( "cube " + std::to_string(n) + "^3", cubeMesh(n) );
+
+  if (!sedov.empty()) reportSpMV( "sedov_coarse", sedov );
+
+  // Laplacian product time [ms], assembled CSR versus matrix-free, and the
+  // memory of the CSR matrix versus the cached gradients [MB]
+  std::cout << '\n' << std::setw(16) << "mesh"
+            << std::setw(12) << "nodes"
+            << std::setw(12) << "CSR"
+            << std::setw(12) << "cached"
+            << std::setw(12) << "recompute"
+            << std::setw(8) << "colors"
+            << std::setw(10) << "CSR MB"
+            << std::setw(10) << "op MB" << std::endl;
+
+  for (std::size_t n=4; n<=nmax; n*=2) reportLaplacian( n );
+
+  // Renumbering: time, bandwidth and profile, assembly and SpMV time [ms]
+  if (!sedov.empty()) {
+    std::cout << '\n' << std::setw(20) << "mesh / renumbering" << std::setw(9) << "time"
+              << std::setw(11) << "bw" << std::setw(11) << "bw new"
+              << std::setw(13) << "profile" << std::setw(13) << "prof. new"
+              << std::setw(9) << "asm" << std::setw(9) << "asm new"
+              << std::setw(9) << "SpMV" << std::setw(9) << "SpMV new" << std::endl;
+    reportRenumber( "sedov RCM", sedov, sedov_coord,
+      []( auto& inpoel, auto& coord ){ renumberRCM( inpoel, coord ); } );
+    reportRenumber( "sedov Hilbert", sedov, sedov_coord,
+      []( auto& inpoel, auto& coord ){ renumberSFC( inpoel, coord, 4, Curve::Hilbert ); } );
+    reportRenumber( "sedov Morton", sedov, sedov_coord,
+      []( auto& inpoel, auto& coord ){ renumberSFC( inpoel, coord, 4, Curve::Morton ); } );
+  }
+
+  return 0;
+}
@@ -3,7 +3,17 @@
 #include <vector>
 #include <cassert>
 #include "SparseCSR.h"
+#include "SellCSigma.h"
+#include "BlockCSR.h"
+#include "SparseCSRIO.h"
+#include <cstdio>
+#include <stdexcept>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <fstream>
+#include <cstddef>
 
 
 std::size_t
@@ -173,6 +183,74 @@ int test_getter_and_setter(){
 
 
 
+int test_dense_kernels(){
+    // sizes that are not multiples of the padding, the unrolling or the blocks
+    const int m = 37, k = 133, n = 45;
+    Dense A(m, k), B(k, n);
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < k; j++) A.at(i,j) = std::sin(1.0 + i + 0.37*j);
+    for (int i = 0; i < k; i++)
+        for (int j = 0; j < n; j++) B.at(i,j) = std::cos(0.5*i - j);
+    if (A.ld() % 8 || A.ld() < k || reinterpret_cast<std::uintptr_t>(A.data()) % 64) {
+        std::cerr << "Dense test failed: rows not aligned" << std::endl;
+        return 1;
+    }
+
+    // GEMV against the definition
+    std::vector<double> x(k), y(m), r;
+    for (int j = 0; j < k; j++) x[j] = 1.0 + 0.01*j;
+    for (int i = 0; i < m; i++) y[i] = i;
+    A.multAdd(2.0, x, -1.0, y, r);
+    for (int i = 0; i < m; i++) {
+        double ref = -y[i];
+        for (int j = 0; j < k; j++) ref += 2.0 * A.getAt(i,j) * x[j];
+        if (std::abs(r[i] - ref) > 1e-12) {
+            std::cerr << "Dense GEMV test failed at row " << i << std::endl;
+            return 1;
+        }
+    }
+
+    // GEMM against the definition, C = 0.5*A*B + 2*C
+    Dense C(m, n, 1.0);
+    A.multAdd(0.5, B, 2.0, C);
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++) {
+            double ref = 2.0;
+            for (int q = 0; q < k; q++) ref += 0.5 * A.getAt(i,q) * B.getAt(q,j);
+            if (std::abs(C.getAt(i,j) - ref) > 1e-12) {
+                std::cerr << "Dense GEMM test failed at " << i << "," << j << std::endl;
+                return 1;
+            }
+        }
+
+    // transpose: rectangular, and square in place across several tiles
+    Dense At(A), S(k, k);
+    At.T();
+    for (int i = 0; i < k; i++)
+        for (int j = 0; j < k; j++) S.at(i,j) = i - 0.001*j;
+    S.T();
+    for (int i = 0; i < k; i++)
+        for (int j = 0; j < k; j++)
+            if ((j < m && At.getAt(i,j) != A.getAt(j,i)) || S.getAt(i,j) != j - 0.001*i) {
+                std::cerr << "Dense blocked transpose test failed" << std::endl;
+                return 1;
+            }
+
+    // reshape keeps the row-major order of the entries
+    Dense R(A);
+    R.reshape(k, m);
+    R.reshape(1, m*k);
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < k; j++)
+            if (R.getAt(0, i*k + j) != A.getAt(i,j)) {
+                std::cerr << "Dense reshape test failed" << std::endl;
+                return 1;
+            }
+
+    std::cout << "Dense GEMV/GEMM/transpose test passed!" << std::endl;
+    return 0;
+}
+
 int test_vector_multiplication(){
 
     std::vector<std::vector<double> > mat(3,std::vector<double>(2,2.0));
@@ -233,17 +311,17 @@ int test_SparseCSR_format(){
     
 
 
-    // for cols it must be as follows
+    // for cols it must be as follows (zero-based)
     std::size_t cols_arr[] = {
+        0, 1, 3, 4,
+        0, 1, 2, 3, 4, 5,
         1, 2, 4, 5,
-        1, 2, 3, 4, 5, 6,
-        2, 3, 5, 6,
+        0, 1, 3, 4, 6, 7,
+        0, 1, 2, 3, 4, 5, 6, 7, 8,
         1, 2, 4, 5, 7, 8,
-        1, 2, 3, 4, 5, 6, 7, 8, 9,
-        2, 3, 5, 6, 8, 9,
-        4, 5, 7, 8,
-        4, 5, 6, 7, 8, 9,
-        5, 6, 8, 9
+        3, 4, 6, 7,
+        3, 4, 5, 6, 7, 8,
+        4, 5, 7, 8
     };
     
     count = sizeof(cols_arr) / sizeof(cols_arr[0]);
@@ -251,7 +329,7 @@ int test_SparseCSR_format(){
     // Create a std::vector using the cols_array.
     std::vector<int> cols(cols_arr, cols_arr + count);
 
-    int row_ptrs_arr[]={1,5,11,15,21,30,36,40,46,50};
+    int row_ptrs_arr[]={0,4,10,14,20,29,35,39,45,49};
     count = sizeof(row_ptrs_arr) / sizeof(row_ptrs_arr[0]);
     std::vector<int> rows_ptr(row_ptrs_arr,row_ptrs_arr + count);
 
@@ -296,11 +374,11 @@ int SparseCSR_2(){
     shiftToZero(connectivity);
     SparseCSR s(connectivity,4);
 
-    int row_ptrs_arr[] = { 1, 8, 15, 22, 29, 36, 43, 50, 57, 66, 75, 84, 94, 103, 113 };
+    int row_ptrs_arr[] = { 0, 7, 14, 21, 28, 35, 42, 49, 56, 65, 74, 83, 93, 102, 112 };
     count = sizeof(row_ptrs_arr)/sizeof(row_ptrs_arr[0]);
     std::vector<int> rows_ptr(row_ptrs_arr,row_ptrs_arr+count);
 
-    int cols_arr[]={ 1, 2, 4, 5, 9, 11, 14, 1, 2, 3, 6, 9, 11, 12, 2, 3, 4, 7, 9, 12, 13, 1, 3, 4, 8, 9, 13, 14, 1, 5, 6, 8, 10, 11, 14, 2, 5, 6, 7, 10, 11, 12, 3, 6, 7, 8, 10, 12, 13, 4, 5, 7, 8, 10, 13, 14, 1, 2, 3, 4, 9, 11, 12, 13, 14, 5, 6, 7, 8, 10, 11, 12, 13, 14, 1, 2, 5, 6, 9, 10, 11, 12, 14, 2, 3, 6, 7, 9, 10, 11, 12, 13, 14, 3, 4, 7, 8, 9, 10, 12, 13, 14, 1, 4, 5, 8, 9, 10, 11, 12, 13, 14 };
+    int cols_arr[]={ 0, 1, 3, 4, 8, 10, 13, 0, 1, 2, 5, 8, 10, 11, 1, 2, 3, 6, 8, 11, 12, 0, 2, 3, 7, 8, 12, 13, 0, 4, 5, 7, 9, 10, 13, 1, 4, 5, 6, 9, 10, 11, 2, 5, 6, 7, 9, 11, 12, 3, 4, 6, 7, 9, 12, 13, 0, 1, 2, 3, 8, 10, 11, 12, 13, 4, 5, 6, 7, 9, 10, 11, 12, 13, 0, 1, 4, 5, 8, 9, 10, 11, 13, 1, 2, 5, 6, 8, 9, 10, 11, 12, 13, 2, 3, 6, 7, 8, 9, 11, 12, 13, 0, 3, 4, 7, 8, 9, 10, 11, 12, 13 };
     count = sizeof(cols_arr)/sizeof(cols_arr[0]);
     std::vector<int> cols(cols_arr,cols_arr+count);
 
@@ -332,6 +410,18 @@ int test_sparse_getter(){
     
     double val = s.at(4,4); // forth row and 4th column 
 
+    // getAt rejects the first row and column past the end, also of a
+    // rectangular matrix
+    SparseCSR<> p({ 0, 1, 2 }, { 1, 0 }, { 1.0, 2.0 }, false, 3);
+    const int n = s.rows();
+    const std::pair<const SparseCSR<>*, std::pair<int,int>> outside[] = {
+        { &s, { n, 0 } }, { &s, { 0, n } }, { &s, { -1, 0 } },
+        { &p, { 2, 0 } }, { &p, { 0, 3 } } };
+    for (const auto& [m, ij] : outside) {
+        try { m->getAt(ij.first, ij.second); val = 1; } catch (const std::out_of_range&) {}
+    }
+    if (p.getAt(1, 0) != 2.0 || p.getAt(1, 2) != 0.0) val = 1;
+
     if(val == 0 ) {
         std::cout<<"Getter test for sparse matrix passed" << val <<std::endl;
         return 0;
@@ -356,9 +446,11 @@ int test_sparse_setter(){
     const std::vector<std::size_t> connectivity(connectivity_arr,connectivity_arr+count);
     SparseCSR s(connectivity,4);
     
+    // one-based node ids are compacted: row 0 is node 1 with the columns
+    // { 0, 1, 3, 4 } of the nodes { 1, 2, 4, 5 }
     s.at(0,4)=3.0;
 
-    double actual_value = s.getVals()[2];
+    double actual_value = s.getVals()[3];
 
 
     if(actual_value == 3.0){
@@ -403,6 +495,256 @@ int test_CRS_vector_multiplication(){
 
 }
 
+int test_SparseCSR_64bit_indices(){
+    int connectivity_arr[] ={
+        1,2,4,5,
+        2,3,5,6,
+        4,5,7,8,
+        5,6,8,9
+    };
+
+    int count = sizeof(connectivity_arr) / sizeof(connectivity_arr[0]);
+
+    std::vector<std::size_t> connectivity(connectivity_arr,connectivity_arr+count);
+    shiftToZero(connectivity);
+
+    SparseCSR<std::int32_t> s32(connectivity,4);
+    SparseCSR<std::int64_t> s64(connectivity,4);
+
+    // same zero-based pattern, independent of the index type
+    std::vector<std::int64_t> rows_ptr(s32.getRPtr().begin(), s32.getRPtr().end());
+    std::vector<std::int64_t> cols(s32.getCols().begin(), s32.getCols().end());
+    if (rows_ptr != s64.getRPtr() || cols != s64.getCols() || s64.getRPtr()[0] != 0) {
+        std::cerr<<"SparseCSR 64-bit index test failed: patterns differ"<<std::endl;
+        return 1;
+    }
+
+    s64.at(4,4) = 2.0;
+    std::vector<double> x(s64.shape()[0], 1.0), r;
+    s64.mult(x, r);
+    if (r[4] != 2.0) {
+        std::cerr<<"SparseCSR 64-bit index test failed: wrong product"<<std::endl;
+        return 1;
+    }
+
+    std::cout<<"SparseCSR 64-bit index test passed"<<std::endl;
+    return 0;
+}
+
+int test_CRS_inplace_multiplication(){
+    int connectivity_arr[] ={
+        1,2,4,5,
+        2,3,5,6,
+        4,5,7,8,
+        5,6,8,9
+    };
+
+    int count = sizeof(connectivity_arr) / sizeof(connectivity_arr[0]);
+
+    std::vector<std::size_t> connectivity(connectivity_arr,connectivity_arr+count);
+    shiftToZero(connectivity);
+    SparseCSR s(connectivity,4);
+
+    // fill the stored entries with distinct values
+    int n = s.shape()[0];
+    for (int i = 0; i < n; i++)
+        for (int k = s.getRPtr()[i]; k < s.getRPtr()[i+1]; k++) {
+            int j = s.getCols()[k];
+            s.at(i,j) = 1.0 + i + 0.5*j;
+        }
+
+    std::vector<double> x(n), y(n), r(n, -1.0);
+    for (int i = 0; i < n; i++) { x[i] = 1.0 + i; y[i] = 2.0 - i; }
+
+    // reference result computed element by element
+    std::vector<double> ref(n, 0.0);
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            ref[i] += s.getAt(i,j) * x[j];
+
+    s.mult(static_cast<const std::vector<double>&>(x), r);
+    for (int i = 0; i < n; i++)
+        if (std::abs(r[i] - ref[i]) > 1e-12) {
+            std::cerr<<"SparseCSR in-place multiplication test failed at row "<<i<<std::endl;
+            return 1;
+        }
+
+    // fused r = alpha*A*x + beta*y, also with y aliasing r
+    s.multAdd(2.0, x, -3.0, y, r);
+    for (int i = 0; i < n; i++)
+        if (std::abs(r[i] - (2.0*ref[i] - 3.0*y[i])) > 1e-12) {
+            std::cerr<<"SparseCSR fused multiply-add test failed at row "<<i<<std::endl;
+            return 1;
+        }
+    r = y;
+    s.multAdd(1.0, x, 1.0, r, r);
+    for (int i = 0; i < n; i++)
+        if (std::abs(r[i] - (ref[i] + y[i])) > 1e-12) {
+            std::cerr<<"SparseCSR fused multiply-add (aliased) test failed at row "<<i<<std::endl;
+            return 1;
+        }
+
+    std::cout<<"SparseCSR in-place and fused multiplication test passed"<<std::endl;
+    return 0;
+}
+
+int test_SparseCSR_one_based_ids(){
+    // one-based and gapped node ids must number rows and columns the same way
+    // as the zero-based ids of the same mesh
+    int connectivity_arr[] ={
+        1,2,4,5,
+        2,3,5,6,
+        4,5,7,8,
+        5,6,8,9
+    };
+    int count = sizeof(connectivity_arr) / sizeof(connectivity_arr[0]);
+    std::vector<std::size_t> one(connectivity_arr,connectivity_arr+count);
+    std::vector<std::size_t> zero(one), gapped(one);
+    shiftToZero(zero);
+    for (auto& p : gapped) p = 10 + 3*p;
+
+    SparseCSR ref(zero,4);
+    const int n = ref.shape()[0];
+    for (int i = 0; i < n; i++)
+        for (int k = ref.getRPtr()[i]; k < ref.getRPtr()[i+1]; k++)
+            ref.data()[k] = (i == ref.getCols()[k] ? 4.0 : -1.0 - 0.1*i);
+    std::vector<double> x(n), rref;
+    for (int i = 0; i < n; i++) x[i] = 1.0 + i;
+    ref.mult(x, rref);
+    SparseCSR refT = ref.transpose();
+
+    for (const auto* conn : { &one, &gapped }) {
+        SparseCSR s(*conn,4);
+        if (s.rows() != ref.rows() || s.cols() != ref.cols() ||
+            !(s.getCols() == ref.getCols()) || !(s.getRPtr() == ref.getRPtr())) {
+            std::cerr<<"SparseCSR one-based ids test failed: wrong pattern"<<std::endl;
+            return 1;
+        }
+        std::copy(ref.getVals().begin(), ref.getVals().end(), s.data());
+        std::vector<double> r;
+        s.mult(x, r);
+        SparseCSR sT = s.transpose();
+        if (r != rref || !(sT.getCols() == refT.getCols()) ||
+            !(sT.getRPtr() == refT.getRPtr()) || sT.getVals() != refT.getVals()) {
+            std::cerr<<"SparseCSR one-based ids test failed: wrong product or transpose"<<std::endl;
+            return 1;
+        }
+    }
+
+    std::cout<<"SparseCSR one-based ids test passed"<<std::endl;
+    return 0;
+}
+
+int test_SparseCSR_empty_mesh(){
+    // a mesh without elements gives a 0x0 matrix whose products are empty
+    for (bool symmetric : { false, true }) {
+        SparseCSR A(std::vector<std::size_t>{}, 4, symmetric);
+        std::vector<double> x, r(3, 1.0), y;
+        A.mult(x, r);
+        A.multAdd(2.0, x, 1.0, y, y);
+        if (A.rows() != 0 || A.cols() != 0 || !r.empty() || !y.empty() ||
+            A.transpose().rows() != 0) {
+            std::cerr<<"SparseCSR empty mesh test failed"<<std::endl;
+            return 1;
+        }
+    }
+
+    std::cout<<"SparseCSR empty mesh test passed"<<std::endl;
+    return 0;
+}
+
+int test_CRS_symmetric_storage(){
+    int connectivity_arr[] ={
+        1,2,4,5,
+        2,3,5,6,
+        4,5,7,8,
+        5,6,8,9
+    };
+
+    int count = sizeof(connectivity_arr) / sizeof(connectivity_arr[0]);
+
+    std::vector<std::size_t> connectivity(connectivity_arr,connectivity_arr+count);
+    shiftToZero(connectivity);
+    SparseCSR full(connectivity,4);
+
+    // fill with symmetric values
+    int n = full.shape()[0];
+    for (int i = 0; i < n; i++)
+        for (int k = full.getRPtr()[i]; k < full.getRPtr()[i+1]; k++) {
+            int j = full.getCols()[k];
+            full.at(i,j) = 1.0 + i + j + (i == j ? 10.0 : 0.0);
+        }
+
+    SparseCSR sym(full);
+    sym.toSymmetric();
+
+    // the upper triangle pattern must match the one built directly
+    SparseCSR direct(connectivity,4,true);
+    if (!sym.isSymmetric() || !(direct.getCols() == sym.getCols()) ||
+        !(direct.getRPtr() == sym.getRPtr()) ||
+        2*sym.getVals().size() - n != full.getVals().size()) {
+        std::cerr<<"SparseCSR symmetric storage test failed: wrong upper triangle"<<std::endl;
+        return 1;
+    }
+
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            if (sym.getAt(i,j) != full.getAt(i,j)) {
+                std::cerr<<"SparseCSR symmetric storage test failed: wrong entry "<<i<<","<<j<<std::endl;
+                return 1;
+            }
+
+    // symmetric SpMV must match the full one
+    std::vector<double> x(n), y(n), rf, rs;
+    for (int i = 0; i < n; i++) { x[i] = 1.0 + i; y[i] = 0.5 * i; }
+    full.multAdd(2.0, x, 1.0, y, rf);
+    sym.multAdd(2.0, x, 1.0, y, rs);
+    std::vector<double> rs2, x2(n);
+    for (int i = 0; i < n; i++) x2[i] = 2.0 * x[i];
+    sym.mult(x2, rs2);
+    for (int i = 0; i < n; i++)
+        if (std::abs(rf[i] - rs[i]) > 1e-12) {
+            std::cerr<<"SparseCSR symmetric multiplication test failed at row "<<i<<std::endl;
+            return 1;
+        }
+
+    // concurrent products of the same symmetric matrix must not interfere
+    {
+        std::vector<double> r1, r2;
+        bool ok1 = true, ok2 = true;
+        std::thread t1([&]{ for (int k = 0; k < 200; k++) { sym.multAdd(2.0, x, 1.0, y, r1); ok1 &= r1 == rs; } });
+        std::thread t2([&]{ for (int k = 0; k < 200; k++) { sym.mult(x2, r2); ok2 &= r2 == rs2; } });
+        t1.join();
+        t2.join();
+        if (!ok1 || !ok2) {
+            std::cerr<<"SparseCSR symmetric multiplication test failed: concurrent products differ"<<std::endl;
+            return 1;
+        }
+    }
+
+    // Dirichlet BCs must act the same on both forms
+    std::vector<double> bf(n, 0.0), bs(n, 0.0);
+    full.dirichlet(4, 2.0, bf);
+    sym.dirichlet(4, 2.0, bs);
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+            if (sym.getAt(i,j) != full.getAt(i,j) || bf[i] != bs[i]) {
+                std::cerr<<"SparseCSR symmetric Dirichlet test failed at "<<i<<","<<j<<std::endl;
+                return 1;
+            }
+
+    // converting back must restore the full storage
+    sym.toFull();
+    if (sym.isSymmetric() || !(sym.getCols() == full.getCols()) ||
+        !(sym.getRPtr() == full.getRPtr()) || sym.getVals() != full.getVals()) {
+        std::cerr<<"SparseCSR symmetric storage test failed: wrong full form"<<std::endl;
+        return 1;
+    }
+
+    std::cout<<"SparseCSR symmetric storage test passed"<<std::endl;
+    return 0;
+}
+
 int test_dirichlet()
 {
     std::cout << "test start" << std::endl;
@@ -414,14 +756,14 @@ int test_dirichlet()
     };
 
     int count = sizeof(connectivity_arr) / sizeof(connectivity_arr[0]);
-    std::vector<double> b = {1, 2, 3, 4};
+    std::vector<double> b = {1, 2, 3, 4, 5, 6, 7, 8, 9};
 
     const std::vector<std::size_t> connectivity(connectivity_arr, connectivity_arr+count);
     SparseCSR s(connectivity, 4);
 
     s.dirichlet(0, 1, b);
 
-    if (s.getAt(0, 0) == 1.0)
+    if (s.getAt(0, 0) != 1.0)
     {
         std::cout << "Dirichlet BC diagonal element not the correct value." << std::endl;
         return 1;
@@ -436,6 +778,491 @@ int test_dirichlet()
     return 0;
 }
 
+int test_dirichlet_batched(){
+    // 5x5 quads on a 6x6 grid of nodes, constrain the bottom and left edges
+    const std::size_t m = 6;
+    std::vector<std::size_t> connectivity;
+    for (std::size_t j = 0; j + 1 < m; j++)
+        for (std::size_t i = 0; i + 1 < m; i++) {
+            std::size_t n0 = i + m*j;
+            connectivity.insert(connectivity.end(), { n0, n0+1, n0+m, n0+m+1 });
+        }
+    SparseCSR A(connectivity,4);
+    int n = A.shape()[0];
+    for (int i = 0; i < n; i++)
+        for (int k = A.getRPtr()[i]; k < A.getRPtr()[i+1]; k++) {
+            int j = A.getCols()[k];
+            A.at(i,j) = (i == j ? 8.0 : -1.0 - 0.01*(i+j));
+        }
+
+    std::vector<std::size_t> nodes;
+    std::vector<double> g;
+    for (std::size_t k = 0; k < m; k++) {
+        nodes.push_back(k);   g.push_back(1.0 + k);
+        if (k) { nodes.push_back(k*m); g.push_back(2.0 - k); }
+    }
+
+    // x satisfies the BCs, b = A*x: the modified systems must keep A*x = b
+    std::vector<double> x(n), b0;
+    for (int i = 0; i < n; i++) x[i] = 0.5 + 0.1*i;
+    for (std::size_t k = 0; k < nodes.size(); k++) x[nodes[k]] = g[k];
+    A.mult(x, b0);
+
+    for (int variant = 0; variant < 3; variant++) {
+        SparseCSR B(A);
+        if (variant == 2) B.toSymmetric();
+        std::vector<double> b(b0), Bx;
+        B.dirichlet(nodes, g, b, variant > 0);
+        B.mult(x, Bx);
+
+        std::vector<char> mask(n, 0);
+        for (auto k : nodes) mask[k] = 1;
+        for (int i = 0; i < n; i++) {
+            bool ok = std::abs(Bx[i] - b[i]) < 1e-12;
+            for (int j = 0; j < n && ok; j++) {
+                if (mask[i]) ok = B.getAt(i,j) == (i == j ? 1.0 : 0.0);
+                else if (mask[j]) ok = B.getAt(i,j) == (variant ? 0.0 : A.getAt(i,j));
+                else ok = B.getAt(i,j) == A.getAt(i,j);
+            }
+            if (!ok) {
+                std::cerr<<"SparseCSR batched Dirichlet test failed: variant "<<variant<<" row "<<i<<std::endl;
+                return 1;
+            }
+        }
+    }
+    // symmetric elimination in one call must equal a loop of single-node calls
+    for (int variant = 0; variant < 2; variant++) {
+        SparseCSR B(A), L(A);
+        if (variant) { B.toSymmetric(); L.toSymmetric(); }
+        std::vector<double> bb(b0), bl(b0);
+        B.dirichlet(nodes, g, bb, true);
+        for (std::size_t k = 0; k < nodes.size(); k++) L.dirichlet(nodes[k], g[k], bl);
+        bool ok = B.getVals() == L.getVals();
+        for (int i = 0; i < n && ok; i++) ok = std::abs(bb[i] - bl[i]) < 1e-12;
+        if (!ok) {
+            std::cerr<<"SparseCSR batched Dirichlet test failed: differs from single-node calls, variant "
+                     <<variant<<std::endl;
+            return 1;
+        }
+    }
+
+    // node ids out of range must be rejected
+    try {
+        SparseCSR B(A);
+        std::vector<double> b(b0);
+        B.dirichlet(std::vector<std::size_t>{ static_cast<std::size_t>(n) }, std::vector<double>{ 1.0 }, b);
+        std::cerr<<"SparseCSR batched Dirichlet test failed: node out of range accepted"<<std::endl;
+        return 1;
+    } catch (const std::out_of_range&) {}
+
+    std::cout<<"SparseCSR batched Dirichlet test passed"<<std::endl;
+    return 0;
+}
+
+int test_SellCSigma(){
+    // 5x5 quads on a 6x6 grid of nodes: rows with 4, 6 and 9 nonzeros
+    const std::size_t m = 6;
+    std::vector<std::size_t> connectivity;
+    for (std::size_t j = 0; j + 1 < m; j++)
+        for (std::size_t i = 0; i + 1 < m; i++) {
+            std::size_t n0 = i + m*j;
+            connectivity.insert(connectivity.end(), { n0, n0+1, n0+m, n0+m+1 });
+        }
+    SparseCSR A(connectivity,4);
+
+    int n = A.shape()[0];
+    for (int i = 0; i < n; i++)
+        for (int k = A.getRPtr()[i]; k < A.getRPtr()[i+1]; k++) {
+            int j = A.getCols()[k];
+            A.at(i,j) = (i == j ? 10.0 : -1.0 - 0.1*(i+j));
+        }
+    SparseCSR S(A);
+    S.toSymmetric();
+
+    std::vector<double> x(n), y(n), ref, r;
+    for (int i = 0; i < n; i++) { x[i] = 1.0 + i; y[i] = 0.5 * i; }
+    A.multAdd(2.0, x, -1.0, y, ref);
+
+    const SellCSigma::Kernel kernels[] = { SellCSigma::Scalar, SellCSigma::AVX2, SellCSigma::AVX512 };
+    const int shapes[][2] = { {1,1}, {4,4}, {4,16}, {8,32}, {32,64} };
+    for (const auto& cs : shapes)
+        for (auto k : kernels) {
+            SellCSigma sell(cs[0] == 8 ? SellCSigma(S, cs[0], cs[1]) : SellCSigma(A, cs[0], cs[1]));
+            if (sell.nonzeros() != A.getVals().size() || sell.fill() < 1.0) {
+                std::cerr<<"SellCSigma test failed: wrong number of nonzeros"<<std::endl;
+                return 1;
+            }
+            if (!SellCSigma::supported(k) || (k == SellCSigma::AVX2 && cs[0] % 4) ||
+                (k == SellCSigma::AVX512 && cs[0] % 8))
+                continue;
+            sell.setKernel(k);
+
+            // fused multiply-add, also with the result overwriting y
+            sell.multAdd(2.0, x, -1.0, y, r);
+            std::vector<double> yr(y);
+            sell.multAdd(2.0, x, -1.0, yr, yr);
+            for (int i = 0; i < n; i++)
+                if (std::abs(r[i] - ref[i]) > 1e-12 || std::abs(yr[i] - ref[i]) > 1e-12) {
+                    std::cerr<<"SellCSigma multiplication test failed: C="<<cs[0]<<" sigma="<<cs[1]
+                             <<" kernel="<<SellCSigma::name(k)<<" row "<<i<<std::endl;
+                    return 1;
+                }
+        }
+
+    // rectangular: the first 9 columns of the first 4 rows of A, x has cols() entries
+    std::vector<int> rp(1, 0), cp;
+    std::vector<double> vp;
+    for (int i = 0; i < 4; i++) {
+        for (int k = A.getRPtr()[i]; k < A.getRPtr()[i+1]; k++)
+            if (A.getCols()[k] < 9) { cp.push_back(A.getCols()[k]); vp.push_back(A.getVals()[k]); }
+        rp.push_back(cp.size());
+    }
+    SparseCSR<> P(rp, cp, vp, false, 9);
+    std::vector<double> xp(x.begin(), x.begin() + 9), refp;
+    P.mult(xp, refp);
+    for (auto k : kernels) {
+        if (!SellCSigma::supported(k)) continue;
+        SellCSigma sell(P, 8, 8);
+        sell.setKernel(k);
+        std::vector<double> rs = sell.mult(xp);
+        bool ok = sell.rows() == 4 && sell.cols() == 9 && rs.size() == 4;
+        for (int i = 0; ok && i < 4; i++) ok = std::abs(rs[i] - refp[i]) < 1e-12;
+        try { sell.mult(std::vector<double>(4), r); ok = false; } catch (const std::length_error&) {}
+        if (!ok) {
+            std::cerr<<"SellCSigma rectangular test failed: kernel="<<SellCSigma::name(k)<<std::endl;
+            return 1;
+        }
+    }
+    std::cout<<"SellCSigma multiplication test passed"<<std::endl;
+    return 0;
+}
+
+int test_SparseCSR_transpose_spgemm(){
+    // 5x5 quads on a 6x6 grid of nodes, nonsymmetric values
+    const std::size_t m = 6;
+    std::vector<std::size_t> connectivity;
+    for (std::size_t j = 0; j + 1 < m; j++)
+        for (std::size_t i = 0; i + 1 < m; i++) {
+            std::size_t n0 = i + m*j;
+            connectivity.insert(connectivity.end(), { n0, n0+1, n0+m, n0+m+1 });
+        }
+    SparseCSR A(connectivity,4);
+    const int n = A.shape()[0];
+    for (int i = 0; i < n; i++)
+        for (int k = A.getRPtr()[i]; k < A.getRPtr()[i+1]; k++)
+            A.data()[k] = (i == A.getCols()[k] ? 8.0 : -1.0 - 0.01*i - 0.001*A.getCols()[k]);
+
+    // dense copy of a matrix, to check the products against
+    auto dense = [](const SparseCSR<>& M) {
+        std::vector<std::vector<double>> D(M.rows(), std::vector<double>(M.cols(), 0.0));
+        for (std::size_t i = 0; i < M.rows(); i++)
+            for (int k = M.getRPtr()[i]; k < M.getRPtr()[i+1]; k++)
+                D[i][M.getCols()[k]] = M.getVals()[k];
+        return D;
+    };
+    auto dproduct = [](const std::vector<std::vector<double>>& X,
+                       const std::vector<std::vector<double>>& Y) {
+        std::vector<std::vector<double>> Z(X.size(), std::vector<double>(Y[0].size(), 0.0));
+        for (std::size_t i = 0; i < X.size(); i++)
+            for (std::size_t k = 0; k < Y.size(); k++)
+                for (std::size_t j = 0; j < Y[0].size(); j++) Z[i][j] += X[i][k] * Y[k][j];
+        return Z;
+    };
+    auto matches = [&](const SparseCSR<>& M, const std::vector<std::vector<double>>& D) {
+        if (M.rows() != D.size() || M.cols() != D[0].size()) return false;
+        for (std::size_t i = 0; i < M.rows(); i++)
+            for (int k = M.getRPtr()[i]; k < M.getRPtr()[i+1]; k++)
+                if (k > M.getRPtr()[i] && M.getCols()[k] <= M.getCols()[k-1]) return false;
+        auto E = dense(M);
+        for (std::size_t i = 0; i < D.size(); i++)
+            for (std::size_t j = 0; j < D[0].size(); j++)
+                if (std::abs(E[i][j] - D[i][j]) > 1e-12) return false;
+        return true;
+    };
+    const auto DA = dense(A);
+
+    // transpose, and in place twice
+    auto At = A.transpose();
+    std::vector<std::vector<double>> DAt(n, std::vector<double>(n));
+    for (int i = 0; i < n; i++) for (int j = 0; j < n; j++) DAt[i][j] = DA[j][i];
+    SparseCSR B(A);
+    B.T();
+    B.T();
+    if (!matches(At, DAt) || At.getVals().size() != A.getVals().size() ||
+        B.getCols() != A.getCols() || B.getVals() != A.getVals()) {
+        std::cerr<<"SparseCSR transpose test failed"<<std::endl;
+        return 1;
+    }
+
+    // A^T A, also from symmetric storage of A + A^T
+    if (!matches(At.multiply(A), dproduct(DAt, DA))) {
+        std::cerr<<"SparseCSR SpGEMM A^T A test failed"<<std::endl;
+        return 1;
+    }
+    SparseCSR S(A);
+    for (int i = 0; i < n; i++)
+        for (int k = S.getRPtr()[i]; k < S.getRPtr()[i+1]; k++)
+            S.data()[k] += At.getVals()[k];
+    auto DS = dense(S);
+    S.toSymmetric();
+    if (!matches(S.multiply(A), dproduct(DS, DA))) {
+        std::cerr<<"SparseCSR SpGEMM symmetric test failed"<<std::endl;
+        return 1;
+    }
+
+    // Galerkin product P^T A P with a rectangular aggregation operator:
+    // fine node (i,j) belongs to the coarse node (i/2, j/2) of a 3x3 grid
+    std::vector<int> rp(n+1), cp(n);
+    std::vector<double> vp(n, 1.0);
+    for (int p = 0; p < n; p++) {
+        rp[p+1] = p + 1;
+        cp[p] = (p % m) / 2 + 3 * ((p / m) / 2);
+    }
+    SparseCSR<> P(rp, cp, vp, false, 9);
+    auto Ac = P.transpose().multiply(A.multiply(P));
+    std::vector<std::vector<double>> DP = dense(P), DPt(9, std::vector<double>(n));
+    for (int i = 0; i < 9; i++) for (int j = 0; j < n; j++) DPt[i][j] = DP[j][i];
+    if (P.rows() != std::size_t(n) || P.cols() != 9 || !matches(Ac, dproduct(DPt, dproduct(DA, DP)))) {
+        std::cerr<<"SparseCSR Galerkin product test failed"<<std::endl;
+        return 1;
+    }
+
+    // reshape keeps the row-major order of the entries, also from symmetric storage
+    auto reshaped = [n](const std::vector<std::vector<double>>& D, int rows, int cols) {
+        std::vector<std::vector<double>> R(rows, std::vector<double>(cols));
+        for (int l = 0; l < n*n; l++) R[l / cols][l % cols] = D[l / n][l % n];
+        return R;
+    };
+    SparseCSR R(A), RS(S);
+    R.reshape(9, 4*n);
+    RS.reshape(4*n, 9);
+    std::vector<double> x(4*n, 1.0), y;
+    R.mult(x, y);
+    bool ok = matches(R, reshaped(DA, 9, 4*n)) && matches(RS, reshaped(DS, 4*n, 9)) && y.size() == 9;
+    for (int i = 0; ok && i < 9; i++) {
+        double sum = 0.0;
+        for (int j = 0; j < 4*n; j++) sum += reshaped(DA, 9, 4*n)[i][j];
+        ok = std::abs(y[i] - sum) < 1e-12;
+    }
+    try { R.reshape(5, n); ok = false; } catch (const std::invalid_argument&) {}
+    if (!ok) {
+        std::cerr<<"SparseCSR reshape test failed"<<std::endl;
+        return 1;
+    }
+
+    std::cout<<"SparseCSR transpose, SpGEMM and reshape test passed"<<std::endl;
+    return 0;
+}
+
+int test_SparseCSR_io(){
+    // 5x5 quads on a 6x6 grid of nodes, nonsymmetric values
+    const std::size_t m = 6;
+    std::vector<std::size_t> connectivity;
+    for (std::size_t j = 0; j + 1 < m; j++)
+        for (std::size_t i = 0; i + 1 < m; i++) {
+            std::size_t n0 = i + m*j;
+            connectivity.insert(connectivity.end(), { n0, n0+1, n0+m, n0+m+1 });
+        }
+    SparseCSR A(connectivity,4);
+    int n = A.shape()[0];
+    for (int i = 0; i < n; i++)
+        for (int k = A.getRPtr()[i]; k < A.getRPtr()[i+1]; k++)
+            A.data()[k] = (i == A.getCols()[k] ? 8.0 : -1.0 - 0.01*i - 0.001*A.getCols()[k]);
+    SparseCSR S(A);
+    for (int i = 0; i < n; i++)
+        for (int k = S.getRPtr()[i]; k < S.getRPtr()[i+1]; k++)
+            S.at(i, S.getCols()[k]) = S.at(S.getCols()[k], i) = A.getAt(std::min(i, S.getCols()[k]),
+                                                                        std::max(i, S.getCols()[k]));
+    S.toSymmetric();
+
+    auto same = [](const SparseCSR<>& X, const SparseCSR<>& Y) {
+        return X.isSymmetric() == Y.isSymmetric() && X.getRPtr() == Y.getRPtr() &&
+               X.getCols() == Y.getCols() && X.getVals() == Y.getVals();
+    };
+    const std::string bin = "test_SparseCSR_io.csr", amg = "test_SparseCSR_io.bin",
+                      mm = "test_SparseCSR_io.mtx";
+    int result = 0;
+
+    // binary format, copied and mapped, full and symmetric storage
+    for (const SparseCSR<>* M : { &A, &S }) {
+        writeBinary(bin, *M);
+        MappedCSR<> mapped(bin);
+        std::vector<double> x(n), r, ref;
+        for (int i = 0; i < n; i++) x[i] = 1.0 + i;
+        M->mult(x, ref);
+        mapped.mult(x, r);
+        bool ok = same(readBinary(bin), *M) && mapped.rows() == std::size_t(n) &&
+                  mapped.isSymmetric() == M->isSymmetric();
+        for (int i = 0; i < n && ok; i++) ok = std::abs(r[i] - ref[i]) < 1e-12;
+        if (!ok) {
+            std::cerr<<"SparseCSR binary io test failed"<<std::endl;
+            result = 1;
+        }
+    }
+
+    // a file with other index or value types is rejected
+    bool thrown = false;
+    try { MappedCSR<std::int64_t, double> wrong(bin); }
+    catch (const std::runtime_error&) { thrown = true; }
+    if (!thrown) {
+        std::cerr<<"SparseCSR binary io test failed: type mismatch not detected"<<std::endl;
+        result = 1;
+    }
+
+    // corrupt files are rejected on open: header sizes that overflow, column
+    // indices out of range, decreasing row pointers, lower triangle entries
+    // in symmetric storage
+    writeBinary(bin, S);
+    CSRFileHeader h;
+    {
+        std::ifstream f(bin, std::ios::binary);
+        f.read(reinterpret_cast<char*>(&h), sizeof(h));
+    }
+    auto corrupt = [&](std::uint64_t offset, const void* data, std::size_t bytes) {
+        writeBinary(bin, S);
+        std::fstream f(bin, std::ios::binary | std::ios::in | std::ios::out);
+        f.seekp(static_cast<std::streamoff>(offset));
+        f.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+        f.close();
+        try { MappedCSR<> bad(bin); }
+        catch (const std::runtime_error&) { return true; }
+        return false;
+    };
+    const std::uint64_t huge = (std::uint64_t(1) << 62) + 1;
+    const int ncols = n, second = S.getRPtr()[2] + 1, diagonal = 0;
+    if (!corrupt(offsetof(CSRFileHeader, nnz), &huge, sizeof(huge)) ||
+        !corrupt(offsetof(CSRFileHeader, nrows), &huge, sizeof(huge)) ||
+        !corrupt(h.col_offset + sizeof(int), &ncols, sizeof(int)) ||
+        !corrupt(h.ptr_offset + sizeof(int), &second, sizeof(int)) ||
+        !corrupt(h.col_offset + S.getRPtr()[1]*sizeof(int), &diagonal, sizeof(int))) {
+        std::cerr<<"SparseCSR binary io test failed: corrupt file accepted"<<std::endl;
+        result = 1;
+    }
+
+    // AMGCL binary and Matrix Market store the full matrix
+    SparseCSR F(S);
+    F.toFull();
+    writeAmgclBinary(amg, S);
+    writeMatrixMarket(mm, A);
+    if (!same(readAmgclBinary(amg), F)) {
+        std::cerr<<"SparseCSR AMGCL binary io test failed"<<std::endl;
+        result = 1;
+    }
+    auto B = readMatrixMarket(mm);
+    bool ok = B.getRPtr() == A.getRPtr() && B.getCols() == A.getCols();
+    for (std::size_t k = 0; k < A.getVals().size() && ok; k++)
+        ok = std::abs(B.getVals()[k] - A.getVals()[k]) < 1e-12;
+    if (!ok) {
+        std::cerr<<"SparseCSR Matrix Market io test failed"<<std::endl;
+        result = 1;
+    }
+
+    std::remove(bin.c_str());
+    std::remove(amg.c_str());
+    std::remove(mm.c_str());
+    if (!result) std::cout<<"SparseCSR io test passed"<<std::endl;
+    return result;
+}
+
+template< int B >
+int test_BlockCSR(){
+    // 2x2 quads on a 3x3 grid of nodes, zero-based
+    std::vector<std::size_t> connectivity{ 0,1,3,4, 1,2,4,5, 3,4,6,7, 4,5,7,8 };
+    BlockCSR<B> A(connectivity,4);
+    SparseCSR pattern(connectivity,4);
+
+    // one block per scalar nonzero of the node pattern
+    if (!(A.getRPtr() == pattern.getRPtr()) || !(A.getCols() == pattern.getCols()) ||
+        A.nonzeros() != B*B*pattern.getVals().size()) {
+        std::cerr<<"BlockCSR<"<<B<<"> test failed: wrong block pattern"<<std::endl;
+        return 1;
+    }
+
+    // symmetric values, diagonally dominant
+    const std::size_t n = A.rows();
+    for (std::size_t bi = 0; bi < A.nblockrows(); bi++)
+        for (int k = A.getRPtr()[bi]; k < A.getRPtr()[bi+1]; k++)
+            for (std::size_t p = 0; p < B; p++)
+                for (std::size_t q = 0; q < B; q++) {
+                    std::size_t i = bi*B + p, j = A.getCols()[k]*B + q;
+                    A.at(i,j) = (i == j ? 20.0 : -1.0 / (1.0 + i + j));
+                }
+
+    // block SpMV against the scalar definition
+    std::vector<double> x(n), y(n), r, ref(n, 0.0);
+    for (std::size_t i = 0; i < n; i++) { x[i] = 1.0 + i; y[i] = 0.25 * i; }
+    for (std::size_t i = 0; i < n; i++) {
+        for (std::size_t j = 0; j < n; j++) ref[i] += A.getAt(i,j) * x[j];
+        ref[i] = 3.0 * ref[i] - y[i];
+    }
+    A.multAdd(3.0, x, -1.0, y, r);
+    for (std::size_t i = 0; i < n; i++)
+        if (std::abs(r[i] - ref[i]) > 1e-10) {
+            std::cerr<<"BlockCSR<"<<B<<"> multiplication test failed at row "<<i<<std::endl;
+            return 1;
+        }
+
+    // Dirichlet on a whole node and on a single component of another node:
+    // the solution of the modified system keeps A*x = b in the free rows
+    std::vector<double> b;
+    A.mult(x, b);
+    std::array<double,B> g;
+    for (int c = 0; c < B; c++) g[c] = x[4*B + c];
+    A.dirichlet(4, g, b);
+    A.dirichlet(0, 1, x[1], b);
+    std::vector<double> Ax;
+    A.mult(x, Ax);
+    for (std::size_t i = 0; i < n; i++)
+        if (std::abs(Ax[i] - b[i]) > 1e-10 ||
+            (i/B == 4 && (A.getAt(i,i) != 1.0 || A.getAt(i,0) != 0.0 || A.getAt(0,i) != 0.0)) ||
+            (i != 1 && (A.getAt(1,i) != 0.0 || A.getAt(i,1) != 0.0))) {
+            std::cerr<<"BlockCSR<"<<B<<"> Dirichlet test failed at row "<<i<<std::endl;
+            return 1;
+        }
+
+    std::cout<<"BlockCSR<"<<B<<"> test passed"<<std::endl;
+    return 0;
+}
+
+int test_SparseCSR_spmm(){
+    // 7x7 quads on an 8x8 grid of nodes, nonsymmetric values
+    const std::size_t m = 8;
+    std::vector<std::size_t> connectivity;
+    for (std::size_t j = 0; j + 1 < m; j++)
+        for (std::size_t i = 0; i + 1 < m; i++) {
+            std::size_t n0 = i + m*j;
+            connectivity.insert(connectivity.end(), { n0, n0+1, n0+m, n0+m+1 });
+        }
+    SparseCSR A(connectivity,4);
+    const std::size_t n = A.rows();
+    for (std::size_t i = 0; i < n; i++)
+        for (int k = A.getRPtr()[i]; k < A.getRPtr()[i+1]; k++)
+            A.data()[k] = (int(i) == A.getCols()[k] ? 8.0 : -1.0 - 0.01*i);
+    SparseCSR S(A);
+    for (std::size_t i = 0; i < n; i++)
+        for (int k = S.getRPtr()[i]; k < S.getRPtr()[i+1]; k++)
+            S.at(S.getCols()[k], i) = S.getVals()[k];
+    S.toSymmetric();
+
+    // each column of the interleaved product must equal the SpMV of that column
+    for (const SparseCSR<>* M : { &A, &S })
+        for (std::size_t k : { 1, 2, 3, 4, 8, 11 }) {
+            std::vector<double> X(n*k), Y, x(n), y;
+            for (std::size_t i = 0; i < X.size(); i++) X[i] = std::sin(0.37*i);
+            M->multBlock(k, X, Y);
+            for (std::size_t c = 0; c < k; c++) {
+                for (std::size_t j = 0; j < n; j++) x[j] = X[j*k + c];
+                M->mult(x, y);
+                for (std::size_t i = 0; i < n; i++)
+                    if (std::abs(Y[i*k + c] - y[i]) > 1e-12) {
+                        std::cerr<<"SparseCSR SpMM test failed, k = "<<k<<std::endl;
+                        return 1;
+                    }
+            }
+        }
+    return 0;
+}
+
 int main() {
     int result = 0;
 
@@ -445,13 +1272,27 @@ int main() {
     result |= test_transpose();
     result |= test_transpose_3x2_array();
     result |= test_getter_and_setter();
+    result |= test_dense_kernels();
     result |= test_vector_multiplication();
     result |= test_SparseCSR_format();
     result |= SparseCSR_2();
     result |= test_sparse_getter();
     result |= test_sparse_setter();
     result |= test_CRS_vector_multiplication();
+    result |= test_SparseCSR_64bit_indices();
+    result |= test_CRS_inplace_multiplication();
+    result |= test_SparseCSR_one_based_ids();
+    result |= test_SparseCSR_empty_mesh();
+    result |= test_CRS_symmetric_storage();
+    result |= test_SellCSigma();
+    result |= test_SparseCSR_io();
+    result |= test_SparseCSR_transpose_spgemm();
+    result |= test_SparseCSR_spmm();
+    result |= test_BlockCSR<2>();
+    result |= test_BlockCSR<3>();
+    result |= test_BlockCSR<5>();
     result |= test_dirichlet();
+    result |= test_dirichlet_batched();
 
     return result;
 }
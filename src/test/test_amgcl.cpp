@@ -1,10 +1,27 @@
 #include <iostream>
 #include <algorithm>
 #include <tuple>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
 #include <amgcl_solver.hpp>
 #include "matrix_generator.hpp"
 #include "Laplacian.hpp"
 
+// Tolerances that depend on the precision of the AMGCL matrices: with
+// FIREFLY_MIXED_PRECISION the solves see the float-rounded matrix, so their
+// round-off and their distance from the double system are those of float
+#ifdef FIREFLY_MIXED_PRECISION
+const double LAPLACE_ERROR = 4.17528e-14, LAPLACE_ERROR_DELTA = 3e-14;
+const double MATRIX_ROUNDOFF = 1e-4;   // solution difference, double vs float matrix
+const double SYSTEM_RESIDUAL = 1e-5;   // residual of the solution in the double system
+#else
+const double LAPLACE_ERROR = 4.91255e-16, LAPLACE_ERROR_DELTA = 3e-16;
+const double MATRIX_ROUNDOFF = 1e-8;
+const double SYSTEM_RESIDUAL = 1e-7;
+#endif
+
 int helper_poissonTest(
     int iters_exp,
     double error_exp,
@@ -160,6 +177,326 @@ int helper_laplaceTest(
     return result;
 }
 
+// Laplace system of the tet mesh above with a Dirichlet BC and a nonzero rhs
+std::tuple<SparseCSR<>, std::vector<double>, std::vector<double>> laplaceSystem()
+{
+    std::vector< std::size_t > inpoel {
+        3, 13, 8, 14,   12, 3, 13, 8,   8, 3, 14, 11,   12, 3, 8, 11,
+        1, 2, 3, 13,    6, 13, 7, 8,    5, 9, 14, 11,   5, 1, 3, 14,
+        10, 4, 12, 11,  2, 6, 12, 13,   8, 7, 9, 14,    13, 1, 7, 14,
+        5, 3, 4, 11,    6, 10, 12, 8,   3, 2, 4, 12,    10, 8, 9, 11,
+        3, 1, 13, 14,   13, 7, 8, 14,   6, 12, 13, 8,   9, 8, 14, 11,
+        3, 5, 14, 11,   4, 3, 12, 11,   3, 2, 12, 13,   10, 12, 8, 11 };
+    std::array< std::vector< double >, 3 > coord {{
+        {{ -0.5, -0.5, -0.5, -0.5, -0.5, 0.5, 0.5, 0.5, 0.5, 0.5, 0, 0, 0, 0 }},
+        {{ 0.5, 0.5, 0, -0.5, -0.5, 0.5, 0.5, 0, -0.5, -0.5, -0.5, 0, 0.5, 0 }},
+        {{ -0.5, 0.5, 0, 0.5, -0.5, 0.5, -0.5, 0, -0.5, 0.5, 0, 0.5, 0, -0.5 }} }};
+    for (auto& n : inpoel) n -= 1;
+
+    auto [A, x, b] = laplacian(inpoel, coord);
+    A.dirichlet(0, 1, b);
+    for (std::size_t i = 0; i < b.size(); ++i) b[i] += 0.1 * i;
+    return { std::move(A), std::move(x), std::move(b) };
+}
+
+// Same Laplace setup, Krylov SpMVs done in SELL-C-sigma format: must match the CSR solve
+int GivenLaplaceInput_WithSellCSigmaOperator_MatchesCSRSolve()
+{
+    auto [A, x, b] = laplaceSystem();
+
+    std::vector<double> xc, xs;
+    auto [iters_csr, error_csr] = solveAMGCL(AmgclPrecond_SPAI0, A.getRPtr(), A.getCols(),
+                                             A.getVals(), b, xc);
+    SellCSigma S(A, 4, 8);
+    auto [iters_sell, error_sell] = solveAMGCL(AmgclPrecond_SPAI0, A, S, b, xs);
+
+    double diff = 0.0;
+    for (std::size_t i = 0; i < xc.size(); ++i)
+        diff = std::max(diff, std::abs(xc[i] - xs[i]));
+    if (iters_sell != iters_csr || std::abs(error_sell - error_csr) > 1e-10 || diff > MATRIX_ROUNDOFF)
+    {
+        std::cerr << "*** Laplace with SELL-C-sigma operator ***" << std::endl
+                  << "Expected " << iters_csr << " iterations, error " << error_csr
+                  << " but got " << iters_sell << ", " << error_sell
+                  << ", max solution difference " << diff << std::endl << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Same Laplace setup with float matrix values: solution close to the double one
+int GivenLaplaceInput_WithFloatValues_MatchesDoubleSolve()
+{
+    auto [A, x, b] = laplaceSystem();
+
+    std::vector<double> xd, xf;
+    solveAMGCL(AmgclPrecond_SPAI0, A.getRPtr(), A.getCols(), A.getVals(), b, xd);
+    SparseCSR<int, float> Af(A);
+    auto [iters, error] = solveAMGCL(AmgclPrecond_SPAI0, Af, b, xf);
+
+    double diff = 0.0, norm = 0.0;
+    for (std::size_t i = 0; i < xd.size(); ++i) {
+        diff = std::max(diff, std::abs(xd[i] - xf[i]));
+        norm = std::max(norm, std::abs(xd[i]));
+    }
+    if (error > 1e-8 || diff > 1e-5 * norm)
+    {
+        std::cerr << "*** Laplace with float matrix values ***" << std::endl
+                  << "Got error " << error << " after " << iters << " iterations"
+                  << ", max solution difference " << diff << std::endl << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Same Laplace setup with several right-hand sides: each solution matches its single solve
+int GivenLaplaceInput_WithMultipleRhs_MatchesSingleSolves()
+{
+    auto [A, x, b] = laplaceSystem();
+
+    std::vector<std::vector<double>> rhs, xs;
+    for (int c = 0; c < 3; ++c) {
+        rhs.push_back(b);
+        for (std::size_t i = 0; i < b.size(); ++i) rhs.back()[i] *= 1.0 + c * std::sin(0.5 * i);
+    }
+    auto results = solveAMGCL(AmgclPrecond_SPAI0, A, rhs, xs);
+
+    int result = 0;
+    for (std::size_t c = 0; c < rhs.size(); ++c) {
+        std::vector<double> xc;
+        auto [iters, error] = solveAMGCL(AmgclPrecond_SPAI0, A.getRPtr(), A.getCols(),
+                                         A.getVals(), rhs[c], xc);
+        double diff = 0.0;
+        for (std::size_t i = 0; i < xc.size(); ++i)
+            diff = std::max(diff, std::abs(xc[i] - xs[c][i]));
+        if (std::get<0>(results[c]) != iters || diff > 1e-12)
+        {
+            std::cerr << "*** Laplace with multiple right-hand sides ***" << std::endl
+                      << "Right-hand side " << c << ": expected " << iters << " iterations"
+                      << " but got " << std::get<0>(results[c])
+                      << ", max solution difference " << diff << std::endl << std::endl;
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// Persistent solver: repeated solves with one setup match the one-shot solves
+int GivenLaplaceInput_WithReusedSolver_MatchesOneShotSolves()
+{
+    auto [A, x, b] = laplaceSystem();
+
+    int result = 0;
+    const AmgclPrecondType precond[] = {
+        AmgclPrecond_GaussSeidel, AmgclPrecond_ILU0, AmgclPrecond_SPAI0 };
+    for (auto p : precond) {
+        AmgclSolver solver(p, A);
+        for (int step = 0; step < 3; ++step) {
+            std::vector<double> rhs(b), xs, xc;
+            for (std::size_t i = 0; i < rhs.size(); ++i) rhs[i] += step * std::cos(0.3 * i);
+            auto [iters, error] = solver.solve(rhs, xs);
+            auto [iters_exp, error_exp] = solveAMGCL(p, A.getRPtr(), A.getCols(), A.getVals(), rhs, xc);
+            double diff = 0.0;
+            for (std::size_t i = 0; i < xc.size(); ++i)
+                diff = std::max(diff, std::abs(xc[i] - xs[i]));
+            if (iters != iters_exp || std::abs(error - error_exp) > 1e-14 || diff > 1e-12)
+            {
+                std::cerr << "*** Laplace with reused AMGCL solver ***" << std::endl
+                          << "Step " << step << ": expected " << iters_exp << " iterations, error "
+                          << error_exp << " but got " << iters << ", " << error
+                          << ", max solution difference " << diff << std::endl << std::endl;
+                result = 1;
+            }
+        }
+        if (solver.solves() != 3 || solver.rows() != b.size() || solver.setupTime() <= 0.0)
+        {
+            std::cerr << "*** Laplace with reused AMGCL solver ***" << std::endl
+                      << "Wrong statistics: " << solver.solves() << " solves, " << solver.rows()
+                      << " rows, setup time " << solver.setupTime() << std::endl << std::endl;
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// Poisson matrix with new values, same pattern: refreshed hierarchy solves the
+// new system, and the rebuild policy kicks in once iterations grow
+int GivenPoissonMatrix_WithNewValues_RefreshSolvesNewSystem()
+{
+    std::vector<int> ptr, col;
+    std::vector<double> val, rhs;
+    poisson(64, ptr, col, val, rhs);
+    SparseCSR<> A(ptr, col, val);
+
+    // variable coefficient: interior rows scaled, symmetric in the products
+    auto scaled = [&](double amplitude) {
+        SparseCSR<> B(A);
+        for (std::size_t i = 0; i + 1 < ptr.size(); ++i)
+            for (int k = ptr[i]; k < ptr[i+1]; ++k)
+                B.data()[k] *= 1.0 + amplitude * std::sin(0.01 * i) * std::sin(0.01 * col[k]);
+        return B;
+    };
+    auto residual = [&](const SparseCSR<> &B, const std::vector<double> &x) {
+        std::vector<double> r;
+        B.residual(rhs, x, r);
+        double rr = 0.0, bb = 0.0;
+        for (std::size_t i = 0; i < r.size(); ++i) { rr += r[i] * r[i]; bb += rhs[i] * rhs[i]; }
+        return std::sqrt(rr / bb);
+    };
+
+    int result = 0;
+    AmgclSolver solver(AmgclPrecond_SPAI0, A);
+    std::vector<double> x;
+    auto [iters0, error0] = solver.solve(rhs, x);
+
+    SparseCSR<> B = scaled(0.5);
+    solver.update(B);
+    x.clear();
+    auto [iters1, error1] = solver.solve(rhs, x);
+    if (solver.refreshes() != 1 || solver.rebuilds() != 0 || residual(B, x) > SYSTEM_RESIDUAL)
+    {
+        std::cerr << "*** Poisson with refreshed AMGCL hierarchy ***" << std::endl
+                  << "Relative residual " << residual(B, x) << " after " << iters1
+                  << " iterations (" << iters0 << " before the refresh)" << std::endl << std::endl;
+        result = 1;
+    }
+
+    // any growth degrades: the next update rebuilds and resets the baseline
+    solver.setRebuildThreshold(0.0);
+    x.clear();
+    solver.solve(rhs, x);
+    SparseCSR<> C = scaled(0.9);
+    bool rebuilt = solver.update(C);
+    x.clear();
+    solver.solve(rhs, x);
+    if (!rebuilt || solver.rebuilds() != 1 || residual(C, x) > SYSTEM_RESIDUAL)
+    {
+        std::cerr << "*** Poisson with rebuilt AMGCL hierarchy ***" << std::endl
+                  << "Rebuilt: " << rebuilt << ", relative residual " << residual(C, x)
+                  << std::endl << std::endl;
+        result = 1;
+    }
+
+    // a changed pattern cannot be refreshed
+    try {
+        solver.refresh(SparseCSR<>(std::vector<int>{0, 1}, std::vector<int>{0}, std::vector<double>{1.0}));
+        std::cerr << "*** Poisson refresh with another pattern did not throw ***" << std::endl;
+        result = 1;
+    } catch (const std::invalid_argument &) {}
+    return result;
+}
+
+#ifdef FIREFLY_AMGCL_RUNTIME
+// Solver stacks read from JSON files: all of them solve the Poisson problem, and
+// CG with SPAI0 smoothed aggregation needs no more iterations than BiCGStab
+int GivenPoissonMatrix_WithRuntimeConfigs_SolvesWithEveryStack()
+{
+    std::vector<int> ptr, col;
+    std::vector<double> val, rhs;
+    poisson(64, ptr, col, val, rhs);
+    SparseCSR<> A(ptr, col, val);
+
+    const char* configs[] = {
+        R"({ "solver": { "type": "cg" } })",
+        R"({ "solver": { "type": "gmres", "M": 30 },
+             "precond": { "coarsening": { "type": "ruge_stuben" }, "relax": { "type": "chebyshev" } } })",
+        R"({ "solver": { "type": "fgmres" },
+             "precond": { "coarsening": { "type": "aggregation" }, "relax": { "type": "ilut" } } })",
+        R"({ "solver": { "type": "idrs", "s": 4 },
+             "precond": { "coarsening": { "type": "smoothed_aggr_emin" }, "relax": { "type": "iluk" } } })",
+        R"({ "solver": { "type": "lgmres" },
+             "precond": { "relax": { "type": "spai1" } } })",
+        R"({ "solver": { "type": "cg", "maxiter": 1000 },
+             "precond": { "class": "relaxation", "type": "damped_jacobi" } })" };
+
+    int result = 0;
+    std::size_t iters_cg = 0;
+    for (std::size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); ++c) {
+        const std::string file = "amgcl_runtime_test.json";
+        std::ofstream(file) << configs[c];
+        std::vector<double> x;
+        int iters = -1; double error = 1.0;
+        try {
+            AmgclSolver solver(file, A);
+            std::tie(iters, error) = solver.solve(rhs, x);
+            solver.refresh(A);      // AMG refreshed, relaxation set up anew
+            x.clear();
+            solver.solve(rhs, x);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+        }
+        std::remove(file.c_str());
+        if (c == 0) iters_cg = iters;
+        if (iters < 0 || error > 1e-8)
+        {
+            std::cerr << "*** Poisson with runtime AMGCL config ***" << std::endl << configs[c] << std::endl
+                      << "Got error " << error << " after " << iters << " iterations" << std::endl << std::endl;
+            result = 1;
+        }
+    }
+
+    std::vector<double> x;
+    auto [iters_bicgstab, error] = solveAMGCL(AmgclPrecond_SPAI0, ptr, col, val, rhs, x);
+    if (iters_cg > static_cast<std::size_t>(2 * iters_bicgstab))
+    {
+        std::cerr << "*** Poisson with runtime CG ***" << std::endl << "Expected at most "
+                  << 2 * iters_bicgstab << " iterations but got " << iters_cg << std::endl << std::endl;
+        result = 1;
+    }
+    return result;
+}
+#endif
+
+// SparseCSR solved in place: same result as from copied CRS arrays, for 32 and
+// 64-bit indices and symmetric storage, and the matrix is left as it was
+int GivenPoissonMatrix_WithSparseCSRInPlace_MatchesCRSSolve()
+{
+    std::vector<int> ptr, col;
+    std::vector<double> val, rhs;
+    poisson(64, ptr, col, val, rhs);
+    SparseCSR<> A(ptr, col, val);
+    SparseCSR<std::int64_t> A64(std::vector<std::int64_t>(ptr.begin(), ptr.end()),
+                                std::vector<std::int64_t>(col.begin(), col.end()), val);
+    SparseCSR<> S(A);               // upper triangle of A, and its full expansion
+    S.toSymmetric();
+    SparseCSR<> F(S);
+    F.toFull();
+
+    int result = 0;
+    const AmgclPrecondType precond[] = {
+        AmgclPrecond_GaussSeidel, AmgclPrecond_ILU0, AmgclPrecond_SPAI0 };
+    for (auto p : precond) {
+        std::vector<double> xc, xf, x32, x64, xs;
+        const SolverResult expected[] = {
+            solveAMGCL(p, ptr, col, val, rhs, xc),
+            solveAMGCL(p, F.getRPtr(), F.getCols(), F.getVals(), rhs, xf) };
+        const SolverResult got[] = {
+            solveAMGCL(p, A, x32, rhs), solveAMGCL(p, A64, x64, rhs), solveAMGCL(p, S, xs, rhs) };
+        const std::vector<double>* x[] = { &x32, &x64, &xs };
+        for (int k = 0; k < 3; ++k) {
+            auto [iters, error] = expected[k / 2];
+            const std::vector<double> &xe = k < 2 ? xc : xf;
+            double diff = 0.0;
+            for (std::size_t i = 0; i < xe.size(); ++i)
+                diff = std::max(diff, std::abs(xe[i] - (*x[k])[i]));
+            if (std::get<0>(got[k]) != iters || std::abs(std::get<1>(got[k]) - error) > 1e-12 || diff > 1e-10)
+            {
+                std::cerr << "*** Poisson with SparseCSR in place ***" << std::endl
+                          << "Case " << k << ": expected " << iters << " iterations, error " << error
+                          << " but got " << std::get<0>(got[k]) << ", " << std::get<1>(got[k])
+                          << ", max solution difference " << diff << std::endl << std::endl;
+                result = 1;
+            }
+        }
+    }
+    if (A.getRPtr() != ptr || A.getCols() != col || A.getVals() != val)
+    {
+        std::cerr << "*** Poisson with SparseCSR in place changed the matrix ***" << std::endl;
+        result = 1;
+    }
+    return result;
+}
+
 int GivenPoissonMatrix_WithGaussSeidelPrecond_ItersAndErrorsMatchExpected()
 {
     const int iters_exp = 6;
@@ -193,8 +530,8 @@ int GivenPoissonMatrix_WithSPAI0Precond_ItersAndErrorsMatchExpected()
 int GivenLaplaceInput_WithGaussSeidelPrecond_ItersAndErrorsMatchExpected()
 {
     const int iters_exp = 1;
-    const double error_exp = 9.33731e-16;
-    const double error_delta = 3e-16;
+    const double error_exp = LAPLACE_ERROR;
+    const double error_delta = LAPLACE_ERROR_DELTA;
     return helper_laplaceTest(
         iters_exp, error_exp, error_delta, AmgclPrecond_GaussSeidel,
         "*** Laplace with Gauss-Seidel preconditioner ***");
@@ -203,8 +540,8 @@ int GivenLaplaceInput_WithGaussSeidelPrecond_ItersAndErrorsMatchExpected()
 int GivenLaplaceInput_WithILU0Precond_ItersAndErrorsMatchExpected()
 {
     const int iters_exp = 1;
-    const double error_exp = 9.33731e-16;
-    const double error_delta = 3e-16;
+    const double error_exp = LAPLACE_ERROR;
+    const double error_delta = LAPLACE_ERROR_DELTA;
     return helper_laplaceTest(
         iters_exp, error_exp, error_delta, AmgclPrecond_ILU0,
         "*** Laplace with ILU0 preconditioner ***");
@@ -213,8 +550,8 @@ int GivenLaplaceInput_WithILU0Precond_ItersAndErrorsMatchExpected()
 int GivenLaplaceInput_WithSPAI0Precond_ItersAndErrorsMatchExpected()
 {
     const int iters_exp = 1;
-    const double error_exp = 9.33731e-16;
-    const double error_delta = 3e-16;
+    const double error_exp = LAPLACE_ERROR;
+    const double error_delta = LAPLACE_ERROR_DELTA;
     return helper_laplaceTest(
         iters_exp, error_exp, error_delta, AmgclPrecond_SPAI0,
         "*** Laplace with SPAI0 preconditioner ***");
@@ -229,6 +566,15 @@ int main()
     result += GivenLaplaceInput_WithGaussSeidelPrecond_ItersAndErrorsMatchExpected();
     result += GivenLaplaceInput_WithILU0Precond_ItersAndErrorsMatchExpected();
     result += GivenLaplaceInput_WithSPAI0Precond_ItersAndErrorsMatchExpected();
+    result += GivenLaplaceInput_WithSellCSigmaOperator_MatchesCSRSolve();
+    result += GivenLaplaceInput_WithFloatValues_MatchesDoubleSolve();
+    result += GivenLaplaceInput_WithMultipleRhs_MatchesSingleSolves();
+    result += GivenLaplaceInput_WithReusedSolver_MatchesOneShotSolves();
+    result += GivenPoissonMatrix_WithNewValues_RefreshSolvesNewSystem();
+    result += GivenPoissonMatrix_WithSparseCSRInPlace_MatchesCRSSolve();
+#ifdef FIREFLY_AMGCL_RUNTIME
+    result += GivenPoissonMatrix_WithRuntimeConfigs_SolvesWithEveryStack();
+#endif
 
     return result;
 }
\ No newline at end of file
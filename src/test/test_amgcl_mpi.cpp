@@ -0,0 +1,93 @@
+#include <iostream>
+#include <algorithm>
+#include <tuple>
+#include <cmath>
+#include <amgcl_mpi_solver.hpp>
+#include "matrix_generator.hpp"
+
+// Relative residual norm ||b - A x|| / ||b||
+double relativeResidual(const SparseCSR<> &A, const std::vector<double> &b, const std::vector<double> &x)
+{
+    std::vector<double> r;
+    A.residual(b, x, r);
+    double rr = 0.0, bb = 0.0;
+    for (std::size_t i = 0; i < r.size(); ++i) { rr += r[i] * r[i]; bb += b[i] * b[i]; }
+    return std::sqrt(rr / bb);
+}
+
+// Distributed solve of the Poisson problem: converges as the serial solve, to the
+// same solution, and the local-rows (CRS arrays and SparseCSR) and global-matrix
+// interfaces agree
+int GivenPoissonMatrix_WithMPISolve_MatchesSerialSolve(MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    std::vector<int> ptr, col;
+    std::vector<double> val, rhs;
+    poisson(64, ptr, col, val, rhs);
+    SparseCSR<> A(ptr, col, val);
+
+    int result = 0;
+    const std::pair<AmgclPrecondType, const char*> precond[] = {
+        { AmgclPrecond_GaussSeidel, "Gauss-Seidel" }, { AmgclPrecond_ILU0, "ILU0" },
+        { AmgclPrecond_SPAI0, "SPAI0" } };
+    for (const auto &p : precond) {
+        std::vector<double> xs, x;
+        auto [iters_serial, error_serial] = solveAMGCL(p.first, ptr, col, val, rhs, xs);
+        auto [iters, error] = solveAMGCL(comm, p.first, A, rhs, x);
+
+        // the same rows passed as local CRS arrays with global column indices
+        auto [first, last] = amgclRowBlock(comm, A.rows());
+        std::vector<int> lptr, lcol;
+        std::vector<double> lval, lrhs(rhs.begin() + first, rhs.begin() + last), lx;
+        lptr.push_back(0);
+        for (std::size_t i = first; i < last; ++i) {
+            for (int k = ptr[i]; k < ptr[i+1]; ++k) { lcol.push_back(col[k]); lval.push_back(val[k]); }
+            lptr.push_back(lcol.size());
+        }
+        auto [iters_local, error_local] = solveAMGCL(comm, p.first, lptr, lcol, lval, lrhs, lx);
+
+        // and as a SparseCSR of the local rows
+        SparseCSR<> Al(lptr, lcol, lval, false, A.rows());
+        std::vector<double> lxs;
+        auto [iters_csr, error_csr] = solveAMGCLLocal(comm, p.first, Al, lrhs, lxs);
+
+        double diff = 0.0, diff_local = 0.0, norm = 0.0;
+        for (std::size_t i = 0; i < xs.size(); ++i) {
+            diff = std::max(diff, std::abs(x[i] - xs[i]));
+            norm = std::max(norm, std::abs(xs[i]));
+        }
+        for (std::size_t i = first; i < last; ++i)
+            diff_local = std::max({diff_local, std::abs(lx[i - first] - x[i]),
+                                   std::abs(lxs[i - first] - x[i])});
+
+        double res = relativeResidual(A, rhs, x);
+        if (res > 1e-8 || iters > 2 * iters_serial + 2 || diff > 1e-6 * norm ||
+            iters_local != iters || iters_csr != iters || diff_local > 1e-12)
+        {
+            std::cerr << "*** Poisson with MPI " << p.second << ", rank " << rank << " of "
+                      << size << " ***" << std::endl
+                      << "Serial: " << iters_serial << " iterations, error " << error_serial
+                      << "; MPI: " << iters << " iterations, error " << error
+                      << ", relative residual " << res << ", max solution difference " << diff
+                      << "; local rows: " << iters_local << " and " << iters_csr
+                      << " iterations, max difference "
+                      << diff_local << std::endl << std::endl;
+            result = 1;
+        }
+    }
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    int result = GivenPoissonMatrix_WithMPISolve_MatchesSerialSolve(MPI_COMM_WORLD);
+
+    int failed = 0;
+    MPI_Allreduce(&result, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Finalize();
+    return failed;
+}